@@ -0,0 +1,159 @@
+#include "drv/rcstorage.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <list>
+#include <thread>
+
+//list based pool as it was before the generational rewrite, kept here for comparison
+template <typename T>
+struct LegacyStorage {
+  struct Id {
+    Id() {}
+    Id(LegacyStorage *s, u32 i) : storage {s}, index {i} {}
+    Id(const Id &id) : storage {id.storage}, index {id.index} { if (storage) storage->elems[index].references++; }
+    Id(Id &&id) : storage {id.storage}, index {id.index} { id.storage = nullptr; }
+    ~Id() { release(); }
+
+    void release() {
+      if (storage && --storage->elems[index].references == 0) {
+        storage->delayed_free.push_front(index);
+      }
+      storage = nullptr;
+    }
+
+    LegacyStorage *storage = nullptr;
+    u32 index = ~0u;
+  };
+
+  Id create(const T &handle) {
+    u32 index;
+    if (empty_cells.size()) {
+      index = empty_cells.front();
+      empty_cells.pop_front();
+      elems[index].handle = handle;
+    } else {
+      index = elems.size();
+      elems.push_back({handle, 0});
+    }
+    elems[index].references++;
+    return {this, index};
+  }
+
+  void collect() {
+    while (delayed_free.size()) {
+      auto index = delayed_free.front();
+      elems[index].handle.release();
+      delayed_free.pop_front();
+      empty_cells.push_front(index);
+    }
+  }
+
+  struct Elem {
+    T handle;
+    u32 references;
+  };
+
+  std::vector<Elem> elems;
+  std::list<u32> empty_cells;
+  std::list<u32> delayed_free;
+};
+
+struct Handle {
+  u64 value;
+  void release() {}
+};
+
+using Clock = std::chrono::high_resolution_clock;
+
+static f64 elapsed_ns(Clock::time_point start) {
+  return std::chrono::duration<f64, std::nano>(Clock::now() - start).count();
+}
+
+static void report(const char *name, const char *op, f64 ns, u32 count) {
+  std::cout << name << " " << op << ": " << ns/count << " ns/op\n";
+}
+
+//create, copy and release/collect phases on the same pool
+template <typename Storage, typename Id>
+static void bench(const char *name, Storage &storage, u32 count, u32 rounds) {
+  f64 create_ns = 0, copy_ns = 0, release_ns = 0;
+  std::vector<Id> ids;
+  std::vector<Id> copies;
+  ids.reserve(count);
+  copies.reserve(count);
+
+  for (u32 r = 0; r < rounds; r++) {
+    auto start = Clock::now();
+    for (u32 i = 0; i < count; i++) {
+      ids.push_back(storage.create(Handle {i}));
+    }
+    create_ns += elapsed_ns(start);
+
+    start = Clock::now();
+    for (auto &id : ids) {
+      copies.push_back(id);
+    }
+    copies.clear();
+    copy_ns += elapsed_ns(start);
+
+    start = Clock::now();
+    ids.clear();
+    storage.collect();
+    release_ns += elapsed_ns(start);
+  }
+
+  report(name, "create", create_ns, count * rounds);
+  report(name, "copy+drop", copy_ns, count * rounds);
+  report(name, "release+collect", release_ns, count * rounds);
+}
+
+//several threads copy shared handles while the main thread keeps creating and collecting
+static void bench_threads(u32 threads, u32 count, u32 copies) {
+  RCStorage<Handle> storage;
+  std::vector<RCId<Handle>> shared;
+  for (u32 i = 0; i < count; i++) {
+    shared.push_back(storage.create(Handle {i}));
+  }
+
+  //values read by workers are summed and printed, so the copies can't be optimized out
+  std::atomic<u64> checksum {0};
+
+  auto start = Clock::now();
+  std::vector<std::thread> workers;
+  for (u32 t = 0; t < threads; t++) {
+    workers.emplace_back([&, t](){
+      u64 sum = 0;
+      for (u32 i = 0; i < copies; i++) {
+        RCId<Handle> local = shared[(i * 31 + t) % count];
+        sum += local->value;
+      }
+      checksum.fetch_add(sum, std::memory_order_relaxed);
+    });
+  }
+
+  for (u32 i = 0; i < copies / 16; i++) {
+    auto tmp = storage.create(Handle {i});
+    tmp.release();
+    storage.collect();
+  }
+
+  for (auto &w : workers) w.join();
+  report("generational", "threaded copy+drop", elapsed_ns(start), threads * copies);
+  std::cout << "generational threaded checksum: " << checksum.load() << "\n";
+}
+
+int main(int argc, char **argv) {
+  const u32 count = 16 * 1024;
+  const u32 rounds = 64;
+
+  LegacyStorage<Handle> legacy;
+  bench<LegacyStorage<Handle>, LegacyStorage<Handle>::Id>("legacy", legacy, count, rounds);
+
+  RCStorage<Handle> storage;
+  bench<RCStorage<Handle>, RCId<Handle>>("generational", storage, count, rounds);
+
+  bench_threads(4, count, 1u << 20u);
+  return 0;
+}
@@ -0,0 +1,226 @@
+#include "benchmark.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+void CameraPath::load(const std::string &path) {
+  std::ifstream file(path);
+  if (!file.is_open()) {
+    throw std::runtime_error {"Failed to open camera path " + path};
+  }
+
+  keys.clear();
+  std::string line;
+  while (std::getline(file, line)) {
+    line = line.substr(0, line.find('#'));
+    if (line.find_first_not_of(" \t\r") == std::string::npos) {
+      continue;
+    }
+
+    std::istringstream stream(line);
+    CameraKey key {};
+    if (!(stream >> key.time >> key.pos.x >> key.pos.y >> key.pos.z >> key.yaw >> key.pitch)) {
+      throw std::runtime_error {"Bad camera key in " + path + ": " + line};
+    }
+    if (keys.size() && key.time < keys.back().time) {
+      throw std::runtime_error {"Camera keys are not sorted by time in " + path};
+    }
+    keys.push_back(key);
+  }
+
+  if (keys.empty()) {
+    throw std::runtime_error {"Camera path " + path + " has no keys"};
+  }
+}
+
+CameraKey CameraPath::sample(float t) const {
+  if (t <= keys.front().time) return keys.front();
+  if (t >= keys.back().time) return keys.back();
+
+  auto next = std::upper_bound(keys.begin(), keys.end(), t, [](float t, const CameraKey &k) { return t < k.time; });
+  auto &b = *next;
+  auto &a = *(next - 1);
+  float k = (b.time > a.time)? (t - a.time)/(b.time - a.time) : 1.f;
+
+  CameraKey res;
+  res.time = t;
+  res.pos = glm::mix(a.pos, b.pos, k);
+  res.yaw = glm::mix(a.yaw, b.yaw, k);
+  res.pitch = glm::mix(a.pitch, b.pitch, k);
+  return res;
+}
+
+void Benchmark::init(const BenchmarkConfig &c) {
+  config = c;
+  enabled = !config.path_file.empty();
+  if (!enabled) {
+    return;
+  }
+
+  path.load(config.path_file);
+  if (!config.frames) {
+    config.frames = u32(path.duration()/config.dt) + 1;
+  }
+  if (config.warmup >= config.frames) {
+    throw std::runtime_error {"Benchmark warmup must be shorter than the run"};
+  }
+  std::cout << "Benchmark: " << config.path_file << ", " << config.frames << " frames, dt " << config.dt << "\n";
+}
+
+CameraKey Benchmark::next_pose() {
+  return path.sample(config.dt * frame++);
+}
+
+void Benchmark::record(const drv::FrameTimings &last, const drv::GpuProfiler &profiler, const drv::WorkStats &stats, float scale) {
+  if (frame <= config.warmup) {
+    return;
+  }
+
+  //render thread busy time, waits on fences and the limiter are excluded
+  cpu_ms.push_back(std::max(last.frame - last.wait, 0.f));
+  frame_ms.push_back(last.frame);
+  gpu_ms.push_back(last.gpu);
+  render_scale.push_back(scale);
+
+  for (auto &zone : profiler.get_frame_stats()) {
+    auto iter = pass_index.find(zone.path);
+    if (iter == pass_index.end()) {
+      iter = pass_index.insert({zone.path, u32(passes.size())}).first;
+      passes.push_back({zone.path});
+    }
+    auto &pass = passes[iter->second];
+    pass.sum += zone.last;
+    pass.max = std::max(pass.max, zone.last);
+    pass.count++;
+  }
+
+  auto add_work = [](WorkSamples &samples, const drv::WorkCounters &c) {
+    samples.sum += c;
+    samples.frames++;
+    if (c.vertex_invocations || c.fragment_invocations) {
+      samples.stat_frames++;
+    }
+  };
+
+  for (auto &pass : stats.get_frame_stats()) {
+    auto iter = work_index.find(pass.name);
+    if (iter == work_index.end()) {
+      iter = work_index.insert({pass.name, u32(work.size())}).first;
+      work.push_back({pass.name});
+    }
+    add_work(work[iter->second], pass.counters);
+  }
+  add_work(work_total, stats.get_frame_total());
+}
+
+namespace {
+  struct Distribution {
+    float mean = 0.f, min = 0.f, max = 0.f, p50 = 0.f, p95 = 0.f, p99 = 0.f;
+  };
+
+  //nearest rank percentiles
+  Distribution distribution(std::vector<float> samples) {
+    Distribution d {};
+    if (samples.empty()) {
+      return d;
+    }
+
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&](float p) {
+      u32 rank = u32(p * (samples.size() - 1) + 0.5f);
+      return samples[rank];
+    };
+
+    double sum = 0.0;
+    for (auto s : samples) sum += s;
+
+    d.mean = float(sum/samples.size());
+    d.min = samples.front();
+    d.max = samples.back();
+    d.p50 = percentile(0.5f);
+    d.p95 = percentile(0.95f);
+    d.p99 = percentile(0.99f);
+    return d;
+  }
+
+  void write_distribution(std::ostream &out, const char *name, const Distribution &d) {
+    out << "  \"" << name << "\": {\"mean\": " << d.mean << ", \"min\": " << d.min << ", \"max\": " << d.max
+      << ", \"p50\": " << d.p50 << ", \"p95\": " << d.p95 << ", \"p99\": " << d.p99 << "},\n";
+  }
+
+  double mean(u64 sum, u32 count) {
+    return count? double(sum)/count : 0.0;
+  }
+}
+
+//means per frame
+void Benchmark::write_work(std::ostream &out, const WorkSamples &w) const {
+  auto &s = w.sum;
+  out << "{\"pass\": \"" << w.pass << "\", \"frames\": " << w.frames
+    << ", \"draws\": " << mean(s.draws, w.frames) << ", \"dispatches\": " << mean(s.dispatches, w.frames)
+    << ", \"triangles\": " << mean(s.triangles, w.frames) << ", \"pipeline_binds\": " << mean(s.pipeline_binds, w.frames)
+    << ", \"descriptor_binds\": " << mean(s.descriptor_binds, w.frames) << ", \"upload_bytes\": " << mean(s.upload_bytes, w.frames)
+    << ", \"vertex_invocations\": " << mean(s.vertex_invocations, w.stat_frames)
+    << ", \"fragment_invocations\": " << mean(s.fragment_invocations, w.stat_frames) << "}";
+}
+
+void Benchmark::write_report(DriverState &ds) const {
+  if (!enabled) {
+    return;
+  }
+
+  auto cpu = distribution(cpu_ms);
+  auto gpu = distribution(gpu_ms);
+  auto interval = distribution(frame_ms);
+
+  //frame intervals twice as long as the median
+  float stutter_threshold = 2.f * interval.p50;
+  u32 stutters = std::count_if(frame_ms.begin(), frame_ms.end(), [&](float ms) { return ms > stutter_threshold; });
+
+  auto props = ds.ctx.get_physical_device().getProperties();
+  auto ext = ds.ctx.get_swapchain_extent();
+
+  std::ofstream out(config.output, std::ios::trunc);
+  out << "{\n";
+  out << "  \"device\": \"" << props.deviceName << "\",\n";
+  out << "  \"resolution\": [" << ext.width << ", " << ext.height << "],\n";
+  out << "  \"headless\": " << (ds.ctx.is_headless()? "true" : "false") << ",\n";
+  out << "  \"present_mode\": \"" << vk::to_string(ds.ctx.get_present_mode()) << "\",\n";
+  out << "  \"frames_in_flight\": " << ds.submit_pool.get_pacing().frames_in_flight << ",\n";
+  out << "  \"camera_path\": \"" << config.path_file << "\",\n";
+  out << "  \"dt\": " << config.dt << ",\n";
+  out << "  \"frames\": " << config.frames << ",\n";
+  out << "  \"warmup\": " << config.warmup << ",\n";
+  out << "  \"samples\": " << cpu_ms.size() << ",\n";
+  write_distribution(out, "frame_ms", interval);
+  write_distribution(out, "cpu_ms", cpu);
+  write_distribution(out, "gpu_ms", gpu);
+  //dynamic resolution, 1 - full extent
+  write_distribution(out, "render_scale", distribution(render_scale));
+  out << "  \"stutters\": {\"threshold_ms\": " << stutter_threshold << ", \"count\": " << stutters << "},\n";
+
+  out << "  \"passes\": [";
+  for (u32 i = 0; i < passes.size(); i++) {
+    auto &p = passes[i];
+    out << (i? ",\n" : "\n") << "    {\"zone\": \"" << p.zone << "\", \"mean_ms\": " << (p.count? p.sum/p.count : 0.0)
+      << ", \"max_ms\": " << p.max << ", \"frames\": " << p.count << "}";
+  }
+  out << "\n  ],\n";
+
+  out << "  \"pipeline_statistics\": " << (ds.work_stats.has_pipeline_statistics()? "true" : "false") << ",\n";
+  out << "  \"work\": [";
+  for (auto &w : work) {
+    out << "\n    ";
+    write_work(out, w);
+    out << ",";
+  }
+  out << "\n    ";
+  write_work(out, work_total);
+  out << "\n  ]\n}\n";
+
+  std::cout << "Benchmark: frame p50 " << interval.p50 << " p99 " << interval.p99 << " ms, cpu p50 " << cpu.p50 << " p95 " << cpu.p95 << " p99 " << cpu.p99
+    << " ms, gpu p50 " << gpu.p50 << " p95 " << gpu.p95 << " p99 " << gpu.p99
+    << " ms, " << stutters << " stutters, written to " << config.output << "\n";
+}
@@ -0,0 +1,85 @@
+#ifndef BENCHMARK_HPP_INCLUDED
+#define BENCHMARK_HPP_INCLUDED
+
+#include "driverstate.hpp"
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+struct CameraKey {
+  float time;
+  glm::vec3 pos;
+  float yaw;
+  float pitch;
+};
+
+//text file, one key per line: time x y z yaw pitch, '#' starts a comment
+struct CameraPath {
+  void load(const std::string &path);
+  float duration() const { return keys.empty()? 0.f : keys.back().time; }
+  //linear between keys, clamped at the ends
+  CameraKey sample(float t) const;
+
+private:
+  std::vector<CameraKey> keys;
+};
+
+struct BenchmarkConfig {
+  std::string path_file; //empty - benchmark is disabled
+  float dt = 1.f/60.f;
+  u32 frames = 0; //0 - path duration / dt
+  u32 warmup = 30;
+  std::string output = "benchmark.json";
+};
+
+//Camera follows the path with fixed dt per frame, so every run renders the same frames.
+//Frame intervals, CPU and GPU frame times of frames after warmup are collected and written as json.
+struct Benchmark {
+  void init(const BenchmarkConfig &config);
+  bool active() const { return enabled; }
+  u32 frame_count() const { return config.frames; }
+
+  //pose of the next frame, time advances by dt on every call
+  CameraKey next_pose();
+  //after the frame is submitted, gpu values lag by frames in flight
+  void record(const drv::FrameTimings &last, const drv::GpuProfiler &profiler, const drv::WorkStats &work, float render_scale);
+  void write_report(DriverState &ds) const;
+
+private:
+  struct PassSamples {
+    std::string zone;
+    double sum = 0.0;
+    float max = 0.f;
+    u32 count = 0;
+  };
+
+  bool enabled = false;
+  BenchmarkConfig config;
+  CameraPath path;
+  u32 frame = 0;
+
+  std::vector<float> frame_ms;
+  std::vector<float> cpu_ms;
+  std::vector<float> gpu_ms;
+  std::vector<float> render_scale;
+  std::vector<PassSamples> passes;
+  std::unordered_map<std::string, u32> pass_index;
+
+  //sums of counters, invocations are counted in frames which have them
+  struct WorkSamples {
+    std::string pass;
+    drv::WorkCounters sum;
+    u32 frames = 0;
+    u32 stat_frames = 0;
+  };
+
+  std::vector<WorkSamples> work;
+  std::unordered_map<std::string, u32> work_index;
+  WorkSamples work_total {"total"};
+
+  void write_work(std::ostream &out, const WorkSamples &w) const;
+};
+
+#endif
@@ -73,11 +73,20 @@ struct Camera {
 
 	void set_speed(float sp) { speed = sp; }
 
+	void set_pose(glm::vec3 position, float yaw_, float pitch_) {
+		pos = position;
+		yaw = yaw_;
+		pitch = pitch_;
+		update_camera_vectors();
+	}
+
 	void move(float dt) {
 	  pos += speed * dt * (move_dir.x * front + move_dir.y * up + move_dir.z * right);
 	}
 
   glm::vec3 get_pos() const { return pos; }
+	float get_yaw() const { return yaw; }
+	float get_pitch() const { return pitch; }
 
 private:
 	glm::vec3 pos, front {0, 0, -1}, up, right, world_up;
@@ -2,6 +2,9 @@
 
 #include "drv/cmd_utils.hpp"
 
+//draw list chunk recorded by one worker
+static const u32 MIN_DRAW_CHUNK = 64;
+
 void CubemapShadowRenderer::create_renderpass(DriverState &ds) {
   vk::AttachmentDescription distance_desc {}, depth_desc {};
 
@@ -73,8 +76,8 @@ void CubemapShadowRenderer::create_pipeline_layout(DriverState &ds) {
 }
 
 void CubemapShadowRenderer::create_pipeline(DriverState &ds) {
-  ds.pipelines.load_shader(ds.ctx, "cube_shadow_vs", "src/shaders/cube_shadow_vert.spv", vk::ShaderStageFlagBits::eVertex);
-  ds.pipelines.load_shader(ds.ctx, "cube_shadow_fs", "src/shaders/cube_shadow_frag.spv", vk::ShaderStageFlagBits::eFragment);
+  ds.pipelines.load_shader(ds.ctx, "cube_shadow_vs", "src/shaders/cube_shadow.vert", vk::ShaderStageFlagBits::eVertex);
+  ds.pipelines.load_shader(ds.ctx, "cube_shadow_fs", "src/shaders/cube_shadow.frag", vk::ShaderStageFlagBits::eFragment);
 
   drv::PipelineDescBuilder builder {};
   builder
@@ -115,7 +118,7 @@ void CubemapShadowRenderer::release(DriverState &ds) {
 }
 
 void CubemapShadowRenderer::set_shader_input(DriverState &ds, const Scene &scene) {
-  drv::DescriptorBinder bind {ds.descriptors.get(shader_res)};
+  drv::DescriptorBinder bind {ds.descriptors, shader_res};
   bind
     .bind_ubo(0, ubo->api_buffer())
     .bind_storage_buff(1, scene.get_matrix_buff()->api_buffer())
@@ -166,6 +169,8 @@ void CubemapShadowRenderer::render(DriverState &ds, drv::ImageID &cubemap, const
     
     vk::CommandBufferBeginInfo begin_buf {};
     cmd.begin(begin_buf);
+    ds.gpu_profiler.begin_frame(ds.ctx, cmd, drv::ONESHOT_SLOT);
+    u32 zone = ds.gpu_profiler.begin_zone(cmd, drv::ONESHOT_SLOT, "cube shadows");
 
     if (side == 0) {
       drv::ImageBarrier barrier {cubemap, vk::ImageAspectFlagBits::eColor};
@@ -190,36 +195,50 @@ void CubemapShadowRenderer::render(DriverState &ds, drv::ImageID &cubemap, const
       .setFramebuffer(fb)
       .setRenderArea(vk::Rect2D{{0u, 0u}, {ext.width, ext.height}});
 
-    cmd.beginRenderPass(pass_begin, vk::SubpassContents::eInline);
-    cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, ds.pipelines.get(pipeline));
-    cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipeline_layout, 0, {ds.descriptors.get(shader_res)}, {});
-
-    vk::Viewport viewport;
-    viewport
-      .setWidth(ext.width)
-      .setHeight(ext.height)
-      .setMinDepth(0.f)
-      .setMaxDepth(1.f);
-
-    cmd.setViewport(0, {viewport});
-    cmd.setScissor(0, {vk::Rect2D{{0u, 0u}, {ext.width, ext.height}}});
-
-    auto buffers = { scene.get_verts_buff()->api_buffer() };
-    auto offsets = {0ul};
-    
-    cmd.bindVertexBuffers(0, buffers, offsets);
-    cmd.bindIndexBuffer(scene.get_index_buff()->api_buffer(), 0, vk::IndexType::eUint32);
-
-    const auto& objects = scene.get_objects(); 
-    auto &materials = scene.get_material_desc();
-    for (auto &obj : objects) {
-      if (materials[obj.material_index].albedo_path.empty()) continue;
-      u32 mat_id = obj.matrix_index;
-      cmd.pushConstants(pipeline_layout, vk::ShaderStageFlagBits::eVertex, 0u, sizeof(u32), &mat_id);
-      cmd.drawIndexed(obj.index_count, 1, obj.index_offset, obj.vertex_offset, 0);
-    }    
-
+    auto api_pipeline = ds.pipelines.get(pipeline);
+    auto layout = pipeline_layout;
+    auto set = ds.descriptors.get(shader_res);
 
+    vk::CommandBufferInheritanceInfo inheritance {};
+    inheritance
+      .setRenderPass(renderpass)
+      .setSubpass(0)
+      .setFramebuffer(fb);
+
+    drv::ParallelRecorder recorder {ds.ctx, ds.submit_pool, ds.workers, drv::ONESHOT_SLOT, inheritance};
+    recorder.add_chunks(scene.get_objects().size(), MIN_DRAW_CHUNK, [&scene, api_pipeline, layout, set, ext](vk::CommandBuffer &cmd, u32 begin, u32 end) {
+      cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, api_pipeline);
+      cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, layout, 0, {set}, {});
+
+      vk::Viewport viewport;
+      viewport
+        .setWidth(ext.width)
+        .setHeight(ext.height)
+        .setMinDepth(0.f)
+        .setMaxDepth(1.f);
+
+      cmd.setViewport(0, {viewport});
+      cmd.setScissor(0, {vk::Rect2D{{0u, 0u}, {ext.width, ext.height}}});
+
+      auto buffers = { scene.get_verts_buff()->api_buffer() };
+      auto offsets = {0ul};
+      
+      cmd.bindVertexBuffers(0, buffers, offsets);
+      cmd.bindIndexBuffer(scene.get_index_buff()->api_buffer(), 0, vk::IndexType::eUint32);
+
+      const auto& objects = scene.get_objects(); 
+      auto &materials = scene.get_material_desc();
+      for (u32 i = begin; i < end; i++) {
+        auto &obj = objects[i];
+        if (materials[obj.material_index].albedo_path.empty()) continue;
+        u32 mat_id = obj.matrix_index;
+        cmd.pushConstants(layout, vk::ShaderStageFlagBits::eVertex, 0u, sizeof(u32), &mat_id);
+        cmd.drawIndexed(obj.index_count, 1, obj.index_offset, obj.vertex_offset, 0);
+      }
+    });
+
+    cmd.beginRenderPass(pass_begin, vk::SubpassContents::eSecondaryCommandBuffers);
+    recorder.execute(cmd);
     cmd.endRenderPass();
 
     drv::BlitImage blit {side_img, cubemap};
@@ -229,6 +248,7 @@ void CubemapShadowRenderer::render(DriverState &ds, drv::ImageID &cubemap, const
       .src_offset(vk::Offset3D{0, 0, 0}, vk::Offset3D{(i32)ext.width, (i32)ext.height, 1})
       .dst_offset(vk::Offset3D{0, 0, 0}, vk::Offset3D{(i32)ext.width, (i32)ext.height, 1})
       .write(cmd);
+    ds.gpu_profiler.end_zone(cmd, drv::ONESHOT_SLOT, zone);
 
     if (side == 5) {
       drv::ImageBarrier barrier {cubemap, vk::ImageAspectFlagBits::eColor};
@@ -241,10 +261,9 @@ void CubemapShadowRenderer::render(DriverState &ds, drv::ImageID &cubemap, const
 
     cmd.end();
 
-    auto fence = ds.submit_pool.submit_cmd(ds.ctx, cmd);
-    ds.ctx.get_device().waitForFences({fence}, VK_TRUE, UINT64_MAX);
-    ds.ctx.get_device().destroyFence(fence);
-    ds.submit_pool.free_cmd(ds.ctx, cmd);
+    ds.submit_pool.submit_and_wait(ds.ctx, cmd);
+    ds.gpu_profiler.resolve(ds.ctx, drv::ONESHOT_SLOT);
+    ds.submit_pool.reset_secondary(ds.ctx, drv::ONESHOT_SLOT);
   }
 
   ds.ctx.get_device().destroyFramebuffer(fb);
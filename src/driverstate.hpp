@@ -6,9 +6,16 @@
 #include "drv/pipeline.hpp"
 #include "drv/resources.hpp"
 #include "drv/draw_context.hpp"
+#include "drv/queue_scheduler.hpp"
 #include "drv/imgui_context.hpp"
+#include "drv/worker_pool.hpp"
+#include "drv/render_graph.hpp"
+#include "drv/gpu_profiler.hpp"
+#include "drv/work_stats.hpp"
+#include "drv/cpu_profiler.hpp"
 
 #include "camera.hpp"
+#include "quality.hpp"
 
 #include <glm/glm.hpp>
 #include <mutex>
@@ -19,7 +26,12 @@ struct DriverState {
   drv::DescriptorStorage descriptors;
   drv::PipelineManager pipelines;
   drv::DrawContextPool submit_pool;
+  drv::QueueScheduler scheduler;
+  drv::WorkerPool workers;
+  drv::GpuProfiler gpu_profiler;
+  drv::WorkStats work_stats;
   vk::RenderPass main_renderpass;
+  Quality quality;
 };
 
 struct GBuffer {
@@ -1,4 +1,5 @@
 #include "resources.hpp"
+#include "cpu_profiler.hpp"
 #include <iostream>
 
 #define VMA_IMPLEMENTATION
@@ -13,37 +14,65 @@ namespace drv {
                            vk::DeviceSize size, vk::BufferUsageFlags usage,
                            vk::SharingMode mode)
   {
-    vk::BufferCreateInfo info {};
-    
+    collect(ctx);
+
     if (ctx.queue_family_count() == 1) {
       mode = vk::SharingMode::eExclusive;
     }
 
-    info.setSharingMode(mode);
-    info.setUsage(usage);
-    info.setSize(size);
-    info.setPQueueFamilyIndices(ctx.get_queue_indexes());
-    info.setQueueFamilyIndexCount(ctx.queue_family_count());
+    Buffer cell;
+    cell.mem_type = type;
+    cell.size = size;
+    cell.sharing_mode = mode;
+    cell.usage = usage;
 
     auto allocation_info = get_alloc_info(type);
-    auto raw_info = static_cast<VkBufferCreateInfo>(info);
+    auto raw_info = static_cast<VkBufferCreateInfo>(get_buffer_info(ctx, cell));
 
     VkBuffer handle;
     VmaAllocation allocation;
     VMA_CHECK(vmaCreateBuffer(allocator, &raw_info, &allocation_info, &handle, &allocation, nullptr), "Buffer create error");
 
-    Buffer cell;
     cell.allocation = allocation;
     cell.handle = handle;
-    cell.mem_type = type;
-    cell.sharing_mode = mode;
-    cell.usage = usage;
 
     return buffers.create(cell);
   }
 
-  void ResourceStorage::collect_buffers() {
-    buffers.collect(allocator);
+  vk::BufferCreateInfo ResourceStorage::get_buffer_info(Context &ctx, const Buffer &buf) const {
+    vk::BufferCreateInfo info {};
+    info.setSharingMode(buf.sharing_mode);
+    info.setUsage(buf.usage);
+    info.setSize(buf.size);
+    info.setPQueueFamilyIndices(ctx.get_queue_indexes());
+    info.setQueueFamilyIndexCount(ctx.queue_family_count());
+    return info;
+  }
+
+  void ResourceStorage::next_frame(Context &ctx, u64 frame, u64 completed) {
+    completed_frame = completed;
+    views.set_epoch(frame);
+    buffers.set_epoch(frame);
+    images.set_epoch(frame);
+    collect(ctx);
+  }
+
+  void ResourceStorage::collect(Context &ctx) {
+    collect_until(ctx, completed_frame);
+  }
+
+  void ResourceStorage::collect_all(Context &ctx) {
+    collect_until(ctx, ~0ull);
+  }
+
+  void ResourceStorage::collect_until(Context &ctx, u64 completed) {
+    views.for_each_expired(completed, [&](const ImageView &view) { released.views.insert(view.api_view()); });
+    buffers.for_each_expired(completed, [&](const Buffer &buf) { released.buffers.insert(buf.api_buffer()); });
+
+    //views hold references to images, so they go first
+    views.collect_until(completed, ctx);
+    buffers.collect_until(completed, allocator);
+    images.collect_until(completed, allocator);
   }
 
   void* ResourceStorage::map_buffer(Context &ctx, const BufferID &id) {
@@ -79,28 +108,32 @@ namespace drv {
 
     vk::CommandPoolCreateInfo info {};
     info.setQueueFamilyIndex(ctx.queue_index(QueueT::Transfer));
+    info.setFlags(vk::CommandPoolCreateFlagBits::eResetCommandBuffer|vk::CommandPoolCreateFlagBits::eTransient);
 
     cmd_pool = ctx.get_device().createCommandPool(info);
   }
 
   void ResourceStorage::release(Context &ctx) {
+    free_transfer_cmds.clear();
     ctx.get_device().destroyCommandPool(cmd_pool);
 
-    views.collect(ctx);
-    collect_buffers();
-    images.collect(allocator);
-
+    collect_all(ctx);
     vmaDestroyAllocator(allocator);
   }
 
   vk::CommandBuffer ResourceStorage::begin_transfer(Context &ctx) {
-    vk::CommandBufferAllocateInfo info {};
-    info.setCommandBufferCount(1);
-    info.setCommandPool(cmd_pool);
-    info.setLevel(vk::CommandBufferLevel::ePrimary);
-    
-    auto res = ctx.get_device().allocateCommandBuffers(info);
-    auto cmd = res.at(0);
+    vk::CommandBuffer cmd;
+    if (free_transfer_cmds.size()) {
+      cmd = free_transfer_cmds.back();
+      free_transfer_cmds.pop_back();
+    } else {
+      vk::CommandBufferAllocateInfo info {};
+      info.setCommandBufferCount(1);
+      info.setCommandPool(cmd_pool);
+      info.setLevel(vk::CommandBufferLevel::ePrimary);
+      cmd = ctx.get_device().allocateCommandBuffers(info).at(0);
+    }
+
     vk::CommandBufferBeginInfo begin {};
     begin.setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
 
@@ -110,7 +143,6 @@ namespace drv {
   
   void ResourceStorage::submit_and_wait(Context &ctx, vk::CommandBuffer &cmd) {
     cmd.end();
-    auto cmd_buffers = {cmd}; 
     
     vk::SubmitInfo info {};
     info.setCommandBuffers(cmd);
@@ -118,10 +150,11 @@ namespace drv {
     ctx.get_queue(QueueT::Transfer).submit(info);
     ctx.get_queue(QueueT::Transfer).waitIdle();
 
-    ctx.get_device().freeCommandBuffers(cmd_pool, cmd_buffers);
+    free_transfer_cmds.push_back(cmd);
   }
 
   void ResourceStorage::buffer_memcpy(Context &ctx, const BufferID &dst, vk::DeviceSize offst, const void *src, vk::DeviceSize size) {
+    CPU_ZONE("buffer_memcpy");
     auto &cell = *dst;
 
     VmaAllocationInfo info {};
@@ -135,7 +168,6 @@ namespace drv {
       buffer_memcpy_coherent(ctx, dst, offst, src, size);
     } else {
       buffer_memcpy_local(ctx, dst, offst, src, size);
-      collect_buffers();
     }
   }
 
@@ -145,6 +177,7 @@ namespace drv {
     char  *ptr = static_cast<char*>(map_buffer(ctx, dst)); 
     std::memcpy(ptr + offst, src, size);
     unmap_buffer(ctx, dst);
+    uploaded_bytes.fetch_add(size, std::memory_order_relaxed);
   }
 
   void ResourceStorage::buffer_memcpy_local(Context &ctx, const BufferID &dst, vk::DeviceSize offst, const void *src, vk::DeviceSize size) {
@@ -2,6 +2,8 @@
 
 #include <SDL2/SDL_vulkan.h>
 #include <iostream>
+#include <algorithm>
+#include <cstring>
 
 namespace drv {
   static VKAPI_ATTR VkBool32 VKAPI_CALL debug_callback(VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
@@ -13,6 +15,10 @@ namespace drv {
   }
 
   static std::vector<const char*> get_instance_extensions(SDL_Window *window) {
+    if (!window) {
+      return {};
+    }
+
     u32 count;
     SDL_Vulkan_GetInstanceExtensions(window, &count, nullptr);
 
@@ -30,8 +36,21 @@ namespace drv {
     app_info.setPApplicationName("NOAPP");
 
     auto instance_ext = get_instance_extensions(window);
-    instance_ext.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
-    auto layers = {"VK_LAYER_KHRONOS_validation"};
+    std::vector<const char*> layers;
+
+    //build machines often have no validation layers installed
+    auto available_layers = vk::enumerateInstanceLayerProperties();
+    for (auto &layer : available_layers) {
+      if (std::strcmp(layer.layerName, "VK_LAYER_KHRONOS_validation") == 0) {
+        layers.push_back("VK_LAYER_KHRONOS_validation");
+      }
+    }
+    auto available_ext = vk::enumerateInstanceExtensionProperties();
+    for (auto &ext : available_ext) {
+      if (std::strcmp(ext.extensionName, VK_EXT_DEBUG_UTILS_EXTENSION_NAME) == 0) {
+        instance_ext.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+      }
+    }
 
     vk::InstanceCreateInfo info {};
     info.setPApplicationInfo(&app_info);
@@ -66,24 +85,47 @@ namespace drv {
       debug_messenger = msg;
     }
 
-    VkSurfaceKHR surf;
-    SDL_Vulkan_CreateSurface(window, instance, &surf);
-    surface = surf;
+    if (window) {
+      VkSurfaceKHR surf;
+      SDL_Vulkan_CreateSurface(window, instance, &surf);
+      surface = surf;
+    }
   }
 
-  void Context::init(SDL_Window *src) {
+  void Context::init(SDL_Window *src, vk::PresentModeKHR mode) {
     window = src;
+    present_mode = mode;
     
     init_instance();
     init_device();
     init_swapchain();
   }
 
+  void Context::init_headless(vk::Extent2D extent, u32 image_count) {
+    window = nullptr;
+    headless = true;
+
+    init_instance();
+    init_device();
+    init_offscreen(extent, image_count);
+  }
+
   void Context::release() {
     if (swapchain) {
       device.destroySwapchainKHR(swapchain);
     }
 
+    if (headless) {
+      for (auto img : swapchain_images) {
+        device.destroyImage(img);
+      }
+      for (auto mem : offscreen_memory) {
+        device.freeMemory(mem);
+      }
+      swapchain_images.clear();
+      offscreen_memory.clear();
+    }
+
     if (device) {
       device.destroy();
     }
@@ -105,7 +147,8 @@ namespace drv {
 
   }
 
-  static vk::PhysicalDevice pick_device(vk::Instance &instance) {
+  //headless mode takes the first device if there is no discrete gpu
+  static vk::PhysicalDevice pick_device(vk::Instance &instance, bool any_type) {
     auto devices = instance.enumeratePhysicalDevices();
     for (auto &dev : devices) {
       auto properties = dev.getProperties();
@@ -115,6 +158,11 @@ namespace drv {
       }
     }
 
+    if (any_type && devices.size()) {
+      std::cout << "Device " << devices[0].getProperties().deviceName << "\n";
+      return devices[0];
+    }
+
     throw std::runtime_error {"Physical device not found"};
     return {};
   }
@@ -151,7 +199,8 @@ namespace drv {
 
       complete = true;
 
-      for (u32 i = 0; i < QUEUE_COUNT; i++) {
+      //compute queue is picked below, it falls back to the graphics one
+      for (u32 i = 0; i < (u32)QueueT::Compute; i++) {
         complete &= queue_picked[i];
       }
       
@@ -163,55 +212,91 @@ namespace drv {
     if (!complete) {
       throw std::runtime_error {"Queue not found"};
     }
+
+    //async compute needs a family without graphics, otherwise compute work goes to the graphics queue
+    auto &compute = out_queues[(u32)QueueT::Compute];
+    compute = out_queues[(u32)QueueT::Graphics];
+    for (u32 i = 0; i < queue_families.size(); i++) {
+      auto flags = queue_families[i].queueFlags;
+      if ((flags & vk::QueueFlagBits::eCompute) && !(flags & vk::QueueFlagBits::eGraphics)) {
+        compute = QueueInfo {i, 0};
+        break;
+      }
+    }
+    std::cout << "ComputeQueue family " << compute.family << " index " << compute.index
+      << ((compute.family != out_queues[(u32)QueueT::Graphics].family)? " (async)\n" : " (shared with graphics)\n");
   }
 
   void Context::init_device() {
-    physical_device = pick_device(instance);
+    physical_device = pick_device(instance, headless);
     pick_queues(physical_device, queue_info);
     
-    queue_family_indexes.push_back(queue_info[0].family);
-    
-    if (queue_info[1].family != queue_info[0].family) {
-      queue_family_indexes.push_back(queue_info[1].family);
+    for (u32 i = 0; i < QUEUE_COUNT; i++) {
+      auto family = queue_info[i].family;
+      if (std::find(queue_family_indexes.begin(), queue_family_indexes.end(), family) == queue_family_indexes.end()) {
+        queue_family_indexes.push_back(family);
+      }
     }
 
-    auto ok = physical_device.getSurfaceSupportKHR(queue_info[(u32)QueueT::Graphics].family, surface);
-    if (ok != VK_TRUE) {
-      throw std::runtime_error {"Device not support Surface!"};
+    if (!headless) {
+      auto ok = physical_device.getSurfaceSupportKHR(queue_info[(u32)QueueT::Graphics].family, surface);
+      if (ok != VK_TRUE) {
+        throw std::runtime_error {"Device not support Surface!"};
+      }
     }
 
+    //queues of one family are created together, the first one has the highest priority
     std::vector<vk::DeviceQueueCreateInfo> queue_conf;
+    std::vector<std::vector<f32>> queue_priorities;
+
+    for (auto family : queue_family_indexes) {
+      u32 count = 0;
+      for (u32 i = 0; i < QUEUE_COUNT; i++) {
+        if (queue_info[i].family == family) {
+          count = std::max(count, queue_info[i].index + 1);
+        }
+      }
 
-    auto queue_priorities = {1.f};
-
-    if (queue_family_indexes.size() > 1) {
-      queue_conf.resize(2);
-      queue_conf[(u32)QueueT::Graphics]
-      .setQueueCount(1)
-      .setQueueFamilyIndex(queue_info[(u32)QueueT::Graphics].family)
-      .setQueuePriorities(queue_priorities);
-
-      queue_conf[(u32)QueueT::Transfer]
-        .setQueueCount(1)
-        .setQueueFamilyIndex(queue_info[(u32)QueueT::Transfer].family)
-        .setQueuePriorities(queue_priorities);
-    } else {
-      auto queue_priorities = {1.f, 0.5f};
+      queue_priorities.emplace_back(count, 0.5f);
+      queue_priorities.back()[0] = 1.f;
+    }
+
+    for (u32 i = 0; i < queue_family_indexes.size(); i++) {
       vk::DeviceQueueCreateInfo info {};
       info
-        .setQueueCount(QUEUE_COUNT)
-        .setQueueFamilyIndex(queue_family_indexes[0])
-        .setQueueCount(2)
-        .setQueuePriorities(queue_priorities);
+        .setQueueFamilyIndex(queue_family_indexes[i])
+        .setQueuePriorities(queue_priorities[i]);
       queue_conf.push_back(info);
     }
-    
 
-    auto ext = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
+    //queue scheduler orders work between queues with timeline semaphores
+    auto supported = physical_device.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan12Features>();
+    if (!supported.get<vk::PhysicalDeviceVulkan12Features>().timelineSemaphore) {
+      throw std::runtime_error {"Device doesn't support timeline semaphores"};
+    }
+
+    vk::PhysicalDeviceVulkan12Features features12 {};
+    features12.setTimelineSemaphore(VK_TRUE);
+
+    //optional, work stats are collected without them
+    auto &core = supported.get<vk::PhysicalDeviceFeatures2>().features;
+    pipeline_statistics = core.pipelineStatisticsQuery && core.inheritedQueries;
+
+    vk::PhysicalDeviceFeatures features {};
+    features
+      .setPipelineStatisticsQuery(pipeline_statistics)
+      .setInheritedQueries(pipeline_statistics);
+
+    std::vector<const char*> ext;
+    if (!headless) {
+      ext.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+    }
 
     vk::DeviceCreateInfo info {};
     info.setPEnabledExtensionNames(ext);
     info.setQueueCreateInfos(queue_conf);
+    info.setPNext(&features12);
+    info.setPEnabledFeatures(&features);
 
     device = physical_device.createDevice(info);
 
@@ -243,13 +328,12 @@ namespace drv {
     swapchain_fmt = info.imageFormat;
     swapchain_colorspace = info.imageColorSpace;
 
-    info.setPresentMode(vk::PresentModeKHR::eImmediate);
-
-    for (auto mode : modes) {
-      if (mode == vk::PresentModeKHR::eMailbox) {
-        info.setPresentMode(mode);
-      }
+    //fifo is always supported
+    if (std::find(modes.begin(), modes.end(), present_mode) == modes.end()) {
+      std::cout << "Present mode " << vk::to_string(present_mode) << " is not supported, using FIFO\n";
+      present_mode = vk::PresentModeKHR::eFifo;
     }
+    info.setPresentMode(present_mode);
 
     info.setPreTransform(cap.currentTransform);
     info.setImageUsage(vk::ImageUsageFlagBits::eColorAttachment);
@@ -272,6 +356,57 @@ namespace drv {
     swapchain_images = device.getSwapchainImagesKHR(swapchain);
   }
 
+  //images stand in for swapchain images, so the rest of the renderer doesn't see the difference
+  void Context::init_offscreen(vk::Extent2D extent, u32 image_count) {
+    swapchain_fmt = vk::Format::eB8G8R8A8Srgb;
+    swapchain_colorspace = vk::ColorSpaceKHR::eSrgbNonlinear;
+    swapchain_ext = extent;
+
+    auto mem_props = physical_device.getMemoryProperties();
+
+    for (u32 i = 0; i < image_count; i++) {
+      vk::ImageCreateInfo info {};
+      info
+        .setImageType(vk::ImageType::e2D)
+        .setFormat(swapchain_fmt)
+        .setExtent(vk::Extent3D{extent.width, extent.height, 1})
+        .setMipLevels(1)
+        .setArrayLayers(1)
+        .setSamples(vk::SampleCountFlagBits::e1)
+        .setTiling(vk::ImageTiling::eOptimal)
+        .setUsage(vk::ImageUsageFlagBits::eColorAttachment|vk::ImageUsageFlagBits::eTransferSrc)
+        .setSharingMode(vk::SharingMode::eExclusive)
+        .setInitialLayout(vk::ImageLayout::eUndefined);
+
+      auto image = device.createImage(info);
+      auto req = device.getImageMemoryRequirements(image);
+
+      u32 type_index = ~0u;
+      for (u32 t = 0; t < mem_props.memoryTypeCount; t++) {
+        bool allowed = req.memoryTypeBits & (1u << t);
+        if (allowed && (mem_props.memoryTypes[t].propertyFlags & vk::MemoryPropertyFlagBits::eDeviceLocal)) {
+          type_index = t;
+          break;
+        }
+      }
+
+      if (type_index == ~0u) {
+        throw std::runtime_error {"No memory type for offscreen images"};
+      }
+
+      vk::MemoryAllocateInfo alloc {};
+      alloc
+        .setAllocationSize(req.size)
+        .setMemoryTypeIndex(type_index);
+
+      auto memory = device.allocateMemory(alloc);
+      device.bindImageMemory(image, memory, 0);
+
+      swapchain_images.push_back(image);
+      offscreen_memory.push_back(memory);
+    }
+  }
+
   u32 Context::queue_index(QueueT qtype) const {
     return queue_info[(u32)qtype].family;
   }
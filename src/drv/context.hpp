@@ -6,7 +6,7 @@
 #include <SDL2/SDL.h>
 
 namespace drv {
-  const u32 QUEUE_COUNT = 2;
+  const u32 QUEUE_COUNT = 3;
   
   const vk::QueueFlags GRAPHICS_QUEUE_FLAGS = vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute | vk::QueueFlagBits::eTransfer;
   const vk::QueueFlags TRANSFER_QUEUE_FLAGS = vk::QueueFlagBits::eTransfer|vk::QueueFlagBits::eGraphics;
@@ -14,6 +14,8 @@ namespace drv {
   enum class QueueT : u32 {
     Graphics = 0,
     Transfer = 1,
+    //family without graphics if device has one, else the graphics queue itself
+    Compute = 2,
     Count
   };
 
@@ -24,9 +26,17 @@ namespace drv {
 
   struct Context {
     Context() {}
-    void init(SDL_Window *w);
+    //present mode falls back to fifo if surface doesn't support it
+    void init(SDL_Window *w, vk::PresentModeKHR mode = vk::PresentModeKHR::eMailbox);
+    //no surface and swapchain, frames are rendered into image_count offscreen images (not less than frames in flight),
+    //any device type is accepted, so it runs on software implementations like lavapipe
+    void init_headless(vk::Extent2D extent, u32 image_count = 3);
     void release();
 
+    bool is_headless() const { return headless; }
+    //layout backbuffers are left in by the main render pass
+    vk::ImageLayout get_backbuffer_layout() const { return headless? vk::ImageLayout::eTransferSrcOptimal : vk::ImageLayout::ePresentSrcKHR; }
+
     std::vector<vk::Image> &get_swapchain_images() { return swapchain_images; }
 
     vk::Instance &get_instance() { return instance; }
@@ -36,12 +46,17 @@ namespace drv {
 
     vk::Format get_swapchain_fmt() const { return swapchain_fmt; }
     vk::Extent2D get_swapchain_extent() const { return swapchain_ext; }
+    vk::PresentModeKHR get_present_mode() const { return present_mode; }
 
     u32 queue_index(QueueT qtype) const;
     const u32* get_queue_indexes() const { return queue_family_indexes.data(); }
     const u32 queue_family_count() const { return queue_family_indexes.size(); }
     
     vk::Queue &get_queue(QueueT qtype) { return queues[(u32)qtype]; }
+    //compute work runs in parallel with graphics instead of sharing its queue
+    bool has_async_compute() const { return queue_info[(u32)QueueT::Compute].family != queue_info[(u32)QueueT::Graphics].family; }
+    //pipeline statistics queries, they may stay active while secondary buffers are executed
+    bool has_pipeline_statistics() const { return pipeline_statistics; }
     
     SDL_Window *get_window() { return window; }
 
@@ -51,10 +66,13 @@ namespace drv {
     void init_instance();
     void init_device();
     void init_swapchain();
+    void init_offscreen(vk::Extent2D extent, u32 image_count);
 
     vk::Instance instance;
     vk::DebugUtilsMessengerEXT debug_messenger;
     SDL_Window *window = nullptr;
+    bool headless = false;
+    bool pipeline_statistics = false;
 
     vk::Device device;
     vk::PhysicalDevice physical_device;
@@ -68,6 +86,8 @@ namespace drv {
     vk::ColorSpaceKHR swapchain_colorspace;
     vk::Extent2D swapchain_ext;
     std::vector<vk::Image> swapchain_images;
+    vk::PresentModeKHR present_mode = vk::PresentModeKHR::eFifo;
+    std::vector<vk::DeviceMemory> offscreen_memory;
     //std::vector<vk::ImageView> surface_views;
   };
 } // namespace drv
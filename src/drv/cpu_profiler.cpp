@@ -0,0 +1,119 @@
+#include "cpu_profiler.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace drv {
+
+  namespace {
+    struct Zone {
+      const char *name;
+      u64 begin;
+      u64 end;
+    };
+
+    struct ThreadRing {
+      u32 tid;
+      std::string name;
+      std::atomic<u64> head {0}; //zones written since start
+      Zone zones[CpuProfiler::RING_SIZE];
+    };
+
+    //rings outlive their threads, workers are joined before the trace is usually written
+    struct Registry {
+      std::mutex lock;
+      std::vector<std::unique_ptr<ThreadRing>> rings;
+    };
+
+    Registry &registry() {
+      static Registry reg;
+      return reg;
+    }
+
+    ThreadRing &thread_ring() {
+      static thread_local ThreadRing *ring = nullptr;
+      if (!ring) {
+        auto &reg = registry();
+        std::lock_guard<std::mutex> guard {reg.lock};
+        reg.rings.push_back(std::make_unique<ThreadRing>());
+        ring = reg.rings.back().get();
+        ring->tid = reg.rings.size();
+        ring->name = "thread " + std::to_string(ring->tid);
+      }
+      return *ring;
+    }
+
+    std::string json_escape(const char *str) {
+      std::string out;
+      for (; *str; str++) {
+        if (*str == '"' || *str == '\\') out.push_back('\\');
+        out.push_back(*str);
+      }
+      return out;
+    }
+
+    const auto START = std::chrono::steady_clock::now();
+  }
+
+  bool CpuProfiler::enabled() {
+#ifdef CPU_PROFILER
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  u64 CpuProfiler::now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - START).count();
+  }
+
+  void CpuProfiler::set_thread_name(const std::string &name) {
+    auto &ring = thread_ring();
+    std::lock_guard<std::mutex> guard {registry().lock};
+    ring.name = name;
+  }
+
+  void CpuProfiler::add_zone(const char *name, u64 begin_ns, u64 end_ns) {
+    auto &ring = thread_ring();
+    u64 head = ring.head.load(std::memory_order_relaxed);
+    ring.zones[head % RING_SIZE] = {name, begin_ns, end_ns};
+    ring.head.store(head + 1, std::memory_order_release);
+  }
+
+  void CpuProfiler::write_trace(const std::string &path) {
+    std::ofstream out(path, std::ios::trunc);
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+
+    auto &reg = registry();
+    std::lock_guard<std::mutex> guard {reg.lock};
+
+    u64 written = 0;
+    bool first = true;
+    for (auto &ring : reg.rings) {
+      out << (first? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << ring->tid
+        << ", \"args\": {\"name\": \"" << json_escape(ring->name.c_str()) << "\"}}";
+      first = false;
+
+      u64 head = ring->head.load(std::memory_order_acquire);
+      u64 start = (head > RING_SIZE)? head - RING_SIZE : 0;
+      for (u64 i = start; i < head; i++) {
+        auto &zone = ring->zones[i % RING_SIZE];
+        //chrome trace timestamps are in microseconds
+        out << ",\n{\"name\": \"" << json_escape(zone.name) << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << ring->tid
+          << ", \"ts\": " << zone.begin/1000.0 << ", \"dur\": " << (zone.end - zone.begin)/1000.0 << "}";
+      }
+      written += head - start;
+    }
+
+    out << "\n]}\n";
+    std::cout << "CPU trace: " << written << " zones of " << reg.rings.size() << " threads written to " << path << "\n";
+  }
+
+}
@@ -0,0 +1,49 @@
+#ifndef CPU_PROFILER_HPP_INCLUDED
+#define CPU_PROFILER_HPP_INCLUDED
+
+#include "common.hpp"
+
+#include <string>
+
+//Zones are compiled only with CPU_PROFILER defined (cmake -DCPU_PROFILER=ON).
+//Zone names must outlive the trace: string literals or other static strings.
+#ifdef CPU_PROFILER
+  #define CPU_ZONE_CONCAT_IMPL(a, b) a##b
+  #define CPU_ZONE_CONCAT(a, b) CPU_ZONE_CONCAT_IMPL(a, b)
+  #define CPU_ZONE(name) drv::CpuZone CPU_ZONE_CONCAT(cpu_zone_, __COUNTER__) {name}
+  #define CPU_THREAD_NAME(name) drv::CpuProfiler::set_thread_name(name)
+#else
+  #define CPU_ZONE(name)
+  #define CPU_THREAD_NAME(name)
+#endif
+
+namespace drv {
+
+  //Every thread writes finished zones into its own ring buffer, only registration of a thread takes a lock.
+  //Old zones are overwritten when the ring is full, so the trace keeps the last RING_SIZE zones per thread.
+  struct CpuProfiler {
+    static constexpr u32 RING_SIZE = 1u << 16u;
+
+    static bool enabled();
+    static void set_thread_name(const std::string &name);
+    static void add_zone(const char *name, u64 begin_ns, u64 end_ns);
+    static u64 now_ns();
+
+    //chrome://tracing and Perfetto json, zones being written during the call may be torn
+    static void write_trace(const std::string &path);
+  };
+
+  struct CpuZone {
+    CpuZone(const char *n) : name {n}, begin {CpuProfiler::now_ns()} {}
+    CpuZone(const CpuZone&) = delete;
+    CpuZone &operator=(const CpuZone&) = delete;
+    ~CpuZone() { CpuProfiler::add_zone(name, begin, CpuProfiler::now_ns()); }
+
+  private:
+    const char *name;
+    u64 begin;
+  };
+
+}
+
+#endif
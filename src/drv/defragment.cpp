@@ -0,0 +1,272 @@
+#include "resources.hpp"
+#include "cmd_utils.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <unordered_map>
+
+namespace drv {
+
+  static vk::ImageAspectFlags get_aspect(vk::Format fmt) {
+    switch (fmt) {
+      case vk::Format::eD16Unorm:
+      case vk::Format::eD32Sfloat:
+      case vk::Format::eX8D24UnormPack32:
+        return vk::ImageAspectFlagBits::eDepth;
+      case vk::Format::eD16UnormS8Uint:
+      case vk::Format::eD24UnormS8Uint:
+      case vk::Format::eD32SfloatS8Uint:
+        return vk::ImageAspectFlagBits::eDepth|vk::ImageAspectFlagBits::eStencil;
+      case vk::Format::eS8Uint:
+        return vk::ImageAspectFlagBits::eStencil;
+      default:
+        return vk::ImageAspectFlagBits::eColor;
+    }
+  }
+
+  static void query_unused(VmaAllocator allocator, vk::DeviceSize &unused, u32 &blocks) {
+    VmaStats stats {};
+    vmaCalculateStats(allocator, &stats);
+    unused = stats.total.unusedBytes;
+    blocks = stats.total.blockCount;
+  }
+
+  DefragmentationStats ResourceStorage::defragment(Context &ctx, Relocations &out) {
+    DefragmentationStats stats {};
+
+    collect_all(ctx);
+
+    query_unused(allocator, stats.unused_before, stats.blocks_before);
+
+    std::vector<u32> moved_images;
+
+    defragment_buffers(ctx, stats, out);
+    defragment_images(ctx, stats, moved_images);
+    recreate_views(ctx, moved_images, stats, out);
+
+    query_unused(allocator, stats.unused_after, stats.blocks_after);
+    return stats;
+  }
+
+  void ResourceStorage::defragment_buffers(Context &ctx, DefragmentationStats &stats, Relocations &out) {
+    std::vector<VmaAllocation> allocations;
+    std::vector<Buffer*> cells;
+
+    buffers.for_each([&](u32 index, Buffer &buf) {
+      allocations.push_back(buf.allocation);
+      cells.push_back(&buf);
+    });
+
+    if (allocations.empty()) return;
+
+    std::vector<VkBool32> changed(allocations.size(), VK_FALSE);
+    auto cmd = begin_transfer(ctx);
+
+    VmaDefragmentationInfo2 info {};
+    info.allocationCount = allocations.size();
+    info.pAllocations = allocations.data();
+    info.pAllocationsChanged = changed.data();
+    info.maxCpuBytesToMove = VK_WHOLE_SIZE;
+    info.maxCpuAllocationsToMove = UINT32_MAX;
+    info.maxGpuBytesToMove = VK_WHOLE_SIZE;
+    info.maxGpuAllocationsToMove = UINT32_MAX;
+    info.commandBuffer = static_cast<VkCommandBuffer>(cmd);
+
+    VmaDefragmentationStats vma_stats {};
+    VmaDefragmentationContext defrag_ctx = VK_NULL_HANDLE;
+
+    auto res = vmaDefragmentationBegin(allocator, &info, &vma_stats, &defrag_ctx);
+    if (res != VK_SUCCESS && res != VK_NOT_READY) {
+      throw std::runtime_error {"Vma defragmentation error"};
+    }
+
+    submit_and_wait(ctx, cmd);
+    vmaDefragmentationEnd(allocator, defrag_ctx);
+
+    std::vector<vk::Buffer> old_handles;
+
+    for (u32 i = 0; i < cells.size(); i++) {
+      if (!changed[i]) continue;
+      auto &buf = *cells[i];
+
+      //buffer is immutably bound to the old memory range, create a new one over the moved allocation
+      auto handle = ctx.get_device().createBuffer(get_buffer_info(ctx, buf));
+      if (vmaBindBufferMemory(allocator, buf.allocation, static_cast<VkBuffer>(handle)) != VK_SUCCESS) {
+        throw std::runtime_error {"Vma bind buffer error"};
+      }
+
+      out.buffers[buf.handle] = handle;
+      old_handles.push_back(buf.handle);
+      buf.handle = handle;
+      stats.buffers_moved++;
+    }
+
+    for (auto &handle : old_handles) {
+      ctx.get_device().destroyBuffer(handle);
+    }
+
+    stats.bytes_moved += vma_stats.bytesMoved;
+    stats.bytes_freed += vma_stats.bytesFreed;
+  }
+
+  void ResourceStorage::defragment_images(Context &ctx, DefragmentationStats &stats, std::vector<u32> &moved) {
+    //VMA can't move optimal tiling images, so they are copied into holes of other blocks one by one.
+    //Old allocation is freed right after its copy is waited, so the next image may take its place
+    //and a block left without allocations is released by VMA.
+    //Only images with known content layout are movable, render targets stay where they are
+    struct Move {
+      Image *img;
+      u32 index;
+      vk::DeviceSize size;
+      VkDeviceMemory memory;
+    };
+
+    //used bytes of every block, an image moves only into a fuller block than its own
+    std::unordered_map<VkDeviceMemory, vk::DeviceSize> used;
+    auto account = [&](VmaAllocation allocation) {
+      VmaAllocationInfo info {};
+      vmaGetAllocationInfo(allocator, allocation, &info);
+      used[info.deviceMemory] += info.size;
+      return info;
+    };
+
+    buffers.for_each([&](u32, Buffer &buf) { account(buf.allocation); });
+
+    const auto required_usage = vk::ImageUsageFlagBits::eTransferSrc|vk::ImageUsageFlagBits::eTransferDst;
+    std::vector<Move> moves;
+
+    images.for_each([&](u32 index, Image &img) {
+      auto alloc_info = account(img.allocation);
+      if ((img.info.usage & required_usage) != required_usage) return;
+      if (img.layout == vk::ImageLayout::eUndefined) return;
+      if (img.info.tiling != vk::ImageTiling::eOptimal) return;
+      moves.push_back({&img, index, alloc_info.size, alloc_info.deviceMemory});
+    });
+
+    //emptiest blocks are drained first, big images get the first pick of free ranges
+    std::sort(moves.begin(), moves.end(), [&](const Move &a, const Move &b){
+      auto ua = used[a.memory], ub = used[b.memory];
+      return (ua != ub)? ua < ub : a.size > b.size;
+    });
+
+    auto alloc_info = get_alloc_info(GPUMemoryT::Local);
+    alloc_info.flags |= VMA_ALLOCATION_CREATE_NEVER_ALLOCATE_BIT|VMA_ALLOCATION_CREATE_STRATEGY_MIN_MEMORY_BIT;
+
+    VmaStats before {};
+    vmaCalculateStats(allocator, &before);
+
+    for (auto &m : moves) {
+      auto &img = *m.img;
+      const auto &info = img.info;
+
+      VkImage handle = VK_NULL_HANDLE;
+      VmaAllocation allocation = VK_NULL_HANDLE;
+      auto api_info = static_cast<VkImageCreateInfo>(info);
+      if (vmaCreateImage(allocator, &api_info, &alloc_info, &handle, &allocation, nullptr) != VK_SUCCESS) {
+        continue;
+      }
+
+      VmaAllocationInfo dst_info {};
+      vmaGetAllocationInfo(allocator, allocation, &dst_info);
+      if (dst_info.deviceMemory == m.memory || used[dst_info.deviceMemory] < used[m.memory]) {
+        vmaDestroyImage(allocator, handle, allocation);
+        continue;
+      }
+
+      auto aspect = get_aspect(info.format);
+      vk::Image dst = handle;
+      auto cmd = begin_transfer(ctx);
+
+      ImageBarrier to_src {img.handle, aspect};
+      to_src
+        .set_range(0, info.mipLevels, 0, info.arrayLayers)
+        .change_layout(img.layout, vk::ImageLayout::eTransferSrcOptimal)
+        .access_msk(vk::AccessFlagBits::eMemoryWrite, vk::AccessFlagBits::eTransferRead)
+        .write(cmd, vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eTransfer);
+
+      ImageBarrier to_dst {dst, aspect};
+      to_dst
+        .set_range(0, info.mipLevels, 0, info.arrayLayers)
+        .change_layout(vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal)
+        .access_msk(vk::AccessFlags{}, vk::AccessFlagBits::eTransferWrite)
+        .write(cmd, vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer);
+
+      std::vector<vk::ImageCopy> regions;
+      for (u32 mip = 0; mip < info.mipLevels; mip++) {
+        vk::ImageSubresourceLayers layers {};
+        layers
+          .setAspectMask(aspect)
+          .setMipLevel(mip)
+          .setBaseArrayLayer(0)
+          .setLayerCount(info.arrayLayers);
+
+        vk::Extent3D ext {
+          max(info.extent.width >> mip, 1u),
+          max(info.extent.height >> mip, 1u),
+          max(info.extent.depth >> mip, 1u)};
+
+        vk::ImageCopy region {};
+        region
+          .setSrcSubresource(layers)
+          .setDstSubresource(layers)
+          .setExtent(ext);
+        regions.push_back(region);
+      }
+
+      cmd.copyImage(img.handle, vk::ImageLayout::eTransferSrcOptimal, dst, vk::ImageLayout::eTransferDstOptimal, regions);
+
+      ImageBarrier restore {dst, aspect};
+      restore
+        .set_range(0, info.mipLevels, 0, info.arrayLayers)
+        .change_layout(vk::ImageLayout::eTransferDstOptimal, img.layout)
+        .access_msk(vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eMemoryRead)
+        .write(cmd, vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eAllCommands);
+
+      submit_and_wait(ctx, cmd);
+
+      //old views are recreated after all moves, they aren't used until then
+      img.release(allocator);
+      img.handle = dst;
+      img.allocation = allocation;
+
+      used[m.memory] -= m.size;
+      used[dst_info.deviceMemory] += dst_info.size;
+      moved.push_back(m.index);
+      stats.bytes_moved += m.size;
+      stats.images_moved++;
+    }
+
+    VmaStats after {};
+    vmaCalculateStats(allocator, &after);
+    auto total = [](const VmaStats &s) { return s.total.usedBytes + s.total.unusedBytes; };
+    if (total(after) < total(before)) {
+      stats.bytes_freed += total(before) - total(after);
+    }
+  }
+
+  void ResourceStorage::recreate_views(Context &ctx, const std::vector<u32> &moved_images, DefragmentationStats &stats, Relocations &out) {
+    if (moved_images.empty()) return;
+
+    std::vector<vk::ImageView> old_views;
+
+    views.for_each([&](u32 index, ImageView &view) {
+      if (std::find(moved_images.begin(), moved_images.end(), view.img_index()) == moved_images.end()) {
+        return;
+      }
+
+      //cell is updated in place, so ImageViewIDs held by passes stay valid
+      view.info.setImage(view.img->api_image());
+      auto handle = ctx.get_device().createImageView(view.info);
+
+      out.views[view.view] = handle;
+      old_views.push_back(view.view);
+      view.view = handle;
+      stats.views_recreated++;
+    });
+
+    for (auto &v : old_views) {
+      ctx.get_device().destroyImageView(v);
+    }
+  }
+
+}
@@ -1,8 +1,40 @@
 #include "descriptors.hpp"
 #include <iostream>
+#include <algorithm>
+#include <cstring>
+
 namespace drv {
 
+  static bool is_image_descriptor(vk::DescriptorType type) {
+    switch (type) {
+      case vk::DescriptorType::eSampler:
+      case vk::DescriptorType::eCombinedImageSampler:
+      case vk::DescriptorType::eSampledImage:
+      case vk::DescriptorType::eStorageImage:
+      case vk::DescriptorType::eInputAttachment:
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  static bool is_buffer_descriptor(vk::DescriptorType type) {
+    switch (type) {
+      case vk::DescriptorType::eUniformBuffer:
+      case vk::DescriptorType::eStorageBuffer:
+      case vk::DescriptorType::eUniformBufferDynamic:
+      case vk::DescriptorType::eStorageBufferDynamic:
+        return true;
+      default:
+        return false;
+    }
+  }
+
   DescriptorSetLayoutID DescriptorStorage::create_layout(Context &ctx, const vk::DescriptorSetLayoutCreateInfo &info, u32 max_sets) {
+    if (info.bindingCount > MAX_BINDINGS) {
+      throw std::runtime_error {"Too many bindings in descriptor set layout"};
+    }
+
     u32 alloc_index;
     if (free_pools.size()) {
       alloc_index = free_pools.front();
@@ -13,11 +45,8 @@ namespace drv {
 
     auto layout = ctx.get_device().createDescriptorSetLayout(info);
 
-    vk::DescriptorPoolCreateInfo pool_info {};
-    pool_info.setMaxSets(max_sets);
-    
     std::vector<vk::DescriptorPoolSize> sizes;
-    
+
     for (u32 i = 0; i < info.bindingCount; i++) {
       vk::DescriptorPoolSize *ptr = nullptr;
       for (u32 j = 0; j < sizes.size(); j++) {
@@ -36,17 +65,52 @@ namespace drv {
 
     }
 
-    for (u32 i = 0; i < sizes.size(); i++) {
-      sizes[i].descriptorCount *= max_sets;
+    auto &cell = pools[alloc_index];
+    cell.layout = layout;
+    cell.set_sizes = std::move(sizes);
+    cell.chunks.push_back({nullptr, max(max_sets, 1u), 0});
+
+    //every binding gets a range of slots, ordered by binding index
+    cell.entries.clear();
+    cell.slots_count = 0;
+    for (u32 i = 0; i < info.bindingCount; i++) {
+      const auto &binding = info.pBindings[i];
+      if (!binding.descriptorCount) continue;
+      if (!is_image_descriptor(binding.descriptorType) && !is_buffer_descriptor(binding.descriptorType)) {
+        throw std::runtime_error {"Unsupported descriptor type"};
+      }
+      cell.entries.push_back({binding.binding, 0, binding.descriptorCount, binding.descriptorType});
+    }
+
+    std::sort(cell.entries.begin(), cell.entries.end(), [](const TemplateEntry &a, const TemplateEntry &b){
+      return a.binding < b.binding;
+    });
+
+    std::vector<vk::DescriptorUpdateTemplateEntry> template_entries;
+    for (auto &entry : cell.entries) {
+      entry.offset = cell.slots_count;
+      cell.slots_count += entry.count;
+
+      vk::DescriptorUpdateTemplateEntry t {};
+      t
+        .setDstBinding(entry.binding)
+        .setDstArrayElement(0)
+        .setDescriptorCount(entry.count)
+        .setDescriptorType(entry.type)
+        .setOffset(entry.offset * sizeof(DescriptorSlot))
+        .setStride(sizeof(DescriptorSlot));
+      template_entries.push_back(t);
     }
-    pool_info.setPoolSizes(sizes);
-    
-    auto pool = ctx.get_device().createDescriptorPool(pool_info);
 
-    pools[alloc_index].allocated = 0;
-    pools[alloc_index].desc_pool = pool;
-    pools[alloc_index].layout = layout;
-    pools[alloc_index].max_descriptors = max_sets;
+    cell.update_template = nullptr;
+    if (template_entries.size()) {
+      vk::DescriptorUpdateTemplateCreateInfo template_info {};
+      template_info
+        .setDescriptorUpdateEntries(template_entries)
+        .setTemplateType(vk::DescriptorUpdateTemplateType::eDescriptorSet)
+        .setDescriptorSetLayout(layout);
+      cell.update_template = ctx.get_device().createDescriptorUpdateTemplate(template_info);
+    }
 
     DescriptorSetLayoutID id;
     id.index = alloc_index;
@@ -54,19 +118,67 @@ namespace drv {
   }
 
   void DescriptorStorage::free_layout(Context &ctx, DescriptorSetLayoutID id) {
-    auto cell = pools.at(id.index);
-    ctx.get_device().destroyDescriptorPool(cell.desc_pool);
+    auto &cell = pools.at(id.index);
+    for (auto &set : cell.sets) {
+      untrack(set.set);
+    }
+
+    for (auto iter = set_cache.begin(); iter != set_cache.end();) {
+      iter = (iter->second.pool_index == id.index)? set_cache.erase(iter) : std::next(iter);
+    }
+
+    for (auto &chunk : cell.chunks) {
+      if (chunk.desc_pool) {
+        ctx.get_device().destroyDescriptorPool(chunk.desc_pool);
+      }
+    }
+
+    if (cell.update_template) {
+      ctx.get_device().destroyDescriptorUpdateTemplate(cell.update_template);
+    }
+
     ctx.get_device().destroyDescriptorSetLayout(cell.layout);
-    free_pools.push_front(id.index); 
+    pools.erase(id.index);
+    free_pools.push_front(id.index);
+  }
+
+  u32 DescriptorStorage::get_chunk(Context &ctx, Pool &pool) {
+    u32 index = 0;
+    for (; index < pool.chunks.size(); index++) {
+      if (pool.chunks[index].allocated < pool.chunks[index].max_sets) {
+        break;
+      }
+    }
+
+    if (index == pool.chunks.size()) {
+      pool.chunks.push_back({nullptr, 2 * pool.chunks.back().max_sets, 0});
+    }
+
+    auto &chunk = pool.chunks[index];
+    if (!chunk.desc_pool) {
+      auto sizes = pool.set_sizes;
+      for (auto &size : sizes) {
+        size.descriptorCount *= chunk.max_sets;
+      }
+
+      vk::DescriptorPoolCreateInfo pool_info {};
+      pool_info
+        .setFlags(vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet)
+        .setMaxSets(chunk.max_sets)
+        .setPoolSizes(sizes);
+
+      chunk.desc_pool = ctx.get_device().createDescriptorPool(pool_info);
+    }
+
+    return index;
   }
 
   DescriptorSetID DescriptorStorage::allocate_set(Context &ctx, DescriptorSetLayoutID layout) {
     auto &cell = pools.at(layout.index);
-    if (cell.allocated >= cell.max_descriptors) {
-      throw std::runtime_error {"Descriptor pool overflow"};
-    }
+    auto chunk_index = get_chunk(ctx, cell);
+    auto &chunk = cell.chunks[chunk_index];
 
-    u32 index; 
+    u32 index;
     if (cell.free_indexes.size()) {
       index = cell.free_indexes.front();
       cell.free_indexes.pop_front();
@@ -76,16 +188,16 @@ namespace drv {
     }
 
     vk::DescriptorSetAllocateInfo info {};
-    info.setDescriptorPool(cell.desc_pool);
-    
+    info.setDescriptorPool(chunk.desc_pool);
+
     auto layouts = { cell.layout };
     info.setDescriptorSetCount(1);
     info.setSetLayouts(layouts);
 
     auto desc = ctx.get_device().allocateDescriptorSets(info).at(0);
 
-    cell.sets[index] = desc;
-    cell.allocated++;
+    cell.sets[index] = {desc, chunk_index};
+    chunk.allocated++;
 
     DescriptorSetID id;
     id.pool_index = layout.index;
@@ -95,10 +207,14 @@ namespace drv {
 
   void DescriptorStorage::free_set(Context &ctx, DescriptorSetID id) {
     auto &cell = pools.at(id.pool_index);
-    auto to_free = {cell.sets[id.desc_index]};
-    ctx.get_device().freeDescriptorSets(cell.desc_pool, to_free);
+    auto &set = cell.sets[id.desc_index];
+    auto &chunk = cell.chunks[set.chunk];
+
+    auto to_free = {set.set};
+    ctx.get_device().freeDescriptorSets(chunk.desc_pool, to_free);
+    untrack(set.set);
 
-    cell.allocated--;
+    chunk.allocated--;
     cell.free_indexes.push_front(id.desc_index);
   }
 
@@ -107,154 +223,315 @@ namespace drv {
   }
 
   const vk::DescriptorSet& DescriptorStorage::get(DescriptorSetID id) {
-    return pools.at(id.pool_index).sets.at(id.desc_index);
+    return pools.at(id.pool_index).sets.at(id.desc_index).set;
+  }
+
+  void DescriptorStorage::write_set(Context &ctx, const vk::DescriptorSet &set, const Pool &pool, const DescriptorSlot *slots, const u32 *counts) {
+    bool complete = true;
+    for (u32 i = 0; i < pool.entries.size(); i++) {
+      complete &= (counts[i] == pool.entries[i].count);
+    }
+
+    if (complete && pool.update_template && use_templates) {
+      ctx.get_device().updateDescriptorSetWithTemplate(set, pool.update_template, slots);
+      return;
+    }
+
+    //partially filled arrays or unbound entries can't go through the template, bound entries are written in one call
+    vk::WriteDescriptorSet writes[MAX_BINDINGS];
+    u32 writes_count = 0;
+
+    for (u32 i = 0; i < pool.entries.size(); i++) {
+      if (!counts[i]) continue;
+      const auto &entry = pool.entries[i];
+
+      auto &write = writes[writes_count++];
+      write
+        .setDstSet(set)
+        .setDstBinding(entry.binding)
+        .setDescriptorType(entry.type)
+        .setDescriptorCount(counts[i]);
+
+      if (is_image_descriptor(entry.type)) {
+        write.setPImageInfo(&slots[entry.offset].image);
+      } else {
+        write.setPBufferInfo(&slots[entry.offset].buffer);
+      }
+    }
+
+    if (writes_count) {
+      ctx.get_device().updateDescriptorSets(writes_count, writes, 0, nullptr);
+    }
+  }
+
+  void DescriptorStorage::track(const vk::DescriptorSet &set, u32 pool_index, const DescriptorSlot *slots, const u32 *counts) {
+    const auto &pool = pools.at(pool_index);
+    auto &content = tracked[set];
+    content.pool_index = pool_index;
+    content.slots.assign(slots, slots + pool.slots_count);
+    content.counts.assign(counts, counts + pool.entries.size());
+  }
+
+  void DescriptorStorage::untrack(const vk::DescriptorSet &set) {
+    tracked.erase(set);
+  }
+
+  //FNV-1a, slots are zero initialized by the binder so padding bytes are stable
+  static void hash_bytes(u64 &h, const void *ptr, size_t size) {
+    auto bytes = static_cast<const u8*>(ptr);
+    for (size_t i = 0; i < size; i++) {
+      h ^= bytes[i];
+      h *= 1099511628211ull;
+    }
+  }
+
+  u64 DescriptorStorage::hash_content(u32 pool_index, const DescriptorSlot *slots, const u32 *counts) const {
+    const auto &pool = pools.at(pool_index);
+    u64 h = 14695981039346656037ull;
+    hash_bytes(h, &pool_index, sizeof(pool_index));
+    hash_bytes(h, slots, pool.slots_count * sizeof(DescriptorSlot));
+    hash_bytes(h, counts, pool.entries.size() * sizeof(u32));
+    return h;
   }
 
-  DescriptorBinder::DescriptorBinder(const vk::DescriptorSet &set) : dst{set} {}
+  bool DescriptorStorage::same_content(const SetContent &content, u32 pool_index, const DescriptorSlot *slots, const u32 *counts) const {
+    return content.pool_index == pool_index
+      && !std::memcmp(content.slots.data(), slots, content.slots.size() * sizeof(DescriptorSlot))
+      && !std::memcmp(content.counts.data(), counts, content.counts.size() * sizeof(u32));
+  }
+
+  vk::DescriptorSet DescriptorStorage::get_cached(Context &ctx, u32 pool_index, const DescriptorSlot *slots, const u32 *counts) {
+    auto hash = hash_content(pool_index, slots, counts);
+    auto &pool = pools.at(pool_index);
+
+    auto range = set_cache.equal_range(hash);
+    for (auto iter = range.first; iter != range.second; iter++) {
+      if (iter->second.pool_index != pool_index) continue;
+
+      const auto &set = pool.sets.at(iter->second.desc_index).set;
+      auto content = tracked.find(set);
+      if (content != tracked.end() && same_content(content->second, pool_index, slots, counts)) {
+        return set;
+      }
+    }
+
+    DescriptorSetLayoutID layout;
+    layout.index = pool_index;
+    auto id = allocate_set(ctx, layout);
+    auto set = get(id);
+
+    write_set(ctx, set, pool, slots, counts);
+    track(set, pool_index, slots, counts);
+    set_cache.insert({hash, {id.pool_index, id.desc_index}});
+    return set;
+  }
+
+  void DescriptorStorage::rehash_cache() {
+    decltype(set_cache) rehashed;
+    for (auto &elem : set_cache) {
+      auto &set = pools.at(elem.second.pool_index).sets.at(elem.second.desc_index).set;
+      auto &content = tracked.at(set);
+      rehashed.insert({hash_content(content.pool_index, content.slots.data(), content.counts.data()), elem.second});
+    }
+    set_cache = std::move(rehashed);
+  }
+
+  void DescriptorStorage::drop_cache(Context &ctx, DescriptorSetLayoutID layout) {
+    for (auto iter = set_cache.begin(); iter != set_cache.end();) {
+      if (iter->second.pool_index != layout.index) {
+        iter++;
+        continue;
+      }
+
+      DescriptorSetID id;
+      id.pool_index = iter->second.pool_index;
+      id.desc_index = iter->second.desc_index;
+      free_set(ctx, id);
+      iter = set_cache.erase(iter);
+    }
+  }
+
+  bool DescriptorStorage::references(const SetContent &content, const ReleasedHandles &released) const {
+    const auto &pool = pools.at(content.pool_index);
+    for (u32 i = 0; i < pool.entries.size(); i++) {
+      const auto &entry = pool.entries[i];
+
+      for (u32 j = 0; j < content.counts[i]; j++) {
+        const auto &slot = content.slots[entry.offset + j];
+        bool found = is_image_descriptor(entry.type)?
+          released.views.count(slot.image.imageView) : released.buffers.count(slot.buffer.buffer);
+        if (found) return true;
+      }
+    }
+    return false;
+  }
+
+  void DescriptorStorage::evict(Context &ctx, const ReleasedHandles &released) {
+    if (released.empty()) return;
+
+    for (auto iter = set_cache.begin(); iter != set_cache.end();) {
+      const auto &set = pools.at(iter->second.pool_index).sets.at(iter->second.desc_index).set;
+      auto content = tracked.find(set);
+      if (content == tracked.end() || !references(content->second, released)) {
+        iter++;
+        continue;
+      }
+
+      DescriptorSetID id;
+      id.pool_index = iter->second.pool_index;
+      id.desc_index = iter->second.desc_index;
+      free_set(ctx, id);
+      iter = set_cache.erase(iter);
+    }
+
+    //sets owned by users stay allocated, they have to be written again before the next use anyway
+    for (auto iter = tracked.begin(); iter != tracked.end();) {
+      iter = references(iter->second, released)? tracked.erase(iter) : std::next(iter);
+    }
+  }
+
+  void DescriptorStorage::relocate(Context &ctx, const Relocations &reloc, DefragmentationStats &stats) {
+    if (reloc.empty()) return;
+
+    for (auto &set : tracked) {
+      auto &content = set.second;
+      const auto &pool = pools.at(content.pool_index);
+      bool patched = false;
+
+      for (u32 i = 0; i < pool.entries.size(); i++) {
+        const auto &entry = pool.entries[i];
+
+        for (u32 j = 0; j < content.counts[i]; j++) {
+          auto &slot = content.slots[entry.offset + j];
+
+          if (is_image_descriptor(entry.type)) {
+            auto iter = reloc.views.find(slot.image.imageView);
+            if (iter != reloc.views.end()) {
+              slot.image.imageView = iter->second;
+              patched = true;
+            }
+          } else {
+            auto iter = reloc.buffers.find(slot.buffer.buffer);
+            if (iter != reloc.buffers.end()) {
+              slot.buffer.buffer = iter->second;
+              patched = true;
+            }
+          }
+        }
+      }
+
+      if (!patched) continue;
+      write_set(ctx, set.first, pool, content.slots.data(), content.counts.data());
+      stats.sets_rewritten++;
+    }
+
+    rehash_cache();
+  }
+
+  DescriptorBinder::DescriptorBinder(DescriptorStorage &s, DescriptorSetID id)
+    : storage {s}, dst {s.get(id)}, pool_index {id.pool_index}, pool {&s.pools.at(id.pool_index)}
+  {
+    init_slots();
+  }
+
+  DescriptorBinder::DescriptorBinder(DescriptorStorage &s, DescriptorSetLayoutID layout)
+    : storage {s}, dst {nullptr}, pool_index {layout.index}, pool {&s.pools.at(layout.index)}
+  {
+    init_slots();
+  }
+
+  void DescriptorBinder::init_slots() {
+    if (pool->slots_count > INLINE_SLOTS) {
+      heap_slots.resize(pool->slots_count);
+    }
+    std::memset(static_cast<void*>(data()), 0, pool->slots_count * sizeof(DescriptorSlot));
+  }
+
+  DescriptorSlot &DescriptorBinder::get_slot(u32 binding, u32 index, vk::DescriptorType type) {
+    for (u32 i = 0; i < pool->entries.size(); i++) {
+      const auto &entry = pool->entries[i];
+      if (entry.binding != binding) continue;
+
+      if (entry.type != type) {
+        throw std::runtime_error {"Descriptor type doesn't match set layout"};
+      }
+      if (index >= entry.count) {
+        throw std::runtime_error {"Descriptor array index out of range"};
+      }
+
+      counts[i] = max(counts[i], index + 1);
+      return data()[entry.offset + index];
+    }
+    throw std::runtime_error {"Binding is missing in set layout"};
+  }
 
   DescriptorBinder &DescriptorBinder::bind_ubo(u32 slot, const vk::Buffer &buf, VkDeviceSize offs, vk::DeviceSize range) {
-    vk::DescriptorBufferInfo info {};
-    info
-      .setBuffer(buf)
-      .setOffset(offs)
-      .setRange(range);
-    
-    buffers.push_back(std::unique_ptr<vk::DescriptorBufferInfo>{new vk::DescriptorBufferInfo{info}});
-
-    vk::WriteDescriptorSet write {};
-    write
-      .setDstSet(dst)
-      .setDstBinding(slot)
-      .setDescriptorType(vk::DescriptorType::eUniformBuffer)
-      .setDescriptorCount(1)
-      .setPBufferInfo(buffers[buffers.size() - 1].get());
-    
-    writes.push_back(write);
+    auto &info = get_slot(slot, 0, vk::DescriptorType::eUniformBuffer).buffer;
+    info.buffer = buf;
+    info.offset = offs;
+    info.range = range;
     return *this;
   }
 
   DescriptorBinder &DescriptorBinder::bind_storage_buff(u32 slot, const vk::Buffer &buf, VkDeviceSize offs, vk::DeviceSize range) {
-    vk::DescriptorBufferInfo info {};
-    info
-      .setBuffer(buf)
-      .setOffset(offs)
-      .setRange(range);
-    
-    buffers.push_back(std::unique_ptr<vk::DescriptorBufferInfo>{new vk::DescriptorBufferInfo{info}});
-
-    vk::WriteDescriptorSet write {};
-    write
-      .setDstSet(dst)
-      .setDstBinding(slot)
-      .setDescriptorType(vk::DescriptorType::eStorageBuffer)
-      .setDescriptorCount(1)
-      .setPBufferInfo(buffers[buffers.size() - 1].get());
-    
-    writes.push_back(write);
+    auto &info = get_slot(slot, 0, vk::DescriptorType::eStorageBuffer).buffer;
+    info.buffer = buf;
+    info.offset = offs;
+    info.range = range;
     return *this;
   }
-  
+
   DescriptorBinder &DescriptorBinder::bind_combined_img(u32 slot, const vk::ImageView &view, const vk::Sampler &smp, vk::ImageLayout layout) {
-    vk::DescriptorImageInfo info {};
-    info
-      .setSampler(smp)
-      .setImageView(view)
-      .setImageLayout(layout);
-
-    images.push_back(std::unique_ptr<vk::DescriptorImageInfo>{new vk::DescriptorImageInfo{info}});
-    
-    vk::WriteDescriptorSet write {};
-    write
-      .setDstSet(dst)
-      .setDstBinding(slot)
-      .setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
-      .setDescriptorCount(1)
-      .setPImageInfo(images[images.size() - 1].get());
-    
-    writes.push_back(write);
+    auto &info = get_slot(slot, 0, vk::DescriptorType::eCombinedImageSampler).image;
+    info.sampler = smp;
+    info.imageView = view;
+    info.imageLayout = layout;
     return *this;
   }
 
   DescriptorBinder &DescriptorBinder::bind_sampler(u32 slot, const vk::Sampler &smp) {
-    vk::WriteDescriptorSet write {};
-    vk::DescriptorImageInfo info {};
-    info.setSampler(smp);
-    images.push_back(std::unique_ptr<vk::DescriptorImageInfo>{new vk::DescriptorImageInfo{info}});
-    write
-      .setDstSet(dst)
-      .setDstBinding(slot)
-      .setDescriptorType(vk::DescriptorType::eSampler)
-      .setDescriptorCount(1)
-      .setPImageInfo(images[images.size() - 1].get());
-    
-    writes.push_back(write);
+    auto &info = get_slot(slot, 0, vk::DescriptorType::eSampler).image;
+    info.sampler = smp;
     return *this;
   }
 
   DescriptorBinder &DescriptorBinder::bind_array_of_img(u32 slot, u32 count, const vk::ImageView *views, vk::ImageLayout layout) {
-    auto data = new vk::DescriptorImageInfo[count] {};
-
     for (u32 i = 0; i < count; i++) {
-      data[i]
-        .setImageLayout(layout)
-        .setImageView(views[i]);
-    }
-
-    arrays_of_img.push_back(std::unique_ptr<vk::DescriptorImageInfo[]>{data});
-    vk::WriteDescriptorSet write {};
-    write
-      .setDstSet(dst)
-      .setDstBinding(slot)
-      .setDescriptorType(vk::DescriptorType::eSampledImage)
-      .setDescriptorCount(count)
-      .setPImageInfo(data);
-    
-    writes.push_back(write);
+      auto &info = get_slot(slot, i, vk::DescriptorType::eSampledImage).image;
+      info.imageView = views[i];
+      info.imageLayout = layout;
+    }
     return *this;
   }
 
   DescriptorBinder &DescriptorBinder::bind_input_attachment(u32 slot, const vk::ImageView &view, vk::ImageLayout layout) {
-    vk::DescriptorImageInfo info {};
-    info
-      .setImageView(view)
-      .setImageLayout(layout);
-
-    images.push_back(std::unique_ptr<vk::DescriptorImageInfo>{new vk::DescriptorImageInfo{info}});
-    
-    vk::WriteDescriptorSet write {};
-    write
-      .setDstSet(dst)
-      .setDstBinding(slot)
-      .setDescriptorType(vk::DescriptorType::eInputAttachment)
-      .setDescriptorCount(1)
-      .setPImageInfo(images[images.size() - 1].get());
-    
-    writes.push_back(write);
+    auto &info = get_slot(slot, 0, vk::DescriptorType::eInputAttachment).image;
+    info.imageView = view;
+    info.imageLayout = layout;
     return *this;
   }
 
   DescriptorBinder &DescriptorBinder::bind_storage_image(u32 slot, const vk::ImageView &view, vk::ImageLayout layout) {
-    vk::DescriptorImageInfo info {};
-    info
-      .setImageView(view)
-      .setImageLayout(layout);
-
-    images.push_back(std::unique_ptr<vk::DescriptorImageInfo>{new vk::DescriptorImageInfo{info}});
-    
-    vk::WriteDescriptorSet write {};
-    write
-      .setDstSet(dst)
-      .setDstBinding(slot)
-      .setDescriptorType(vk::DescriptorType::eStorageImage)
-      .setDescriptorCount(1)
-      .setPImageInfo(images[images.size() - 1].get());
-    
-    writes.push_back(write);
+    auto &info = get_slot(slot, 0, vk::DescriptorType::eStorageImage).image;
+    info.imageView = view;
+    info.imageLayout = layout;
     return *this;
   }
 
   void DescriptorBinder::write(Context &ctx) {
-    ctx.get_device().updateDescriptorSets(writes, {});
+    if (!dst) {
+      throw std::runtime_error {"DescriptorBinder without set, use write_cached"};
+    }
+
+    storage.write_set(ctx, dst, *pool, data(), counts);
+    storage.track(dst, pool_index, data(), counts);
+  }
+
+  vk::DescriptorSet DescriptorBinder::write_cached(Context &ctx) {
+    if (dst) {
+      throw std::runtime_error {"DescriptorBinder is not created from layout"};
+    }
+    return storage.get_cached(ctx, pool_index, data(), counts);
   }
 
-}
\ No newline at end of file
+}
@@ -2,23 +2,39 @@
 #define DESCRIPTORS_HPP_INCLUDED
 
 #include "context.hpp"
+#include "resources.hpp"
 
 #include <list>
 #include <map>
+#include <unordered_map>
+#include <memory>
 
 
 namespace drv {
   struct DescriptorStorage;
+  struct DescriptorBinder;
 
   struct DescriptorSetLayoutID {
   private:
     u32 index;
     friend DescriptorStorage;
+    friend DescriptorBinder;
   };
 
   struct DescriptorSetID;
 
+  //element of the flat array consumed by descriptor update templates
+  union DescriptorSlot {
+    DescriptorSlot() {}
+    vk::DescriptorImageInfo image;
+    vk::DescriptorBufferInfo buffer;
+  };
+
+  static_assert(sizeof(DescriptorSlot) == sizeof(vk::DescriptorImageInfo), "Image infos must be tightly packed in slots");
+  static_assert(sizeof(DescriptorSlot) == sizeof(vk::DescriptorBufferInfo), "Buffer infos must be tightly packed in slots");
+
   struct DescriptorStorage {
+    //max_sets is the size of the first pool, following pools for the layout are twice bigger than the previous one
     DescriptorSetLayoutID create_layout(Context &ctx, const vk::DescriptorSetLayoutCreateInfo &info, u32 max_sets);
     void free_layout(Context &ctx, DescriptorSetLayoutID id);
 
@@ -28,22 +44,87 @@ namespace drv {
     const vk::DescriptorSetLayout& get(DescriptorSetLayoutID id);
     const vk::DescriptorSet& get(DescriptorSetID id);
 
+    //patches every tracked write that references moved resources
+    void relocate(Context &ctx, const Relocations &reloc, DefragmentationStats &stats);
+
+    //frees cached sets and forgets tracked content referencing destroyed resources, so reused handles don't hit stale sets
+    void evict(Context &ctx, const ReleasedHandles &released);
+
+    //one batched write call is used instead of update templates when disabled, to compare them in benchmarks
+    void set_update_templates(bool enable) { use_templates = enable; }
+
+    //frees cached sets of the layout. Must be called when resources referenced by them are recreated
+    void drop_cache(Context &ctx, DescriptorSetLayoutID layout);
+
   private:
+    friend DescriptorBinder;
 
-    struct Pool {
-      vk::DescriptorSetLayout layout;
+    static constexpr u32 MAX_BINDINGS = 32;
+
+    struct TemplateEntry {
+      u32 binding;
+      u32 offset; //in slots
+      u32 count;
+      vk::DescriptorType type;
+    };
+
+    struct SetContent {
+      u32 pool_index;
+      std::vector<DescriptorSlot> slots;
+      std::vector<u32> counts; //written descriptors for each entry
+    };
+
+    struct Chunk {
       vk::DescriptorPool desc_pool;
-      
-      u32 max_descriptors;
+      u32 max_sets;
       u32 allocated;
+    };
+
+    struct SetCell {
+      vk::DescriptorSet set;
+      u32 chunk;
+    };
 
-      std::vector<vk::DescriptorSet> sets;
+    struct Pool {
+      vk::DescriptorSetLayout layout;
+      vk::DescriptorUpdateTemplate update_template;
+      std::vector<TemplateEntry> entries;
+      u32 slots_count;
+
+      std::vector<vk::DescriptorPoolSize> set_sizes;
+      std::vector<Chunk> chunks;
+
+      std::vector<SetCell> sets;
       std::list<u32> free_indexes;
     };
 
+    struct CachedSet {
+      u32 pool_index;
+      u32 desc_index;
+    };
+
+    u32 get_chunk(Context &ctx, Pool &pool);
+
+    //template update if every entry is complete, plain writes of bound entries otherwise
+    void write_set(Context &ctx, const vk::DescriptorSet &set, const Pool &pool, const DescriptorSlot *slots, const u32 *counts);
+
+    void track(const vk::DescriptorSet &set, u32 pool_index, const DescriptorSlot *slots, const u32 *counts);
+    void untrack(const vk::DescriptorSet &set);
+
+    u64 hash_content(u32 pool_index, const DescriptorSlot *slots, const u32 *counts) const;
+    bool same_content(const SetContent &content, u32 pool_index, const DescriptorSlot *slots, const u32 *counts) const;
+    bool references(const SetContent &content, const ReleasedHandles &released) const;
+
+    //returns set with the same layout and content or allocates and writes a new one
+    vk::DescriptorSet get_cached(Context &ctx, u32 pool_index, const DescriptorSlot *slots, const u32 *counts);
+    void rehash_cache();
+
     std::map<u32, Pool> pools;
+    std::map<vk::DescriptorSet, SetContent> tracked;
+    std::unordered_multimap<u64, CachedSet> set_cache;
     std::list<u32> free_pools;
     u32 pools_counter = 0;
+    bool use_templates = true;
     friend DescriptorSetID;
   };
 
@@ -54,10 +135,18 @@ namespace drv {
     u32 desc_index;
 
     friend DescriptorStorage;
+    friend DescriptorBinder;
   };
 
+  //Fills flat descriptor data for the set layout and writes it with an update template.
+  //Layouts with up to INLINE_SLOTS descriptors don't touch the heap.
   struct DescriptorBinder {
-    DescriptorBinder(const vk::DescriptorSet &set);
+    DescriptorBinder(DescriptorStorage &storage, DescriptorSetID id);
+    //set is taken from the storage cache by write_cached
+    DescriptorBinder(DescriptorStorage &storage, DescriptorSetLayoutID layout);
+
+    DescriptorBinder(const DescriptorBinder&) = delete;
+    DescriptorBinder &operator=(const DescriptorBinder&) = delete;
 
     DescriptorBinder &bind_ubo(u32 slot, const vk::Buffer &buf, VkDeviceSize offs = 0, vk::DeviceSize range = VK_WHOLE_SIZE);
     DescriptorBinder &bind_combined_img(u32 slot, const vk::ImageView &view, const vk::Sampler &smp, vk::ImageLayout layout = vk::ImageLayout::eShaderReadOnlyOptimal);
@@ -68,13 +157,24 @@ namespace drv {
     DescriptorBinder &bind_storage_image(u32 slot, const vk::ImageView &view, vk::ImageLayout layout = vk::ImageLayout::eGeneral);
 
     void write(Context &ctx);
+    //skips the update if a set with identical bindings already exists
+    vk::DescriptorSet write_cached(Context &ctx);
   private:
+    static constexpr u32 INLINE_SLOTS = 16;
+
+    void init_slots();
+    DescriptorSlot &get_slot(u32 binding, u32 index, vk::DescriptorType type);
+    DescriptorSlot *data() { return heap_slots.empty()? inline_slots : heap_slots.data(); }
+
+    DescriptorStorage &storage;
     vk::DescriptorSet dst;
-    std::vector<vk::WriteDescriptorSet> writes;
-    std::vector<std::unique_ptr<vk::DescriptorImageInfo>> images;
-    std::vector<std::unique_ptr<vk::DescriptorBufferInfo>> buffers;
-    std::vector<std::unique_ptr<vk::DescriptorImageInfo[]>> arrays_of_img;
+    u32 pool_index;
+    const DescriptorStorage::Pool *pool;
+
+    DescriptorSlot inline_slots[INLINE_SLOTS];
+    std::vector<DescriptorSlot> heap_slots;
+    u32 counts[DescriptorStorage::MAX_BINDINGS] {};
   };
 };
 
-#endif
\ No newline at end of file
+#endif
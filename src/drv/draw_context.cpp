@@ -1,7 +1,31 @@
 #include "draw_context.hpp"
 #include <iostream>
+#include <thread>
 namespace drv {
 
+  using Clock = std::chrono::steady_clock;
+
+  static f32 ms_between(Clock::time_point from, Clock::time_point to) {
+    return std::chrono::duration<f32, std::milli>(to - from).count();
+  }
+
+  //exponential average, first sample is taken as is
+  static void smooth(f32 &avg, f32 value) {
+    avg = (avg == 0.f)? value : (0.9f * avg + 0.1f * value);
+  }
+
+  void DrawContextPool::add_sample(f32 FrameTimings::*field, f32 value) {
+    last_timings.*field = value;
+    smooth(timings.*field, value);
+  }
+
+  void DrawContextPool::configure(const FramePacing &p) {
+    if (p.frames_in_flight < 1 || p.frames_in_flight > MAX_FRAMES_IN_FLIGHT) {
+      throw std::runtime_error {"Frames in flight must be in 1.." + std::to_string(MAX_FRAMES_IN_FLIGHT)};
+    }
+    pacing = p;
+  }
+
   void DrawContextPool::init_backbuffer_views(Context &ctx) {
     auto &images = ctx.get_swapchain_images();
 
@@ -88,6 +112,17 @@ namespace drv {
         frame_done[i] = ctx.get_device().createFence(fence);
       }  
     }
+
+    {
+      vk::QueryPoolCreateInfo info {};
+      info
+        .setQueryType(vk::QueryType::eTimestamp)
+        .setQueryCount(2 * MAX_FRAMES_IN_FLIGHT);
+      timestamps = ctx.get_device().createQueryPool(info);
+      timestamp_period = ctx.get_physical_device().getProperties().limits.timestampPeriod;
+    }
+
+    last_frame_start = Clock::now();
   }
 
   void DrawContextPool::init(Context &ctx, vk::RenderPass &pass, ResourceStorage &storage) {
@@ -106,14 +141,80 @@ namespace drv {
     }
   }
   
+  void DrawContextPool::init_thread_pools(Context &ctx, u32 threads) {
+    thread_pools.resize(MAX_FRAMES_IN_FLIGHT + 1);
+    for (auto &slot : thread_pools) {
+      slot.resize(threads);
+      for (auto &tp : slot) {
+        vk::CommandPoolCreateInfo info {};
+        info.setQueueFamilyIndex(ctx.queue_index(QueueT::Graphics));
+        info.setFlags(vk::CommandPoolCreateFlagBits::eTransient);
+        tp.pool = ctx.get_device().createCommandPool(info);
+      }
+    }
+  }
+
+  vk::CommandBuffer DrawContextPool::begin_secondary(Context &ctx, u32 slot, const vk::CommandBufferInheritanceInfo &inheritance) {
+    auto thread = WorkerPool::thread_index();
+    if (slot >= thread_pools.size() || thread >= thread_pools[slot].size()) {
+      throw std::runtime_error {"No command pool for recording thread"};
+    }
+
+    auto &tp = thread_pools[slot][thread];
+    if (tp.used == tp.buffers.size()) {
+      vk::CommandBufferAllocateInfo info {};
+      info
+        .setCommandBufferCount(1)
+        .setCommandPool(tp.pool)
+        .setLevel(vk::CommandBufferLevel::eSecondary);
+      tp.buffers.push_back(ctx.get_device().allocateCommandBuffers(info)[0]);
+    }
+
+    auto cmd = tp.buffers[tp.used++];
+
+    vk::CommandBufferBeginInfo info {};
+    info
+      .setFlags(vk::CommandBufferUsageFlagBits::eRenderPassContinue|vk::CommandBufferUsageFlagBits::eOneTimeSubmit)
+      .setPInheritanceInfo(&inheritance);
+    cmd.begin(info);
+    return cmd;
+  }
+
+  //buffers stay allocated and are reused after the pool reset
+  void DrawContextPool::reset_secondary(Context &ctx, u32 slot) {
+    if (slot >= thread_pools.size()) {
+      return;
+    }
+
+    for (auto &tp : thread_pools[slot]) {
+      if (tp.used) {
+        ctx.get_device().resetCommandPool(tp.pool, vk::CommandPoolResetFlags {});
+        tp.used = 0;
+      }
+    }
+  }
+
   void DrawContextPool::release(Context &ctx) {
+    for (auto &slot : thread_pools) {
+      for (auto &tp : slot) {
+        ctx.get_device().destroyCommandPool(tp.pool);
+      }
+    }
+    thread_pools.clear();
+
     for (u32 i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
       ctx.get_device().destroyFence(frame_done[i]);
       ctx.get_device().destroySemaphore(image_awailable[i]);
       ctx.get_device().destroySemaphore(submit_done[i]);
     }
 
+    for (auto fence : free_fences) {
+      ctx.get_device().destroyFence(fence);
+    }
+    free_fences.clear();
+    free_cmds.clear();
     ctx.get_device().destroyCommandPool(buffer_pool);
+    ctx.get_device().destroyQueryPool(timestamps);
 
     for (u32 i = 0; i < backbuffer_images.size(); i++) {
       ctx.get_device().destroyFramebuffer(backbuffers[i]);
@@ -126,56 +227,166 @@ namespace drv {
 
   }
 
-  DrawContext DrawContextPool::get_next(Context &ctx) {
-    auto wait_fences = {frame_done[frame_id]};
-    ctx.get_device().waitForFences(wait_fences, 1, UINT64_MAX);
-    ctx.get_device().resetFences(wait_fences);
+  void DrawContextPool::wait_frame(Context &ctx, u32 slot) {
+    ctx.get_device().waitForFences({frame_done[slot]}, VK_TRUE, UINT64_MAX);
+    if (latency_pending[slot]) {
+      add_sample(&FrameTimings::latency, ms_between(input_time[slot], Clock::now()));
+      latency_pending[slot] = false;
+    }
+  }
+
+  void DrawContextPool::read_timestamps(Context &ctx, u32 slot) {
+    if (!slot_submitted[slot]) {
+      return;
+    }
+
+    u64 data[2];
+    auto res = ctx.get_device().getQueryPoolResults(timestamps, 2 * slot, 2, sizeof(data), data, sizeof(u64), vk::QueryResultFlagBits::e64);
+    if (res != vk::Result::eSuccess) {
+      return;
+    }
+
+    const f64 ticks_to_ms = timestamp_period * 1e-6;
+    add_sample(&FrameTimings::gpu, f32((data[1] - data[0]) * ticks_to_ms));
+    if (last_gpu_end && data[0] > last_gpu_end) {
+      add_sample(&FrameTimings::gpu_idle, f32((data[0] - last_gpu_end) * ticks_to_ms));
+    }
+    last_gpu_end = data[1];
+  }
+
+  DrawContext DrawContextPool::get_next(Context &ctx, ResourceStorage &storage) {
+    CPU_ZONE("get_next");
+    auto start = Clock::now();
+
+    //frames finished since the last call report their latency
+    for (u32 i = 0; i < pacing.frames_in_flight; i++) {
+      if (latency_pending[i] && ctx.get_device().getFenceStatus(frame_done[i]) == vk::Result::eSuccess) {
+        wait_frame(ctx, i);
+      }
+    }
+
+    if (pacing.low_latency) {
+      u32 prev = (frame_id + pacing.frames_in_flight - 1) % pacing.frames_in_flight;
+      wait_frame(ctx, prev);
+    }
+
+    wait_frame(ctx, frame_id);
+    ctx.get_device().resetFences({frame_done[frame_id]});
+    read_timestamps(ctx, frame_id);
 
-    u32 image_id = ctx.get_device().acquireNextImageKHR(ctx.get_swapchain(), UINT64_MAX, image_awailable[frame_id], nullptr);
+    if (pacing.fps_limit > 0.f) {
+      auto interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<f64>(1.0/pacing.fps_limit));
+      std::this_thread::sleep_until(last_frame_start + interval);
+    }
+
+    //fence of this slot was signaled by frame (frame_counter - frames_in_flight)
+    frame_counter++;
+    u64 completed = (frame_counter > pacing.frames_in_flight)? frame_counter - pacing.frames_in_flight : 0;
+    storage.next_frame(ctx, frame_counter, completed);
+
+    //offscreen images are cycled, the fence of this slot guarantees the image isn't used by gpu
+    u32 image_id = 0;
+    if (ctx.is_headless()) {
+      image_id = u32(frame_counter % backbuffers.size());
+    } else {
+      image_id = ctx.get_device().acquireNextImageKHR(ctx.get_swapchain(), UINT64_MAX, image_awailable[frame_id], nullptr);
+    }
 
     cmd_buffers[frame_id].reset(vk::CommandBufferResetFlagBits::eReleaseResources);
+    reset_secondary(ctx, frame_id);
+
+    //input is sampled by the caller right after return
+    auto now = Clock::now();
+    add_sample(&FrameTimings::frame, ms_between(last_frame_start, now));
+    add_sample(&FrameTimings::wait, ms_between(start, now));
+    last_frame_start = now;
+    input_time[frame_id] = now;
     
     DrawContext dctx {
       frame_id,
       image_id,
       backbuffers[image_id],
-      cmd_buffers[frame_id]
+      cmd_buffers[frame_id],
+      frame_counter,
+      completed
     };
 
     vk::CommandBufferBeginInfo info {};
     dctx.dcb.begin(info);
+    dctx.dcb.resetQueryPool(timestamps, 2 * frame_id, 2);
+    dctx.dcb.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, timestamps, 2 * frame_id);
     return dctx;
   }
 
   void DrawContextPool::submit(Context &ctx, DrawContext &dctx) {
+    CPU_ZONE("submit");
     assert(((dctx.frame_id == frame_id) && "submit order mismatch"));
 
-    auto wait_sem = {image_awailable[frame_id]};
-    vk::PipelineStageFlags wait_msk[] {vk::PipelineStageFlagBits::eColorAttachmentOutput};
+    dctx.dcb.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, timestamps, 2 * frame_id + 1);
+    dctx.dcb.end();
+
+    //binary acquire semaphore ignores its value
+    if (!ctx.is_headless()) {
+      task_semaphores.push_back(image_awailable[frame_id]);
+      task_values.push_back(0);
+      task_stages.push_back(vk::PipelineStageFlagBits::eColorAttachmentOutput);
+    }
+
     auto signal_sem = {submit_done[frame_id]};
     auto submit_buffers = { dctx.dcb };
+
+    vk::TimelineSemaphoreSubmitInfo timeline_info {};
+    timeline_info
+      .setWaitSemaphoreValueCount(task_values.size())
+      .setPWaitSemaphoreValues(task_values.data());
     
     vk::SubmitInfo info {};
-    info.setWaitSemaphores(wait_sem);
-    info.setPWaitDstStageMask(wait_msk);
-    info.setSignalSemaphores(signal_sem);
-    info.setCommandBuffers(submit_buffers);
+    info
+      .setPNext(&timeline_info)
+      .setCommandBuffers(submit_buffers)
+      .setWaitSemaphores(task_semaphores)
+      .setPWaitDstStageMask(task_stages.data());
+    if (!ctx.is_headless()) {
+      info.setSignalSemaphores(signal_sem);
+    }
     
     ctx.get_queue(QueueT::Graphics).submit(info, frame_done[frame_id]);
+    task_semaphores.clear();
+    task_values.clear();
+    task_stages.clear();
     
-    auto swapchains = { ctx.get_swapchain() };
-    auto images = { dctx.image_id };
-    vk::PresentInfoKHR pres {};
-    pres.setWaitSemaphores(signal_sem);
-    pres.setSwapchains(swapchains);
-    pres.setImageIndices(images);
-    ctx.get_queue(QueueT::Graphics).presentKHR(pres);
+    if (!ctx.is_headless()) {
+      auto swapchains = { ctx.get_swapchain() };
+      auto images = { dctx.image_id };
+      vk::PresentInfoKHR pres {};
+      pres.setWaitSemaphores(signal_sem);
+      pres.setSwapchains(swapchains);
+      pres.setImageIndices(images);
+      ctx.get_queue(QueueT::Graphics).presentKHR(pres);
+    }
 
-    frame_id = (frame_id + 1) % MAX_FRAMES_IN_FLIGHT;
+    slot_submitted[frame_id] = true;
+    latency_pending[frame_id] = true;
+    frame_id = (frame_id + 1) % pacing.frames_in_flight;
   }
 
+  void DrawContextPool::wait_task(const QueueScheduler &scheduler, const TaskWait &wait) {
+    if (!wait.task.value) {
+      return;
+    }
+    task_semaphores.push_back(scheduler.get_semaphore(wait.task.queue));
+    task_values.push_back(wait.task.value);
+    task_stages.push_back(wait.stages);
+  }
+
+  //pool has eResetCommandBuffer, begin() resets recycled buffers
   vk::CommandBuffer DrawContextPool::start_cmd(Context &ctx) {
-    
+    if (free_cmds.size()) {
+      auto cmd = free_cmds.back();
+      free_cmds.pop_back();
+      return cmd;
+    }
+
     vk::CommandBufferAllocateInfo info {};
     info
       .setCommandBufferCount(1)
@@ -192,15 +403,56 @@ namespace drv {
     vk::SubmitInfo info {};
     info.setCommandBuffers(buffers);
 
-    vk::FenceCreateInfo fence_info {};
-    
-    auto fence = ctx.get_device().createFence(fence_info);
+    vk::Fence fence;
+    if (free_fences.size()) {
+      fence = free_fences.back();
+      free_fences.pop_back();
+    } else {
+      fence = ctx.get_device().createFence(vk::FenceCreateInfo {});
+    }
+
     ctx.get_queue(QueueT::Graphics).submit(info, fence);
     return fence;
   }
 
-  void DrawContextPool::free_cmd(Context &ctx, vk::CommandBuffer cmd) {
-    ctx.get_device().freeCommandBuffers(buffer_pool, {cmd});
-    //ctx.get_device().trimCommandPool(buffer_pool, vk::CommandPoolTrimFlags(0));
+  void DrawContextPool::free_cmd(Context &, vk::CommandBuffer cmd) {
+    free_cmds.push_back(cmd);
+  }
+
+  void DrawContextPool::free_fence(Context &ctx, vk::Fence fence) {
+    ctx.get_device().resetFences({fence});
+    free_fences.push_back(fence);
+  }
+
+  void DrawContextPool::submit_and_wait(Context &ctx, vk::CommandBuffer cmd) {
+    auto fence = submit_cmd(ctx, cmd);
+    auto res = ctx.get_device().waitForFences({fence}, VK_TRUE, UINT64_MAX);
+    if (res != vk::Result::eSuccess) {
+      throw std::runtime_error {"Failed to wait for one-shot commands"};
+    }
+
+    free_fence(ctx, fence);
+    free_cmd(ctx, cmd);
+  }
+
+  void ParallelRecorder::wait() {
+    for (auto &job : jobs) {
+      if (job.valid()) job.wait();
+    }
+  }
+
+  void ParallelRecorder::execute(vk::CommandBuffer &cmd) {
+    //all jobs are finished before an exception leaves, buffers stay in their pools
+    wait();
+
+    std::vector<vk::CommandBuffer> buffers;
+    for (auto &job : jobs) {
+      buffers.push_back(job.get());
+    }
+    jobs.clear();
+
+    if (buffers.size()) {
+      cmd.executeCommands(buffers);
+    }
   }
 }
\ No newline at end of file
@@ -3,19 +3,61 @@
 
 #include "context.hpp"
 #include "resources.hpp"
+#include "worker_pool.hpp"
+#include "cpu_profiler.hpp"
+#include "queue_scheduler.hpp"
+
+#include <future>
+#include <chrono>
 
 namespace drv {
 
-  const u32 MAX_FRAMES_IN_FLIGHT = 2;
+  //upper bound for per frame resources, the used count is FramePacing::frames_in_flight
+  const u32 MAX_FRAMES_IN_FLIGHT = 3;
+  //secondary buffers of start_cmd commands, the slot is reset by the caller after waiting for them
+  const u32 ONESHOT_SLOT = MAX_FRAMES_IN_FLIGHT;
+
+  struct FramePacing {
+    u32 frames_in_flight = 2;
+    //0 - unlimited
+    f32 fps_limit = 0.f;
+    //get_next waits until gpu finishes the previous frame, so input is sampled as late as possible
+    bool low_latency = false;
+  };
+
+  //ms, smoothed over recent frames
+  struct FrameTimings {
+    f32 frame = 0.f;
+    //blocked in get_next on fences, limiter and acquire
+    f32 wait = 0.f;
+    //from get_next return (input sample) until the frame is seen finished by gpu,
+    //precise in low latency mode, otherwise rounded up to the next get_next
+    f32 latency = 0.f;
+    f32 gpu = 0.f;
+    //gpu time between the end of previous frame and start of this one
+    f32 gpu_idle = 0.f;
+  };
 
   struct DrawContext {
     u32 frame_id;
     u32 image_id;
     vk::Framebuffer &backbuffer;
     vk::CommandBuffer dcb;
+    //frame_index is increasing, all frames up to completed_frame are finished by gpu
+    u64 frame_index;
+    u64 completed_frame;
   };
 
   struct DrawContextPool {
+    //before init
+    void configure(const FramePacing &p);
+    void set_fps_limit(f32 fps) { pacing.fps_limit = fps; }
+    void set_low_latency(bool enable) { pacing.low_latency = enable; }
+    const FramePacing &get_pacing() const { return pacing; }
+    const FrameTimings &get_timings() const { return timings; }
+    //not smoothed, gpu values are from the frame finished last
+    const FrameTimings &get_last_timings() const { return last_timings; }
+
     void init_backbuffer_views(Context &ctx);
     void init(Context &ctx, const std::vector<vk::Framebuffer> &fb);
 
@@ -27,32 +69,124 @@ namespace drv {
 
     void release(Context &ctx);
 
-    DrawContext get_next(Context &ctx);
+    //waits for the frame slot and destroys storage resources released before it, dcb is begun
+    DrawContext get_next(Context &ctx, ResourceStorage &storage);
+    //ends dcb, submits and presents
     void submit(Context &ctx, DrawContext &dctx);
+    //next submit waits for the task, for async work the frame reads
+    void wait_task(const QueueScheduler &scheduler, const TaskWait &wait);
 
+    //one-shot commands, buffers and fences are recycled instead of allocated on every call
     vk::CommandBuffer start_cmd(Context &ctx);
     vk::Fence submit_cmd(Context &ctx, vk::CommandBuffer cmd);
+    //both must be finished by gpu
     void free_cmd(Context &ctx, vk::CommandBuffer cmd);
+    void free_fence(Context &ctx, vk::Fence fence);
+    //submit_cmd + wait + free
+    void submit_and_wait(Context &ctx, vk::CommandBuffer cmd);
+
+    //command pools of every recording thread (caller + workers) for each frame slot and ONESHOT_SLOT
+    void init_thread_pools(Context &ctx, u32 threads);
+    //secondary buffer from the pool of calling thread, valid until the slot is reset
+    vk::CommandBuffer begin_secondary(Context &ctx, u32 slot, const vk::CommandBufferInheritanceInfo &inheritance);
+    //get_next resets the slot of its frame
+    void reset_secondary(Context &ctx, u32 slot);
     
   private:
     void create_sync_resources(Context &ctx);
     void create_depth_buffers(Context &ctx, ResourceStorage &storage);
+    void wait_frame(Context &ctx, u32 slot);
+    void read_timestamps(Context &ctx, u32 slot);
+    void add_sample(f32 FrameTimings::*field, f32 value);
+
+    //pools are used only by their own thread, no locking
+    struct ThreadPool {
+      vk::CommandPool pool;
+      std::vector<vk::CommandBuffer> buffers;
+      u32 used = 0;
+    };
 
     vk::CommandPool buffer_pool;
     std::vector<vk::ImageView> backbuffer_images;
     std::vector<vk::Framebuffer> backbuffers;
     std::vector<vk::CommandBuffer> cmd_buffers;
+    std::vector<vk::CommandBuffer> free_cmds;
+    std::vector<vk::Fence> free_fences;
     
     std::vector<ImageViewID> backbuffer_depth;
+    std::vector<std::vector<ThreadPool>> thread_pools; //[slot][thread]
 
     vk::Semaphore image_awailable[MAX_FRAMES_IN_FLIGHT];
     vk::Semaphore submit_done[MAX_FRAMES_IN_FLIGHT];
     vk::Fence frame_done[MAX_FRAMES_IN_FLIGHT];
 
+    //begin and end of each frame slot
+    vk::QueryPool timestamps;
+    f64 timestamp_period = 1.0;
+    u64 last_gpu_end = 0;
+    bool slot_submitted[MAX_FRAMES_IN_FLIGHT] {};
+    bool latency_pending[MAX_FRAMES_IN_FLIGHT] {};
+    std::chrono::steady_clock::time_point input_time[MAX_FRAMES_IN_FLIGHT];
+    std::chrono::steady_clock::time_point last_frame_start;
+
+    //timeline waits of the next submit
+    std::vector<vk::Semaphore> task_semaphores;
+    std::vector<u64> task_values;
+    std::vector<vk::PipelineStageFlags> task_stages;
+
+    FramePacing pacing;
+    FrameTimings timings;
+    FrameTimings last_timings;
+
     u32 frame_id = 0;
+    u64 frame_counter = 0;
+  };
+
+  //Records secondary buffers on worker threads, execute() runs them in the order they were added.
+  //Inheritance info must describe the render pass the primary buffer is in.
+  struct ParallelRecorder {
+    ParallelRecorder(Context &c, DrawContextPool &p, WorkerPool &w, u32 s, const vk::CommandBufferInheritanceInfo &info)
+      : ctx {c}, pool {p}, workers {w}, slot {s}, inheritance {info} {}
+    ParallelRecorder(const ParallelRecorder&) = delete;
+    ParallelRecorder &operator=(const ParallelRecorder&) = delete;
+    ~ParallelRecorder() { wait(); }
+
+    //record(cmd) on a worker, cmd has no bound state
+    template <typename F>
+    void add(F &&record) {
+      jobs.push_back(workers.submit([this, record = std::forward<F>(record)]() {
+        CPU_ZONE("record secondary");
+        auto cmd = pool.begin_secondary(ctx, slot, inheritance);
+        record(cmd);
+        cmd.end();
+        return cmd;
+      }));
+    }
+
+    //record(cmd, begin, end) for chunks of [0, count), one chunk per worker unless chunks get smaller than min_chunk
+    template <typename F>
+    void add_chunks(u32 count, u32 min_chunk, F &&record) {
+      u32 threads = max(workers.size(), 1u);
+      u32 chunk = max(max(min_chunk, 1u), (count + threads - 1)/threads);
+      for (u32 start = 0; start < count; start += chunk) {
+        u32 end = min(count, start + chunk);
+        add([record, start, end](vk::CommandBuffer &cmd) { record(cmd, start, end); });
+      }
+    }
+
+    void execute(vk::CommandBuffer &cmd);
+
+  private:
+    void wait();
+
+    Context &ctx;
+    DrawContextPool &pool;
+    WorkerPool &workers;
+    u32 slot;
+    vk::CommandBufferInheritanceInfo inheritance;
+    std::vector<std::future<vk::CommandBuffer>> jobs;
   };
 
-  
 
 }
 
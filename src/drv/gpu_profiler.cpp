@@ -0,0 +1,304 @@
+#include "gpu_profiler.hpp"
+#include "lib/vkimgui/imgui.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+namespace drv {
+
+  static void smooth(f32 &avg, f32 value) {
+    avg = 0.9f * avg + 0.1f * value;
+  }
+
+  static std::string json_escape(const std::string &str) {
+    std::string out;
+    for (char c : str) {
+      if (c == '"' || c == '\\') out.push_back('\\');
+      out.push_back(c);
+    }
+    return out;
+  }
+
+  void GpuProfiler::init(Context &ctx) {
+    auto props = ctx.get_physical_device().getProperties();
+    auto families = ctx.get_physical_device().getQueueFamilyProperties();
+    u32 valid_bits = families[ctx.queue_index(QueueT::Graphics)].timestampValidBits;
+
+    if (!valid_bits) {
+      std::cout << "Graphics queue doesn't support timestamps, gpu profiler is disabled\n";
+      return;
+    }
+
+    timestamp_period = props.limits.timestampPeriod;
+    timestamp_mask = (valid_bits < 64)? ((1ull << valid_bits) - 1) : ~0ull;
+    //async zones are measured with the same mask
+    async_enabled = families[ctx.queue_index(QueueT::Compute)].timestampValidBits == valid_bits;
+
+    vk::QueryPoolCreateInfo info {};
+    info
+      .setQueryType(vk::QueryType::eTimestamp)
+      .setQueryCount(2 * MAX_ZONES * SLOTS);
+    pool = ctx.get_device().createQueryPool(info);
+    enabled = true;
+  }
+
+  void GpuProfiler::release(Context &ctx) {
+    if (enabled) {
+      ctx.get_device().destroyQueryPool(pool);
+    }
+    enabled = false;
+  }
+
+  void GpuProfiler::begin_frame(Context &ctx, vk::CommandBuffer &cmd, u32 slot) {
+    if (!slot_enabled(slot)) {
+      return;
+    }
+
+    resolve(ctx, slot);
+    cmd.resetQueryPool(pool, query(slot, 0), 2 * MAX_ZONES);
+    slots[slot].used.store(0, std::memory_order_relaxed);
+    slots[slot].pending = true;
+  }
+
+  u32 GpuProfiler::begin_zone(vk::CommandBuffer &cmd, u32 slot, const std::string &name) {
+    if (!slot_enabled(slot)) {
+      return ~0u;
+    }
+
+    u32 zone = slots[slot].used.fetch_add(1, std::memory_order_relaxed);
+    if (zone >= MAX_ZONES) {
+      return ~0u;
+    }
+
+    slots[slot].zones[zone].name = name;
+    cmd.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, pool, query(slot, zone));
+    return zone;
+  }
+
+  void GpuProfiler::end_zone(vk::CommandBuffer &cmd, u32 slot, u32 zone) {
+    if (zone == ~0u) {
+      return;
+    }
+    cmd.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, pool, query(slot, zone) + 1);
+  }
+
+  void GpuProfiler::resolve(Context &ctx, u32 slot) {
+    auto &s = slots[slot];
+    if (!slot_enabled(slot) || !s.pending) {
+      return;
+    }
+    s.pending = false;
+
+    u32 count = std::min(s.used.load(std::memory_order_relaxed), MAX_ZONES);
+    if (!count) {
+      return;
+    }
+
+    //value and availability for every query, zones which weren't ended are skipped
+    std::vector<u64> data(4 * count);
+    auto flags = vk::QueryResultFlagBits::e64|vk::QueryResultFlagBits::eWithAvailability;
+    auto res = ctx.get_device().getQueryPoolResults(pool, query(slot, 0), 2 * count, data.size() * sizeof(u64), data.data(), 2 * sizeof(u64), flags);
+    if (res != vk::Result::eSuccess && res != vk::Result::eNotReady) {
+      return;
+    }
+
+    std::vector<Zone> zones;
+    for (u32 i = 0; i < count; i++) {
+      if (!data[4 * i + 1] || !data[4 * i + 3]) {
+        continue;
+      }
+      zones.push_back({s.zones[i].name, data[4 * i], data[4 * i + 2]});
+    }
+
+    accumulate(zones, slot >= ONESHOT_SLOT);
+  }
+
+  void GpuProfiler::accumulate(std::vector<Zone> &zones, bool oneshot) {
+    //parents go before children starting at the same time
+    std::sort(zones.begin(), zones.end(), [](const Zone &a, const Zone &b) {
+      return (a.begin != b.begin)? a.begin < b.begin : a.end > b.end;
+    });
+
+    std::unordered_map<std::string, u32> known;
+    auto &stats = oneshot? oneshot_stats : frame_stats;
+    for (u32 i = 0; i < stats.size(); i++) {
+      known[stats[i].path] = i;
+    }
+
+    std::vector<ZoneStats> next;
+    std::vector<std::pair<u64, std::string>> parents; //end time and path of open zones
+
+    for (auto &zone : zones) {
+      while (parents.size() && zone.end > parents.back().first) {
+        parents.pop_back();
+      }
+
+      auto parent = parents.size()? parents.back().second : std::string {};
+      auto path = parents.size()? parent + "/" + zone.name : zone.name;
+      u32 depth = parents.size();
+      f32 ms = f32(((zone.end - zone.begin) & timestamp_mask) * timestamp_period * 1e-6);
+      parents.push_back({zone.end, path});
+
+      if (!oneshot) {
+        //repeated zones of one frame are summed
+        if (next.size() && next.back().path == path) {
+          next.back().last += ms;
+        } else {
+          next.push_back(ZoneStats {path, zone.name, depth, ms, 1, ms});
+        }
+        continue;
+      }
+
+      auto iter = known.find(path);
+      if (iter != known.end()) {
+        stats[iter->second].ms += ms;
+        stats[iter->second].count++;
+        continue;
+      }
+
+      //new one-shot zones are inserted after the subtree of their parent
+      u32 pos = stats.size();
+      if (depth) {
+        for (u32 i = 0; i < stats.size(); i++) {
+          auto &p = stats[i].path;
+          if (p == parent || (p.size() > parent.size() && p.compare(0, parent.size() + 1, parent + "/") == 0)) {
+            pos = i + 1;
+          }
+        }
+      }
+      stats.insert(stats.begin() + pos, ZoneStats {path, zone.name, depth, ms, 1, ms});
+      known.clear();
+      for (u32 i = 0; i < stats.size(); i++) {
+        known[stats[i].path] = i;
+      }
+    }
+
+    if (!oneshot) {
+      for (auto &entry : next) {
+        auto iter = known.find(entry.path);
+        if (iter != known.end()) {
+          entry.ms = stats[iter->second].ms;
+          entry.count = stats[iter->second].count + 1;
+          smooth(entry.ms, entry.last);
+        }
+      }
+      frame_stats = std::move(next);
+    }
+  }
+
+  static void draw_table(const char *id, const std::vector<GpuProfiler::ZoneStats> &stats, bool show_count) {
+    auto flags = ImGuiTableFlags_BordersV|ImGuiTableFlags_BordersOuterH|ImGuiTableFlags_RowBg;
+    if (!ImGui::BeginTable(id, show_count? 3 : 2, flags)) {
+      return;
+    }
+
+    ImGui::TableSetupColumn("Zone", ImGuiTableColumnFlags_NoHide);
+    ImGui::TableSetupColumn("ms", ImGuiTableColumnFlags_WidthFixed, 80.f);
+    if (show_count) {
+      ImGui::TableSetupColumn("count", ImGuiTableColumnFlags_WidthFixed, 60.f);
+    }
+    ImGui::TableHeadersRow();
+
+    //rows deeper than visible_depth belong to collapsed nodes
+    u32 open_depth = 0;
+    u32 visible_depth = 0;
+    for (u32 i = 0; i < stats.size(); i++) {
+      auto &zone = stats[i];
+      if (zone.depth > visible_depth) {
+        continue;
+      }
+
+      while (open_depth > zone.depth) {
+        ImGui::TreePop();
+        open_depth--;
+      }
+
+      bool has_children = (i + 1 < stats.size()) && (stats[i + 1].depth > zone.depth);
+      ImGuiTreeNodeFlags node_flags = ImGuiTreeNodeFlags_SpanFullWidth|ImGuiTreeNodeFlags_DefaultOpen;
+      if (!has_children) {
+        node_flags |= ImGuiTreeNodeFlags_Leaf|ImGuiTreeNodeFlags_NoTreePushOnOpen;
+      }
+
+      ImGui::TableNextRow();
+      ImGui::TableNextColumn();
+      bool open = ImGui::TreeNodeEx((void*)(intptr_t)i, node_flags, "%s", zone.name.c_str());
+      ImGui::TableNextColumn();
+      ImGui::Text("%.3f", zone.ms);
+      if (show_count) {
+        ImGui::TableNextColumn();
+        ImGui::Text("%u", zone.count);
+      }
+
+      if (has_children && open) {
+        open_depth++;
+        visible_depth = zone.depth + 1;
+      } else {
+        visible_depth = zone.depth;
+      }
+    }
+
+    while (open_depth--) {
+      ImGui::TreePop();
+    }
+    ImGui::EndTable();
+  }
+
+  void GpuProfiler::draw_ui() {
+    ImGui::Begin("GPU profiler");
+    if (!enabled) {
+      ImGui::Text("Timestamps are not supported");
+      ImGui::End();
+      return;
+    }
+
+    if (ImGui::Button("Export CSV")) {
+      export_csv("gpu_profile.csv");
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Export JSON")) {
+      export_json("gpu_profile.json");
+    }
+
+    if (ImGui::CollapsingHeader("Frame", ImGuiTreeNodeFlags_DefaultOpen)) {
+      draw_table("frame_zones", frame_stats, false);
+    }
+    if (ImGui::CollapsingHeader("One-shot (total)")) {
+      draw_table("oneshot_zones", oneshot_stats, true);
+    }
+    ImGui::End();
+  }
+
+  void GpuProfiler::export_csv(const std::string &path) const {
+    std::ofstream out(path, std::ios::trunc);
+    out << "section,zone,depth,ms,count\n";
+    for (auto &z : frame_stats) {
+      out << "frame," << z.path << "," << z.depth << "," << z.ms << "," << z.count << "\n";
+    }
+    for (auto &z : oneshot_stats) {
+      out << "oneshot," << z.path << "," << z.depth << "," << z.ms << "," << z.count << "\n";
+    }
+    std::cout << "GPU profile written to " << path << "\n";
+  }
+
+  void GpuProfiler::export_json(const std::string &path) const {
+    auto write_section = [](std::ofstream &out, const std::vector<ZoneStats> &stats) {
+      out << "[";
+      for (u32 i = 0; i < stats.size(); i++) {
+        auto &z = stats[i];
+        out << (i? ",\n    " : "\n    ") << "{\"zone\": \"" << json_escape(z.path) << "\", \"depth\": " << z.depth
+          << ", \"ms\": " << z.ms << ", \"count\": " << z.count << "}";
+      }
+      out << "\n  ]";
+    };
+
+    std::ofstream out(path, std::ios::trunc);
+    out << "{\n  \"frame\": ";
+    write_section(out, frame_stats);
+    out << ",\n  \"oneshot\": ";
+    write_section(out, oneshot_stats);
+    out << "\n}\n";
+    std::cout << "GPU profile written to " << path << "\n";
+  }
+
+}
@@ -0,0 +1,101 @@
+#ifndef GPU_PROFILER_HPP_INCLUDED
+#define GPU_PROFILER_HPP_INCLUDED
+
+#include "common.hpp"
+#include "context.hpp"
+#include "draw_context.hpp"
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+namespace drv {
+
+  //Timestamp zones for frame slots and ONESHOT_SLOT.
+  //Queries of a slot are read when the slot is begun again, its fence is already waited by then,
+  //so results come MAX_FRAMES_IN_FLIGHT frames late and reading never stalls.
+  //Zones may be written from any thread into primary or secondary buffers of the slot,
+  //nesting is restored from timestamps: a zone inside the time range of another one is its child.
+  //ASYNC_SLOT is for one-shot tasks on the compute queue, they must be ordered by semaphores,
+  //the first task begins the slot and it is resolved after the last one. Its zones go to one-shot stats.
+  struct GpuProfiler {
+    static constexpr u32 MAX_ZONES = 256; //per slot
+    static constexpr u32 ASYNC_SLOT = ONESHOT_SLOT + 1;
+    static constexpr u32 SLOTS = ASYNC_SLOT + 1;
+
+    struct ZoneStats {
+      std::string path; //parent names joined with '/'
+      std::string name;
+      u32 depth;
+      //frames - smoothed time of a zone, one-shot - sum of all zones with this path
+      f32 ms;
+      u32 count;
+      //frames - time in the last resolved frame
+      f32 last;
+    };
+
+    void init(Context &ctx);
+    void release(Context &ctx);
+
+    //resolves previous contents of the slot and resets its queries, cmd is primary and outside of render pass
+    void begin_frame(Context &ctx, vk::CommandBuffer &cmd, u32 slot);
+    //reads queries of a finished slot, for ONESHOT_SLOT after submit_and_wait
+    void resolve(Context &ctx, u32 slot);
+
+    //returns ~0u when the slot is full or timestamps aren't supported
+    u32 begin_zone(vk::CommandBuffer &cmd, u32 slot, const std::string &name);
+    void end_zone(vk::CommandBuffer &cmd, u32 slot, u32 zone);
+
+    const std::vector<ZoneStats> &get_frame_stats() const { return frame_stats; }
+    const std::vector<ZoneStats> &get_oneshot_stats() const { return oneshot_stats; }
+
+    void draw_ui();
+    void export_csv(const std::string &path) const;
+    void export_json(const std::string &path) const;
+
+  private:
+    struct Zone {
+      std::string name;
+      u64 begin;
+      u64 end;
+    };
+
+    struct Slot {
+      std::atomic<u32> used {0};
+      bool pending = false;
+      Zone zones[MAX_ZONES];
+    };
+
+    u32 query(u32 slot, u32 zone) const { return 2 * (slot * MAX_ZONES + zone); }
+    bool slot_enabled(u32 slot) const { return enabled && (slot != ASYNC_SLOT || async_enabled); }
+    void accumulate(std::vector<Zone> &zones, bool oneshot);
+
+    bool enabled = false;
+    bool async_enabled = false;
+    vk::QueryPool pool;
+    f64 timestamp_period = 1.0;
+    u64 timestamp_mask = ~0ull;
+    Slot slots[SLOTS];
+
+    std::vector<ZoneStats> frame_stats;
+    std::vector<ZoneStats> oneshot_stats;
+  };
+
+  struct GpuZone {
+    GpuZone(GpuProfiler &p, vk::CommandBuffer &c, u32 s, const std::string &name)
+      : profiler {p}, cmd {c}, slot {s}, zone {p.begin_zone(c, s, name)} {}
+    GpuZone(const GpuZone&) = delete;
+    GpuZone &operator=(const GpuZone&) = delete;
+    ~GpuZone() { profiler.end_zone(cmd, slot, zone); }
+
+  private:
+    GpuProfiler &profiler;
+    vk::CommandBuffer &cmd;
+    u32 slot;
+    u32 zone;
+  };
+
+}
+
+#endif
@@ -12,6 +12,8 @@ namespace drv {
   static void gen_mipmaps(Image &img, vk::CommandBuffer &cmd);
 
   void ResourceStorage::fill_image_info(Context &ctx, const vk::ImageCreateInfo &info, Image &img) {
+    collect(ctx);
+
     img.info = info;
     img.info.initialLayout = vk::ImageLayout::eUndefined;
     img.layout = img.info.initialLayout;
@@ -113,7 +115,11 @@ namespace drv {
     info.setSubresourceRange(r);
     info.setComponents(map);
     
-    ImageView view {ctx.get_device().createImageView(info), img};
+    return create_view(ctx, img, info);
+  }
+
+  ImageViewID ResourceStorage::create_view(Context &ctx, const ImageID &img, const vk::ImageViewCreateInfo &info) {
+    ImageView view {info, ctx.get_device().createImageView(info), img};
     return views.create(view);
   }
 
@@ -205,7 +211,6 @@ namespace drv {
       img.layout = vk::ImageLayout::eShaderReadOnlyOptimal;
     }
 
-    collect_buffers();
     return images.create(img);    
   }
 
@@ -332,13 +337,16 @@ namespace drv {
     info.setSubresourceRange(r);
     info.setComponents(map);
     
-    ImageView view {ctx.get_device().createImageView(info), img};
-    return views.create(view);
+    return create_view(ctx, img, info);
   }
 
   ImageID ResourceStorage::create_image2D_array(Context &ctx, 
-    u32 width, u32 height, vk::Format fmt, vk::ImageUsageFlags usage, u32 layers, u32 levels) 
+    u32 width, u32 height, vk::Format fmt, vk::ImageUsageFlags usage, u32 layers, u32 levels, vk::SharingMode mode) 
   {
+    if (ctx.queue_family_count() == 1) {
+      mode = vk::SharingMode::eExclusive;
+    }
+
     Image img;
     vk::ImageCreateInfo info {};
     info.format = fmt;
@@ -350,6 +358,7 @@ namespace drv {
     info
       .setQueueFamilyIndexCount(ctx.queue_family_count())
       .setPQueueFamilyIndices(ctx.get_queue_indexes())
+      .setSharingMode(mode)
       .setSamples(vk::SampleCountFlagBits::e1)
       .setTiling(vk::ImageTiling::eOptimal)
       //.setFlags(vk::ImageCreateFlagBits::e2DArrayCompatible)
@@ -386,8 +395,7 @@ namespace drv {
     info.setSubresourceRange(range);
     info.setComponents(vk::ComponentMapping{});
     
-    ImageView view {ctx.get_device().createImageView(info), img};
-    return views.create(view);
+    return create_view(ctx, img, info);
   }
 
   ImageViewID ResourceStorage::create_2Darray_mip_view(Context &ctx, const ImageID &img, vk::ImageAspectFlags flags, u32 mip_level) {
@@ -406,8 +414,7 @@ namespace drv {
     info.setSubresourceRange(range);
     info.setComponents(vk::ComponentMapping{});
     
-    ImageView view {ctx.get_device().createImageView(info), img};
-    return views.create(view);
+    return create_view(ctx, img, info);
   }
 
   ImageViewID ResourceStorage::create_2Dlayer_view(Context &ctx, const ImageID &img, const vk::ImageAspectFlags &flags, u32 layer) {
@@ -426,8 +433,7 @@ namespace drv {
     info.setSubresourceRange(range);
     info.setComponents(vk::ComponentMapping{});
     
-    ImageView view {ctx.get_device().createImageView(info), img};
-    return views.create(view);
+    return create_view(ctx, img, info);
   }
 }
 
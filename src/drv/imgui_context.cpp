@@ -54,7 +54,10 @@ namespace drv {
     //ImGui::StyleColorsClassic();
 
     // Setup Platform/Renderer backends
-    ImGui_ImplSDL2_InitForVulkan(ctx.get_window());
+    //headless context has no window, display size is set by new_frame
+    if (ctx.get_window()) {
+      ImGui_ImplSDL2_InitForVulkan(ctx.get_window());
+    }
     ImGui_ImplVulkan_InitInfo init_info = {};
     init_info.Instance = static_cast<VkInstance>(ctx.get_instance());
     init_info.PhysicalDevice = static_cast<VkPhysicalDevice>(ctx.get_physical_device());
@@ -71,12 +74,19 @@ namespace drv {
     ImGui_ImplVulkan_Init(&init_info, static_cast<VkRenderPass>(renderpass));
 
     window = ctx.get_window();
+    extent = ctx.get_swapchain_extent();
 
   }
 
   void ImguiContext::new_frame() {
     ImGui_ImplVulkan_NewFrame();
-    ImGui_ImplSDL2_NewFrame(window);
+    if (window) {
+      ImGui_ImplSDL2_NewFrame(window);
+    } else {
+      auto &io = ImGui::GetIO();
+      io.DisplaySize = ImVec2(f32(extent.width), f32(extent.height));
+      io.DeltaTime = 1.f/60.f;
+    }
     ImGui::NewFrame();
   }
 
@@ -89,12 +99,16 @@ namespace drv {
 
   void ImguiContext::release(Context &ctx) {
     ImGui_ImplVulkan_Shutdown();
-    ImGui_ImplSDL2_Shutdown();
+    if (window) {
+      ImGui_ImplSDL2_Shutdown();
+    }
     ImGui::DestroyContext();
   }
 
   void ImguiContext::process_event(const SDL_Event &event) {
-    ImGui_ImplSDL2_ProcessEvent(&event);
+    if (window) {
+      ImGui_ImplSDL2_ProcessEvent(&event);
+    }
   }
 
   void ImguiContext::create_fonts(Context &ctx, DrawContextPool &ctx_pool) {
@@ -104,10 +118,7 @@ namespace drv {
     cmd.begin(info);
     ImGui_ImplVulkan_CreateFontsTexture(cmd);
     cmd.end();
-    auto fence = ctx_pool.submit_cmd(ctx, cmd);
-
-    ctx.get_device().waitForFences({fence}, VK_TRUE, ~0ul);
-    ctx.get_device().destroyFence(fence);
+    ctx_pool.submit_and_wait(ctx, cmd);
   }
 
 }
\ No newline at end of file
@@ -19,6 +19,8 @@ namespace drv {
   private:
     vk::DescriptorPool pool;
     SDL_Window *window = nullptr;
+    //display size without window
+    vk::Extent2D extent;
   };
 
 
@@ -2,47 +2,257 @@
 
 #include <fstream>
 #include <iostream>
+#include <chrono>
+#include <cstring>
+#include <algorithm>
 
 namespace drv {
-  
+
+  static const u32 PIPELINE_CACHE_MAGIC = 0x50434143; //"CACP"
+
+  //prepended to vkGetPipelineCacheData output
+  struct PipelineCacheHeader {
+    u32 magic;
+    u32 vendor_id;
+    u32 device_id;
+    u32 driver_version;
+    u8 cache_uuid[VK_UUID_SIZE];
+    u64 data_size;
+  };
+
+  static PipelineCacheHeader get_cache_header(Context &ctx) {
+    auto props = ctx.get_physical_device().getProperties();
+    PipelineCacheHeader header {};
+    header.magic = PIPELINE_CACHE_MAGIC;
+    header.vendor_id = props.vendorID;
+    header.device_id = props.deviceID;
+    header.driver_version = props.driverVersion;
+    std::memcpy(header.cache_uuid, props.pipelineCacheUUID.data(), VK_UUID_SIZE);
+    return header;
+  }
+
+  namespace {
+    struct KeyWriter {
+      std::vector<u32> words;
+
+      KeyWriter &add(u32 v) { words.push_back(v); return *this; }
+      KeyWriter &add(i32 v) { return add(u32(v)); }
+      KeyWriter &add(u64 v) { return add(u32(v)).add(u32(v >> 32u)); }
+      KeyWriter &add(f32 v) {
+        u32 bits;
+        std::memcpy(&bits, &v, sizeof(bits));
+        return add(bits);
+      }
+      KeyWriter &add(const std::string &str) {
+        add(u32(str.size()));
+        for (u32 i = 0; i < str.size(); i += 4) {
+          u32 w = 0;
+          std::memcpy(&w, str.data() + i, min<size_t>(4, str.size() - i));
+          add(w);
+        }
+        return *this;
+      }
+      //enums and flags
+      template <typename T>
+      KeyWriter &value(T v) { return add(u32(v)); }
+
+      template <typename Handle>
+      KeyWriter &handle(Handle h) {
+        auto raw = static_cast<typename Handle::CType>(h);
+        u64 bits = 0;
+        std::memcpy(&bits, &raw, sizeof(raw));
+        return add(bits);
+      }
+
+      KeyWriter &add(const vk::AttachmentReference *ref) {
+        return ref? add(ref->attachment).value(ref->layout) : add(~0u);
+      }
+    };
+  }
+
+  static f64 elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<f64, std::milli>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  SpecConstants &SpecConstants::set(u32 id, u32 value) {
+    auto iter = std::lower_bound(ids.begin(), ids.end(), id);
+    auto pos = iter - ids.begin();
+    if (iter != ids.end() && *iter == id) {
+      values[pos] = value;
+    } else {
+      ids.insert(iter, id);
+      values.insert(values.begin() + pos, value);
+    }
+
+    //fnv-1a over (id, value) pairs
+    hash = 14695981039346656037ull;
+    for (u32 i = 0; i < ids.size(); i++) {
+      hash = (hash ^ ids[i]) * 1099511628211ull;
+      hash = (hash ^ values[i]) * 1099511628211ull;
+    }
+    return *this;
+  }
+
+  SpecConstants &SpecConstants::set(u32 id, f32 value) {
+    u32 bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return set(id, bits);
+  }
+
+  SpecConstants &SpecConstants::merge(const SpecConstants &other) {
+    for (u32 i = 0; i < other.ids.size(); i++) {
+      set(other.ids[i], other.values[i]);
+    }
+    return *this;
+  }
+
+  vk::SpecializationInfo SpecConstants::build(std::vector<vk::SpecializationMapEntry> &entries) const {
+    entries.clear();
+    for (u32 i = 0; i < ids.size(); i++) {
+      entries.push_back({ids[i], u32(i * sizeof(u32)), sizeof(u32)});
+    }
+
+    vk::SpecializationInfo info {};
+    info
+      .setMapEntries(entries)
+      .setDataSize(values.size() * sizeof(u32))
+      .setPData(values.data());
+    return info;
+  }
+
+  void PipelineManager::init(Context &ctx, const std::string &path) {
+    cache_path = path;
+    device_handle = ctx.get_device();
+    compiler.init();
+    load_cache(ctx);
+  }
+
+  void PipelineManager::load_cache(Context &ctx) {
+    std::vector<char> data;
+    auto expected = get_cache_header(ctx);
+
+    std::ifstream file(cache_path, std::ios::binary);
+    if (file.is_open()) {
+      PipelineCacheHeader header {};
+      file.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+      bool valid = file.good()
+        && header.magic == expected.magic
+        && header.vendor_id == expected.vendor_id
+        && header.device_id == expected.device_id
+        && header.driver_version == expected.driver_version
+        && !std::memcmp(header.cache_uuid, expected.cache_uuid, VK_UUID_SIZE);
+
+      if (valid) {
+        data.resize(header.data_size);
+        file.read(data.data(), data.size());
+        if (!file.good()) data.clear();
+      } else {
+        std::cout << "Pipeline cache " << cache_path << " is stale, ignored\n";
+      }
+    }
+
+    vk::PipelineCacheCreateInfo info {};
+    if (data.size()) {
+      info.setInitialDataSize(data.size());
+      info.setPInitialData(data.data());
+    }
+
+    pipeline_cache = ctx.get_device().createPipelineCache(info);
+    warm_cache = !data.empty();
+    std::cout << "Pipeline cache: " << (warm_cache? "warm, " : "cold, ") << data.size() << " bytes loaded\n";
+  }
+
+  void PipelineManager::save_cache(Context &ctx) {
+    auto data = ctx.get_device().getPipelineCacheData(pipeline_cache);
+    auto header = get_cache_header(ctx);
+    header.data_size = data.size();
+
+    std::ofstream file(cache_path, std::ios::binary|std::ios::trunc);
+    if (!file.is_open()) {
+      std::cout << "Failed to save pipeline cache to " << cache_path << "\n";
+      return;
+    }
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(data.data()), data.size());
+    std::cout << "Pipeline cache: " << data.size() << " bytes saved\n";
+  }
+
+
   bool PipelineManager::load_shader(Context &ctx, const std::string &name, const std::string &path, vk::ShaderStageFlagBits stages, const std::string &proc) {
+    return load_shader(ctx, name, path, stages, ShaderDefines {}, proc);
+  }
+
+  bool PipelineManager::load_shader(Context &ctx, const std::string &name, const std::string &path, vk::ShaderStageFlagBits stages, const ShaderDefines &defines, const std::string &proc) {
     if (shaders.find(name) != shaders.end()) {
       return false;
     }
   
+    auto res = compiler.load(path, stages, defines);
+    const auto &code = res.code;
+
     ShaderDesc desc;
-    desc.mod = load_shader(ctx, path);
+    desc.mod = create_module(ctx, code);
     desc.path = path;
     desc.proc = proc;
+    desc.defines = defines;
     desc.stages = stages;
+    desc.files = std::move(res.files);
+    desc.write_times = get_write_times(desc.files);
+    desc.hash = hash_code(code);
+    try {
+      desc.reflection = reflect_spirv((const u32*)code.data(), code.size()/sizeof(u32), stages);
+    } catch (const std::runtime_error &e) {
+      ctx.get_device().destroyShaderModule(desc.mod);
+      throw std::runtime_error {"Shader " + path + ": " + e.what()};
+    }
 
     shaders.insert({name, desc});
     return true;
   }
 
-  vk::ShaderModule PipelineManager::load_shader(Context &ctx, const std::string &path) {
-    std::ifstream file(path, std::ios::ate | std::ios::binary);
+  //missing files get default time, so they are seen as changed once they appear
+  PipelineManager::WriteTimes PipelineManager::get_write_times(const std::vector<std::string> &files) {
+    WriteTimes times;
+    for (const auto &f : files) {
+      std::error_code err;
+      auto t = std::filesystem::last_write_time(f, err);
+      times.push_back(err? std::filesystem::file_time_type {} : t);
+    }
+    return times;
+  }
 
-    if (!file.is_open()) {
-      throw std::runtime_error("failed to open file!");
+  //fnv-1a
+  u64 PipelineManager::hash_code(const std::vector<char> &code) {
+    u64 hash = 14695981039346656037ull;
+    for (auto c : code) {
+      hash ^= u8(c);
+      hash *= 1099511628211ull;
     }
-    size_t fileSize = (size_t) file.tellg();
-    std::vector<char> buffer(fileSize);
+    return hash;
+  }
 
-    file.seekg(0);
-    file.read(buffer.data(), fileSize);
-    file.close();
+  vk::ShaderModule PipelineManager::create_module(Context &ctx, const std::vector<char> &code) {
     vk::ShaderModuleCreateInfo info {};
 
-    info.setPCode((u32*)buffer.data());
-    info.setCodeSize(buffer.size());
+    info.setPCode((const u32*)code.data());
+    info.setCodeSize(code.size());
 
     return ctx.get_device().createShaderModule(info);
   }
 
-  vk::Pipeline PipelineManager::create_pipeline(Context &ctx, PipelineManager::PipelineDesc &desc) {
-    bool has_vertex_input = !desc.input.bindings.empty() && !desc.input.attributes.empty();
-    
+  std::vector<PipelineManager::ShaderStage> PipelineManager::get_stages(const std::vector<std::string> &names, const ModuleOverrides &overrides) const {
+    std::vector<ShaderStage> stages;
+    for (const auto &sname : names) {
+      auto &shader = shaders.at(sname);
+      auto iter = overrides.find(sname);
+      auto mod = (iter != overrides.end())? iter->second : shader.mod;
+      stages.push_back({mod, shader.stages, shader.proc});
+    }
+    return stages;
+  }
+  PipelineManager::Compiled PipelineManager::build_pipeline(vk::Device device, vk::PipelineCache cache, PipelineDesc &desc, const std::vector<ShaderStage> &shader_stages, const SpecConstants &constants) {
     vk::PipelineVertexInputStateCreateInfo input {};
     input
       .setVertexAttributeDescriptions(desc.input.attributes)
@@ -57,15 +267,18 @@ namespace drv {
 
     auto dyn_state = desc.build_dyn();
 
+    std::vector<vk::SpecializationMapEntry> entries;
+    auto spec = constants.build(entries);
+
     std::vector<vk::PipelineShaderStageCreateInfo> stages;
     
-    for (const auto& sname : desc.modules) {
-      auto &shader = shaders.at(sname);
+    for (const auto &shader : shader_stages) {
       vk::PipelineShaderStageCreateInfo next {};
       next
         .setModule(shader.mod)
-        .setStage(shader.stages)
-        .setPName(shader.proc.c_str());
+        .setStage(shader.stage)
+        .setPName(shader.proc.c_str())
+        .setPSpecializationInfo(constants.empty()? nullptr : &spec);
 
       stages.push_back(next);
     }
@@ -87,11 +300,47 @@ namespace drv {
       .setPDynamicState(&dyn_state)
       .setPMultisampleState(&ms);
     
-    auto h = ctx.get_device().createGraphicsPipeline(nullptr, p);
-    return h.value;
+    auto start = std::chrono::steady_clock::now();
+    auto h = device.createGraphicsPipeline(cache, p);
+    return {h.value, elapsed_ms(start)};
+  }
+
+  PipelineManager::Compiled PipelineManager::build_compute_pipeline(vk::Device device, vk::PipelineCache cache, const ShaderStage &shader, vk::PipelineLayout layout, const SpecConstants &constants) {
+    std::vector<vk::SpecializationMapEntry> entries;
+    auto spec = constants.build(entries);
+
+    vk::PipelineShaderStageCreateInfo stage {};
+    stage.setStage(shader.stage);
+    stage.setModule(shader.mod);
+    stage.setPName(shader.proc.c_str());
+    stage.setPSpecializationInfo(constants.empty()? nullptr : &spec);
+
+    vk::ComputePipelineCreateInfo info {};
+    info.setStage(stage);
+    info.setLayout(layout);
+    
+    auto start = std::chrono::steady_clock::now();
+    vk::Pipeline handle = device.createComputePipeline(cache, info);
+    return {handle, elapsed_ms(start)};
+  }
+
+  vk::Pipeline PipelineManager::create_pipeline(Context &ctx, PipelineManager::PipelineDesc &desc) {
+    auto res = build_pipeline(ctx.get_device(), pipeline_cache, desc, get_stages(desc.modules), desc.constants);
+    stats.creation_ms += res.ms;
+    stats.created++;
+    return res.handle;
   }
 
   PipelineID PipelineManager::create_pipeline(Context &ctx, const PipelineDescBuilder &info) {
+    stats.requested++;
+    auto key = get_key(info.desc);
+    auto existing = pipeline_keys.find(key);
+    if (existing != pipeline_keys.end()) {
+      pipelines[existing->second].refs++;
+      stats.shared++;
+      return existing->second;
+    }
+
     u32 index = pipelines.size();
     bool push = true;
     if (free_index.size()) {
@@ -107,100 +356,758 @@ namespace drv {
     }
     
     auto &desc = pipelines[index];
-    desc.handle = create_pipeline(ctx, desc);
+    desc.refs = 1;
+    desc.key = key;
+    pipeline_keys[key] = index;
+
+    auto rp = renderpasses.find(desc.renderpass);
+    if (rp != renderpasses.end()) {
+      rp->second.refs++;
+    }
+
+    if (!batch_pool) {
+      desc.handle = create_pipeline(ctx, desc);
+      return index;
+    }
+
+    desc.handle = nullptr;
+    auto device = ctx.get_device();
+    auto cache = pipeline_cache;
+    pending_pipelines[index] = batch_pool->submit([device, cache, desc, stages = get_stages(desc.modules)]() mutable {
+      return build_pipeline(device, cache, desc, stages, desc.constants);
+    });
     return index;
   }
 
+  void PipelineManager::begin_batch(WorkerPool &pool) {
+    batch_pool = &pool;
+  }
+
+  void PipelineManager::end_batch() {
+    batch_pool = nullptr;
+  }
+
+  void PipelineManager::resolve(PipelineID id) {
+    if (pending_pipelines.empty()) return;
+    auto iter = pending_pipelines.find(id);
+    if (iter == pending_pipelines.end()) return;
+
+    auto res = iter->second.get();
+    pipelines[id].handle = res.handle;
+    stats.creation_ms += res.ms;
+    stats.created++;
+    pending_pipelines.erase(iter);
+  }
+
+  void PipelineManager::resolve(ComputePipelineID id) {
+    if (pending_compute.empty()) return;
+    auto iter = pending_compute.find(id);
+    if (iter == pending_compute.end()) return;
+
+    auto res = iter->second.get();
+    compute_pipelines[id].handle = res.handle;
+    stats.creation_ms += res.ms;
+    stats.created++;
+    pending_compute.erase(iter);
+  }
+
+  void PipelineManager::flush() {
+    while (pending_pipelines.size()) {
+      resolve(PipelineID {pending_pipelines.begin()->first});
+    }
+
+    while (pending_compute.size()) {
+      resolve(ComputePipelineID {pending_compute.begin()->first});
+    }
+  }
+
   void PipelineManager::release(Context &ctx) {
+    flush();
+    if (reload) {
+      for (auto &c : reload->compiles) {
+        c.result.wait();
+      }
+      for (auto &job : reload->jobs) {
+        ctx.get_device().destroyPipeline(job.result.get().handle);
+      }
+      for (auto &m : reload->modules) {
+        ctx.get_device().destroyShaderModule(m.second);
+      }
+      reload.reset();
+    }
+
+    for (auto &r : retired) {
+      ctx.get_device().destroyPipeline(r.handle);
+    }
+    retired.clear();
+
+    std::cout << "Pipelines: " << stats.requested << " requested, " << stats.shared << " shared, "
+      << stats.created << " created in " << stats.creation_ms << " ms with " << (warm_cache? "warm" : "cold") << " cache\n";
+
+    save_cache(ctx);
+    ctx.get_device().destroyPipelineCache(pipeline_cache);
+
     for (auto &d : shaders) {
       ctx.get_device().destroyShaderModule(d.second.mod);
     }
 
     for (auto &d : pipelines) {
+      destroy_variants(ctx, d.variants);
+      if (d.handle) ctx.get_device().destroyPipeline(d.handle);
+      if (d.layout && !is_reflected(d.layout)) ctx.get_device().destroyPipelineLayout(d.layout);
+    }
+
+    for (auto &d : compute_pipelines) {
+      destroy_variants(ctx, d.variants);
       if (d.handle) ctx.get_device().destroyPipeline(d.handle);
-      if (d.layout) ctx.get_device().destroyPipelineLayout(d.layout);
+      if (d.layout && !is_reflected(d.layout)) ctx.get_device().destroyPipelineLayout(d.layout);
+    }
+
+    pipelines.clear();
+    compute_pipelines.clear();
+    pipeline_keys.clear();
+    compute_keys.clear();
+
+    //not freed by owners yet
+    for (auto &r : renderpasses) {
+      ctx.get_device().destroyRenderPass(r.first);
+    }
+    renderpasses.clear();
+    renderpass_keys.clear();
+
+    for (auto &l : reflected_layouts) {
+      ctx.get_device().destroyPipelineLayout(l.second.layout);
+    }
+    for (auto &s : reflected_sets) {
+      reflected_storage->free_layout(ctx, s.second);
     }
+    reflected_layouts.clear();
+    reflected_sets.clear();
   }
 
-  void PipelineManager::reload_shaders(Context &ctx) {
-    
-    for (auto &desc : shaders) {
-      desc.second.mod = load_shader(ctx, desc.second.path);
+  const ReflectedLayout &PipelineManager::reflect_layout(Context &ctx, DescriptorStorage &descriptors, const std::vector<std::string> &names) {
+    std::vector<ShaderBinding> bindings;
+    vk::PushConstantRange push {};
+
+    for (const auto &name : names) {
+      auto &shader = shaders.at(name);
+      for (const auto &b : shader.reflection.bindings) {
+        auto iter = std::find_if(bindings.begin(), bindings.end(), [&](const ShaderBinding &elem){
+          return elem.set == b.set && elem.binding == b.binding;
+        });
+
+        if (iter == bindings.end()) {
+          bindings.push_back(b);
+          continue;
+        }
+
+        if (iter->type != b.type || iter->count != b.count) {
+          throw std::runtime_error {"Shader " + name + ": set " + std::to_string(b.set) + " binding " 
+            + std::to_string(b.binding) + " is declared differently in other stages"};
+        }
+        iter->stages |= b.stages;
+      }
+
+      if (shader.reflection.push_constants_size) {
+        push.size = max(push.size, shader.reflection.push_constants_size);
+        push.stageFlags |= shader.stages;
+      }
+    }
+
+    std::sort(bindings.begin(), bindings.end(), [](const ShaderBinding &a, const ShaderBinding &b){
+      return (a.set != b.set)? a.set < b.set : a.binding < b.binding;
+    });
+
+    std::vector<u32> key {push.size, u32(VkShaderStageFlags(push.stageFlags))};
+    for (const auto &b : bindings) {
+      key.insert(key.end(), {b.set, b.binding, u32(b.type), b.count, u32(VkShaderStageFlags(b.stages))});
+    }
+
+    auto cached = reflected_layouts.find(key);
+    if (cached != reflected_layouts.end()) {
+      return cached->second;
+    }
+
+    if (reflected_storage && reflected_storage != &descriptors) {
+      throw std::runtime_error {"Reflected layouts must use one DescriptorStorage"};
+    }
+    reflected_storage = &descriptors;
+
+    ReflectedLayout result {};
+    result.bindings = bindings;
+    result.push_constants = push;
+
+    //sets without bindings get an empty layout
+    u32 sets_count = bindings.size()? bindings.back().set + 1 : 0;
+    std::vector<vk::DescriptorSetLayout> set_layouts;
+
+    for (u32 set = 0; set < sets_count; set++) {
+      std::vector<BindingKey> set_key;
+      std::vector<vk::DescriptorSetLayoutBinding> set_bindings;
+
+      for (const auto &b : bindings) {
+        if (b.set != set) continue;
+        set_key.push_back({b.set, b.binding, u32(b.type), b.count, u32(VkShaderStageFlags(b.stages))});
+        set_bindings.push_back({b.binding, b.type, b.count, b.stages});
+      }
+
+      auto iter = reflected_sets.find(set_key);
+      if (iter == reflected_sets.end()) {
+        vk::DescriptorSetLayoutCreateInfo info {};
+        info.setBindings(set_bindings);
+        iter = reflected_sets.insert({set_key, descriptors.create_layout(ctx, info, REFLECTED_POOL_SETS)}).first;
+      }
+
+      result.sets.push_back(iter->second);
+      set_layouts.push_back(descriptors.get(iter->second));
+    }
+
+    vk::PipelineLayoutCreateInfo info {};
+    info.setSetLayouts(set_layouts);
+    if (push.size) {
+      info.setPushConstantRangeCount(1);
+      info.setPPushConstantRanges(&push);
+    }
+
+    result.layout = ctx.get_device().createPipelineLayout(info);
+    return reflected_layouts.insert({key, result}).first->second;
+  }
+
+  bool PipelineManager::is_reflected(vk::PipelineLayout layout) const {
+    for (const auto &l : reflected_layouts) {
+      if (l.second.layout == layout) return true;
+    }
+    return false;
+  }
+
+  bool PipelineManager::start_reload(Context &ctx, WorkerPool &pool) {
+    if (reload) {
+      std::cout << "Shader reload is already in progress\n";
+      return false;
+    }
+
+    auto next = std::make_unique<Reload>();
+    next->start = std::chrono::steady_clock::now();
+    next->pool = &pool;
+
+    //timestamps filter untouched shaders, compiler cache makes the rest cheap
+    for (auto &elem : shaders) {
+      auto &desc = elem.second;
+      auto times = get_write_times(desc.files);
+      if (times == desc.write_times) continue;
+
+      desc.write_times = times;
+      auto job = pool.submit([this, path = desc.path, stages = desc.stages, defines = desc.defines](){
+        return compiler.load(path, stages, defines);
+      });
+      next->compiles.push_back({elem.first, std::move(job)});
+    }
+
+    if (next->compiles.empty()) {
+      std::cout << "Shaders are up to date\n";
+      return false;
+    }
+
+    reload = std::move(next);
+    return true;
+  }
+
+  //all compiles are finished, hash filters sources saved without changes
+  void PipelineManager::start_rebuild(Context &ctx) {
+    auto &next = reload;
+    for (auto &c : next->compiles) {
+      auto &desc = shaders.at(c.shader);
+      CompiledShader res;
+      try {
+        res = c.result.get();
+      } catch (const std::runtime_error &e) {
+        std::cout << "Shader " << desc.path << ": " << e.what() << "\n";
+        continue;
+      }
+
+      //includes could be added or removed
+      if (res.files != desc.files) {
+        desc.files = res.files;
+        desc.write_times = get_write_times(desc.files);
+      }
+
+      auto &code = res.code;
+      auto hash = hash_code(code);
+      if (hash == desc.hash) continue;
+
+      //layouts are already built for the old interface
+      ShaderInterface reflection;
+      try {
+        reflection = reflect_spirv((const u32*)code.data(), code.size()/sizeof(u32), desc.stages);
+      } catch (const std::runtime_error &e) {
+        std::cout << "Shader " << desc.path << ": " << e.what() << "\n";
+        continue;
+      }
+
+      if (reflection != desc.reflection) {
+        std::cout << "Shader " << desc.path << " changed its bindings, restart to apply it\n";
+        continue;
+      }
+
+      desc.hash = hash;
+      next->modules[c.shader] = create_module(ctx, code);
+    }
+    next->compiles.clear();
+
+    if (next->modules.empty()) {
+      std::cout << "Shaders are up to date\n";
+      reload.reset();
+      return;
     }
 
-    for (auto &p : pipelines) {
-      if (p.handle && p.layout) {
-        ctx.get_device().destroyPipeline(p.handle);
-        p.handle = create_pipeline(ctx, p);
+    flush();
+    auto &pool = *next->pool;
+    auto device = ctx.get_device();
+    auto cache = pipeline_cache;
+    auto &modules = next->modules;
+    auto changed = [&](const std::string &name) { return modules.count(name) != 0; };
+
+    for (u32 i = 0; i < pipelines.size(); i++) {
+      auto &p = pipelines[i];
+      if (!p.handle || !p.layout) continue;
+      if (std::none_of(p.modules.begin(), p.modules.end(), changed)) continue;
+
+      auto stages = get_stages(p.modules, modules);
+      auto job = pool.submit([device, cache, desc = p, stages]() mutable {
+        return build_pipeline(device, cache, desc, stages, desc.constants);
+      });
+      next->jobs.push_back({i, false, false, 0, p.handle, std::move(job)});
+
+      for (auto &v : p.variants) {
+        if (!v.second.handle) continue;
+        auto constants = p.constants;
+        constants.merge(v.second.constants);
+        auto job = pool.submit([device, cache, desc = p, stages, constants]() mutable {
+          return build_pipeline(device, cache, desc, stages, constants);
+        });
+        next->jobs.push_back({i, false, true, v.first, v.second.handle, std::move(job)});
       }
     }
 
-    for (auto &p : compute_pipelines) {
-      if (p.handle && p.layout) {
-        ctx.get_device().destroyPipeline(p.handle);
-        p.handle = create_pipeline(ctx, p.module, p.layout);
+    for (u32 i = 0; i < compute_pipelines.size(); i++) {
+      auto &p = compute_pipelines[i];
+      if (!p.handle || !p.layout || !changed(p.module)) continue;
+
+      auto stage = get_stages({p.module}, modules).at(0);
+      auto job = pool.submit([device, cache, layout = p.layout, stage, constants = p.constants](){
+        return build_compute_pipeline(device, cache, stage, layout, constants);
+      });
+      next->jobs.push_back({i, true, false, 0, p.handle, std::move(job)});
+
+      for (auto &v : p.variants) {
+        if (!v.second.handle) continue;
+        auto constants = p.constants;
+        constants.merge(v.second.constants);
+        auto job = pool.submit([device, cache, layout = p.layout, stage, constants](){
+          return build_compute_pipeline(device, cache, stage, layout, constants);
+        });
+        next->jobs.push_back({i, true, true, v.first, v.second.handle, std::move(job)});
       }
     }
+
+    std::cout << "Reloading " << modules.size() << " shaders, " << next->jobs.size() << " pipelines\n";
   }
 
-  void PipelineManager::free_pipeline(Context &ctx, PipelineID id) {
-    ctx.get_device().destroyPipeline(pipelines[id].handle);
-    ctx.get_device().destroyPipelineLayout(pipelines[id].layout);
+  void PipelineManager::next_frame(Context &ctx, u64 frame, u64 completed_frame) {
+    frame_index = frame;
 
-    pipelines[id].handle = nullptr;
-    pipelines[id].layout = nullptr;
+    u32 destroyed = 0;
+    for (auto &r : retired) {
+      if (r.frame > completed_frame) break;
+      ctx.get_device().destroyPipeline(r.handle);
+      destroyed++;
+    }
+    retired.erase(retired.begin(), retired.begin() + destroyed);
 
-    free_index.push_back(id);
+    if (!reload) return;
+    if (reload->compiles.size()) {
+      for (auto &c : reload->compiles) {
+        if (c.result.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+          return;
+        }
+      }
+      start_rebuild(ctx);
+      //pipeline jobs are checked on the next frames
+      return;
+    }
+
+    for (auto &job : reload->jobs) {
+      if (job.result.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        return;
+      }
+    }
+    apply_reload(ctx);
   }
 
-  vk::Pipeline PipelineManager::create_pipeline(Context &ctx, const std::string &shader_name, vk::PipelineLayout layout) {
-    auto &shader = shaders.at(shader_name);
+  //all jobs are finished, the current frame is not recorded yet
+  void PipelineManager::apply_reload(Context &ctx) {
+    //batch pipelines could be created with old modules
+    flush();
 
-    vk::PipelineShaderStageCreateInfo stage {};
-    stage.setStage(shader.stages);
-    stage.setModule(shader.mod);
-    stage.setPName(shader.proc.c_str());
+    for (auto &job : reload->jobs) {
+      auto res = job.result.get();
+      stats.creation_ms += res.ms;
+      stats.created++;
 
-    vk::ComputePipelineCreateInfo info {};
-    info.setStage(stage);
-    info.setLayout(layout);
-    
-    return ctx.get_device().createComputePipeline(nullptr, info);
+      vk::Pipeline *handle = job.compute? &compute_pipelines[job.index].handle : &pipelines[job.index].handle;
+      if (job.variant) {
+        auto &variants = job.compute? compute_pipelines[job.index].variants : pipelines[job.index].variants;
+        auto iter = variants.find(job.variant_key);
+        handle = (iter != variants.end())? &iter->second.handle : nullptr;
+      }
+
+      //pipeline was freed or replaced while being rebuilt
+      if (!handle || *handle != job.old_handle) {
+        ctx.get_device().destroyPipeline(res.handle);
+        continue;
+      }
+      //old handle could be used by frames up to the previous one
+      retired.push_back({*handle, frame_index - 1});
+      *handle = res.handle;
+    }
+
+    //modules are not needed by created pipelines
+    for (auto &m : reload->modules) {
+      auto &desc = shaders.at(m.first);
+      ctx.get_device().destroyShaderModule(desc.mod);
+      desc.mod = m.second;
+    }
+
+    std::cout << "Shaders reloaded in " << elapsed_ms(reload->start) << " ms\n";
+    reload.reset();
+  }
+
+  PipelineManager::Variant *PipelineManager::find_variant(VariantMap &variants, const SpecConstants &variant) {
+    auto iter = variants.find(variant.key());
+    if (iter == variants.end()) {
+      return nullptr;
+    }
+    if (iter->second.constants != variant) {
+      throw std::runtime_error {"Specialization constants key collision"};
+    }
+    return &iter->second;
+  }
+
+  void PipelineManager::destroy_variants(Context &ctx, VariantMap &variants) {
+    for (auto &v : variants) {
+      if (v.second.handle) ctx.get_device().destroyPipeline(v.second.handle);
+    }
+    variants.clear();
+  }
+
+  vk::Pipeline PipelineManager::get(PipelineID id, const SpecConstants &variant) {
+    resolve(id);
+    auto &desc = pipelines[id];
+    if (variant.empty()) {
+      return desc.handle;
+    }
+
+    if (auto v = find_variant(desc.variants, variant)) {
+      return v->handle? v->handle : desc.handle;
+    }
+
+    auto constants = desc.constants;
+    constants.merge(variant);
+
+    vk::Pipeline handle = nullptr;
+    if (constants != desc.constants) {
+      //pending reload modules are used, so the variant isn't left with old code after swap
+      auto stages = get_stages(desc.modules, reload? reload->modules : ModuleOverrides {});
+      auto res = build_pipeline(device_handle, pipeline_cache, desc, stages, constants);
+      stats.creation_ms += res.ms;
+      stats.created++;
+      handle = res.handle;
+    }
+
+    desc.variants.insert({variant.key(), Variant {variant, handle}});
+    return handle? handle : desc.handle;
+  }
+
+  vk::Pipeline PipelineManager::get(ComputePipelineID id, const SpecConstants &variant) {
+    resolve(id);
+    auto &desc = compute_pipelines[id];
+    if (variant.empty()) {
+      return desc.handle;
+    }
+
+    if (auto v = find_variant(desc.variants, variant)) {
+      return v->handle? v->handle : desc.handle;
+    }
+
+    auto constants = desc.constants;
+    constants.merge(variant);
+
+    vk::Pipeline handle = nullptr;
+    if (constants != desc.constants) {
+      auto stage = get_stages({desc.module}, reload? reload->modules : ModuleOverrides {}).at(0);
+      auto res = build_compute_pipeline(device_handle, pipeline_cache, stage, desc.layout, constants);
+      stats.creation_ms += res.ms;
+      stats.created++;
+      handle = res.handle;
+    }
+
+    desc.variants.insert({variant.key(), Variant {variant, handle}});
+    return handle? handle : desc.handle;
+  }
+
+  void PipelineManager::free_pipeline(Context &ctx, PipelineID id) {
+    resolve(id);
+    auto &desc = pipelines[id];
+    if (!desc.refs) {
+      throw std::runtime_error {"Attempt to double-free pipeline"};
+    }
+    if (--desc.refs) {
+      return;
+    }
+
+    pipeline_keys.erase(desc.key);
+    destroy_variants(ctx, desc.variants);
+    ctx.get_device().destroyPipeline(desc.handle);
+    if (!is_reflected(desc.layout)) {
+      ctx.get_device().destroyPipelineLayout(desc.layout);
+    }
+    if (renderpasses.count(desc.renderpass)) {
+      free_renderpass(ctx, desc.renderpass);
+    }
+
+    desc.handle = nullptr;
+    desc.layout = nullptr;
+    desc.key.clear();
+
+    free_index.push_back(id);
+  }
+
+  vk::Pipeline PipelineManager::create_pipeline(Context &ctx, const std::string &shader_name, vk::PipelineLayout layout, const SpecConstants &constants) {
+    auto res = build_compute_pipeline(ctx.get_device(), pipeline_cache, get_stages({shader_name}).at(0), layout, constants);
+    stats.creation_ms += res.ms;
+    stats.created++;
+    return res.handle;
   }
 
-  ComputePipelineID PipelineManager::create_compute_pipeline(Context &ctx, const std::string &shader_name, vk::PipelineLayout layout) {
+  ComputePipelineID PipelineManager::create_compute_pipeline(Context &ctx, const std::string &shader_name, vk::PipelineLayout layout, const SpecConstants &constants) {
+    stats.requested++;
+    auto key = get_key(shader_name, layout, constants);
+    auto existing = compute_keys.find(key);
+    if (existing != compute_keys.end()) {
+      compute_pipelines[existing->second].refs++;
+      stats.shared++;
+      return existing->second;
+    }
+
     ComputePipeline pipe {};
     pipe.module = shader_name;
     pipe.layout = layout;
+    pipe.constants = constants;
+    pipe.refs = 1;
+    pipe.key = key;
     
-    pipe.handle = create_pipeline(ctx, shader_name, layout);
+    if (!batch_pool) {
+      pipe.handle = create_pipeline(ctx, shader_name, layout, constants);
+    }
 
+    u32 index = compute_pipelines.size();
     u32 size = compute_pipeline_free_index.size(); 
 
     if (size) {
-      u32 ix = compute_pipeline_free_index[size - 1];
+      index = compute_pipeline_free_index[size - 1];
       compute_pipeline_free_index.pop_back();
-
-      compute_pipelines[ix] = pipe;
-      return ix;
+      compute_pipelines[index] = pipe;
+    } else {
+      compute_pipelines.push_back(pipe);
     }
+    compute_keys[key] = index;
 
-    compute_pipelines.push_back(pipe);
-    return compute_pipelines.size() - 1;
+    if (batch_pool) {
+      auto device = ctx.get_device();
+      auto cache = pipeline_cache;
+      pending_compute[index] = batch_pool->submit([device, cache, layout, constants, stage = get_stages({shader_name}).at(0)](){
+        return build_compute_pipeline(device, cache, stage, layout, constants);
+      });
+    }
+    return index;
   }
 
   void PipelineManager::free_pipeline(Context &ctx, ComputePipelineID id) {
+    resolve(id);
     auto &desc = compute_pipelines[id];
     
-    if (!desc.layout || !desc.handle) {
+    if (!desc.refs) {
       throw std::runtime_error {"Attempt to double-free compute pipeline"};
     }
+    if (--desc.refs) {
+      return;
+    }
 
+    compute_keys.erase(desc.key);
+    destroy_variants(ctx, desc.variants);
     ctx.get_device().destroyPipeline(desc.handle);
-    ctx.get_device().destroyPipelineLayout(desc.layout);
+    if (!is_reflected(desc.layout)) {
+      ctx.get_device().destroyPipelineLayout(desc.layout);
+    }
 
     desc.handle = nullptr;
     desc.layout = nullptr;
+    desc.key.clear();
     compute_pipeline_free_index.push_back(id);
   }
+
+  vk::RenderPass PipelineManager::create_renderpass(Context &ctx, const vk::RenderPassCreateInfo &info) {
+    auto key = get_key(info);
+    auto existing = renderpass_keys.find(key);
+    if (existing != renderpass_keys.end()) {
+      renderpasses.at(existing->second).refs++;
+      return existing->second;
+    }
+
+    auto renderpass = ctx.get_device().createRenderPass(info);
+    renderpass_keys[key] = renderpass;
+    renderpasses[renderpass] = SharedRenderPass {key, 1};
+    return renderpass;
+  }
+
+  void PipelineManager::free_renderpass(Context &ctx, vk::RenderPass renderpass) {
+    auto iter = renderpasses.find(renderpass);
+    if (iter == renderpasses.end()) {
+      throw std::runtime_error {"Attempt to free unknown render pass"};
+    }
+    if (--iter->second.refs) {
+      return;
+    }
+
+    renderpass_keys.erase(iter->second.key);
+    ctx.get_device().destroyRenderPass(renderpass);
+    renderpasses.erase(iter);
+  }
+
+  //fnv-1a
+  size_t PipelineManager::StateKeyHash::operator()(const StateKey &key) const {
+    u64 hash = 14695981039346656037ull;
+    for (auto w : key) {
+      hash = (hash ^ w) * 1099511628211ull;
+    }
+    return size_t(hash);
+  }
+
+  static void write_constants(KeyWriter &w, const SpecConstants &constants) {
+    w.add(u32(constants.get_ids().size()));
+    for (u32 i = 0; i < constants.get_ids().size(); i++) {
+      w.add(constants.get_ids()[i]).add(constants.get_values()[i]);
+    }
+  }
+
+  //shaders are written by name, so keys stay valid after reload
+  PipelineManager::StateKey PipelineManager::get_key(const PipelineDesc &desc) {
+    KeyWriter w;
+    w.add(u32(desc.modules.size()));
+    for (const auto &m : desc.modules) {
+      w.add(m);
+    }
+    write_constants(w, desc.constants);
+
+    w.add(u32(desc.input.bindings.size()));
+    for (const auto &b : desc.input.bindings) {
+      w.add(b.binding).add(b.stride).value(b.inputRate);
+    }
+    w.add(u32(desc.input.attributes.size()));
+    for (const auto &a : desc.input.attributes) {
+      w.add(a.location).add(a.binding).value(a.format).add(a.offset);
+    }
+
+    w.value(desc.assembly.topology).add(desc.assembly.primitiveRestartEnable);
+
+    w.add(u32(desc.viewports.size()));
+    for (const auto &vp : desc.viewports) {
+      w.add(vp.x).add(vp.y).add(vp.width).add(vp.height).add(vp.minDepth).add(vp.maxDepth);
+    }
+    w.add(u32(desc.scissors.size()));
+    for (const auto &sc : desc.scissors) {
+      w.add(sc.offset.x).add(sc.offset.y).add(sc.extent.width).add(sc.extent.height);
+    }
+
+    const auto &r = desc.raster;
+    w.add(r.depthClampEnable).add(r.rasterizerDiscardEnable).value(r.polygonMode).value(r.cullMode).value(r.frontFace)
+      .add(r.depthBiasEnable).add(r.depthBiasConstantFactor).add(r.depthBiasClamp).add(r.depthBiasSlopeFactor).add(r.lineWidth);
+
+    const auto &d = desc.depth_state;
+    w.add(d.depthTestEnable).add(d.depthWriteEnable).value(d.depthCompareOp).add(d.depthBoundsTestEnable)
+      .add(d.stencilTestEnable).add(d.minDepthBounds).add(d.maxDepthBounds);
+    for (const auto &op : {d.front, d.back}) {
+      w.value(op.failOp).value(op.passOp).value(op.depthFailOp).value(op.compareOp).add(op.compareMask).add(op.writeMask).add(op.reference);
+    }
+
+    const auto &b = desc.blend_state;
+    w.add(b.info.logicOpEnable);
+    for (auto c : b.info.blendConstants) {
+      w.add(c);
+    }
+    w.add(u32(b.attachmens.size()));
+    for (const auto &a : b.attachmens) {
+      w.add(a.blendEnable).value(a.srcColorBlendFactor).value(a.dstColorBlendFactor).value(a.colorBlendOp)
+        .value(a.srcAlphaBlendFactor).value(a.dstAlphaBlendFactor).value(a.alphaBlendOp).value(a.colorWriteMask);
+    }
+
+    w.add(u32(desc.dynamic_states.size()));
+    for (auto state : desc.dynamic_states) {
+      w.value(state);
+    }
+
+    w.handle(desc.layout).handle(desc.renderpass).add(desc.subpass);
+    return std::move(w.words);
+  }
+
+  PipelineManager::StateKey PipelineManager::get_key(const std::string &shader, vk::PipelineLayout layout, const SpecConstants &constants) {
+    KeyWriter w;
+    w.add(shader).handle(layout);
+    write_constants(w, constants);
+    return std::move(w.words);
+  }
+
+  PipelineManager::StateKey PipelineManager::get_key(const vk::RenderPassCreateInfo &info) {
+    KeyWriter w;
+    //extensions are not compared, such passes are never shared
+    if (info.pNext) {
+      static u32 unique = 0;
+      return std::move(w.add(~0u).add(unique++).words);
+    }
+
+    w.value(info.flags).add(info.attachmentCount);
+    for (u32 i = 0; i < info.attachmentCount; i++) {
+      const auto &a = info.pAttachments[i];
+      w.value(a.flags).value(a.format).value(a.samples).value(a.loadOp).value(a.storeOp)
+        .value(a.stencilLoadOp).value(a.stencilStoreOp).value(a.initialLayout).value(a.finalLayout);
+    }
+
+    w.add(info.subpassCount);
+    for (u32 i = 0; i < info.subpassCount; i++) {
+      const auto &s = info.pSubpasses[i];
+      w.value(s.flags).value(s.pipelineBindPoint);
+      w.add(s.inputAttachmentCount);
+      for (u32 j = 0; j < s.inputAttachmentCount; j++) {
+        w.add(s.pInputAttachments + j);
+      }
+      w.add(s.colorAttachmentCount);
+      for (u32 j = 0; j < s.colorAttachmentCount; j++) {
+        w.add(s.pColorAttachments + j);
+        w.add(s.pResolveAttachments? s.pResolveAttachments + j : nullptr);
+      }
+      w.add(s.pDepthStencilAttachment);
+      w.add(s.preserveAttachmentCount);
+      for (u32 j = 0; j < s.preserveAttachmentCount; j++) {
+        w.add(s.pPreserveAttachments[j]);
+      }
+    }
+
+    w.add(info.dependencyCount);
+    for (u32 i = 0; i < info.dependencyCount; i++) {
+      const auto &d = info.pDependencies[i];
+      w.add(d.srcSubpass).add(d.dstSubpass).value(d.srcStageMask).value(d.dstStageMask)
+        .value(d.srcAccessMask).value(d.dstAccessMask).value(d.dependencyFlags);
+    }
+    return std::move(w.words);
+  }
 }
\ No newline at end of file
@@ -3,9 +3,19 @@
 
 #include "common.hpp"
 #include "context.hpp"
+#include "worker_pool.hpp"
+#include "descriptors.hpp"
+#include "shader_reflection.hpp"
+#include "shader_compiler.hpp"
 
 #include <string>
 #include <map>
+#include <array>
+#include <unordered_map>
+#include <future>
+#include <memory>
+#include <chrono>
+#include <filesystem>
 
 namespace drv {
 
@@ -27,6 +37,35 @@ namespace drv {
     std::vector<vk::DescriptorSetLayoutBinding> bindings;
   };
 
+  //Specialization constants, applied to every stage of a pipeline. Each value is 4 bytes,
+  //ids missing in a shader module are ignored by vulkan
+  struct SpecConstants {
+    using Self = SpecConstants&;
+
+    Self set(u32 id, u32 value);
+    Self set(u32 id, i32 value) { return set(id, u32(value)); }
+    Self set(u32 id, f32 value);
+    Self set(u32 id, bool value) { return set(id, u32(value? VK_TRUE : VK_FALSE)); }
+    //values from other replace values of this
+    Self merge(const SpecConstants &other);
+
+    bool empty() const { return ids.empty(); }
+    const std::vector<u32> &get_ids() const { return ids; }
+    const std::vector<u32> &get_values() const { return values; }
+    //permutation key
+    u64 key() const { return hash; }
+    //entries and this object must outlive the returned info
+    vk::SpecializationInfo build(std::vector<vk::SpecializationMapEntry> &entries) const;
+
+    bool operator==(const SpecConstants &o) const { return ids == o.ids && values == o.values; }
+    bool operator!=(const SpecConstants &o) const { return !(*this == o); }
+
+  private:
+    std::vector<u32> ids; //sorted
+    std::vector<u32> values;
+    u64 hash = 0;
+  };
+
   struct PipelineID {
     PipelineID() {}
     PipelineID(u32 i) : index {i} {};
@@ -45,42 +84,186 @@ namespace drv {
 
   struct PipelineDescBuilder;
 
-  struct PipelineManager {
-    bool load_shader(Context &ctx, const std::string &name, const std::string &path, vk::ShaderStageFlagBits stages, const std::string &proc = "main");    
-    void reload_shaders(Context &ctx);
+  //descriptor set and pipeline layouts derived from shader modules
+  struct ReflectedLayout {
+    vk::PipelineLayout layout;
+    std::vector<DescriptorSetLayoutID> sets; //indexed by set number
+    std::vector<ShaderBinding> bindings;
+    vk::PushConstantRange push_constants; //size is 0 without push constants
+  };
 
+  struct PipelineStats {
+    u32 requested = 0; //create_pipeline and create_compute_pipeline calls
+    u32 shared = 0; //requests served by an existing pipeline
+    u32 created = 0; //vkCreate*Pipelines calls, variants and reloads included
+    f64 creation_ms = 0.0;
+  };
+
+  struct PipelineManager {
+    //creates pipeline cache, contents of cache_path are used if they were saved for the same device and driver
+    void init(Context &ctx, const std::string &cache_path = "pipeline_cache.bin");
+
+    //path is glsl source or spirv. Sources are compiled with ShaderCompiler, defines make a permutation of one source
+    bool load_shader(Context &ctx, const std::string &name, const std::string &path, vk::ShaderStageFlagBits stages, const std::string &proc = "main");
+    bool load_shader(Context &ctx, const std::string &name, const std::string &path, vk::ShaderStageFlagBits stages, const ShaderDefines &defines, const std::string &proc = "main");
+    //fills shader cache on the pool before load_shader calls
+    void prebuild_shaders(WorkerPool &pool, const std::string &dir) { compiler.prebuild(pool, dir); }
+    
+    //Recompiles shaders whose source or includes changed, then rebuilds dependent pipelines on the pool.
+    //Returns false if nothing changed or reload is already running
+    bool start_reload(Context &ctx, WorkerPool &pool);
+    //Call at frame boundary before recording. Advances reload and destroys pipelines retired before completed_frame
+    void next_frame(Context &ctx, u64 frame_index, u64 completed_frame);
+    bool reload_in_progress() const { return bool(reload); }
+
+    const ShaderInterface &get_interface(const std::string &shader) const { return shaders.at(shader).reflection; }
+    //Layouts for pipelines with the given shaders. Each distinct interface gets one pipeline layout,
+    //identical sets share descriptor set layout. Throws if stages declare a binding differently.
+    //Layouts are owned by the manager, free_pipeline doesn't destroy them
+    const ReflectedLayout &reflect_layout(Context &ctx, DescriptorStorage &descriptors, const std::vector<std::string> &shaders);
+
+    //Requests with identical state, shaders, layout and render pass return the same refcounted id,
+    //each create call needs its own free_pipeline
     PipelineID create_pipeline(Context &ctx, const PipelineDescBuilder &info);
     void free_pipeline(Context &ctx, PipelineID id);
 
-    ComputePipelineID create_compute_pipeline(Context &ctx, const std::string &shader_name, vk::PipelineLayout layout);
+    ComputePipelineID create_compute_pipeline(Context &ctx, const std::string &shader_name, vk::PipelineLayout layout, const SpecConstants &constants = {});
     void free_pipeline(Context &ctx, ComputePipelineID id);
 
-    vk::Pipeline &get(PipelineID id) { return pipelines[id].handle; }
+    //Render passes with equal create info are shared, so pipelines made for them can be shared too.
+    //Pipelines keep their render pass alive for rebuilds on reload
+    vk::RenderPass create_renderpass(Context &ctx, const vk::RenderPassCreateInfo &info);
+    void free_renderpass(Context &ctx, vk::RenderPass renderpass);
+
+    const PipelineStats &get_stats() const { return stats; }
+
+    //Pipelines created between begin_batch and end_batch are compiled on the pool.
+    //Their ids are valid at once, get() waits for the compilation of the requested pipeline
+    void begin_batch(WorkerPool &pool);
+    void end_batch();
+    //waits for every pipeline in flight
+    void flush();
+
+    vk::Pipeline &get(PipelineID id) { resolve(id); return pipelines[id].handle; }
     vk::PipelineLayout &get_layout(PipelineID id) { return pipelines[id].layout; }
 
+    //const getters don't wait, pipeline must be resolved already
     const vk::Pipeline &get(PipelineID id) const { return pipelines[id].handle; }
     const vk::PipelineLayout &get_layout(PipelineID id) const { return pipelines[id].layout; }
 
-    vk::Pipeline &get(ComputePipelineID id) { return compute_pipelines[id].handle; }
+    vk::Pipeline &get(ComputePipelineID id) { resolve(id); return compute_pipelines[id].handle; }
     vk::PipelineLayout &get_layout(ComputePipelineID id) { return compute_pipelines[id].layout; }
 
     const vk::Pipeline &get(ComputePipelineID id) const { return compute_pipelines[id].handle; }
     const vk::PipelineLayout &get_layout(ComputePipelineID id) const { return compute_pipelines[id].layout; }
 
+    //Variant of the pipeline with constants replaced by values from variant.
+    //Compiled on first request and cached by variant.key()
+    vk::Pipeline get(PipelineID id, const SpecConstants &variant);
+    vk::Pipeline get(ComputePipelineID id, const SpecConstants &variant);
+
+    //saves pipeline cache to disk
     void release(Context &ctx);
 
   private:
     struct PipelineDesc;
 
-    vk::ShaderModule load_shader(Context &ctx, const std::string &path);
+    void load_cache(Context &ctx);
+    void save_cache(Context &ctx);
+
+    //everything a worker needs from the shader table, copied so load_shader may run concurrently
+    struct ShaderStage {
+      vk::ShaderModule mod;
+      vk::ShaderStageFlagBits stage;
+      std::string proc;
+    };
+
+    struct Compiled {
+      vk::Pipeline handle;
+      f64 ms;
+    };
+
+    static u64 hash_code(const std::vector<char> &code);
+    vk::ShaderModule create_module(Context &ctx, const std::vector<char> &code);
+    void start_rebuild(Context &ctx);
+    void apply_reload(Context &ctx);
+    bool is_reflected(vk::PipelineLayout layout) const;
     vk::Pipeline create_pipeline(Context &ctx, PipelineDesc &desc);
-    vk::Pipeline create_pipeline(Context &ctx, const std::string &shader_name, vk::PipelineLayout layout);
+    vk::Pipeline create_pipeline(Context &ctx, const std::string &shader_name, vk::PipelineLayout layout, const SpecConstants &constants);
+
+    using ModuleOverrides = std::map<std::string, vk::ShaderModule>;
+    std::vector<ShaderStage> get_stages(const std::vector<std::string> &names, const ModuleOverrides &overrides = {}) const;
+    static Compiled build_pipeline(vk::Device device, vk::PipelineCache cache, PipelineDesc &desc, const std::vector<ShaderStage> &stages, const SpecConstants &constants);
+    static Compiled build_compute_pipeline(vk::Device device, vk::PipelineCache cache, const ShaderStage &stage, vk::PipelineLayout layout, const SpecConstants &constants);
+
+    void resolve(PipelineID id);
+    void resolve(ComputePipelineID id);
+
+    //exact state of a pipeline or render pass, written as plain words
+    using StateKey = std::vector<u32>;
+    struct StateKeyHash {
+      size_t operator()(const StateKey &key) const;
+    };
+
+    static StateKey get_key(const PipelineDesc &desc);
+    static StateKey get_key(const std::string &shader, vk::PipelineLayout layout, const SpecConstants &constants);
+    static StateKey get_key(const vk::RenderPassCreateInfo &info);
+
+    struct SharedRenderPass {
+      StateKey key;
+      u32 refs;
+    };
+
+    using WriteTimes = std::vector<std::filesystem::file_time_type>;
+    static WriteTimes get_write_times(const std::vector<std::string> &files);
 
     struct ShaderDesc {
       std::string path;
       std::string proc;
+      ShaderDefines defines;
       vk::ShaderStageFlagBits stages;
       vk::ShaderModule mod;
+      //source and includes, used to find changed files on reload
+      std::vector<std::string> files;
+      WriteTimes write_times;
+      u64 hash;
+      ShaderInterface reflection;
+    };
+
+    //null handle means that variant matches base constants
+    struct Variant {
+      SpecConstants constants;
+      vk::Pipeline handle;
+    };
+
+    using VariantMap = std::unordered_map<u64, Variant>;
+
+    struct ReloadJob {
+      u32 index;
+      bool compute;
+      bool variant;
+      u64 variant_key;
+      vk::Pipeline old_handle;
+      std::future<Compiled> result;
+    };
+
+    struct ReloadCompile {
+      std::string shader;
+      std::future<CompiledShader> result;
+    };
+
+    //compiles run first, pipeline jobs are submitted once every compile is done
+    struct Reload {
+      WorkerPool *pool;
+      std::vector<ReloadCompile> compiles;
+      ModuleOverrides modules;
+      std::vector<ReloadJob> jobs;
+      std::chrono::steady_clock::time_point start;
+    };
+
+    struct RetiredPipeline {
+      vk::Pipeline handle;
+      u64 frame;
     };
 
     struct VertexDesc {
@@ -110,6 +293,7 @@ namespace drv {
 
     struct PipelineDesc {
       std::vector<std::string> modules;
+      SpecConstants constants;
       
       VertexDesc input{};
       vk::PipelineInputAssemblyStateCreateInfo assembly {}; 
@@ -130,6 +314,9 @@ namespace drv {
       u32 subpass;
       
       vk::Pipeline handle;
+      VariantMap variants;
+      u32 refs = 0;
+      StateKey key;
 
       vk::PipelineViewportStateCreateInfo build_vp() {
         vk::PipelineViewportStateCreateInfo info {};
@@ -148,10 +335,18 @@ namespace drv {
 
     struct ComputePipeline {
       std::string module;
+      SpecConstants constants;
       vk::PipelineLayout layout;
       vk::Pipeline handle;
+      VariantMap variants;
+      u32 refs = 0;
+      StateKey key;
     };
 
+    Variant *find_variant(VariantMap &variants, const SpecConstants &variant);
+    void destroy_variants(Context &ctx, VariantMap &variants);
+
+    ShaderCompiler compiler;
     std::map<std::string, ShaderDesc> shaders;
 
     std::vector<PipelineDesc> pipelines;
@@ -160,6 +355,34 @@ namespace drv {
     std::vector<ComputePipeline> compute_pipelines;
     std::vector<u32> compute_pipeline_free_index;
 
+    std::unordered_map<StateKey, u32, StateKeyHash> pipeline_keys;
+    std::unordered_map<StateKey, u32, StateKeyHash> compute_keys;
+    std::unordered_map<StateKey, vk::RenderPass, StateKeyHash> renderpass_keys;
+    std::map<vk::RenderPass, SharedRenderPass> renderpasses;
+
+    //for variants compiled on get()
+    vk::Device device_handle;
+    vk::PipelineCache pipeline_cache;
+    std::string cache_path;
+    bool warm_cache = false;
+    PipelineStats stats;
+
+    WorkerPool *batch_pool = nullptr;
+    std::map<u32, std::future<Compiled>> pending_pipelines;
+    std::map<u32, std::future<Compiled>> pending_compute;
+
+    //set, binding, type, count, stages
+    using BindingKey = std::array<u32, 5>;
+    std::map<std::vector<BindingKey>, DescriptorSetLayoutID> reflected_sets;
+    //push constants size and stages, then bindings
+    std::map<std::vector<u32>, ReflectedLayout> reflected_layouts;
+    DescriptorStorage *reflected_storage = nullptr;
+    static constexpr u32 REFLECTED_POOL_SETS = 4;
+
+    std::unique_ptr<Reload> reload;
+    std::vector<RetiredPipeline> retired;
+    u64 frame_index = 0;
+
     friend PipelineDescBuilder;
   };
 
@@ -251,6 +474,10 @@ namespace drv {
       desc.modules.push_back(name);
       return *this;
     }
+    PipelineDescBuilder& set_constants(const SpecConstants &constants) {
+      desc.constants = constants;
+      return *this;
+    }
 
     //VertexInput 
     PipelineDescBuilder& add_attribute(u32 loc, u32 binding, vk::Format fmt, u32 offset) {
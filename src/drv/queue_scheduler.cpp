@@ -0,0 +1,147 @@
+#include "queue_scheduler.hpp"
+#include "cpu_profiler.hpp"
+
+namespace drv {
+
+  void QueueScheduler::init(Context &ctx) {
+    for (u32 i = 0; i < QUEUE_COUNT; i++) {
+      auto &timeline = timelines[i];
+
+      vk::SemaphoreTypeCreateInfo type_info {};
+      type_info
+        .setSemaphoreType(vk::SemaphoreType::eTimeline)
+        .setInitialValue(0);
+
+      vk::SemaphoreCreateInfo sem_info {};
+      sem_info.setPNext(&type_info);
+      timeline.semaphore = ctx.get_device().createSemaphore(sem_info);
+
+      vk::CommandPoolCreateInfo pool_info {};
+      pool_info
+        .setQueueFamilyIndex(ctx.queue_index(QueueT(i)))
+        .setFlags(vk::CommandPoolCreateFlagBits::eResetCommandBuffer|vk::CommandPoolCreateFlagBits::eTransient);
+      timeline.pool = ctx.get_device().createCommandPool(pool_info);
+    }
+  }
+
+  void QueueScheduler::release(Context &ctx) {
+    for (u32 i = 0; i < QUEUE_COUNT; i++) {
+      auto &timeline = timelines[i];
+      if (!timeline.semaphore) {
+        continue;
+      }
+
+      wait(ctx, GpuTask {QueueT(i), timeline.submitted});
+      ctx.get_device().destroyCommandPool(timeline.pool);
+      ctx.get_device().destroySemaphore(timeline.semaphore);
+      timeline = Timeline {};
+    }
+  }
+
+  //pool has eResetCommandBuffer, begin() resets recycled buffers
+  vk::CommandBuffer QueueScheduler::begin(Context &ctx, QueueT queue) {
+    auto &timeline = timelines[(u32)queue];
+    recycle(ctx, timeline);
+
+    vk::CommandBuffer cmd;
+    if (timeline.free.size()) {
+      cmd = timeline.free.back();
+      timeline.free.pop_back();
+    } else {
+      vk::CommandBufferAllocateInfo info {};
+      info
+        .setCommandBufferCount(1)
+        .setCommandPool(timeline.pool)
+        .setLevel(vk::CommandBufferLevel::ePrimary);
+      cmd = ctx.get_device().allocateCommandBuffers(info)[0];
+    }
+
+    vk::CommandBufferBeginInfo begin_info {};
+    begin_info.setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+    cmd.begin(begin_info);
+    return cmd;
+  }
+
+  GpuTask QueueScheduler::submit(Context &ctx, QueueT queue, vk::CommandBuffer cmd, std::initializer_list<TaskWait> waits) {
+    CPU_ZONE("queue submit");
+    auto &timeline = timelines[(u32)queue];
+    cmd.end();
+
+    std::vector<vk::Semaphore> wait_semaphores;
+    std::vector<u64> wait_values;
+    std::vector<vk::PipelineStageFlags> wait_stages;
+    for (auto &wait : waits) {
+      if (!wait.task.value) {
+        continue;
+      }
+      wait_semaphores.push_back(timelines[(u32)wait.task.queue].semaphore);
+      wait_values.push_back(wait.task.value);
+      wait_stages.push_back(wait.stages);
+    }
+
+    u64 value = ++timeline.submitted;
+
+    vk::TimelineSemaphoreSubmitInfo timeline_info {};
+    timeline_info
+      .setWaitSemaphoreValueCount(wait_values.size())
+      .setPWaitSemaphoreValues(wait_values.data())
+      .setSignalSemaphoreValueCount(1)
+      .setPSignalSemaphoreValues(&value);
+
+    auto buffers = {cmd};
+    vk::SubmitInfo info {};
+    info
+      .setPNext(&timeline_info)
+      .setWaitSemaphoreCount(wait_semaphores.size())
+      .setPWaitSemaphores(wait_semaphores.data())
+      .setPWaitDstStageMask(wait_stages.data())
+      .setCommandBuffers(buffers)
+      .setSignalSemaphoreCount(1)
+      .setPSignalSemaphores(&timeline.semaphore);
+
+    ctx.get_queue(queue).submit(info);
+    timeline.pending.push_back({value, cmd});
+    return GpuTask {queue, value};
+  }
+
+  bool QueueScheduler::is_done(Context &ctx, const GpuTask &task) {
+    return ctx.get_device().getSemaphoreCounterValue(timelines[(u32)task.queue].semaphore) >= task.value;
+  }
+
+  void QueueScheduler::wait(Context &ctx, const GpuTask &task) {
+    if (!task.value) {
+      return;
+    }
+
+    CPU_ZONE("queue wait");
+    auto &timeline = timelines[(u32)task.queue];
+    vk::SemaphoreWaitInfo info {};
+    info
+      .setSemaphoreCount(1)
+      .setPSemaphores(&timeline.semaphore)
+      .setPValues(&task.value);
+
+    if (ctx.get_device().waitSemaphores(info, UINT64_MAX) != vk::Result::eSuccess) {
+      throw std::runtime_error {"Failed to wait for gpu task"};
+    }
+    recycle(ctx, timeline);
+  }
+
+  void QueueScheduler::recycle(Context &ctx, Timeline &timeline) {
+    if (timeline.pending.empty()) {
+      return;
+    }
+
+    u64 reached = ctx.get_device().getSemaphoreCounterValue(timeline.semaphore);
+    u32 kept = 0;
+    for (auto &entry : timeline.pending) {
+      if (entry.first <= reached) {
+        timeline.free.push_back(entry.second);
+      } else {
+        timeline.pending[kept++] = entry;
+      }
+    }
+    timeline.pending.resize(kept);
+  }
+
+}
@@ -0,0 +1,63 @@
+#ifndef QUEUE_SCHEDULER_HPP_INCLUDED
+#define QUEUE_SCHEDULER_HPP_INCLUDED
+
+#include "common.hpp"
+#include "context.hpp"
+
+#include <initializer_list>
+#include <utility>
+#include <vector>
+
+namespace drv {
+
+  //point on the timeline of a queue, reached when all work submitted up to it is finished
+  struct GpuTask {
+    QueueT queue = QueueT::Graphics;
+    u64 value = 0; //0 - nothing to wait for
+  };
+
+  //submit waits for the task before these stages, they must be supported by the waiting queue
+  struct TaskWait {
+    GpuTask task;
+    vk::PipelineStageFlags stages;
+  };
+
+  //One-shot work for every queue. Each queue has a timeline semaphore, tasks wait for each other on gpu,
+  //so compute work overlaps with rasterization and cpu waits only when it needs the results.
+  //Without a dedicated compute family compute tasks go to the graphics queue.
+  //Images used by both graphics and compute tasks must be created concurrent.
+  //Tasks are submitted from one thread.
+  struct QueueScheduler {
+    void init(Context &ctx);
+    //waits for all submitted tasks
+    void release(Context &ctx);
+
+    //primary buffer from the pool of queue family, begun for one submit
+    vk::CommandBuffer begin(Context &ctx, QueueT queue);
+    //ends cmd and submits it after waits, tasks of the same queue aren't ordered without a wait either
+    GpuTask submit(Context &ctx, QueueT queue, vk::CommandBuffer cmd, std::initializer_list<TaskWait> waits = {});
+
+    bool is_done(Context &ctx, const GpuTask &task);
+    void wait(Context &ctx, const GpuTask &task);
+
+    //for waits in submits made outside of the scheduler
+    vk::Semaphore get_semaphore(QueueT queue) const { return timelines[(u32)queue].semaphore; }
+
+  private:
+    struct Timeline {
+      vk::Semaphore semaphore;
+      vk::CommandPool pool;
+      u64 submitted = 0;
+      //buffers wait here until the timeline reaches their value
+      std::vector<std::pair<u64, vk::CommandBuffer>> pending;
+      std::vector<vk::CommandBuffer> free;
+    };
+
+    void recycle(Context &ctx, Timeline &timeline);
+
+    Timeline timelines[QUEUE_COUNT];
+  };
+
+}
+
+#endif
@@ -1,95 +1,232 @@
 #ifndef RCSTORAGE_HPP_INCLUDED
 #define RCSTORAGE_HPP_INCLUDED
 
+#include "common.hpp"
+
 #include <vector>
-#include <list>
+#include <memory>
+#include <atomic>
+#include <iostream>
+#include <mutex>
+#include <new>
+#include <stdexcept>
 
 template <typename T>
 struct RCId;
 
+//Refcounted pool of handles. Cells live in fixed pages, so references returned by get() stay valid
+//while other threads create new cells. References are atomic, the free list and the retire queue
+//are guarded by a mutex which is taken only on create, on the last dec_ref and on collect.
+//Dereferencing a stale id throws in every build.
 template <typename T>
 struct RCStorage {
+  static constexpr u32 PAGE_SIZE = 256;
+  static constexpr u32 INITIAL_PAGES = 16;
 
-  RCId<T> create(const T& handle) {
-    u32 index;
-    if (empty_cells.size()) {
-      index = empty_cells.front();
-      empty_cells.pop_front();
-      elems[index].handle = handle;
-    } else {
-      index = elems.size();
-      elems.push_back({handle, 0});
+  RCStorage() {
+    tables.emplace_back(new PageTable {std::vector<Elem*>(INITIAL_PAGES, nullptr)});
+    table.store(tables.back().get(), std::memory_order_release);
+  }
+
+  RCStorage(const RCStorage&) = delete;
+  RCStorage &operator=(const RCStorage&) = delete;
+
+  ~RCStorage() {
+    for (u32 i = 0; i < cells_count; i++) {
+      auto &elem = cell(i);
+      if (elem.constructed) elem.ptr()->~T();
     }
+  }
 
-    elems[index].references++;
-    return {this, index};
+  RCId<T> create(const T& handle) {
+    std::lock_guard<std::mutex> guard {lock};
+    auto index = alloc_cell();
+    auto &elem = cell(index);
+    new (elem.storage) T(handle);
+    elem.constructed = true;
+    elem.references.store(1, std::memory_order_relaxed);
+    return {this, index, elem.generation.load(std::memory_order_relaxed)};
   }
 
   RCId<T> create(T&& handle) {
-    u32 index;
-    if (empty_cells.size()) {
-      index = empty_cells.front();
-      empty_cells.pop_front();
-      elems[index].handle = std::move(handle);
-    } else {
-      index = elems.size();
-      elems.push_back({std::move(handle), 0});
+    std::lock_guard<std::mutex> guard {lock};
+    auto index = alloc_cell();
+    auto &elem = cell(index);
+    new (elem.storage) T(std::move(handle));
+    elem.constructed = true;
+    elem.references.store(1, std::memory_order_relaxed);
+    return {this, index, elem.generation.load(std::memory_order_relaxed)};
+  }
+
+  template <typename... Args>
+  void collect(Args&... args) {
+    collect_until(~0ull, args...);
+  }
+
+  //releases cells that were freed before or during completed_epoch
+  template <typename... Args>
+  void collect_until(u64 completed_epoch, Args&... args) {
+    std::lock_guard<std::mutex> guard {lock};
+    u32 count = 0;
+    while (count < delayed_free.size() && delayed_free[count].epoch <= completed_epoch) {
+      auto index = delayed_free[count].index;
+      auto &elem = cell(index);
+      elem.ptr()->release(args...);
+      elem.ptr()->~T();
+      elem.constructed = false;
+      //outstanding copies of the old handle will fail the generation check
+      elem.generation.store(elem.generation.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+      elem.next_free = free_head;
+      free_head = index;
+      count++;
     }
+    delayed_free.erase(delayed_free.begin(), delayed_free.begin() + count);
+  }
 
-    elems[index].references++;
-    return {this, index};
+  //visits cells which will be released by collect_until(completed_epoch)
+  template <typename F>
+  void for_each_expired(u64 completed_epoch, F &&f) {
+    std::lock_guard<std::mutex> guard {lock};
+    for (auto &retired : delayed_free) {
+      if (retired.epoch > completed_epoch) break;
+      f(*cell(retired.index).ptr());
+    }
   }
 
-  template <typename... Args> 
-  void collect(Args&... args) {
-    while (delayed_free.size()) {
-      auto index = delayed_free.front();
-      elems[index].handle.release(args...);
-      delayed_free.pop_front();
-      empty_cells.push_front(index);
+  //cells freed from now on are tagged with this value
+  void set_epoch(u64 e) { epoch.store(e, std::memory_order_relaxed); }
+
+  //visits every cell that is still referenced
+  template <typename F>
+  void for_each(F &&f) {
+    std::lock_guard<std::mutex> guard {lock};
+    for (u32 i = 0; i < cells_count; i++) {
+      auto &elem = cell(i);
+      if (elem.references.load(std::memory_order_relaxed)) f(i, *elem.ptr());
     }
   }
 
 private:
   friend RCId<T>;
 
+  static constexpr u32 INVALID_CELL = ~0u;
+
+  struct Elem {
+    alignas(T) unsigned char storage[sizeof(T)];
+    std::atomic<u32> references {0};
+    //changed under the lock, read without it by checks of ids from other threads
+    std::atomic<u32> generation {0};
+    u32 next_free = INVALID_CELL;
+    bool constructed = false;
+
+    T *ptr() { return std::launder(reinterpret_cast<T*>(storage)); }
+    const T *ptr() const { return std::launder(reinterpret_cast<const T*>(storage)); }
+  };
+
+  struct PageTable {
+    std::vector<Elem*> pages;
+  };
+
+  struct Retired {
+    u32 index;
+    u64 epoch;
+  };
+
+  //table which was current when the id was created, or a newer one, has its page
+  Elem &cell(u32 index) { return table.load(std::memory_order_acquire)->pages[index / PAGE_SIZE][index % PAGE_SIZE]; }
+  const Elem &cell(u32 index) const { return table.load(std::memory_order_acquire)->pages[index / PAGE_SIZE][index % PAGE_SIZE]; }
+
+  u32 alloc_cell() {
+    if (free_head != INVALID_CELL) {
+      auto index = free_head;
+      free_head = cell(index).next_free;
+      return index;
+    }
+
+    auto page = cells_count / PAGE_SIZE;
+    auto current = table.load(std::memory_order_relaxed);
+    if (page >= current->pages.size()) {
+      grow(current);
+      current = table.load(std::memory_order_relaxed);
+    }
+    if (!current->pages[page]) {
+      pages.emplace_back(new Elem[PAGE_SIZE]);
+      current->pages[page] = pages.back().get();
+    }
+    return cells_count++;
+  }
+
+  //Readers may still index the old table, so it is kept until the storage is destroyed.
+  //Pages don't move, both tables point to the same ones.
+  void grow(PageTable *current) {
+    auto next = new PageTable {current->pages};
+    next->pages.resize(2 * current->pages.size(), nullptr);
+    tables.emplace_back(next);
+    table.store(next, std::memory_order_release);
+  }
+
+  const Elem &checked(const RCId<T> &id) const {
+    const auto &elem = cell(id.index);
+    if (elem.generation.load(std::memory_order_acquire) != id.generation) {
+      throw std::runtime_error {"Stale RCId"};
+    }
+    return elem;
+  }
+
+  Elem &checked(const RCId<T> &id) {
+    auto &elem = cell(id.index);
+    if (elem.generation.load(std::memory_order_acquire) != id.generation) {
+      throw std::runtime_error {"Stale RCId"};
+    }
+    return elem;
+  }
+
   void inc_ref(const RCId<T> &id) {
-    elems[id.index].references++;
+    checked(id).references.fetch_add(1, std::memory_order_relaxed);
   }
-  
+
+  //called from destructors, so a stale id is reported instead of thrown
   void dec_ref(const RCId<T> &id) {
-    elems[id.index].references--;
-    if (elems[id.index].references == 0) {
-      delayed_free.push_front(id.index);
+    auto &elem = cell(id.index);
+    if (elem.generation.load(std::memory_order_acquire) != id.generation) {
+      std::cout << "Stale RCId " << id.index << " released\n";
+      return;
+    }
+
+    if (elem.references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      std::lock_guard<std::mutex> guard {lock};
+      delayed_free.push_back({id.index, epoch.load(std::memory_order_relaxed)});
     }
   }
 
   const T& get(const RCId<T> &id) const {
-    return elems[id.index].handle;
+    return *checked(id).ptr();
   }
 
   T& get(const RCId<T> &id) {
-    return elems[id.index].handle;
+    return *checked(id).ptr();
   }
 
-  struct Elem {
-    T handle;
-    u32 references;
-  };
+  //create() replaces the table when it is full, pages and old tables are owned here
+  std::atomic<PageTable*> table {nullptr};
+  std::vector<std::unique_ptr<PageTable>> tables;
+  std::vector<std::unique_ptr<Elem[]>> pages;
+  u32 cells_count = 0;
+  u32 free_head = INVALID_CELL;
 
-  std::vector<Elem> elems;
-  std::list<u32> empty_cells;
-  std::list<u32> delayed_free;
+  std::vector<Retired> delayed_free;
+  std::atomic<u64> epoch {0};
+  std::mutex lock;
 };
 
 template <typename T>
 struct RCId {
   RCId() {}
-  RCId(const RCId &id) : storage {id.storage}, index {id.index} {
+  RCId(const RCId &id) : storage {id.storage}, index {id.index}, generation {id.generation} {
     if (storage) storage->inc_ref(id);
   }
 
-  RCId(RCId &&id) : storage {id.storage}, index {id.index} {
+  RCId(RCId &&id) : storage {id.storage}, index {id.index}, generation {id.generation} {
     id.storage = nullptr;
   }
 
@@ -98,24 +235,31 @@ struct RCId {
   }
 
   const RCId& operator=(const RCId<T> &id) {
+    if (id.storage) {
+      id.storage->inc_ref(id);
+    }
+
     if (storage) {
       storage->dec_ref(*this);
     }
 
     storage = id.storage;
     index = id.index;
-    storage->inc_ref(*this);
+    generation = id.generation;
     return *this;
   }
 
   const RCId& operator=(RCId<T> &&id) {
+    if (this == &id) return *this;
+
     if (storage) {
       storage->dec_ref(*this);
     }
 
     storage = id.storage;
     index = id.index;
-    id.storage = nullptr; 
+    generation = id.generation;
+    id.storage = nullptr;
     return *this;
   }
 
@@ -124,8 +268,8 @@ struct RCId {
     storage = nullptr;
   }
 
-  bool operator==(const RCId<T> &id) {
-    return (storage == id.storage) && (index == id.index);
+  bool operator==(const RCId<T> &id) const {
+    return (storage == id.storage) && (index == id.index) && (generation == id.generation);
   }
 
   const T& operator*() const {
@@ -138,7 +282,7 @@ struct RCId {
 
   T* operator->() { return &storage->get(*this); }
   const T* operator->() const { return &storage->get(*this); }
-  
+
   void release() {
     if (storage) storage->dec_ref(*this);
     storage = nullptr;
@@ -146,11 +290,12 @@ struct RCId {
   u32 debug_index() const { return index; }
 private:
   friend RCStorage<T>;
-  
-  RCId(RCStorage<T> *s, u32 i) : storage{s}, index {i} {}
+
+  RCId(RCStorage<T> *s, u32 i, u32 g) : storage{s}, index {i}, generation {g} {}
 
   RCStorage<T> *storage = nullptr;
-  u32 index = ~0;
+  u32 index = ~0u;
+  u32 generation = 0;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,493 @@
+#include "render_graph.hpp"
+#include "gpu_profiler.hpp"
+#include "work_stats.hpp"
+
+#include <sstream>
+
+namespace drv {
+
+  namespace {
+    struct UsageInfo {
+      vk::ImageLayout layout;
+      vk::PipelineStageFlags stages; //empty if stages are given by pass
+      vk::AccessFlags read;
+      vk::AccessFlags write;
+    };
+
+    UsageInfo get_usage_info(ImageUsage usage) {
+      using Stage = vk::PipelineStageFlagBits;
+      using Access = vk::AccessFlagBits;
+      switch (usage) {
+        case ImageUsage::Sampled:
+          return {vk::ImageLayout::eShaderReadOnlyOptimal, {}, Access::eShaderRead, {}};
+        case ImageUsage::Storage:
+          return {vk::ImageLayout::eGeneral, {}, Access::eShaderRead, Access::eShaderWrite};
+        case ImageUsage::ColorAttachment:
+          return {vk::ImageLayout::eColorAttachmentOptimal, Stage::eColorAttachmentOutput, Access::eColorAttachmentRead, Access::eColorAttachmentWrite};
+        case ImageUsage::DepthAttachment:
+          return {vk::ImageLayout::eDepthStencilAttachmentOptimal, Stage::eEarlyFragmentTests|Stage::eLateFragmentTests,
+            Access::eDepthStencilAttachmentRead, Access::eDepthStencilAttachmentRead|Access::eDepthStencilAttachmentWrite};
+        case ImageUsage::TransferSrc:
+          return {vk::ImageLayout::eTransferSrcOptimal, Stage::eTransfer, Access::eTransferRead, {}};
+        case ImageUsage::TransferDst:
+          return {vk::ImageLayout::eTransferDstOptimal, Stage::eTransfer, {}, Access::eTransferWrite};
+      }
+      throw std::runtime_error {"Unknown image usage"};
+    }
+
+    UsageInfo get_usage_info(BufferUsage usage) {
+      using Stage = vk::PipelineStageFlagBits;
+      using Access = vk::AccessFlagBits;
+      switch (usage) {
+        case BufferUsage::Uniform: return {{}, {}, Access::eUniformRead, {}};
+        case BufferUsage::Storage: return {{}, {}, Access::eShaderRead, Access::eShaderWrite};
+        case BufferUsage::Vertex: return {{}, Stage::eVertexInput, Access::eVertexAttributeRead, {}};
+        case BufferUsage::Index: return {{}, Stage::eVertexInput, Access::eIndexRead, {}};
+        case BufferUsage::Indirect: return {{}, Stage::eDrawIndirect, Access::eIndirectCommandRead, {}};
+        case BufferUsage::Transfer: return {{}, Stage::eTransfer, Access::eTransferRead, Access::eTransferWrite};
+      }
+      throw std::runtime_error {"Unknown buffer usage"};
+    }
+
+    vk::ImageAspectFlags get_aspect(vk::Format fmt, bool view) {
+      using Aspect = vk::ImageAspectFlagBits;
+      switch (fmt) {
+        case vk::Format::eD16Unorm:
+        case vk::Format::eX8D24UnormPack32:
+        case vk::Format::eD32Sfloat:
+          return Aspect::eDepth;
+        case vk::Format::eS8Uint:
+          return Aspect::eStencil;
+        case vk::Format::eD16UnormS8Uint:
+        case vk::Format::eD24UnormS8Uint:
+        case vk::Format::eD32SfloatS8Uint:
+          return view? vk::ImageAspectFlags {Aspect::eDepth} : (Aspect::eDepth|Aspect::eStencil);
+        default:
+          return Aspect::eColor;
+      }
+    }
+
+    bool operator==(const TransientImageDesc &a, const TransientImageDesc &b) {
+      return a.width == b.width && a.height == b.height && a.format == b.format && a.usage == b.usage
+        && a.layers == b.layers && a.mips == b.mips;
+    }
+  }
+
+  PassBuilder &PassBuilder::read(RGImage img, ImageUsage usage, vk::PipelineStageFlags stages, ImageRange range) {
+    return image_access(img, usage, stages, range, false, false);
+  }
+
+  PassBuilder &PassBuilder::write(RGImage img, ImageUsage usage, vk::PipelineStageFlags stages, ImageRange range) {
+    return image_access(img, usage, stages, range, true, false);
+  }
+
+  PassBuilder &PassBuilder::overwrite(RGImage img, ImageUsage usage, vk::PipelineStageFlags stages, ImageRange range) {
+    return image_access(img, usage, stages, range, true, true);
+  }
+
+  PassBuilder &PassBuilder::read(RGBuffer buf, BufferUsage usage, vk::PipelineStageFlags stages) {
+    return buffer_access(buf, usage, stages, false);
+  }
+
+  PassBuilder &PassBuilder::write(RGBuffer buf, BufferUsage usage, vk::PipelineStageFlags stages) {
+    return buffer_access(buf, usage, stages, true);
+  }
+
+  PassBuilder &PassBuilder::keep() {
+    graph.passes[pass].keep = true;
+    return *this;
+  }
+
+  PassBuilder &PassBuilder::image_access(RGImage img, ImageUsage usage, vk::PipelineStageFlags stages, ImageRange range, bool write, bool discard) {
+    auto info = get_usage_info(usage);
+    auto access = write? info.write : info.read;
+    if (!access) {
+      throw std::runtime_error {std::string {"Image usage doesn't support "} + (write? "writes" : "reads")};
+    }
+    if (info.stages) {
+      stages = info.stages;
+    }
+    if (!stages) {
+      throw std::runtime_error {"Shader stages are required for sampled and storage images"};
+    }
+
+    auto &images = graph.passes[pass].images;
+    for (auto &a : images) {
+      if (a.image != img || a.range.base_mip != range.base_mip || a.range.mip_count != range.mip_count) continue;
+      if (a.layout != info.layout) {
+        throw std::runtime_error {"Image is used with two layouts in pass " + graph.passes[pass].name};
+      }
+      a.stages |= stages;
+      a.access |= access;
+      a.write = a.write || write;
+      a.discard = a.discard && discard;
+      return *this;
+    }
+
+    images.push_back({img, range, info.layout, stages, access, write, discard});
+    return *this;
+  }
+
+  PassBuilder &PassBuilder::buffer_access(RGBuffer buf, BufferUsage usage, vk::PipelineStageFlags stages, bool write) {
+    auto info = get_usage_info(usage);
+    auto access = write? info.write : info.read;
+    if (!access) {
+      throw std::runtime_error {std::string {"Buffer usage doesn't support "} + (write? "writes" : "reads")};
+    }
+    if (info.stages) {
+      stages = info.stages;
+    }
+    if (!stages) {
+      throw std::runtime_error {"Shader stages are required for uniform and storage buffers"};
+    }
+
+    graph.passes[pass].buffers.push_back({buf, stages, access, write});
+    return *this;
+  }
+
+  RGImage RenderGraph::import_image(const std::string &name, const ImageID &image, vk::ImageLayout layout) {
+    ImageResource res {};
+    res.name = name;
+    res.image = image;
+    res.mips.resize(image->get_info().mipLevels);
+    for (auto &m : res.mips) {
+      m.layout = layout;
+    }
+
+    images.push_back(res);
+    return RGImage {u32(images.size() - 1)};
+  }
+
+  RGImage RenderGraph::import_image(const std::string &name, const ImageViewID &view, vk::ImageLayout layout) {
+    auto id = import_image(name, view->get_base_img(), layout);
+    images[id].view = view;
+    return id;
+  }
+
+  RGBuffer RenderGraph::import_buffer(const std::string &name, const BufferID &buffer) {
+    buffers.push_back({name, buffer, {}});
+    return RGBuffer {u32(buffers.size() - 1)};
+  }
+
+  RGImage RenderGraph::create_image(const std::string &name, const TransientImageDesc &desc) {
+    transients.push_back({name, desc, ~0u});
+    return RGImage {u32(transients.size() - 1) | TRANSIENT_BIT};
+  }
+
+  PassBuilder RenderGraph::add_pass(const std::string &name, PassCallback callback) {
+    Pass pass {};
+    pass.name = name;
+    pass.callback = std::move(callback);
+    pass.keep = false;
+    pass.culled = false;
+    passes.push_back(std::move(pass));
+    return PassBuilder {*this, u32(passes.size() - 1)};
+  }
+
+  void RenderGraph::export_image(RGImage image, ImageUsage usage, vk::PipelineStageFlags stages, ImageRange range) {
+    const auto &name = is_transient(image)? transients.at(image & ~TRANSIENT_BIT).name : images.at(image).name;
+    add_pass("export " + name, nullptr)
+      .read(image, usage, stages, range)
+      .keep();
+  }
+
+  RenderGraph::ImageResource &RenderGraph::get_resource(u32 image) {
+    if (!is_transient(image)) {
+      return images.at(image);
+    }
+
+    auto &t = transients.at(image & ~TRANSIENT_BIT);
+    if (t.pool_index == ~0u) {
+      throw std::runtime_error {"Transient image " + t.name + " is not allocated"};
+    }
+    return pool[t.pool_index].resource;
+  }
+
+  const RenderGraph::ImageResource &RenderGraph::get_resource(u32 image) const {
+    return const_cast<RenderGraph*>(this)->get_resource(image);
+  }
+
+  const ImageID &RenderGraph::get_image(RGImage image) const {
+    return get_resource(image).image;
+  }
+
+  const ImageViewID &RenderGraph::get_view(RGImage image) const {
+    return get_resource(image).view;
+  }
+
+  //passes that write only transient images nobody reads later are dropped
+  void RenderGraph::cull() {
+    std::vector<bool> needed(transients.size(), false);
+
+    for (u32 i = passes.size(); i > 0; i--) {
+      auto &pass = passes[i - 1];
+      bool used = pass.keep;
+
+      for (const auto &a : pass.images) {
+        if (!a.write) continue;
+        used = used || !is_transient(a.image) || needed[a.image & ~TRANSIENT_BIT];
+      }
+      for (const auto &b : pass.buffers) {
+        used = used || b.write;
+      }
+
+      pass.culled = !used;
+      if (!used) continue;
+
+      for (const auto &a : pass.images) {
+        if (is_transient(a.image) && !a.discard) {
+          needed[a.image & ~TRANSIENT_BIT] = true;
+        }
+      }
+    }
+  }
+
+  void RenderGraph::allocate(Context &ctx, ResourceStorage &storage) {
+    std::vector<bool> used(transients.size(), false);
+    for (const auto &pass : passes) {
+      if (pass.culled) continue;
+      for (const auto &a : pass.images) {
+        if (is_transient(a.image)) used[a.image & ~TRANSIENT_BIT] = true;
+      }
+    }
+
+    for (auto &p : pool) {
+      p.used = false;
+    }
+
+    for (u32 i = 0; i < transients.size(); i++) {
+      if (!used[i]) continue;
+      auto &t = transients[i];
+
+      for (u32 p = 0; p < pool.size(); p++) {
+        if (!pool[p].used && pool[p].desc == t.desc) {
+          t.pool_index = p;
+          break;
+        }
+      }
+
+      if (t.pool_index == ~0u) {
+        const auto &d = t.desc;
+        PooledImage image {};
+        image.desc = d;
+        image.resource.name = t.name;
+        image.resource.image = (d.layers > 1 || d.mips > 1)?
+          storage.create_image2D_array(ctx, d.width, d.height, d.format, d.usage, d.layers, d.mips) :
+          storage.create_rt(ctx, d.width, d.height, d.format, d.usage);
+
+        vk::ImageSubresourceRange range {get_aspect(d.format, true), 0, d.mips, 0, d.layers};
+        auto type = (d.layers > 1)? vk::ImageViewType::e2DArray : vk::ImageViewType::e2D;
+        image.resource.view = storage.create_image_view(ctx, image.resource.image, type, range);
+        image.resource.mips.resize(d.mips);
+
+        t.pool_index = pool.size();
+        pool.push_back(image);
+      }
+
+      pool[t.pool_index].used = true;
+    }
+  }
+
+  RenderGraph::Dependency RenderGraph::sync(SyncState &s, vk::ImageLayout layout, vk::PipelineStageFlags stages, vk::AccessFlags access, bool write, bool discard) {
+    Dependency dep {};
+    dep.old_layout = s.layout;
+
+    if (layout != s.layout) {
+      //transition is a write, it waits for every previous access
+      dep.needed = true;
+      dep.src = s.write_stages|s.read_stages;
+      dep.src_access = s.write_access;
+      dep.old_layout = discard? vk::ImageLayout::eUndefined : s.layout;
+
+      s.layout = layout;
+      s.write_stages = stages;
+      s.write_access = write? access : vk::AccessFlags {};
+      s.read_stages = write? vk::PipelineStageFlags {} : stages;
+      s.visible_stages = write? vk::PipelineStageFlags {} : stages;
+      s.visible_access = write? vk::AccessFlags {} : access;
+      return dep;
+    }
+
+    if (write) {
+      //write after write, write after read
+      if (s.write_stages || s.read_stages) {
+        dep.needed = true;
+        dep.src = s.write_stages|s.read_stages;
+        dep.src_access = s.write_access;
+      }
+
+      s.write_stages = stages;
+      s.write_access = access;
+      s.read_stages = {};
+      s.visible_stages = {};
+      s.visible_access = {};
+      return dep;
+    }
+
+    //read after write, skipped if these stages already wait for it
+    bool visible = !(stages & ~s.visible_stages) && !(access & ~s.visible_access);
+    if (s.write_stages && !visible) {
+      dep.needed = true;
+      dep.src = s.write_stages;
+      dep.src_access = s.write_access;
+    }
+
+    s.read_stages |= stages;
+    s.visible_stages |= stages;
+    s.visible_access |= access;
+    return dep;
+  }
+
+  void RenderGraph::record_barriers(Pass &pass, vk::CommandBuffer &cmd, PassRecord &record) {
+    std::vector<vk::ImageMemoryBarrier> barriers;
+    vk::PipelineStageFlags src, dst;
+    vk::AccessFlags memory_src, memory_dst;
+    bool memory = false;
+
+    for (const auto &a : pass.images) {
+      auto &res = get_resource(a.image);
+      u32 end = (a.range.mip_count == VK_REMAINING_MIP_LEVELS)? res.mips.size() : min<u32>(res.mips.size(), a.range.base_mip + a.range.mip_count);
+
+      for (u32 mip = a.range.base_mip; mip < end; mip++) {
+        auto dep = sync(res.mips[mip], a.layout, a.stages, a.access, a.write, a.discard);
+        if (!dep.needed) continue;
+
+        src |= dep.src;
+        dst |= a.stages;
+
+        //same layout needs only memory dependency
+        if (dep.old_layout == a.layout) {
+          memory = true;
+          memory_src |= dep.src_access;
+          memory_dst |= a.access;
+          continue;
+        }
+
+        //neighbour mips with the same transition share a barrier
+        if (barriers.size()) {
+          auto &last = barriers.back();
+          auto &r = last.subresourceRange;
+          if (last.image == res.image->api_image() && last.oldLayout == dep.old_layout && last.newLayout == a.layout
+            && last.srcAccessMask == dep.src_access && last.dstAccessMask == a.access && r.baseMipLevel + r.levelCount == mip) {
+            r.levelCount++;
+            continue;
+          }
+        }
+
+        vk::ImageMemoryBarrier barrier {};
+        barrier
+          .setImage(res.image->api_image())
+          .setOldLayout(dep.old_layout)
+          .setNewLayout(a.layout)
+          .setSrcAccessMask(dep.src_access)
+          .setDstAccessMask(a.access)
+          .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+          .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+          .setSubresourceRange({get_aspect(res.image->get_info().format, false), mip, 1, 0, VK_REMAINING_ARRAY_LAYERS});
+        barriers.push_back(barrier);
+
+        record.transitions.push_back(res.name + " mip " + std::to_string(mip) + ": "
+          + vk::to_string(dep.old_layout) + " -> " + vk::to_string(a.layout));
+      }
+    }
+
+    //buffers are not transitioned, a global barrier covers them
+    for (const auto &b : pass.buffers) {
+      auto &state = buffers.at(b.buffer).state;
+      auto dep = sync(state, vk::ImageLayout::eUndefined, b.stages, b.access, b.write, false);
+      if (!dep.needed) continue;
+
+      src |= dep.src;
+      dst |= b.stages;
+      memory = true;
+      memory_src |= dep.src_access;
+      memory_dst |= b.access;
+    }
+
+    if (!dst) {
+      return;
+    }
+
+    //first use of a resource has nothing to wait for
+    if (!src) {
+      src = vk::PipelineStageFlagBits::eTopOfPipe;
+    }
+
+    std::vector<vk::MemoryBarrier> memory_barriers;
+    if (memory) {
+      memory_barriers.push_back(vk::MemoryBarrier {memory_src, memory_dst});
+    }
+
+    cmd.pipelineBarrier(src, dst, vk::DependencyFlags {}, memory_barriers, {}, barriers);
+
+    record.src = src;
+    record.dst = dst;
+    record.image_barriers = barriers.size();
+    record.memory_barrier = memory;
+  }
+
+  void RenderGraph::execute(Context &ctx, ResourceStorage &storage, vk::CommandBuffer &cmd, GpuProfiler *profiler, u32 slot, WorkStats *stats) {
+    cull();
+    allocate(ctx, storage);
+
+    last_execution.clear();
+    for (auto &pass : passes) {
+      PassRecord record {pass.name, pass.culled, {}, {}, 0, false, {}};
+      if (!pass.culled) {
+        record_barriers(pass, cmd, record);
+        u64 uploaded = storage.get_uploaded_bytes();
+        u32 query = (pass.callback && stats)? stats->begin_query(cmd, slot, pass.name) : ~0u;
+
+        if (pass.callback && profiler) {
+          GpuZone zone {*profiler, cmd, slot, pass.name};
+          pass.callback(cmd);
+        } else if (pass.callback) {
+          pass.callback(cmd);
+        }
+
+        if (pass.callback && stats) {
+          stats->end_query(cmd, slot, query);
+          stats->pass(pass.name).upload(storage.get_uploaded_bytes() - uploaded);
+        }
+      }
+      last_execution.push_back(std::move(record));
+    }
+
+    passes.clear();
+    transients.clear();
+  }
+
+  std::string RenderGraph::describe() const {
+    std::stringstream out;
+    for (const auto &r : last_execution) {
+      out << r.name;
+      if (r.culled) {
+        out << " (culled)\n";
+        continue;
+      }
+      out << "\n";
+
+      if (r.image_barriers || r.memory_barrier) {
+        out << "  wait " << vk::to_string(r.src) << " -> " << vk::to_string(r.dst) << ", "
+          << r.image_barriers << " image barriers" << (r.memory_barrier? ", memory barrier\n" : "\n");
+      } else {
+        out << "  no barrier, may overlap previous passes\n";
+      }
+
+      for (const auto &t : r.transitions) {
+        out << "  " << t << "\n";
+      }
+    }
+    return out.str();
+  }
+
+  void RenderGraph::release() {
+    passes.clear();
+    transients.clear();
+    images.clear();
+    buffers.clear();
+    pool.clear();
+    last_execution.clear();
+  }
+
+}
@@ -0,0 +1,232 @@
+#ifndef RENDER_GRAPH_HPP_INCLUDED
+#define RENDER_GRAPH_HPP_INCLUDED
+
+#include "common.hpp"
+#include "context.hpp"
+#include "resources.hpp"
+
+#include <string>
+#include <vector>
+#include <functional>
+
+namespace drv {
+
+  //how a pass touches an image, decides layout, stages and access flags
+  enum class ImageUsage {
+    Sampled, //shader read only optimal, stages are required
+    Storage, //general, stages are required
+    ColorAttachment,
+    DepthAttachment,
+    TransferSrc,
+    TransferDst
+  };
+
+  enum class BufferUsage {
+    Uniform, //stages are required
+    Storage, //stages are required
+    Vertex,
+    Index,
+    Indirect,
+    Transfer
+  };
+
+  //mip levels of an image, all array layers are tracked together
+  struct ImageRange {
+    u32 base_mip = 0;
+    u32 mip_count = VK_REMAINING_MIP_LEVELS;
+  };
+
+  struct TransientImageDesc {
+    u32 width;
+    u32 height;
+    vk::Format format;
+    vk::ImageUsageFlags usage;
+    u32 layers = 1;
+    u32 mips = 1;
+  };
+
+  struct RGImage {
+    RGImage() {}
+    RGImage(u32 i) : index {i} {};
+    operator u32() const { return index; }
+  private:
+    u32 index = ~0u;
+  };
+
+  struct RGBuffer {
+    RGBuffer() {}
+    RGBuffer(u32 i) : index {i} {};
+    operator u32() const { return index; }
+  private:
+    u32 index = ~0u;
+  };
+
+  struct RenderGraph;
+  struct GpuProfiler;
+  struct WorkStats;
+
+  struct PassBuilder {
+    using Self = PassBuilder&;
+
+    //previous contents are kept
+    Self read(RGImage img, ImageUsage usage, vk::PipelineStageFlags stages = {}, ImageRange range = {});
+    Self write(RGImage img, ImageUsage usage, vk::PipelineStageFlags stages = {}, ImageRange range = {});
+    //previous contents are discarded, layout transition starts from undefined
+    Self overwrite(RGImage img, ImageUsage usage, vk::PipelineStageFlags stages = {}, ImageRange range = {});
+
+    Self read(RGBuffer buf, BufferUsage usage, vk::PipelineStageFlags stages = {});
+    Self write(RGBuffer buf, BufferUsage usage, vk::PipelineStageFlags stages = {});
+
+    //pass has results the graph doesn't see (swapchain, host readback), it is never culled
+    Self keep();
+
+  private:
+    PassBuilder(RenderGraph &g, u32 p) : graph {g}, pass {p} {}
+    Self image_access(RGImage img, ImageUsage usage, vk::PipelineStageFlags stages, ImageRange range, bool write, bool discard);
+    Self buffer_access(RGBuffer buf, BufferUsage usage, vk::PipelineStageFlags stages, bool write);
+
+    RenderGraph &graph;
+    u32 pass;
+
+    friend RenderGraph;
+  };
+
+  //Passes are added every execution, imported resources keep their state between executions,
+  //so the first barrier of a frame waits only for the stages that used a resource last time.
+  //Barriers of a pass are batched into one vkCmdPipelineBarrier before its callback.
+  //Render passes used inside callbacks must keep attachments in the layout of their usage
+  //(initial = final = subpass layout), transitions are made by the graph.
+  struct RenderGraph {
+    using PassCallback = std::function<void (vk::CommandBuffer &cmd)>;
+
+    RGImage import_image(const std::string &name, const ImageID &image, vk::ImageLayout layout = vk::ImageLayout::eUndefined);
+    RGImage import_image(const std::string &name, const ImageViewID &view, vk::ImageLayout layout = vk::ImageLayout::eUndefined);
+    RGBuffer import_buffer(const std::string &name, const BufferID &buffer);
+
+    //Valid for one execution. Memory comes from a pool of images with the same description,
+    //images of culled passes are not allocated
+    RGImage create_image(const std::string &name, const TransientImageDesc &desc);
+
+    PassBuilder add_pass(const std::string &name, PassCallback callback);
+    //transitions image for use outside of the graph after the last pass
+    void export_image(RGImage image, ImageUsage usage, vk::PipelineStageFlags stages = {}, ImageRange range = {});
+
+    //valid inside pass callbacks
+    const ImageID &get_image(RGImage image) const;
+    //view of all layers and mips, depth aspect for depth formats
+    const ImageViewID &get_view(RGImage image) const;
+
+    //culls passes, allocates transient images, records passes with barriers into cmd,
+    //with profiler every pass callback is a timestamp zone of the slot,
+    //with stats it is a pipeline statistics query and its uploads are counted
+    void execute(Context &ctx, ResourceStorage &storage, vk::CommandBuffer &cmd, GpuProfiler *profiler = nullptr, u32 slot = 0, WorkStats *stats = nullptr);
+    //passes and barriers of the last execution
+    std::string describe() const;
+
+    void release();
+
+  private:
+    static constexpr u32 TRANSIENT_BIT = 1u << 31u;
+
+    //last write and readers since it
+    struct SyncState {
+      vk::ImageLayout layout = vk::ImageLayout::eUndefined;
+      vk::PipelineStageFlags write_stages;
+      vk::AccessFlags write_access;
+      vk::PipelineStageFlags read_stages;
+      //stages and accesses the last write is visible to
+      vk::PipelineStageFlags visible_stages;
+      vk::AccessFlags visible_access;
+    };
+
+    struct Dependency {
+      bool needed = false;
+      vk::PipelineStageFlags src;
+      vk::AccessFlags src_access;
+      vk::ImageLayout old_layout;
+    };
+
+    struct ImageResource {
+      std::string name;
+      ImageID image;
+      ImageViewID view;
+      std::vector<SyncState> mips;
+    };
+
+    struct PooledImage {
+      TransientImageDesc desc;
+      ImageResource resource;
+      bool used;
+    };
+
+    struct Transient {
+      std::string name;
+      TransientImageDesc desc;
+      u32 pool_index;
+    };
+
+    struct BufferResource {
+      std::string name;
+      BufferID buffer;
+      SyncState state;
+    };
+
+    struct ImageAccess {
+      u32 image;
+      ImageRange range;
+      vk::ImageLayout layout;
+      vk::PipelineStageFlags stages;
+      vk::AccessFlags access;
+      bool write;
+      bool discard;
+    };
+
+    struct BufferAccess {
+      u32 buffer;
+      vk::PipelineStageFlags stages;
+      vk::AccessFlags access;
+      bool write;
+    };
+
+    struct Pass {
+      std::string name;
+      PassCallback callback;
+      std::vector<ImageAccess> images;
+      std::vector<BufferAccess> buffers;
+      bool keep;
+      bool culled;
+    };
+
+    //what execute did, kept for describe()
+    struct PassRecord {
+      std::string name;
+      bool culled;
+      vk::PipelineStageFlags src;
+      vk::PipelineStageFlags dst;
+      u32 image_barriers;
+      bool memory_barrier;
+      std::vector<std::string> transitions;
+    };
+
+    bool is_transient(u32 image) const { return image & TRANSIENT_BIT; }
+    ImageResource &get_resource(u32 image);
+    const ImageResource &get_resource(u32 image) const;
+
+    void cull();
+    void allocate(Context &ctx, ResourceStorage &storage);
+    void record_barriers(Pass &pass, vk::CommandBuffer &cmd, PassRecord &record);
+    static Dependency sync(SyncState &state, vk::ImageLayout layout, vk::PipelineStageFlags stages, vk::AccessFlags access, bool write, bool discard);
+
+    std::vector<ImageResource> images;
+    std::vector<BufferResource> buffers;
+    std::vector<Transient> transients;
+    std::vector<PooledImage> pool;
+    std::vector<Pass> passes;
+    std::vector<PassRecord> last_execution;
+
+    friend PassBuilder;
+  };
+
+}
+
+#endif
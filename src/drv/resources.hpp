@@ -7,6 +7,11 @@
 
 #include "lib/vk_mem_alloc.h"
 
+#include <atomic>
+#include <map>
+#include <set>
+#include <utility>
+
 namespace drv {
 
   #include <list>
@@ -33,6 +38,7 @@ namespace drv {
     VmaAllocation allocation;
     GPUMemoryT mem_type;
 
+    vk::DeviceSize size;
     vk::BufferUsageFlags usage;
     vk::SharingMode sharing_mode;
     vk::Buffer handle;
@@ -51,6 +57,7 @@ namespace drv {
     const vk::Image& api_image() const { return handle; }
     vk::Image& api_image() { return handle; }
     const vk::ImageCreateInfo &get_info() const { return info; }
+    vk::ImageLayout get_layout() const { return layout; }
   private:
     VmaAllocation allocation;
     GPUMemoryT mem_type;
@@ -77,10 +84,12 @@ namespace drv {
 
     const ImageID &get_base_img() const { return img; }
     ImageID &get_base_img() { return img; }
+    const vk::ImageViewCreateInfo &get_info() const { return info; }
     
   private:
-    ImageView(const vk::ImageView &v, const ImageID &i) : view{v}, img{i} {}
+    ImageView(const vk::ImageViewCreateInfo &inf, const vk::ImageView &v, const ImageID &i) : info{inf}, view{v}, img{i} {}
 
+    vk::ImageViewCreateInfo info {};
     vk::ImageView view;
     ImageID img;
 
@@ -89,6 +98,35 @@ namespace drv {
 
   using ImageViewID = RCId<ImageView>;
 
+  //old api handle -> new api handle for everything moved by defragmentation
+  struct Relocations {
+    std::map<vk::Buffer, vk::Buffer> buffers;
+    std::map<vk::ImageView, vk::ImageView> views;
+
+    bool empty() const { return buffers.empty() && views.empty(); }
+  };
+
+  //api handles destroyed by collect, descriptor sets referencing them are stale
+  struct ReleasedHandles {
+    std::set<vk::Buffer> buffers;
+    std::set<vk::ImageView> views;
+
+    bool empty() const { return buffers.empty() && views.empty(); }
+  };
+
+  struct DefragmentationStats {
+    vk::DeviceSize bytes_moved = 0;
+    vk::DeviceSize bytes_freed = 0;
+    vk::DeviceSize unused_before = 0;
+    vk::DeviceSize unused_after = 0;
+    u32 blocks_before = 0;
+    u32 blocks_after = 0;
+    u32 buffers_moved = 0;
+    u32 images_moved = 0;
+    u32 views_recreated = 0;
+    u32 sets_rewritten = 0; //filled by DescriptorStorage::relocate
+  };
+
   struct ResourceStorage {
     
 
@@ -102,7 +140,8 @@ namespace drv {
     void* map_buffer(Context &ctx, const BufferID &id);
     void unmap_buffer(Context &ctx, const BufferID &id);
     void buffer_memcpy(Context &ctx, const BufferID &dst, vk::DeviceSize offst, const void *src, vk::DeviceSize size);
-    void collect_buffers();
+    //bytes written by buffer_memcpy since init, local buffers are counted once through staging
+    u64 get_uploaded_bytes() const { return uploaded_bytes.load(std::memory_order_relaxed); }
     Buffer &get(BufferID &id);
     const Buffer &get(const BufferID &id) const;
 
@@ -111,7 +150,9 @@ namespace drv {
     ImageID create_depth2D_rt(Context &ctx, u32 width, u32 height);
     ImageID create_rt(Context &ctx, u32 width, u32 height, vk::Format fmt, vk::ImageUsageFlags usage);
     ImageID create_cubemap(Context &ctx, u32 width, u32 height, vk::Format fmt, vk::ImageUsageFlags usage);
-    ImageID create_image2D_array(Context &ctx, u32 width, u32 height, vk::Format fmt, vk::ImageUsageFlags usage, u32 layers, u32 levels = 1);
+    //concurrent mode for arrays used by graphics and async compute queues
+    ImageID create_image2D_array(Context &ctx, u32 width, u32 height, vk::Format fmt, vk::ImageUsageFlags usage, u32 layers, u32 levels = 1,
+                                 vk::SharingMode mode = vk::SharingMode::eExclusive);
 
     ImageViewID create_image_view(Context &ctx, const ImageID &img, const vk::ImageViewType &t, const vk::ImageSubresourceRange &range, vk::ComponentMapping map = {});
     ImageViewID create_rt_view(Context &ctx, const ImageID &img, const vk::ImageAspectFlags &flags, vk::ComponentMapping map = {});
@@ -121,9 +162,28 @@ namespace drv {
     ImageViewID create_2Darray_mip_view(Context &ctx, const ImageID &img, vk::ImageAspectFlags flags, u32 mip_level = 0);
     ImageViewID create_2Dlayer_view(Context &ctx, const ImageID &img, const vk::ImageAspectFlags &flags, u32 layer);
 
+    //frame - index of the frame being recorded, completed - last frame finished by GPU.
+    //Resources released while recording a frame are destroyed when this frame is completed
+    void next_frame(Context &ctx, u64 frame, u64 completed);
+
+    //Must be called with idle queues. Returned relocations should be passed to DescriptorStorage::relocate
+    DefragmentationStats defragment(Context &ctx, Relocations &out);
+
+    //handles destroyed since the last call. Should be passed to DescriptorStorage::evict
+    ReleasedHandles take_released() { return std::exchange(released, {}); }
+
   private: 
 
+    void collect(Context &ctx);
+    void collect_all(Context &ctx);
+    void collect_until(Context &ctx, u64 completed);
     void fill_image_info(Context &ctx, const vk::ImageCreateInfo &info, Image &img);
+    ImageViewID create_view(Context &ctx, const ImageID &img, const vk::ImageViewCreateInfo &info);
+    vk::BufferCreateInfo get_buffer_info(Context &ctx, const Buffer &buf) const;
+
+    void defragment_buffers(Context &ctx, DefragmentationStats &stats, Relocations &out);
+    void defragment_images(Context &ctx, DefragmentationStats &stats, std::vector<u32> &moved);
+    void recreate_views(Context &ctx, const std::vector<u32> &moved_images, DefragmentationStats &stats, Relocations &out);
 
     VmaAllocationCreateInfo get_alloc_info(GPUMemoryT type) const {
       VmaAllocationCreateInfo info {};
@@ -144,9 +204,17 @@ namespace drv {
 
     VmaAllocator allocator;
     vk::CommandPool cmd_pool;
+    //transfers are waited, finished buffers are begun again instead of reallocated
+    std::vector<vk::CommandBuffer> free_transfer_cmds;
     RCStorage<Buffer> buffers;
     RCStorage<Image> images;
     RCStorage<ImageView> views;
+    ReleasedHandles released;
+
+    //before the first frame all work is synchronous, so frame 0 is always completed
+    u64 completed_frame = 0;
+    //workers upload uniforms too
+    std::atomic<u64> uploaded_bytes {0};
   };
 
 }
@@ -0,0 +1,295 @@
+#include "shader_compiler.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <chrono>
+#include <filesystem>
+#include <future>
+#include <thread>
+#include <algorithm>
+
+#ifdef USE_SHADERC
+#include <shaderc/shaderc.hpp>
+#endif
+
+namespace drv {
+
+  //bump to invalidate cached spirv after compiler option changes
+  static const u32 CACHE_VERSION = 1;
+
+  static bool read_file(const std::string &path, std::string &out) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+      return false;
+    }
+    std::stringstream stream;
+    stream << file.rdbuf();
+    out = stream.str();
+    return true;
+  }
+
+  static std::vector<char> read_binary(const std::string &path) {
+    std::string data;
+    if (!read_file(path, data)) {
+      throw std::runtime_error {"Failed to open shader " + path};
+    }
+    return std::vector<char>(data.begin(), data.end());
+  }
+
+  //fnv-1a
+  static u64 hash_bytes(u64 hash, const void *data, size_t size) {
+    auto ptr = static_cast<const u8*>(data);
+    for (size_t i = 0; i < size; i++) {
+      hash ^= ptr[i];
+      hash *= 1099511628211ull;
+    }
+    return hash;
+  }
+
+  static u64 hash_string(u64 hash, const std::string &str) {
+    const u8 separator = 0;
+    hash = hash_bytes(hash, str.data(), str.size());
+    return hash_bytes(hash, &separator, 1);
+  }
+
+  static std::string extension(const std::string &path) {
+    return std::filesystem::path(path).extension().string();
+  }
+
+  void ShaderCompiler::init(const std::string &dir) {
+    cache_dir = dir;
+    std::error_code err;
+    std::filesystem::create_directories(cache_dir, err);
+  }
+
+  bool ShaderCompiler::is_source(const std::string &path) {
+    auto ext = extension(path);
+    return ext == ".vert" || ext == ".frag" || ext == ".comp" || ext == ".geom" || ext == ".tesc" || ext == ".tese";
+  }
+
+  vk::ShaderStageFlagBits ShaderCompiler::stage_from_path(const std::string &path) {
+    auto ext = extension(path);
+    if (ext == ".vert") return vk::ShaderStageFlagBits::eVertex;
+    if (ext == ".frag") return vk::ShaderStageFlagBits::eFragment;
+    if (ext == ".comp") return vk::ShaderStageFlagBits::eCompute;
+    if (ext == ".geom") return vk::ShaderStageFlagBits::eGeometry;
+    if (ext == ".tesc") return vk::ShaderStageFlagBits::eTessellationControl;
+    if (ext == ".tese") return vk::ShaderStageFlagBits::eTessellationEvaluation;
+    throw std::runtime_error {"Unknown shader stage for " + path};
+  }
+
+  //includes in comments and disabled branches are collected too, missing files are left to the compiler
+  void ShaderCompiler::collect_includes(const std::string &path, std::vector<std::string> &files) const {
+    if (std::find(files.begin(), files.end(), path) != files.end()) {
+      return;
+    }
+
+    std::string text;
+    if (!read_file(path, text)) {
+      return;
+    }
+    files.push_back(path);
+
+    auto base = std::filesystem::path(path).parent_path();
+    std::istringstream stream(text);
+    std::string line;
+    while (std::getline(stream, line)) {
+      auto start = line.find_first_not_of(" \t");
+      if (start == std::string::npos || line.compare(start, 8, "#include") != 0) {
+        continue;
+      }
+
+      auto open = line.find('"', start);
+      auto close = (open != std::string::npos)? line.find('"', open + 1) : std::string::npos;
+      if (close == std::string::npos) {
+        continue;
+      }
+
+      auto name = line.substr(open + 1, close - open - 1);
+      collect_includes((base / name).lexically_normal().generic_string(), files);
+    }
+  }
+
+  ShaderCompiler::Source ShaderCompiler::preprocess(const std::string &path, vk::ShaderStageFlagBits stage, const ShaderDefines &defines) const {
+    Source src {};
+    collect_includes(path, src.files);
+    if (src.files.empty()) {
+      throw std::runtime_error {"Failed to open shader " + path};
+    }
+
+    u64 hash = 14695981039346656037ull;
+    hash = hash_bytes(hash, &CACHE_VERSION, sizeof(CACHE_VERSION));
+    u32 stage_bits = u32(stage);
+    hash = hash_bytes(hash, &stage_bits, sizeof(stage_bits));
+
+    for (const auto &def : defines) {
+      hash = hash_string(hash, def.first);
+      hash = hash_string(hash, def.second);
+    }
+
+    for (const auto &file : src.files) {
+      std::string text;
+      read_file(file, text);
+      hash = hash_string(hash, text);
+      if (file == path) {
+        src.text = std::move(text);
+      }
+    }
+
+    src.hash = hash;
+    return src;
+  }
+
+  CompiledShader ShaderCompiler::load(const std::string &path, vk::ShaderStageFlagBits stage, const ShaderDefines &defines) {
+    if (!is_source(path)) {
+      return {read_binary(path), {path}, false};
+    }
+
+#ifndef USE_SHADERC
+    auto p = std::filesystem::path(path);
+    auto spv_path = (p.parent_path() / (p.stem().string() + "_" + p.extension().string().substr(1) + ".spv")).generic_string();
+    if (defines.size()) {
+      throw std::runtime_error {"Shader defines need USE_SHADERC, " + path};
+    }
+    return {read_binary(spv_path), {spv_path}, false};
+#else
+    auto src = preprocess(path, stage, defines);
+
+    {
+      std::lock_guard<std::mutex> guard {lock};
+      auto iter = memory_cache.find(src.hash);
+      if (iter != memory_cache.end()) {
+        cache_hits++;
+        return {iter->second, src.files, true};
+      }
+    }
+
+    std::stringstream name;
+    name << cache_dir << "/" << std::hex << std::setw(16) << std::setfill('0') << src.hash << ".spv";
+    auto cache_file = name.str();
+
+    CompiledShader result {{}, src.files, true};
+    std::string cached;
+    if (read_file(cache_file, cached) && cached.size()) {
+      result.code.assign(cached.begin(), cached.end());
+    } else {
+      result.code = compile(src, path, stage, defines);
+      result.from_cache = false;
+
+      //written under a unique name and renamed, so concurrent loads never see partial files
+      auto tmp_file = cache_file + "." + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+      {
+        std::ofstream out(tmp_file, std::ios::binary|std::ios::trunc);
+        out.write(result.code.data(), result.code.size());
+      }
+      std::error_code err;
+      std::filesystem::rename(tmp_file, cache_file, err);
+    }
+
+    std::lock_guard<std::mutex> guard {lock};
+    memory_cache[src.hash] = result.code;
+    if (result.from_cache) {
+      cache_hits++;
+    } else {
+      compiled++;
+    }
+    return result;
+#endif
+  }
+
+#ifdef USE_SHADERC
+  namespace {
+    struct Includer : shaderc::CompileOptions::IncluderInterface {
+      struct Data {
+        std::string name;
+        std::string content;
+        shaderc_include_result result;
+      };
+
+      shaderc_include_result *GetInclude(const char *requested, shaderc_include_type type, const char *requesting, size_t) override {
+        auto data = new Data;
+        auto base = std::filesystem::path(requesting).parent_path();
+        data->name = (type == shaderc_include_type_relative)? (base / requested).lexically_normal().generic_string() : std::string {requested};
+
+        //empty name reports error
+        if (!read_file(data->name, data->content)) {
+          data->content = "Failed to open " + data->name;
+          data->name.clear();
+        }
+
+        data->result = {data->name.c_str(), data->name.size(), data->content.c_str(), data->content.size(), data};
+        return &data->result;
+      }
+
+      void ReleaseInclude(shaderc_include_result *res) override {
+        delete static_cast<Data*>(res->user_data);
+      }
+    };
+
+    shaderc_shader_kind shader_kind(vk::ShaderStageFlagBits stage) {
+      switch (stage) {
+        case vk::ShaderStageFlagBits::eVertex: return shaderc_glsl_vertex_shader;
+        case vk::ShaderStageFlagBits::eFragment: return shaderc_glsl_fragment_shader;
+        case vk::ShaderStageFlagBits::eCompute: return shaderc_glsl_compute_shader;
+        case vk::ShaderStageFlagBits::eGeometry: return shaderc_glsl_geometry_shader;
+        case vk::ShaderStageFlagBits::eTessellationControl: return shaderc_glsl_tess_control_shader;
+        case vk::ShaderStageFlagBits::eTessellationEvaluation: return shaderc_glsl_tess_evaluation_shader;
+        default: throw std::runtime_error {"Unsupported shader stage"};
+      }
+    }
+  }
+
+  std::vector<char> ShaderCompiler::compile(const Source &src, const std::string &path, vk::ShaderStageFlagBits stage, const ShaderDefines &defines) const {
+    //same options as glslc default, unused resources are kept for reflection
+    shaderc::CompileOptions options;
+    options.SetTargetEnvironment(shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_2);
+    options.SetIncluder(std::make_unique<Includer>());
+    for (const auto &def : defines) {
+      options.AddMacroDefinition(def.first, def.second);
+    }
+
+    shaderc::Compiler compiler;
+    auto res = compiler.CompileGlslToSpv(src.text, shader_kind(stage), path.c_str(), options);
+    if (res.GetCompilationStatus() != shaderc_compilation_status_success) {
+      throw std::runtime_error {res.GetErrorMessage()};
+    }
+
+    std::vector<char> code((res.cend() - res.cbegin()) * sizeof(u32));
+    std::copy(res.cbegin(), res.cend(), reinterpret_cast<u32*>(code.data()));
+    return code;
+  }
+#else
+  std::vector<char> ShaderCompiler::compile(const Source &, const std::string &path, vk::ShaderStageFlagBits, const ShaderDefines &) const {
+    throw std::runtime_error {"Built without USE_SHADERC, can't compile " + path};
+  }
+#endif
+
+  void ShaderCompiler::prebuild(WorkerPool &pool, const std::string &dir) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::pair<std::string, std::future<CompiledShader>>> jobs;
+
+    for (const auto &entry : std::filesystem::directory_iterator(dir)) {
+      auto path = entry.path().generic_string();
+      if (!entry.is_regular_file() || !is_source(path)) continue;
+
+      auto stage = stage_from_path(path);
+      jobs.push_back({path, pool.submit([this, path, stage](){ return load(path, stage); })});
+    }
+
+    u32 from_cache = 0;
+    for (auto &job : jobs) {
+      try {
+        from_cache += job.second.get().from_cache? 1 : 0;
+      } catch (const std::runtime_error &e) {
+        //reported again by load_shader if the shader is used
+        std::cout << "Shader " << job.first << ": " << e.what() << "\n";
+      }
+    }
+
+    auto ms = std::chrono::duration<f64, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Shaders: " << jobs.size() << " sources, " << from_cache << " from cache, built in " << ms << " ms\n";
+  }
+
+}
@@ -0,0 +1,57 @@
+#ifndef SHADER_COMPILER_HPP_INCLUDED
+#define SHADER_COMPILER_HPP_INCLUDED
+
+#include "common.hpp"
+#include "worker_pool.hpp"
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+
+namespace drv {
+
+  using ShaderDefines = std::vector<std::pair<std::string, std::string>>;
+
+  struct CompiledShader {
+    std::vector<char> code;
+    std::vector<std::string> files; //source and every included file
+    bool from_cache;
+  };
+
+  //Compiles glsl with libshaderc (USE_SHADERC) and caches spirv in cache_dir.
+  //Cache key is a hash of the source, included files, defines and stage,
+  //so only shaders with changed inputs are rebuilt.
+  //Without shaderc sources resolve to spirv made by compile_shaders.py: shading.frag -> shading_frag.spv
+  struct ShaderCompiler {
+    void init(const std::string &cache_dir = "shader_cache");
+
+    //thread safe. Files with .spv extension are loaded as is
+    CompiledShader load(const std::string &path, vk::ShaderStageFlagBits stage, const ShaderDefines &defines = {});
+    //compiles every shader source in dir on the pool
+    void prebuild(WorkerPool &pool, const std::string &dir);
+
+    static bool is_source(const std::string &path);
+    static vk::ShaderStageFlagBits stage_from_path(const std::string &path);
+
+  private:
+    struct Source {
+      std::string text;
+      std::vector<std::string> files;
+      u64 hash;
+    };
+
+    Source preprocess(const std::string &path, vk::ShaderStageFlagBits stage, const ShaderDefines &defines) const;
+    void collect_includes(const std::string &path, std::vector<std::string> &files) const;
+    std::vector<char> compile(const Source &src, const std::string &path, vk::ShaderStageFlagBits stage, const ShaderDefines &defines) const;
+
+    std::string cache_dir;
+    std::mutex lock;
+    std::unordered_map<u64, std::vector<char>> memory_cache;
+    u32 compiled = 0;
+    u32 cache_hits = 0;
+  };
+
+}
+
+#endif
@@ -0,0 +1,290 @@
+#include "shader_reflection.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace drv {
+
+  namespace spv {
+    const u32 MAGIC = 0x07230203;
+    const u32 HEADER_WORDS = 5;
+
+    enum Op : u32 {
+      OpDecorate = 71,
+      OpMemberDecorate = 72,
+      OpTypeBool = 20,
+      OpTypeInt = 21,
+      OpTypeFloat = 22,
+      OpTypeVector = 23,
+      OpTypeMatrix = 24,
+      OpTypeImage = 25,
+      OpTypeSampler = 26,
+      OpTypeSampledImage = 27,
+      OpTypeArray = 28,
+      OpTypeRuntimeArray = 29,
+      OpTypeStruct = 30,
+      OpTypePointer = 32,
+      OpConstant = 43,
+      OpSpecConstant = 50,
+      OpVariable = 59
+    };
+
+    enum Decoration : u32 {
+      Block = 2,
+      BufferBlock = 3,
+      ArrayStride = 6,
+      MatrixStride = 7,
+      Binding = 33,
+      DescriptorSet = 34,
+      Offset = 35
+    };
+
+    enum StorageClass : u32 {
+      UniformConstant = 0,
+      Uniform = 2,
+      PushConstant = 9,
+      StorageBuffer = 12
+    };
+
+    enum Dim : u32 {
+      DimBuffer = 5,
+      DimSubpassData = 6
+    };
+  }
+
+  namespace {
+    const u32 NONE = ~0u;
+
+    struct Member {
+      u32 offset = 0;
+      u32 matrix_stride = 0;
+    };
+
+    //everything known about one result id
+    struct Id {
+      u32 opcode = 0;
+      u32 type = 0; //element, pointee, image or variable type
+      u32 count = 0; //width of scalars, components of vectors and matrices, length id of arrays
+      u32 value = 0;
+      u32 storage = NONE;
+      u32 set = NONE;
+      u32 binding = NONE;
+      u32 array_stride = 0;
+      u32 image_dim = 0;
+      u32 image_sampled = 0;
+      bool block = false;
+      bool buffer_block = false;
+      std::vector<u32> members;
+      std::vector<Member> member_info;
+    };
+
+    struct Module {
+      std::vector<Id> ids;
+
+      Id &at(u32 id) {
+        if (id >= ids.size()) {
+          throw std::runtime_error {"SPIR-V id out of bounds"};
+        }
+        return ids[id];
+      }
+
+      Member &member(u32 id, u32 index) {
+        auto &elem = at(id);
+        if (elem.member_info.size() <= index) {
+          elem.member_info.resize(index + 1);
+        }
+        return elem.member_info[index];
+      }
+
+      u32 size_of(u32 id, u32 matrix_stride = 0) {
+        auto &t = at(id);
+        switch (t.opcode) {
+          case spv::OpTypeBool: return 4;
+          case spv::OpTypeInt:
+          case spv::OpTypeFloat: return t.count/8;
+          case spv::OpTypeVector: return t.count * size_of(t.type);
+          case spv::OpTypeMatrix: return t.count * (matrix_stride? matrix_stride : size_of(t.type));
+          case spv::OpTypeArray: {
+            u32 length = at(t.count).value;
+            return length * (t.array_stride? t.array_stride : size_of(t.type, matrix_stride));
+          }
+          case spv::OpTypeRuntimeArray: return 0;
+          case spv::OpTypeStruct: {
+            u32 size = 0;
+            for (u32 i = 0; i < t.members.size(); i++) {
+              auto info = (i < t.member_info.size())? t.member_info[i] : Member {};
+              size = max(size, info.offset + size_of(t.members[i], info.matrix_stride));
+            }
+            return size;
+          }
+        }
+        throw std::runtime_error {"Unsupported type in push constants block"};
+      }
+
+      //strips arrays from type, returns descriptor type
+      vk::DescriptorType descriptor_type(u32 storage, u32 type, u32 &count) {
+        count = 1;
+        auto *t = &at(type);
+        while (t->opcode == spv::OpTypeArray || t->opcode == spv::OpTypeRuntimeArray) {
+          if (t->opcode == spv::OpTypeRuntimeArray) {
+            throw std::runtime_error {"Unsized descriptor arrays are not supported"};
+          }
+          count *= at(t->count).value;
+          t = &at(t->type);
+        }
+
+        if (storage == spv::StorageBuffer) {
+          return vk::DescriptorType::eStorageBuffer;
+        }
+
+        if (storage == spv::Uniform) {
+          if (t->opcode != spv::OpTypeStruct) {
+            throw std::runtime_error {"Uniform variable is not a block"};
+          }
+          return t->buffer_block? vk::DescriptorType::eStorageBuffer : vk::DescriptorType::eUniformBuffer;
+        }
+
+        switch (t->opcode) {
+          case spv::OpTypeSampler: return vk::DescriptorType::eSampler;
+          case spv::OpTypeSampledImage: return vk::DescriptorType::eCombinedImageSampler;
+          case spv::OpTypeImage: {
+            bool storage_image = (t->image_sampled == 2);
+            if (t->image_dim == spv::DimSubpassData) return vk::DescriptorType::eInputAttachment;
+            if (t->image_dim == spv::DimBuffer) {
+              return storage_image? vk::DescriptorType::eStorageTexelBuffer : vk::DescriptorType::eUniformTexelBuffer;
+            }
+            return storage_image? vk::DescriptorType::eStorageImage : vk::DescriptorType::eSampledImage;
+          }
+        }
+        throw std::runtime_error {"Unsupported descriptor type"};
+      }
+    };
+  }
+
+  ShaderInterface reflect_spirv(const u32 *code, size_t words, vk::ShaderStageFlags stages) {
+    if (words < spv::HEADER_WORDS || code[0] != spv::MAGIC) {
+      throw std::runtime_error {"Invalid SPIR-V module"};
+    }
+
+    Module module;
+    module.ids.resize(code[3]);
+    std::vector<u32> variables;
+
+    for (size_t pos = spv::HEADER_WORDS; pos < words;) {
+      u32 opcode = code[pos] & 0xffffu;
+      u32 count = code[pos] >> 16u;
+      if (!count || pos + count > words) {
+        throw std::runtime_error {"Truncated SPIR-V instruction"};
+      }
+      const u32 *op = code + pos;
+      pos += count;
+
+      switch (opcode) {
+        case spv::OpDecorate: {
+          auto &target = module.at(op[1]);
+          switch (op[2]) {
+            case spv::DescriptorSet: target.set = op[3]; break;
+            case spv::Binding: target.binding = op[3]; break;
+            case spv::Block: target.block = true; break;
+            case spv::BufferBlock: target.buffer_block = true; break;
+            case spv::ArrayStride: target.array_stride = op[3]; break;
+          }
+          break;
+        }
+        case spv::OpMemberDecorate: {
+          if (op[3] == spv::Offset) module.member(op[1], op[2]).offset = op[4];
+          if (op[3] == spv::MatrixStride) module.member(op[1], op[2]).matrix_stride = op[4];
+          break;
+        }
+        case spv::OpTypeBool:
+        case spv::OpTypeSampler:
+          module.at(op[1]).opcode = opcode;
+          break;
+        case spv::OpTypeInt:
+        case spv::OpTypeFloat:
+          module.at(op[1]).opcode = opcode;
+          module.at(op[1]).count = op[2];
+          break;
+        case spv::OpTypeVector:
+        case spv::OpTypeMatrix:
+        case spv::OpTypeArray:
+          module.at(op[1]).opcode = opcode;
+          module.at(op[1]).type = op[2];
+          module.at(op[1]).count = op[3];
+          break;
+        case spv::OpTypeRuntimeArray:
+        case spv::OpTypeSampledImage:
+          module.at(op[1]).opcode = opcode;
+          module.at(op[1]).type = op[2];
+          break;
+        case spv::OpTypeImage:
+          module.at(op[1]).opcode = opcode;
+          module.at(op[1]).image_dim = op[3];
+          module.at(op[1]).image_sampled = op[7];
+          break;
+        case spv::OpTypeStruct:
+          module.at(op[1]).opcode = opcode;
+          module.at(op[1]).members.assign(op + 2, op + count);
+          break;
+        case spv::OpTypePointer:
+          module.at(op[1]).opcode = opcode;
+          module.at(op[1]).storage = op[2];
+          module.at(op[1]).type = op[3];
+          break;
+        //array lengths, spec constants are taken with their default values
+        case spv::OpConstant:
+        case spv::OpSpecConstant:
+          module.at(op[2]).opcode = opcode;
+          module.at(op[2]).value = op[3];
+          break;
+        case spv::OpVariable:
+          module.at(op[2]).opcode = opcode;
+          module.at(op[2]).type = op[1];
+          module.at(op[2]).storage = op[3];
+          variables.push_back(op[2]);
+          break;
+      }
+    }
+
+    ShaderInterface result;
+    for (auto id : variables) {
+      auto &var = module.at(id);
+      auto &pointer = module.at(var.type);
+
+      if (var.storage == spv::PushConstant) {
+        result.push_constants_size = max(result.push_constants_size, module.size_of(pointer.type));
+        continue;
+      }
+
+      if (var.storage != spv::UniformConstant && var.storage != spv::Uniform && var.storage != spv::StorageBuffer) {
+        continue;
+      }
+
+      if (var.set == NONE || var.binding == NONE) {
+        throw std::runtime_error {"Shader resource without set or binding decoration"};
+      }
+
+      ShaderBinding binding {};
+      binding.set = var.set;
+      binding.binding = var.binding;
+      binding.type = module.descriptor_type(var.storage, pointer.type, binding.count);
+      binding.stages = stages;
+      result.bindings.push_back(binding);
+    }
+
+    std::sort(result.bindings.begin(), result.bindings.end(), [](const ShaderBinding &a, const ShaderBinding &b){
+      return (a.set != b.set)? a.set < b.set : a.binding < b.binding;
+    });
+
+    for (u32 i = 1; i < result.bindings.size(); i++) {
+      auto &prev = result.bindings[i - 1];
+      auto &next = result.bindings[i];
+      if (prev.set == next.set && prev.binding == next.binding) {
+        throw std::runtime_error {"Set " + std::to_string(next.set) + " binding " + std::to_string(next.binding) + " is declared twice"};
+      }
+    }
+
+    return result;
+  }
+
+}
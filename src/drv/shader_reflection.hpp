@@ -0,0 +1,40 @@
+#ifndef SHADER_REFLECTION_HPP_INCLUDED
+#define SHADER_REFLECTION_HPP_INCLUDED
+
+#include "common.hpp"
+
+#include <vector>
+#include <string>
+
+namespace drv {
+
+  struct ShaderBinding {
+    u32 set;
+    u32 binding;
+    vk::DescriptorType type;
+    u32 count;
+    vk::ShaderStageFlags stages;
+  };
+
+  //resources declared by a spirv module
+  struct ShaderInterface {
+    std::vector<ShaderBinding> bindings; //sorted by set, binding
+    u32 push_constants_size = 0;
+  };
+
+  inline bool operator==(const ShaderBinding &a, const ShaderBinding &b) {
+    return a.set == b.set && a.binding == b.binding && a.type == b.type && a.count == b.count && a.stages == b.stages;
+  }
+
+  inline bool operator==(const ShaderInterface &a, const ShaderInterface &b) {
+    return a.bindings == b.bindings && a.push_constants_size == b.push_constants_size;
+  }
+
+  inline bool operator!=(const ShaderInterface &a, const ShaderInterface &b) { return !(a == b); }
+
+  //Parses decorations and types of resource variables. Throws on malformed code or unsupported resources
+  ShaderInterface reflect_spirv(const u32 *code, size_t words, vk::ShaderStageFlags stages);
+
+}
+
+#endif
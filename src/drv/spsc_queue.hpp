@@ -0,0 +1,46 @@
+#ifndef SPSC_QUEUE_HPP_INCLUDED
+#define SPSC_QUEUE_HPP_INCLUDED
+
+#include "common.hpp"
+
+#include <atomic>
+
+namespace drv {
+
+  //Bounded queue for one producer and one consumer thread, SIZE is a power of two
+  template <typename T, u32 SIZE>
+  struct SpscQueue {
+    static_assert(SIZE && !(SIZE & (SIZE - 1)), "SpscQueue size must be a power of two");
+
+    //producer thread, false if the queue is full
+    bool push(const T &value) {
+      u32 t = tail.load(std::memory_order_relaxed);
+      if (t - head.load(std::memory_order_acquire) == SIZE) {
+        return false;
+      }
+      items[t & (SIZE - 1)] = value;
+      tail.store(t + 1, std::memory_order_release);
+      return true;
+    }
+
+    //consumer thread, false if the queue is empty
+    bool pop(T &out) {
+      u32 h = head.load(std::memory_order_relaxed);
+      if (h == tail.load(std::memory_order_acquire)) {
+        return false;
+      }
+      out = items[h & (SIZE - 1)];
+      head.store(h + 1, std::memory_order_release);
+      return true;
+    }
+
+  private:
+    T items[SIZE];
+    //separate cache lines, producer and consumer don't invalidate each other
+    alignas(64) std::atomic<u32> head {0};
+    alignas(64) std::atomic<u32> tail {0};
+  };
+
+}
+
+#endif
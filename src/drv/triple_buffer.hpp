@@ -0,0 +1,40 @@
+#ifndef TRIPLE_BUFFER_HPP_INCLUDED
+#define TRIPLE_BUFFER_HPP_INCLUDED
+
+#include "common.hpp"
+
+#include <atomic>
+
+namespace drv {
+
+  //Latest value from one writer thread for one reader thread, neither side waits.
+  //Writer fills its own buffer and swaps it with the middle one, reader takes the middle one if it is newer.
+  template <typename T>
+  struct TripleBuffer {
+    //writer thread
+    void publish(const T &value) {
+      buffers[back] = value;
+      back = middle.exchange(back | NEW_BIT, std::memory_order_acq_rel) & INDEX_MASK;
+    }
+
+    //reader thread, value stays valid until the next call
+    const T &read() {
+      if (middle.load(std::memory_order_relaxed) & NEW_BIT) {
+        front = middle.exchange(front, std::memory_order_acq_rel) & INDEX_MASK;
+      }
+      return buffers[front];
+    }
+
+  private:
+    static constexpr u32 NEW_BIT = 4;
+    static constexpr u32 INDEX_MASK = 3;
+
+    T buffers[3] {};
+    u32 front = 0; //reader only
+    u32 back = 1; //writer only
+    std::atomic<u32> middle {2};
+  };
+
+}
+
+#endif
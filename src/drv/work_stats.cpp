@@ -0,0 +1,205 @@
+#include "work_stats.hpp"
+#include "lib/vkimgui/imgui.h"
+
+#include <iostream>
+
+namespace drv {
+
+  WorkCounters &WorkCounters::operator+=(const WorkCounters &c) {
+    draws += c.draws;
+    dispatches += c.dispatches;
+    triangles += c.triangles;
+    pipeline_binds += c.pipeline_binds;
+    descriptor_binds += c.descriptor_binds;
+    upload_bytes += c.upload_bytes;
+    vertex_invocations += c.vertex_invocations;
+    fragment_invocations += c.fragment_invocations;
+    return *this;
+  }
+
+  void PassCounters::add(const WorkCounters &c) {
+    draws.fetch_add(c.draws, std::memory_order_relaxed);
+    dispatches.fetch_add(c.dispatches, std::memory_order_relaxed);
+    triangles.fetch_add(c.triangles, std::memory_order_relaxed);
+    pipeline_binds.fetch_add(c.pipeline_binds, std::memory_order_relaxed);
+    descriptor_binds.fetch_add(c.descriptor_binds, std::memory_order_relaxed);
+    upload_bytes.fetch_add(c.upload_bytes, std::memory_order_relaxed);
+  }
+
+  WorkCounters PassCounters::take() {
+    WorkCounters c {};
+    c.draws = draws.exchange(0, std::memory_order_relaxed);
+    c.dispatches = dispatches.exchange(0, std::memory_order_relaxed);
+    c.triangles = triangles.exchange(0, std::memory_order_relaxed);
+    c.pipeline_binds = pipeline_binds.exchange(0, std::memory_order_relaxed);
+    c.descriptor_binds = descriptor_binds.exchange(0, std::memory_order_relaxed);
+    c.upload_bytes = upload_bytes.exchange(0, std::memory_order_relaxed);
+    return c;
+  }
+
+  void WorkStats::init(Context &ctx) {
+    supported = ctx.has_pipeline_statistics();
+    if (!supported) {
+      std::cout << "Pipeline statistics queries are not supported, only recorded commands are counted\n";
+      return;
+    }
+
+    vk::QueryPoolCreateInfo info {};
+    info
+      .setQueryType(vk::QueryType::ePipelineStatistics)
+      .setPipelineStatistics(STATISTICS)
+      .setQueryCount(MAX_QUERIES * MAX_FRAMES_IN_FLIGHT);
+    pool = ctx.get_device().createQueryPool(info);
+    enabled = true;
+  }
+
+  void WorkStats::release(Context &ctx) {
+    if (supported) {
+      ctx.get_device().destroyQueryPool(pool);
+    }
+    supported = false;
+    enabled = false;
+  }
+
+  PassCounters &WorkStats::pass(const std::string &name) {
+    auto iter = pass_index.find(name);
+    if (iter == pass_index.end()) {
+      iter = pass_index.insert({name, u32(passes.size())}).first;
+      passes.emplace_back(new Pass {});
+      passes.back()->name = name;
+    }
+
+    auto &p = *passes[iter->second];
+    p.used = true;
+    return p.counters;
+  }
+
+  void WorkStats::begin_frame(Context &ctx, vk::CommandBuffer &cmd, u32 slot) {
+    resolve(ctx, slot);
+    if (!enabled) {
+      return;
+    }
+
+    cmd.resetQueryPool(pool, slot * MAX_QUERIES, MAX_QUERIES);
+    slots[slot].used = 0;
+    slots[slot].pending = true;
+  }
+
+  void WorkStats::end_frame(const ResourceStorage &storage) {
+    frame_stats.clear();
+    frame_total = {};
+
+    for (auto &p : passes) {
+      if (!p->used) {
+        continue;
+      }
+      p->used = false;
+
+      PassStats stats {p->name, p->counters.take()};
+      auto iter = invocations.find(p->name);
+      if (iter != invocations.end()) {
+        stats.counters.vertex_invocations = iter->second.first;
+        stats.counters.fragment_invocations = iter->second.second;
+      }
+      frame_total += stats.counters;
+      frame_stats.push_back(std::move(stats));
+    }
+
+    u64 total = storage.get_uploaded_bytes();
+    frame_total.upload_bytes = total - uploaded;
+    uploaded = total;
+  }
+
+  void WorkStats::reset(const ResourceStorage &storage) {
+    for (auto &p : passes) {
+      p->counters.take();
+      p->used = false;
+    }
+    uploaded = storage.get_uploaded_bytes();
+  }
+
+  u32 WorkStats::begin_query(vk::CommandBuffer &cmd, u32 slot, const std::string &name) {
+    auto &s = slots[slot];
+    if (!enabled || !s.pending || s.used >= MAX_QUERIES) {
+      return ~0u;
+    }
+
+    u32 query = s.used++;
+    s.names[query] = name;
+    cmd.beginQuery(pool, slot * MAX_QUERIES + query, {});
+    return query;
+  }
+
+  void WorkStats::end_query(vk::CommandBuffer &cmd, u32 slot, u32 query) {
+    if (query == ~0u) {
+      return;
+    }
+    cmd.endQuery(pool, slot * MAX_QUERIES + query);
+  }
+
+  void WorkStats::resolve(Context &ctx, u32 slot) {
+    auto &s = slots[slot];
+    if (!s.pending) {
+      return;
+    }
+    s.pending = false;
+
+    if (!s.used) {
+      return;
+    }
+
+    //vertex and fragment invocations in bit order, then availability
+    std::vector<u64> data(3 * s.used);
+    auto flags = vk::QueryResultFlagBits::e64|vk::QueryResultFlagBits::eWithAvailability;
+    auto res = ctx.get_device().getQueryPoolResults(pool, slot * MAX_QUERIES, s.used, data.size() * sizeof(u64), data.data(), 3 * sizeof(u64), flags);
+    if (res != vk::Result::eSuccess && res != vk::Result::eNotReady) {
+      return;
+    }
+
+    for (u32 i = 0; i < s.used; i++) {
+      if (!data[3 * i + 2]) {
+        continue;
+      }
+      invocations[s.names[i]] = {data[3 * i], data[3 * i + 1]};
+    }
+  }
+
+  void WorkStats::draw_ui() {
+    ImGui::Begin("Work stats");
+    if (supported) {
+      ImGui::Checkbox("Pipeline statistics", &enabled);
+    } else {
+      ImGui::Text("Pipeline statistics are not supported");
+    }
+
+    auto flags = ImGuiTableFlags_BordersV|ImGuiTableFlags_BordersOuterH|ImGuiTableFlags_RowBg;
+    if (ImGui::BeginTable("work", 9, flags)) {
+      const char *columns[] = {"draws", "dispatches", "triangles", "pipelines", "sets", "upload", "vs", "fs"};
+      ImGui::TableSetupColumn("Pass", ImGuiTableColumnFlags_NoHide);
+      for (auto name : columns) {
+        ImGui::TableSetupColumn(name, ImGuiTableColumnFlags_WidthFixed, 70.f);
+      }
+      ImGui::TableHeadersRow();
+
+      auto row = [](const std::string &name, const WorkCounters &c) {
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        ImGui::TextUnformatted(name.c_str());
+        u64 values[] {c.draws, c.dispatches, c.triangles, c.pipeline_binds, c.descriptor_binds, c.upload_bytes,
+          c.vertex_invocations, c.fragment_invocations};
+        for (auto v : values) {
+          ImGui::TableNextColumn();
+          ImGui::Text("%llu", (unsigned long long)v);
+        }
+      };
+
+      for (auto &p : frame_stats) {
+        row(p.name, p.counters);
+      }
+      row("total", frame_total);
+      ImGui::EndTable();
+    }
+    ImGui::End();
+  }
+
+}
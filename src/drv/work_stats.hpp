@@ -0,0 +1,133 @@
+#ifndef WORK_STATS_HPP_INCLUDED
+#define WORK_STATS_HPP_INCLUDED
+
+#include "common.hpp"
+#include "context.hpp"
+#include "draw_context.hpp"
+#include "resources.hpp"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace drv {
+
+  //work of one pass in one frame
+  struct WorkCounters {
+    u64 draws = 0;
+    u64 dispatches = 0;
+    u64 triangles = 0; //submitted, before culling
+    u64 pipeline_binds = 0;
+    u64 descriptor_binds = 0; //sets
+    u64 upload_bytes = 0;
+    //pipeline statistics, 0 without queries
+    u64 vertex_invocations = 0;
+    u64 fragment_invocations = 0;
+
+    WorkCounters &operator+=(const WorkCounters &c);
+  };
+
+  //Recording code counts its commands here, any thread may add.
+  //Hot loops count into a local WorkCounters and add it once.
+  struct PassCounters {
+    void draw(u32 vertices, u32 instances = 1) {
+      draws.fetch_add(1, std::memory_order_relaxed);
+      triangles.fetch_add(u64(vertices/3) * instances, std::memory_order_relaxed);
+    }
+    void dispatch() { dispatches.fetch_add(1, std::memory_order_relaxed); }
+    void bind_pipeline() { pipeline_binds.fetch_add(1, std::memory_order_relaxed); }
+    void bind_descriptors(u32 sets = 1) { descriptor_binds.fetch_add(sets, std::memory_order_relaxed); }
+    void upload(u64 bytes) { upload_bytes.fetch_add(bytes, std::memory_order_relaxed); }
+    void add(const WorkCounters &c);
+
+  private:
+    WorkCounters take();
+
+    std::atomic<u64> draws {0};
+    std::atomic<u64> dispatches {0};
+    std::atomic<u64> triangles {0};
+    std::atomic<u64> pipeline_binds {0};
+    std::atomic<u64> descriptor_binds {0};
+    std::atomic<u64> upload_bytes {0};
+
+    friend struct WorkStats;
+  };
+
+  //Commands recorded by the passes of a frame and vertex/fragment invocations from pipeline statistics queries.
+  //Render graph puts a query around every pass and counts bytes uploaded by buffer_memcpy while the pass is recorded,
+  //uploads of workers recording another pass at the same time go to the running one.
+  //Queries of a slot are read when the slot is begun again, like GpuProfiler zones, so invocations come
+  //frames in flight later than counters. Rows are matched by pass name.
+  struct WorkStats {
+    static constexpr u32 MAX_QUERIES = 32; //per slot
+
+    struct PassStats {
+      std::string name;
+      WorkCounters counters;
+    };
+
+    void init(Context &ctx);
+    void release(Context &ctx);
+
+    //render thread, counters of the pass in the frame being recorded, references stay valid
+    PassCounters &pass(const std::string &name);
+
+    //resolves queries of the slot and resets them, cmd is primary and outside of render pass
+    void begin_frame(Context &ctx, vk::CommandBuffer &cmd, u32 slot);
+    //after all passes are recorded, counters of the frame become the last frame stats
+    void end_frame(const ResourceStorage &storage);
+    //drops work recorded before the first frame
+    void reset(const ResourceStorage &storage);
+
+    //returns ~0u when queries are disabled or the slot is full
+    u32 begin_query(vk::CommandBuffer &cmd, u32 slot, const std::string &name);
+    void end_query(vk::CommandBuffer &cmd, u32 slot, u32 query);
+
+    //for inheritance info of secondary buffers executed inside a pass
+    vk::QueryPipelineStatisticFlags get_inherited_statistics() const { return supported? STATISTICS : vk::QueryPipelineStatisticFlags {}; }
+    bool has_pipeline_statistics() const { return supported; }
+
+    const std::vector<PassStats> &get_frame_stats() const { return frame_stats; }
+    //sum of passes, uploads include ones made outside of passes
+    const WorkCounters &get_frame_total() const { return frame_total; }
+
+    void draw_ui();
+
+  private:
+    static constexpr vk::QueryPipelineStatisticFlags STATISTICS =
+      vk::QueryPipelineStatisticFlagBits::eVertexShaderInvocations|vk::QueryPipelineStatisticFlagBits::eFragmentShaderInvocations;
+
+    struct Slot {
+      u32 used = 0;
+      bool pending = false;
+      std::string names[MAX_QUERIES];
+    };
+
+    struct Pass {
+      std::string name;
+      PassCounters counters;
+      bool used = false;
+    };
+
+    void resolve(Context &ctx, u32 slot);
+
+    bool supported = false;
+    bool enabled = false; //queries are written
+    vk::QueryPool pool;
+    Slot slots[MAX_FRAMES_IN_FLIGHT];
+
+    std::vector<std::unique_ptr<Pass>> passes;
+    std::unordered_map<std::string, u32> pass_index;
+    u64 uploaded = 0; //storage counter at the end of the last frame
+
+    //last resolved invocations, vertex and fragment
+    std::unordered_map<std::string, std::pair<u64, u64>> invocations;
+    std::vector<PassStats> frame_stats;
+    WorkCounters frame_total;
+  };
+
+}
+
+#endif
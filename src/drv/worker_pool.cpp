@@ -0,0 +1,55 @@
+#include "worker_pool.hpp"
+#include "cpu_profiler.hpp"
+
+namespace drv {
+
+  static thread_local u32 current_thread_index = 0;
+
+  u32 WorkerPool::thread_index() {
+    return current_thread_index;
+  }
+
+  void WorkerPool::init(u32 threads) {
+    if (!threads) {
+      auto hw = std::thread::hardware_concurrency();
+      threads = (hw > 1)? hw - 1 : 1;
+    }
+
+    stop = false;
+    for (u32 i = 0; i < threads; i++) {
+      workers.emplace_back([this, i](){ worker_loop(i + 1); });
+    }
+  }
+
+  void WorkerPool::release() {
+    {
+      std::lock_guard<std::mutex> guard {lock};
+      stop = true;
+    }
+    has_jobs.notify_all();
+
+    for (auto &t : workers) {
+      t.join();
+    }
+    workers.clear();
+  }
+
+  void WorkerPool::worker_loop(u32 index) {
+    current_thread_index = index;
+    CPU_THREAD_NAME("worker " + std::to_string(index));
+    while (true) {
+      std::function<void()> job;
+      {
+        std::unique_lock<std::mutex> guard {lock};
+        has_jobs.wait(guard, [this](){ return stop || !jobs.empty(); });
+        //queued jobs are finished before exit, futures must not be left broken
+        if (jobs.empty()) return;
+        job = std::move(jobs.front());
+        jobs.pop();
+      }
+      CPU_ZONE("job");
+      job();
+    }
+  }
+
+}
@@ -0,0 +1,52 @@
+#ifndef WORKER_POOL_HPP_INCLUDED
+#define WORKER_POOL_HPP_INCLUDED
+
+#include "common.hpp"
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace drv {
+
+  //fixed set of threads executing jobs in submission order
+  struct WorkerPool {
+    //threads = 0 picks hardware concurrency minus the main thread
+    void init(u32 threads = 0);
+    void release();
+
+    u32 size() const { return workers.size(); }
+    //0 for threads outside of pools, 1..size() for workers
+    static u32 thread_index();
+
+    template <typename F>
+    auto submit(F &&f) -> std::future<decltype(f())> {
+      using Result = decltype(f());
+      auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(f));
+      auto result = task->get_future();
+      {
+        std::lock_guard<std::mutex> guard {lock};
+        jobs.push([task](){ (*task)(); });
+      }
+      has_jobs.notify_one();
+      return result;
+    }
+
+  private:
+    void worker_loop(u32 index);
+
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> jobs;
+    std::mutex lock;
+    std::condition_variable has_jobs;
+    bool stop = false;
+  };
+
+}
+
+#endif
@@ -0,0 +1,113 @@
+#ifndef DYNAMIC_RESOLUTION_HPP_INCLUDED
+#define DYNAMIC_RESOLUTION_HPP_INCLUDED
+
+#include "drv/common.hpp"
+
+#include <glm/glm.hpp>
+#include <cmath>
+#include <stdexcept>
+
+struct DynamicResolutionConfig {
+  bool enabled = true;
+  //gpu time of a frame, ms
+  f32 target_ms = 16.6f;
+  //part of full extent per axis
+  f32 min_scale = 0.5f;
+};
+
+//Picks the extent gbuffer and shading are rendered at from gpu time of the last resolved frame.
+//Cost is taken as proportional to pixel count. Gpu time comes frames in flight late,
+//so after a change the scale is held until frames rendered with it are measured.
+struct DynamicResolution {
+  //render extent is a multiple of it
+  static constexpr u32 ALIGN = 8;
+  //scale goes up only below this part of the target, so it doesn't oscillate around it
+  static constexpr f32 HEADROOM = 0.85f;
+  //per change, drops fast in heavy views and recovers slowly
+  static constexpr f32 MAX_STEP_DOWN = 0.15f;
+  static constexpr f32 MAX_STEP_UP = 0.05f;
+
+  void init(const DynamicResolutionConfig &c, vk::Extent2D full_extent, u32 latency_frames) {
+    full = full_extent;
+    latency = latency_frames;
+    configure(c);
+    set_scale(1.f);
+  }
+
+  void configure(const DynamicResolutionConfig &c) {
+    if (c.target_ms <= 0.f) {
+      throw std::runtime_error {"Dynamic resolution target must be positive"};
+    }
+    if (c.min_scale <= 0.f || c.min_scale > 1.f) {
+      throw std::runtime_error {"Dynamic resolution min scale must be in (0, 1]"};
+    }
+    config = c;
+  }
+
+  //once per frame, before gbuffer is recorded
+  vk::Extent2D update(f32 gpu_ms) {
+    if (!config.enabled) {
+      set_scale(1.f);
+      return extent;
+    }
+
+    if (hold) {
+      hold--;
+      return extent;
+    }
+
+    if (gpu_ms <= 0.f) {
+      return extent;
+    }
+
+    f32 next = scale;
+    if (gpu_ms > config.target_ms) {
+      next = max(scale * std::sqrt(config.target_ms/gpu_ms), scale - MAX_STEP_DOWN);
+    } else if (gpu_ms < HEADROOM * config.target_ms) {
+      next = min(scale * std::sqrt(HEADROOM * config.target_ms/gpu_ms), scale + MAX_STEP_UP);
+    }
+    next = glm::clamp(next, config.min_scale, 1.f);
+
+    auto prev = extent;
+    set_scale(next);
+    if (prev != extent) {
+      hold = latency;
+    }
+    return extent;
+  }
+
+  const DynamicResolutionConfig &get_config() const { return config; }
+  vk::Extent2D get_extent() const { return extent; }
+  f32 get_scale() const { return scale; }
+
+  //rendered part of full size targets in uv
+  glm::vec2 get_uv_scale() const {
+    return {f32(extent.width)/full.width, f32(extent.height)/full.height};
+  }
+
+  //keeps bilinear taps inside the rendered part
+  glm::vec2 get_uv_max() const {
+    return {(extent.width - 0.5f)/full.width, (extent.height - 0.5f)/full.height};
+  }
+
+private:
+  void set_scale(f32 s) {
+    scale = s;
+    extent.width = align(full.width, s);
+    extent.height = align(full.height, s);
+  }
+
+  static u32 align(u32 size, f32 s) {
+    u32 aligned = u32(std::round(size * s/ALIGN)) * ALIGN;
+    return glm::clamp(aligned, min(ALIGN, size), size);
+  }
+
+  DynamicResolutionConfig config;
+  vk::Extent2D full {};
+  vk::Extent2D extent {};
+  f32 scale = 1.f;
+  u32 latency = 0;
+  u32 hold = 0;
+};
+
+#endif
@@ -7,22 +7,38 @@
 #include "lightfield_probes.hpp"
 #include "shpherical_harmonics.hpp"
 #include "config.hpp"
+#include "drv/triple_buffer.hpp"
 
 #include <iostream>
+#include <chrono>
 
 struct FrameGlobal {
   void init(DriverState &ds) {
-    scene.load("assets/Sponza/glTF/Sponza.gltf", "assets/Sponza/glTF/");
-    scene.gen_buffers(ds);
+    {
+      CPU_ZONE("scene load");
+      scene.load("assets/Sponza/glTF/Sponza.gltf", "assets/Sponza/glTF/");
+    }
+    {
+      CPU_ZONE("buffer upload");
+      scene.gen_buffers(ds);
+    }
 
     scene.add_light({0.f, 4.f, 0.f}, {10.f, 10.f, 10.f});
     scene.add_light({5.30641, 0.947165, -1.44263}, {0.f, 2.f, 0.f});
-    scene.gen_shadows(ds);
-
-    scene.gen_textures(ds);
-
-    light_field.init(ds);
-    light_field.render(ds, scene, glm::vec3{-10, 0.295498, -4}, glm::vec3{10, 2.50458, 4}, glm::uvec3{6, 3, 4});
+    {
+      CPU_ZONE("shadow bake");
+      scene.gen_shadows(ds);
+    }
+    {
+      CPU_ZONE("texture load");
+      scene.gen_textures(ds);
+    }
+    drv::GpuTask filter_task;
+    {
+      CPU_ZONE("probe bake");
+      light_field.init(ds);
+      filter_task = light_field.render(ds, scene, glm::vec3{-10, 0.295498, -4}, glm::vec3{10, 2.50458, 4}, glm::uvec3{6, 3, 4});
+    }
 
     vk::SamplerCreateInfo smp {};
     smp
@@ -43,23 +59,53 @@ struct FrameGlobal {
     default_sampler = ds.ctx.get_device().createSampler(smp);
     nearest_sampler = ds.ctx.get_device().createSampler(smp2);
 
-    auto sh_pass = new SHPass{ds};
-    sh_probes = sh_pass->integrate(ds, light_field.get_distance_array(), default_sampler);
-    delete sh_pass;
+    //probe filtering and sh run on the compute queue, frames wait for them on gpu
+    {
+      CPU_ZONE("sh integrate");
+      sh_pass = new SHPass{ds};
+      bake_task = sh_pass->integrate(ds, light_field.get_distance_array(), default_sampler, sh_probes, filter_task);
+    }
+
+    current_pose = get_pose();
+    publish_camera(current_pose, std::chrono::steady_clock::now(), 1.f);
+    latch_camera(std::chrono::steady_clock::now());
   }
 
   void release(DriverState &ds) {
+    ds.scheduler.wait(ds.ctx, bake_task);
+    collect_bake(ds);
     light_field.release(ds);
     ds.ctx.get_device().destroySampler(default_sampler);
   }
 
-  void update(float dt) {
-    std::lock_guard<std::mutex> lock{frame_lock};
+  //Render thread, before the frame is recorded. Until the bake is finished every frame waits for it,
+  //a wait in one submit doesn't order the next ones.
+  void collect_bake(DriverState &ds) {
+    if (!sh_pass) {
+      return;
+    }
+
+    if (!ds.scheduler.is_done(ds.ctx, bake_task)) {
+      ds.submit_pool.wait_task(ds.scheduler, {bake_task, vk::PipelineStageFlagBits::eFragmentShader});
+      return;
+    }
+
+    ds.gpu_profiler.resolve(ds.ctx, drv::GpuProfiler::ASYNC_SLOT);
+    delete sh_pass;
+    sh_pass = nullptr;
+  }
+
+  //update thread, camera is owned by it, fixed step states are published to render thread
+  void update(float dt, std::chrono::steady_clock::time_point tick) {
+    CPU_ZONE("camera update");
+    auto prev = current_pose;
     camera.move(dt);
+    current_pose = get_pose();
+    publish_camera(prev, tick, dt);
   }
   
+  //rotation is published with the next step
   void handle_events(const SDL_Event &event) {
-    std::lock_guard<std::mutex> lock{frame_lock};
     camera.process_event(event);
 
     if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_SPACE) {
@@ -68,20 +114,32 @@ struct FrameGlobal {
     }
   }
 
-  void lock() {
-    frame_lock.lock();
+  //render thread, replaces published camera from now on
+  void set_camera_pose(glm::vec3 pos, float yaw, float pitch) {
+    camera_override = {pos, yaw, pitch};
+    has_override = true;
   }
 
-  void unlock() {
-    frame_lock.unlock();
+  //Render thread, takes the camera once per frame, so all passes see the same one.
+  //Camera is interpolated between the last two steps, it is one step behind the simulation.
+  void latch_camera(std::chrono::steady_clock::time_point now) {
+    auto pose = camera_override;
+    if (!has_override) {
+      auto &state = camera_state.read();
+      float alpha = std::chrono::duration<float>(now - state.tick).count()/state.step;
+      alpha = glm::clamp(alpha, 0.f, 1.f);
+      pose.pos = glm::mix(state.prev.pos, state.cur.pos, alpha);
+      pose.yaw = glm::mix(state.prev.yaw, state.cur.yaw, alpha);
+      pose.pitch = glm::mix(state.prev.pitch, state.cur.pitch, alpha);
+    }
+
+    Camera posed;
+    posed.set_pose(pose.pos, pose.yaw, pose.pitch);
+    camera_matrix = posed.get_view_mat();
+    camera_pos = pose.pos;
   }
 
-  glm::mat4 get_camera_matrix(bool update = true) {
-    if (update) {
-      std::lock_guard<std::mutex> lock{frame_lock};
-      camera_matrix = camera.get_view_mat();
-      camera_pos = camera.get_pos(); 
-    } 
+  glm::mat4 get_camera_matrix() const {
     return camera_matrix;
   }
 
@@ -110,11 +168,38 @@ private:
   LightField light_field;
   
   drv::BufferID sh_probes;
+  SHPass *sh_pass = nullptr; //until bake_task is done
+  drv::GpuTask bake_task;
   vk::Sampler default_sampler;
   vk::Sampler nearest_sampler;
 
-  std::mutex frame_lock;
+  struct CameraPose {
+    glm::vec3 pos;
+    float yaw;
+    float pitch;
+  };
+
+  //poses of two last steps, cur is the state at tick
+  struct CameraState {
+    CameraPose prev;
+    CameraPose cur;
+    std::chrono::steady_clock::time_point tick;
+    float step;
+  };
+
+  CameraPose get_pose() const {
+    return {camera.get_pos(), camera.get_yaw(), camera.get_pitch()};
+  }
+
+  void publish_camera(const CameraPose &prev, std::chrono::steady_clock::time_point tick, float step) {
+    camera_state.publish({prev, current_pose, tick, step});
+  }
+
   Camera camera;
+  CameraPose current_pose; //update thread
+  drv::TripleBuffer<CameraState> camera_state;
+  CameraPose camera_override;
+  bool has_override = false;
   
   glm::mat4 camera_matrix;
   glm::vec3 camera_pos;
@@ -23,7 +23,7 @@ void GBufferSubpass::create_texture_sets(DriverState &ds) {
   tex_layout = ds.descriptors.create_layout(ds.ctx, builder.build(), 1);
   texture_set = ds.descriptors.allocate_set(ds.ctx, tex_layout);
 
-  drv::DescriptorBinder img_bind {ds.descriptors.get(texture_set)};
+  drv::DescriptorBinder img_bind {ds.descriptors, texture_set};
   img_bind
     .bind_sampler(0, sampler)
     .bind_array_of_img(1, api_views.size(), api_views.data())
@@ -33,10 +33,11 @@ void GBufferSubpass::create_texture_sets(DriverState &ds) {
 }
 
 void GBufferSubpass::create_renderpass(DriverState &ds) {
+  //layout transitions and dependencies are made by the frame graph
   vk::AttachmentDescription albedo_desc {};
   albedo_desc
-    .setInitialLayout(vk::ImageLayout::eUndefined)
-    .setFinalLayout(vk::ImageLayout::eShaderReadOnlyOptimal)
+    .setInitialLayout(vk::ImageLayout::eColorAttachmentOptimal)
+    .setFinalLayout(vk::ImageLayout::eColorAttachmentOptimal)
     .setFormat(vk::Format::eR8G8B8A8Srgb)
     .setLoadOp(vk::AttachmentLoadOp::eClear)
     .setStoreOp(vk::AttachmentStoreOp::eStore)
@@ -51,7 +52,8 @@ void GBufferSubpass::create_renderpass(DriverState &ds) {
   
   vk::AttachmentDescription depth_desc = albedo_desc;
   depth_desc
-    .setFinalLayout(vk::ImageLayout::eDepthStencilReadOnlyOptimal)
+    .setInitialLayout(vk::ImageLayout::eDepthStencilAttachmentOptimal)
+    .setFinalLayout(vk::ImageLayout::eDepthStencilAttachmentOptimal)
     .setFormat(vk::Format::eD24UnormS8Uint);
 
   auto attachments = {albedo_desc, normal_desc, worldpos_desc, depth_desc};
@@ -78,30 +80,9 @@ void GBufferSubpass::create_renderpass(DriverState &ds) {
 
   auto subpasses = {subpass};
 
-  vk::SubpassDependency begin {};
-  begin
-    .setSrcAccessMask(vk::AccessFlagBits::eMemoryRead|vk::AccessFlagBits::eMemoryWrite)
-    .setDstAccessMask(vk::AccessFlagBits::eDepthStencilAttachmentRead)
-    .setSrcStageMask(vk::PipelineStageFlagBits::eAllCommands)
-    .setDstStageMask(vk::PipelineStageFlagBits::eEarlyFragmentTests)
-    .setSrcSubpass(VK_SUBPASS_EXTERNAL)
-    .setDstSubpass(0);
-  
-  vk::SubpassDependency end {};
-  end  
-    .setSrcAccessMask(vk::AccessFlagBits::eMemoryRead|vk::AccessFlagBits::eMemoryWrite)
-    .setDstAccessMask(vk::AccessFlagBits::eMemoryRead|vk::AccessFlagBits::eMemoryWrite)
-    .setSrcStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput)
-    .setDstStageMask(vk::PipelineStageFlagBits::eAllCommands)
-    .setSrcSubpass(0)
-    .setDstSubpass(VK_SUBPASS_EXTERNAL);
-
-  auto dependencies = {begin, end};
-
   vk::RenderPassCreateInfo info {};
   info
     .setAttachments(attachments)
-    .setDependencies(dependencies)
     .setSubpasses(subpasses);
 
   gbuf_renderpass = ds.ctx.get_device().createRenderPass(info);
@@ -130,8 +111,8 @@ void GBufferSubpass::create_framebuffer(DriverState &ds) {
 }
 
 void GBufferSubpass::create_pipeline(DriverState &ds) {
-  ds.pipelines.load_shader(ds.ctx, "triangle_vs", "src/shaders/triangle_vert.spv", vk::ShaderStageFlagBits::eVertex);
-  ds.pipelines.load_shader(ds.ctx, "triangle_fs", "src/shaders/triangle_frag.spv", vk::ShaderStageFlagBits::eFragment);
+  ds.pipelines.load_shader(ds.ctx, "triangle_vs", "src/shaders/triangle.vert", vk::ShaderStageFlagBits::eVertex);
+  ds.pipelines.load_shader(ds.ctx, "triangle_fs", "src/shaders/triangle.frag", vk::ShaderStageFlagBits::eFragment);
 
   drv::PipelineDescBuilder desc;
   auto ext = ds.ctx.get_swapchain_extent();
@@ -148,8 +129,11 @@ void GBufferSubpass::create_pipeline(DriverState &ds) {
     .set_polygon_mode(vk::PolygonMode::eFill)
     .set_front_face(vk::FrontFace::eCounterClockwise)
 
+    //render extent changes every frame, secondary buffers set it themselves
     .add_viewport(0.f, 0.f, ext.width, ext.height, 0.f, 1.f)
     .add_scissors(0, 0, ext.width, ext.height)
+    .add_dynamic_state(vk::DynamicState::eViewport)
+    .add_dynamic_state(vk::DynamicState::eScissor)
 
     .set_blend_logic_op(false)
     .add_blend_attachment()
@@ -183,8 +167,9 @@ void GBufferSubpass::create_pipeline_layout(DriverState &ds) {
   builder.add_storage_buffer(1, vk::ShaderStageFlagBits::eVertex);
   
   desc_layout = ds.descriptors.create_layout(ds.ctx, builder.build(), drv::MAX_FRAMES_IN_FLIGHT);
-  sets.push_back(ds.descriptors.allocate_set(ds.ctx, desc_layout));
-  sets.push_back(ds.descriptors.allocate_set(ds.ctx, desc_layout));
+  for (u32 i = 0; i < drv::MAX_FRAMES_IN_FLIGHT; i++) {
+    sets.push_back(ds.descriptors.allocate_set(ds.ctx, desc_layout));
+  }
 
   auto layouts = {ds.descriptors.get(desc_layout), ds.descriptors.get(tex_layout)};
 
@@ -205,7 +190,7 @@ void GBufferSubpass::create_pipeline_layout(DriverState &ds) {
 
   for (u32 i = 0; i < drv::MAX_FRAMES_IN_FLIGHT; i++) {
     ubo[i] = ds.storage.create_buffer(ds.ctx, drv::GPUMemoryT::Coherent, sizeof(VertexUB), vk::BufferUsageFlagBits::eUniformBuffer);
-    drv::DescriptorBinder bind {ds.descriptors.get(sets[i])};
+    drv::DescriptorBinder bind {ds.descriptors, sets[i]};
     bind
       .bind_ubo(0, *ubo[i])
       .bind_storage_buff(1, frame_data.get_scene().get_matrix_buff()->api_buffer());    
@@ -213,7 +198,7 @@ void GBufferSubpass::create_pipeline_layout(DriverState &ds) {
   }   
 }
 
-void GBufferSubpass::render(drv::DrawContext &draw_ctx, DriverState &ds) {
+void GBufferSubpass::render(drv::DrawContext &draw_ctx, DriverState &ds, vk::Extent2D extent, drv::PassCounters &counters) {
   auto frame = draw_ctx.frame_id;
     
   VertexUB data;
@@ -222,10 +207,11 @@ void GBufferSubpass::render(drv::DrawContext &draw_ctx, DriverState &ds) {
   data.project = frame_data.get_projection_matrix();
   data.camera_origin = glm::vec4{camera_pos.x, camera_pos.y, camera_pos.z, 0.f};
 
-  auto ext = ds.ctx.get_swapchain_extent();
+  //targets have swapchain size, only the top left corner is rendered
   vk::Rect2D area {};
   area.offset = vk::Offset2D{0, 0};
-  area.extent = ext;
+  area.extent = extent;
+  vk::Viewport viewport {0.f, 0.f, f32(extent.width), f32(extent.height), 0.f, 1.f};
 
   vk::ClearColorValue val;
   val.setFloat32({0.f, 0.f, 0.f, 0.f});
@@ -246,33 +232,57 @@ void GBufferSubpass::render(drv::DrawContext &draw_ctx, DriverState &ds) {
     .setRenderPass(gbuf_renderpass)
     .setRenderArea(area);
 
-  draw_ctx.dcb.beginRenderPass(begin_rp, vk::SubpassContents::eInline);
-
   ds.storage.buffer_memcpy(ds.ctx, ubo[frame], 0, &data, sizeof(data));
-  draw_ctx.dcb.bindPipeline(vk::PipelineBindPoint::eGraphics, ds.pipelines.get(pipeline));
-    
-  auto buffers = { frame_data.get_scene().get_verts_buff()->api_buffer() };
-  auto offsets = {0ul};
-    
-  draw_ctx.dcb.bindVertexBuffers(0, buffers, offsets);
-  draw_ctx.dcb.bindIndexBuffer(frame_data.get_scene().get_index_buff()->api_buffer(), 0, vk::IndexType::eUint32);
 
-  auto bind_sets = { ds.descriptors.get(sets[frame]), ds.descriptors.get(texture_set) };
-  draw_ctx.dcb.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipeline_layout, 0, bind_sets, {});
-
-  const auto& objects = frame_data.get_scene().get_objects(); 
-  auto &tex_info = frame_data.get_scene().get_materials();
-
-
-  for (auto &obj : objects) {
-    auto albedo_id = tex_info.materials[obj.material_index].albedo_tex_id;
-    auto mr_id = tex_info.materials[obj.material_index].mr_tex_id;
-    if (albedo_id < 0) continue;
-
-    i32 indexes[3] {obj.matrix_index, albedo_id, mr_id};
-    draw_ctx.dcb.pushConstants(pipeline_layout, vk::ShaderStageFlagBits::eVertex|vk::ShaderStageFlagBits::eFragment, 0u, 3*sizeof(i32), indexes);
-    draw_ctx.dcb.drawIndexed(obj.index_count, 1, obj.index_offset, obj.vertex_offset, 0);
-  }
+  //handles are taken here, workers only record
+  auto api_pipeline = ds.pipelines.get(pipeline);
+  auto layout = pipeline_layout;
+  std::array<vk::DescriptorSet, 2> bind_sets { ds.descriptors.get(sets[frame]), ds.descriptors.get(texture_set) };
+  auto &scene = frame_data.get_scene();
 
+  vk::CommandBufferInheritanceInfo inheritance {};
+  inheritance
+    .setRenderPass(gbuf_renderpass)
+    .setSubpass(0)
+    .setFramebuffer(framebuf)
+    .setPipelineStatistics(ds.work_stats.get_inherited_statistics());
+
+  //draw list is split between workers, each chunk binds its own state
+  drv::ParallelRecorder recorder {ds.ctx, ds.submit_pool, ds.workers, frame, inheritance};
+  recorder.add_chunks(scene.get_objects().size(), MIN_DRAW_CHUNK, [&scene, &counters, api_pipeline, layout, bind_sets, viewport, area](vk::CommandBuffer &cmd, u32 begin, u32 end) {
+    drv::WorkCounters work {};
+    cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, api_pipeline);
+    work.pipeline_binds++;
+    cmd.setViewport(0, {viewport});
+    cmd.setScissor(0, {area});
+      
+    auto buffers = { scene.get_verts_buff()->api_buffer() };
+    auto offsets = {0ul};
+      
+    cmd.bindVertexBuffers(0, buffers, offsets);
+    cmd.bindIndexBuffer(scene.get_index_buff()->api_buffer(), 0, vk::IndexType::eUint32);
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, layout, 0, bind_sets, {});
+    work.descriptor_binds += bind_sets.size();
+
+    const auto& objects = scene.get_objects(); 
+    auto &tex_info = scene.get_materials();
+
+    for (u32 i = begin; i < end; i++) {
+      auto &obj = objects[i];
+      auto albedo_id = tex_info.materials[obj.material_index].albedo_tex_id;
+      auto mr_id = tex_info.materials[obj.material_index].mr_tex_id;
+      if (albedo_id < 0) continue;
+
+      i32 indexes[3] {obj.matrix_index, albedo_id, mr_id};
+      cmd.pushConstants(layout, vk::ShaderStageFlagBits::eVertex|vk::ShaderStageFlagBits::eFragment, 0u, 3*sizeof(i32), indexes);
+      cmd.drawIndexed(obj.index_count, 1, obj.index_offset, obj.vertex_offset, 0);
+      work.draws++;
+      work.triangles += obj.index_count/3;
+    }
+    counters.add(work);
+  });
+
+  draw_ctx.dcb.beginRenderPass(begin_rp, vk::SubpassContents::eSecondaryCommandBuffers);
+  recorder.execute(draw_ctx.dcb);
   draw_ctx.dcb.endRenderPass();    
 }
\ No newline at end of file
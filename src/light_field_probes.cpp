@@ -7,8 +7,9 @@
 
 const u32 CUBEMAP_RES = 512;
 const vk::Extent2D CUBEMAP_EXT {CUBEMAP_RES, CUBEMAP_RES};
-const u32 OCT_RES = 1024;
+const u32 OCT_RES = PROBE_OCT_RES;
 const u32 DIST_MIPS = 7;
+const u32 MIN_DRAW_CHUNK = 64;
 
 void LightField::calc_matrix(u32 side, vk::Extent2D ext, glm::vec3 pos, glm::mat4 &out) {
   float aspect = float(ext.width)/float(ext.height);
@@ -32,8 +33,9 @@ void LightField::calc_matrix(u32 side, vk::Extent2D ext, glm::vec3 pos, glm::mat
 void LightField::create_renderpass(DriverState &ds) {
   std::array<vk::AttachmentDescription, 4> desc {};
 
-  desc[0].setInitialLayout(vk::ImageLayout::eUndefined);
-  desc[0].setFinalLayout(vk::ImageLayout::eTransferSrcOptimal);
+  //transitions are made by bake graph
+  desc[0].setInitialLayout(vk::ImageLayout::eColorAttachmentOptimal);
+  desc[0].setFinalLayout(vk::ImageLayout::eColorAttachmentOptimal);
   desc[0].setLoadOp(vk::AttachmentLoadOp::eClear);
   desc[0].setStoreOp(vk::AttachmentStoreOp::eStore);
   desc[0].setSamples(vk::SampleCountFlagBits::e1);
@@ -47,6 +49,7 @@ void LightField::create_renderpass(DriverState &ds) {
   desc[2].setFormat(vk::Format::eR16G16B16A16Sfloat); //normal
   desc[3].setFormat(vk::Format::eD24UnormS8Uint); //depth
 
+  desc[3].setInitialLayout(vk::ImageLayout::eDepthStencilAttachmentOptimal);
   desc[3].setFinalLayout(vk::ImageLayout::eDepthStencilAttachmentOptimal);
 
   std::array<vk::AttachmentReference, 3> inputs {}; 
@@ -73,20 +76,8 @@ void LightField::create_renderpass(DriverState &ds) {
 }
 
 void LightField::create_framebuffer(DriverState &ds) {
-  const auto IMG_USG = vk::ImageUsageFlagBits::eColorAttachment|vk::ImageUsageFlagBits::eTransferSrc;
-  const auto DEPTH_USG = vk::ImageUsageFlagBits::eDepthStencilAttachment;
   const auto CM_USAGE = vk::ImageUsageFlagBits::eTransferDst|vk::ImageUsageFlagBits::eSampled;
 
-  auto dist_img = ds.storage.create_rt(ds.ctx, CUBEMAP_RES, CUBEMAP_RES, vk::Format::eR32Sfloat, IMG_USG);
-  auto color_img = ds.storage.create_rt(ds.ctx, CUBEMAP_RES, CUBEMAP_RES, vk::Format::eR16G16B16A16Sfloat, IMG_USG);
-  auto norm_img = ds.storage.create_rt(ds.ctx, CUBEMAP_RES, CUBEMAP_RES, vk::Format::eR16G16B16A16Sfloat, IMG_USG);
-  auto depth_img = ds.storage.create_rt(ds.ctx, CUBEMAP_RES, CUBEMAP_RES, vk::Format::eD24UnormS8Uint, DEPTH_USG);
-
-  dist = ds.storage.create_rt_view(ds.ctx, dist_img, vk::ImageAspectFlagBits::eColor);
-  norm = ds.storage.create_rt_view(ds.ctx, norm_img, vk::ImageAspectFlagBits::eColor);
-  color = ds.storage.create_rt_view(ds.ctx, color_img, vk::ImageAspectFlagBits::eColor);
-  depth = ds.storage.create_rt_view(ds.ctx, depth_img, vk::ImageAspectFlagBits::eDepth);
-
   auto dist_cm = ds.storage.create_cubemap(ds.ctx, CUBEMAP_RES, CUBEMAP_RES, vk::Format::eR32Sfloat, CM_USAGE);
   auto color_cm = ds.storage.create_cubemap(ds.ctx, CUBEMAP_RES, CUBEMAP_RES, vk::Format::eR16G16B16A16Sfloat, CM_USAGE);
   auto norm_cm = ds.storage.create_cubemap(ds.ctx, CUBEMAP_RES, CUBEMAP_RES, vk::Format::eR16G16B16A16Sfloat, CM_USAGE);
@@ -95,16 +86,9 @@ void LightField::create_framebuffer(DriverState &ds) {
   cm_norm = ds.storage.create_cubemap_view(ds.ctx, norm_cm, vk::ImageAspectFlagBits::eColor);
   cm_color = ds.storage.create_cubemap_view(ds.ctx, color_cm, vk::ImageAspectFlagBits::eColor);
 
-  std::array<vk::ImageView, 4> fb_views {dist->api_view(), color->api_view(), norm->api_view(), depth->api_view()};
-
-  vk::FramebufferCreateInfo fb_info {};
-  fb_info.setAttachments(fb_views);
-  fb_info.setWidth(CUBEMAP_RES);
-  fb_info.setHeight(CUBEMAP_RES);
-  fb_info.setLayers(1);
-  fb_info.setRenderPass(renderpass);
-  
-  fb = ds.ctx.get_device().createFramebuffer(fb_info);
+  cubemaps[0] = bake_graph.import_image("distance cubemap", cm_dist);
+  cubemaps[1] = bake_graph.import_image("radiance cubemap", cm_color);
+  cubemaps[2] = bake_graph.import_image("normal cubemap", cm_norm);
 
   vk::SamplerCreateInfo smp {};
   smp
@@ -151,13 +135,14 @@ void LightField::create_pipeline_layout(DriverState &ds) {
 }
 
 void LightField::create_pipeline(DriverState &ds) {
-  ds.pipelines.load_shader(ds.ctx, "cube_probe_vs", "src/shaders/cube_probe_vert.spv", vk::ShaderStageFlagBits::eVertex);
-  ds.pipelines.load_shader(ds.ctx, "cube_probe_fs", "src/shaders/cube_probe_frag.spv", vk::ShaderStageFlagBits::eFragment);
+  ds.pipelines.load_shader(ds.ctx, "cube_probe_vs", "src/shaders/cube_probe.vert", vk::ShaderStageFlagBits::eVertex);
+  ds.pipelines.load_shader(ds.ctx, "cube_probe_fs", "src/shaders/cube_probe.frag", vk::ShaderStageFlagBits::eFragment);
 
   drv::PipelineDescBuilder builder {};
   builder
     .add_shader("cube_probe_vs")
     .add_shader("cube_probe_fs")
+    .set_constants(ds.quality.constants)
     
     .add_attribute(0, 0, vk::Format::eR32G32B32Sfloat, offsetof(SceneVertex, pos))
     .add_attribute(1, 0, vk::Format::eR32G32B32Sfloat, offsetof(SceneVertex, norm))
@@ -196,9 +181,9 @@ void LightField::init(DriverState &ds) {
   create_pipeline_layout(ds);
   create_pipeline(ds);
 
-  ds.pipelines.load_shader(ds.ctx, "pass_vs", "src/shaders/pass_vert.spv", vk::ShaderStageFlagBits::eVertex);
-  ds.pipelines.load_shader(ds.ctx, "cube_probe_to_oct_fs", "src/shaders/cube_probe_to_oct_frag.spv", vk::ShaderStageFlagBits::eFragment);
-  ds.pipelines.load_shader(ds.ctx, "cube_probe_to_oct_depth_fs", "src/shaders/cube_probe_to_oct_depth_frag.spv", vk::ShaderStageFlagBits::eFragment);
+  ds.pipelines.load_shader(ds.ctx, "pass_vs", "src/shaders/pass.vert", vk::ShaderStageFlagBits::eVertex);
+  ds.pipelines.load_shader(ds.ctx, "cube_probe_to_oct_fs", "src/shaders/cube_probe_to_oct.frag", vk::ShaderStageFlagBits::eFragment);
+  ds.pipelines.load_shader(ds.ctx, "cube_probe_to_oct_depth_fs", "src/shaders/cube_probe_to_oct_depth.frag", vk::ShaderStageFlagBits::eFragment);
 
   lightprobe_pass
     .init_attachment(vk::Format::eR32Sfloat) //distance
@@ -214,6 +199,7 @@ void LightField::init(DriverState &ds) {
 }
 
 void LightField::release(DriverState &ds) {
+  hidist_pass.mip_views.clear();
   ds.ctx.get_device().destroySampler(hidist_pass.nearest_sampler);
   lightprobe_pass.release(ds);
   ds.ctx.get_device().destroySampler(sampler);
@@ -221,6 +207,7 @@ void LightField::release(DriverState &ds) {
   //ds.ctx.get_device().destroyPipelineLayout(pipeline_layout);
   ds.ctx.get_device().destroyFramebuffer(fb);
   ds.ctx.get_device().destroyRenderPass(renderpass);
+  bake_graph.release();
 
 }
 
@@ -244,32 +231,114 @@ void LightField::render_cubemaps(DriverState &ds, Scene &scene, glm::vec3 center
       ds.storage.buffer_memcpy(ds.ctx, lights_ubo, 0, &data, sizeof(data));
     }
 
+    //render targets are transient, pooled images are reused by every side and probe
+    const auto IMG_USG = vk::ImageUsageFlagBits::eColorAttachment|vk::ImageUsageFlagBits::eTransferSrc;
+    std::array<drv::RGImage, 4> targets {
+      bake_graph.create_image("distance", {CUBEMAP_RES, CUBEMAP_RES, vk::Format::eR32Sfloat, IMG_USG}),
+      bake_graph.create_image("radiance", {CUBEMAP_RES, CUBEMAP_RES, vk::Format::eR16G16B16A16Sfloat, IMG_USG}),
+      bake_graph.create_image("normal", {CUBEMAP_RES, CUBEMAP_RES, vk::Format::eR16G16B16A16Sfloat, IMG_USG}),
+      bake_graph.create_image("depth", {CUBEMAP_RES, CUBEMAP_RES, vk::Format::eD24UnormS8Uint, vk::ImageUsageFlagBits::eDepthStencilAttachment})
+    };
+
+    bake_graph.add_pass("cubemap side " + std::to_string(side), [&](vk::CommandBuffer &cmd) {
+        update_framebuffer(ds, targets);
+        render_side(ds, scene, cmd);
+      })
+      .overwrite(targets[0], drv::ImageUsage::ColorAttachment)
+      .overwrite(targets[1], drv::ImageUsage::ColorAttachment)
+      .overwrite(targets[2], drv::ImageUsage::ColorAttachment)
+      .overwrite(targets[3], drv::ImageUsage::DepthAttachment);
+
+    auto blit = bake_graph.add_pass("blit", [&](vk::CommandBuffer &cmd) {
+      blit_cubemaps(cmd, side, targets);
+    });
+
+    for (u32 i = 0; i < 3; i++) {
+      blit.read(targets[i], drv::ImageUsage::TransferSrc);
+      //previous probe is already filtered
+      if (side == 0) {
+        blit.overwrite(cubemaps[i], drv::ImageUsage::TransferDst);
+      } else {
+        blit.write(cubemaps[i], drv::ImageUsage::TransferDst);
+      }
+    }
+
+    if (side == 5) {
+      for (u32 i = 0; i < 3; i++) {
+        bake_graph.export_image(cubemaps[i], drv::ImageUsage::Sampled, vk::PipelineStageFlagBits::eFragmentShader);
+      }
+    }
+
     auto cmd = ds.submit_pool.start_cmd(ds.ctx);
     
     vk::CommandBufferBeginInfo begin_buf {};
     cmd.begin(begin_buf);
-
-    if (side == 0) {
-      transform_cubemap_layout(cmd, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal);
+    ds.gpu_profiler.begin_frame(ds.ctx, cmd, drv::ONESHOT_SLOT);
+    {
+      drv::GpuZone zone {ds.gpu_profiler, cmd, drv::ONESHOT_SLOT, "probe faces"};
+      bake_graph.execute(ds.ctx, ds.storage, cmd, &ds.gpu_profiler, drv::ONESHOT_SLOT);
     }
+    cmd.end();
 
-    vk::ClearValue clear_dist {}, clear_depth {}, clear_color {};
-    
-    clear_depth.depthStencil.setDepth(1.f).setStencil(0u);
-    clear_dist.color.setFloat32({100.f, 0.f, 0.f, 0.f});
-    clear_color.color.setFloat32({0.f, 0.f, 0.f, 0.f});
-    auto clear_vals = {clear_dist, clear_color, clear_color, clear_depth};
-
-    vk::RenderPassBeginInfo pass_begin {};
-    pass_begin
-      .setRenderPass(renderpass)
-      .setClearValues(clear_vals)
-      .setFramebuffer(fb)
-      .setRenderArea(vk::Rect2D{{0u, 0u}, CUBEMAP_EXT});
-
-    cmd.beginRenderPass(pass_begin, vk::SubpassContents::eInline);
-    cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, ds.pipelines.get(pipeline));
-    cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipeline_layout, 0, {ds.descriptors.get(resource_set)}, {});
+    ds.submit_pool.submit_and_wait(ds.ctx, cmd);
+    ds.gpu_profiler.resolve(ds.ctx, drv::ONESHOT_SLOT);
+    ds.submit_pool.reset_secondary(ds.ctx, drv::ONESHOT_SLOT);
+  }
+}
+
+//pooled render targets keep their views, framebuffer is recreated only on first use
+void LightField::update_framebuffer(DriverState &ds, const std::array<drv::RGImage, 4> &targets) {
+  std::array<vk::ImageView, 4> views;
+  for (u32 i = 0; i < 4; i++) {
+    views[i] = bake_graph.get_view(targets[i])->api_view();
+  }
+
+  if (fb && views == fb_views) {
+    return;
+  }
+
+  ds.ctx.get_device().destroyFramebuffer(fb);
+  fb_views = views;
+
+  vk::FramebufferCreateInfo fb_info {};
+  fb_info.setAttachments(fb_views);
+  fb_info.setWidth(CUBEMAP_RES);
+  fb_info.setHeight(CUBEMAP_RES);
+  fb_info.setLayers(1);
+  fb_info.setRenderPass(renderpass);
+  
+  fb = ds.ctx.get_device().createFramebuffer(fb_info);
+}
+
+void LightField::render_side(DriverState &ds, Scene &scene, vk::CommandBuffer &cmd) {
+  vk::ClearValue clear_dist {}, clear_depth {}, clear_color {};
+  
+  clear_depth.depthStencil.setDepth(1.f).setStencil(0u);
+  clear_dist.color.setFloat32({100.f, 0.f, 0.f, 0.f});
+  clear_color.color.setFloat32({0.f, 0.f, 0.f, 0.f});
+  auto clear_vals = {clear_dist, clear_color, clear_color, clear_depth};
+
+  vk::RenderPassBeginInfo pass_begin {};
+  pass_begin
+    .setRenderPass(renderpass)
+    .setClearValues(clear_vals)
+    .setFramebuffer(fb)
+    .setRenderArea(vk::Rect2D{{0u, 0u}, CUBEMAP_EXT});
+
+  auto api_pipeline = ds.pipelines.get(pipeline, ds.quality.constants);
+  auto layout = pipeline_layout;
+  auto set = ds.descriptors.get(resource_set);
+
+  vk::CommandBufferInheritanceInfo inheritance {};
+  inheritance
+    .setRenderPass(renderpass)
+    .setSubpass(0)
+    .setFramebuffer(fb);
+
+  drv::ParallelRecorder recorder {ds.ctx, ds.submit_pool, ds.workers, drv::ONESHOT_SLOT, inheritance};
+  recorder.add_chunks(scene.get_objects().size(), MIN_DRAW_CHUNK, [&scene, api_pipeline, layout, set](vk::CommandBuffer &cmd, u32 begin, u32 end) {
+    cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, api_pipeline);
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, layout, 0, {set}, {});
 
     vk::Viewport viewport;
     viewport
@@ -290,7 +359,8 @@ void LightField::render_cubemaps(DriverState &ds, Scene &scene, glm::vec3 center
     const auto& objects = scene.get_objects(); 
     auto &tex_info = scene.get_materials();
     
-    for (auto &obj : objects) {
+    for (u32 i = begin; i < end; i++) {
+      auto &obj = objects[i];
       auto albedo_id = tex_info.materials[obj.material_index].albedo_tex_id;
       
       if (albedo_id < 0) continue;
@@ -298,25 +368,14 @@ void LightField::render_cubemaps(DriverState &ds, Scene &scene, glm::vec3 center
       u32 pc_data[2];
       pc_data[0] = obj.matrix_index;
       pc_data[1] = albedo_id; 
-      cmd.pushConstants(pipeline_layout, vk::ShaderStageFlagBits::eVertex|vk::ShaderStageFlagBits::eFragment, 0u, 2*sizeof(u32), pc_data);
+      cmd.pushConstants(layout, vk::ShaderStageFlagBits::eVertex|vk::ShaderStageFlagBits::eFragment, 0u, 2*sizeof(u32), pc_data);
       cmd.drawIndexed(obj.index_count, 1, obj.index_offset, obj.vertex_offset, 0);
-    }    
-
-
-    cmd.endRenderPass();
-
-    blit_cubemaps(cmd, side);
-    if (side == 5) {
-      transform_cubemap_layout(cmd, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal);
     }
+  });
 
-    cmd.end();
-
-    auto fence = ds.submit_pool.submit_cmd(ds.ctx, cmd);
-    ds.ctx.get_device().waitForFences({fence}, VK_TRUE, UINT64_MAX);
-    ds.ctx.get_device().destroyFence(fence);
-    ds.submit_pool.free_cmd(ds.ctx, cmd);
-  }
+  cmd.beginRenderPass(pass_begin, vk::SubpassContents::eSecondaryCommandBuffers);
+  recorder.execute(cmd);
+  cmd.endRenderPass();
 }
 
 void LightField::bind_resources(DriverState &ds, Scene &scene) {
@@ -325,7 +384,7 @@ void LightField::bind_resources(DriverState &ds, Scene &scene) {
     api_views.push_back(view->api_view());
   }
 
-  drv::DescriptorBinder bind {ds.descriptors.get(resource_set)};
+  drv::DescriptorBinder bind {ds.descriptors, resource_set};
   bind
     .bind_ubo(0, ubo->api_buffer())
     .bind_storage_buff(1, scene.get_matrix_buff()->api_buffer())
@@ -337,16 +396,23 @@ void LightField::bind_resources(DriverState &ds, Scene &scene) {
   bind.write(ds.ctx);
 }
 
-void LightField::render(DriverState &ds, Scene &scene, glm::vec3 bmin, glm::vec3 bmax, glm::uvec3 d) {
+drv::GpuTask LightField::render(DriverState &ds, Scene &scene, glm::vec3 bmin, glm::vec3 bmax, glm::uvec3 d) {
   auto ARR_USG = vk::ImageUsageFlagBits::eColorAttachment|vk::ImageUsageFlagBits::eSampled;
   auto layers = d.x * d.y * d.z;
-  auto dist_img = ds.storage.create_image2D_array(ds.ctx, OCT_RES, OCT_RES, vk::Format::eR32Sfloat, ARR_USG|vk::ImageUsageFlagBits::eStorage, layers, DIST_MIPS);
+  auto dist_img = ds.storage.create_image2D_array(ds.ctx, OCT_RES, OCT_RES, vk::Format::eR32Sfloat, ARR_USG|vk::ImageUsageFlagBits::eStorage, layers, DIST_MIPS, vk::SharingMode::eConcurrent);
   dist_array = ds.storage.create_2Darray_view(ds.ctx, dist_img, vk::ImageAspectFlagBits::eColor, true);
 
+  //mip views live as long as dist_img, so hidist descriptors are reused until the next render
+  ds.descriptors.drop_cache(ds.ctx, hidist_pass.descriptor_layout);
+  hidist_pass.mip_views.clear();
+  for (u32 mip = 0; mip < DIST_MIPS; mip++) {
+    hidist_pass.mip_views.push_back(ds.storage.create_2Darray_mip_view(ds.ctx, dist_img, vk::ImageAspectFlagBits::eColor, mip));
+  }
+
   auto norm_img = ds.storage.create_image2D_array(ds.ctx, OCT_RES, OCT_RES, vk::Format::eR16G16B16A16Sfloat, ARR_USG, layers);
   norm_array = ds.storage.create_2Darray_view(ds.ctx, norm_img, vk::ImageAspectFlagBits::eColor);
 
-  auto radiance_img = ds.storage.create_image2D_array(ds.ctx, OCT_RES, OCT_RES, vk::Format::eR16G16B16A16Sfloat, ARR_USG, layers);
+  auto radiance_img = ds.storage.create_image2D_array(ds.ctx, OCT_RES, OCT_RES, vk::Format::eR16G16B16A16Sfloat, ARR_USG, layers, 1, vk::SharingMode::eConcurrent);
   radiance_array = ds.storage.create_2Darray_view(ds.ctx, radiance_img, vk::ImageAspectFlagBits::eColor);
 
   dim = d;
@@ -384,68 +450,47 @@ void LightField::render(DriverState &ds, Scene &scene, glm::vec3 bmin, glm::vec3
         lightprobe_pass.set_image_sampler(1, cm_color, sampler);
         lightprobe_pass.set_image_sampler(2, cm_norm, sampler);
         std::cout << "Filling probe\n";
-        lightprobe_pass.render_and_wait(ds);
+        lightprobe_pass.render_and_wait(ds, "oct conversion");
         std::cout << "End\n";
         probes.push_back(probe);
       }
     }
   }
-  std::cout << "Downsampling distances\n";
-  downsample_distances(ds);
-  std::cout << "End\n";
-  std::cout << "Irradiance\n";
-  compute_irradiance(ds);
-  std::cout << "End\n";
-  create_hidist_images(ds);
-  hidist_array = ds.storage.create_2Darray_view(ds.ctx, dist_img, vk::ImageAspectFlagBits::eColor, false);
-}
-
-void LightField::transform_cubemap_layout(vk::CommandBuffer &buf, vk::ImageLayout src, vk::ImageLayout dst) {
-  std::array<drv::ImageID, 3> cubemaps {
-    cm_dist->get_base_img(),
-    cm_color->get_base_img(),
-    cm_norm->get_base_img()};
-  
-  vk::PipelineStageFlags pipe_src, pipe_dst;
-  vk::AccessFlags a_src, a_dst;
-
-  if (src == vk::ImageLayout::eUndefined && dst == vk::ImageLayout::eTransferDstOptimal) {
-    pipe_src = vk::PipelineStageFlagBits::eAllCommands;
-    pipe_dst = vk::PipelineStageFlagBits::eTransfer;
-    a_src = vk::AccessFlagBits::eMemoryRead|vk::AccessFlagBits::eMemoryWrite;
-    a_dst = vk::AccessFlagBits::eTransferRead;
+  //filtering passes are recorded into one command buffer, barriers come from the graph.
+  //Passes are compute only, so they run on the async queue and overlap the first frames.
+  drv::RenderGraph filter_graph;
+  auto distance = filter_graph.import_image("distance", dist_array, vk::ImageLayout::eShaderReadOnlyOptimal);
+  auto radiance = filter_graph.import_image("radiance", radiance_array, vk::ImageLayout::eShaderReadOnlyOptimal);
+
+  auto low_res = downsample_distances(ds, filter_graph, distance);
+  auto irradiance = compute_irradiance(ds, filter_graph, radiance);
+  create_hidist_images(ds, filter_graph, distance);
+
+  //graphics work waits for the task with a semaphore, it makes writes visible to fragment shaders
+  filter_graph.export_image(distance, drv::ImageUsage::Sampled, vk::PipelineStageFlagBits::eComputeShader);
+  filter_graph.export_image(low_res, drv::ImageUsage::Sampled, vk::PipelineStageFlagBits::eComputeShader);
+  filter_graph.export_image(irradiance, drv::ImageUsage::Sampled, vk::PipelineStageFlagBits::eComputeShader);
+
+  //async slot is resolved by the owner of the task
+  auto cmd = ds.scheduler.begin(ds.ctx, drv::QueueT::Compute);
+  ds.gpu_profiler.begin_frame(ds.ctx, cmd, drv::GpuProfiler::ASYNC_SLOT);
+  {
+    drv::GpuZone zone {ds.gpu_profiler, cmd, drv::GpuProfiler::ASYNC_SLOT, "probe filtering"};
+    filter_graph.execute(ds.ctx, ds.storage, cmd, &ds.gpu_profiler, drv::GpuProfiler::ASYNC_SLOT);
   }
+  auto task = ds.scheduler.submit(ds.ctx, drv::QueueT::Compute, cmd);
 
-  if (src == vk::ImageLayout::eTransferDstOptimal && dst == vk::ImageLayout::eShaderReadOnlyOptimal) {
-    pipe_src = vk::PipelineStageFlagBits::eTransfer;
-    pipe_dst = vk::PipelineStageFlagBits::eAllCommands;
-    a_src = vk::AccessFlagBits::eTransferWrite;
-    a_dst = vk::AccessFlagBits::eMemoryRead|vk::AccessFlagBits::eMemoryWrite;
-  }
+  //images are owned by the light field, graph doesn't have transients
+  std::cout << "Probe filtering\n" << filter_graph.describe();
+  filter_graph.release();
 
-  for (u32 i = 0; i < cubemaps.size(); i++) {
-    drv::ImageBarrier barrier {cubemaps[i], vk::ImageAspectFlagBits::eColor};
-    barrier
-      .set_range(0, 1, 0, 6)
-      .change_layout(src, dst)
-      .access_msk(a_src, a_dst)
-      .write(buf, pipe_src, pipe_dst);
-  }
+  hidist_array = ds.storage.create_2Darray_view(ds.ctx, dist_img, vk::ImageAspectFlagBits::eColor, false);
+  return task;
 }
 
-void LightField::blit_cubemaps(vk::CommandBuffer &buf, u32 side) {
-  std::array<drv::ImageID, 3> cubemaps {
-    cm_dist->get_base_img(),
-    cm_color->get_base_img(),
-    cm_norm->get_base_img()};
-  
-  std::array<drv::ImageID, 3> images {
-    dist->get_base_img(),
-    color->get_base_img(),
-    norm->get_base_img()};
-
-  for (u32 i = 0; i < cubemaps.size(); i++) {
-    drv::BlitImage blit {images[i], cubemaps[i]};
+void LightField::blit_cubemaps(vk::CommandBuffer &buf, u32 side, const std::array<drv::RGImage, 4> &targets) {
+  for (u32 i = 0; i < 3; i++) {
+    drv::BlitImage blit {bake_graph.get_image(targets[i])->api_image(), bake_graph.get_image(cubemaps[i])->api_image()};
     blit
       .src_subresource(vk::ImageAspectFlagBits::eColor, 0, 0, 1)
       .dst_subresource(vk::ImageAspectFlagBits::eColor, 0, side, 1)
@@ -456,8 +501,8 @@ void LightField::blit_cubemaps(vk::CommandBuffer &buf, u32 side) {
 }
 
 void LightField::init_compute_resources(DriverState &ds) {
-  ds.pipelines.load_shader(ds.ctx, "oct_fold_cs", "src/shaders/oct_fold_comp.spv", vk::ShaderStageFlagBits::eCompute);
-  ds.pipelines.load_shader(ds.ctx, "irradiance_cs", "src/shaders/irradiance_comp.spv", vk::ShaderStageFlagBits::eCompute);
+  ds.pipelines.load_shader(ds.ctx, "oct_fold_cs", "src/shaders/oct_fold.comp", vk::ShaderStageFlagBits::eCompute);
+  ds.pipelines.load_shader(ds.ctx, "irradiance_cs", "src/shaders/irradiance.comp", vk::ShaderStageFlagBits::eCompute);
   {
     drv::DescriptorSetLayoutBuilder layout_builder {};
     layout_builder
@@ -492,7 +537,9 @@ void LightField::init_compute_resources(DriverState &ds) {
     layout_info.setSetLayouts(layouts);
 
     irradiance_pass.pipeline_layout = ds.ctx.get_device().createPipelineLayout(layout_info);
-    irradiance_pass.pipeline = ds.pipelines.create_compute_pipeline(ds.ctx, "irradiance_cs", irradiance_pass.pipeline_layout);
+    auto constants = Quality::probe_constants();
+    constants.merge(ds.quality.constants);
+    irradiance_pass.pipeline = ds.pipelines.create_compute_pipeline(ds.ctx, "irradiance_cs", irradiance_pass.pipeline_layout, constants);
 
     irradiance_pass.descriptor = ds.descriptors.allocate_set(ds.ctx, irradiance_pass.descriptor_layout);
     irradiance_pass.samples_buffer 
@@ -515,7 +562,7 @@ void LightField::init_compute_resources(DriverState &ds) {
 }
 
 void LightField::init_hidist_resources(DriverState &ds) {
-  ds.pipelines.load_shader(ds.ctx, "hi_dist_mips_cs", "src/shaders/hi_dist_mips_comp.spv", vk::ShaderStageFlagBits::eCompute);
+  ds.pipelines.load_shader(ds.ctx, "hi_dist_mips_cs", "src/shaders/hi_dist_mips.comp", vk::ShaderStageFlagBits::eCompute);
 
   drv::DescriptorSetLayoutBuilder builder{};
   builder
@@ -544,146 +591,78 @@ void LightField::init_hidist_resources(DriverState &ds) {
   hidist_pass.nearest_sampler = ds.ctx.get_device().createSampler(sinfo);
 }
 
-void LightField::downsample_distances(DriverState &ds) {
+drv::RGImage LightField::downsample_distances(DriverState &ds, drv::RenderGraph &graph, drv::RGImage distance) {
   auto layers = dim.x * dim.y * dim.z;
 
-  auto low_res_img = ds.storage.create_image2D_array(ds.ctx, 64, 64, vk::Format::eR32Sfloat, vk::ImageUsageFlagBits::eStorage|vk::ImageUsageFlagBits::eSampled, layers);
+  auto low_res_img = ds.storage.create_image2D_array(ds.ctx, PROBE_LOW_RES, PROBE_LOW_RES, vk::Format::eR32Sfloat, vk::ImageUsageFlagBits::eStorage|vk::ImageUsageFlagBits::eSampled, layers, 1, vk::SharingMode::eConcurrent);
   low_res_array = ds.storage.create_2Darray_view(ds.ctx, low_res_img, vk::ImageAspectFlagBits::eColor);
+  auto low_res = graph.import_image("low res distance", low_res_array);
 
-  drv::DescriptorBinder binder {ds.descriptors.get(low_res_bindings)};
+  drv::DescriptorBinder binder {ds.descriptors, low_res_bindings};
   binder
     .bind_combined_img(0, dist_array->api_view(), sampler)
     .bind_storage_image(1, low_res_array->api_view())
     .write(ds.ctx);
 
+  graph.add_pass("oct fold", [this, &ds, layers](vk::CommandBuffer &cmd) {
+      cmd.bindPipeline(vk::PipelineBindPoint::eCompute, ds.pipelines.get(low_res_pipeline));
+      cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, ds.pipelines.get_layout(low_res_pipeline), 0, {ds.descriptors.get(low_res_bindings)}, {});
+      cmd.dispatch(4, 4, layers);
+    })
+    .read(distance, drv::ImageUsage::Sampled, vk::PipelineStageFlagBits::eComputeShader, {0, 1})
+    .overwrite(low_res, drv::ImageUsage::Storage, vk::PipelineStageFlagBits::eComputeShader);
 
-  auto cmd = ds.submit_pool.start_cmd(ds.ctx);
-  vk::CommandBufferBeginInfo begin_info {};
-  cmd.begin(begin_info);
-  
-  drv::ImageBarrier to_general{low_res_img, vk::ImageAspectFlagBits::eColor};
-
-  to_general.set_range(0, 1, 0, layers);
-  to_general.change_layout(vk::ImageLayout::eUndefined, vk::ImageLayout::eGeneral);
-  to_general.access_msk(vk::AccessFlagBits::eMemoryRead, vk::AccessFlagBits::eMemoryWrite);
-  to_general.write(cmd, vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eComputeShader);
-
-  cmd.bindPipeline(vk::PipelineBindPoint::eCompute, ds.pipelines.get(low_res_pipeline));
-  cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, ds.pipelines.get_layout(low_res_pipeline), 0, {ds.descriptors.get(low_res_bindings)}, {});
-  cmd.dispatch(4, 4, layers);
-
-  drv::ImageBarrier to_sampled{low_res_img, vk::ImageAspectFlagBits::eColor};
-  to_sampled.set_range(0, 1, 0, layers);
-  to_sampled.change_layout(vk::ImageLayout::eGeneral, vk::ImageLayout::eShaderReadOnlyOptimal);
-  to_sampled.access_msk(vk::AccessFlagBits::eMemoryWrite, vk::AccessFlagBits::eMemoryRead);
-  to_sampled.write(cmd, vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eBottomOfPipe);
-
-
-  cmd.end();
-  auto fence = ds.submit_pool.submit_cmd(ds.ctx, cmd);
-  ds.ctx.get_device().waitForFences({fence}, VK_TRUE, ~(0ul));
-  ds.ctx.get_device().destroyFence(fence);
+  return low_res;
 }
 
-void LightField::compute_irradiance(DriverState &ds) {
+drv::RGImage LightField::compute_irradiance(DriverState &ds, drv::RenderGraph &graph, drv::RGImage radiance) {
   auto layers = dim.x * dim.y * dim.z;
-  auto irradiance_img = ds.storage.create_image2D_array(ds.ctx, 64, 64, vk::Format::eR16G16B16A16Sfloat, vk::ImageUsageFlagBits::eStorage|vk::ImageUsageFlagBits::eSampled, layers);
+  auto irradiance_img = ds.storage.create_image2D_array(ds.ctx, PROBE_LOW_RES, PROBE_LOW_RES, vk::Format::eR16G16B16A16Sfloat, vk::ImageUsageFlagBits::eStorage|vk::ImageUsageFlagBits::eSampled, layers, 1, vk::SharingMode::eConcurrent);
 
   irradiance_pass.image_view = ds.storage.create_2Darray_view(ds.ctx, irradiance_img, vk::ImageAspectFlagBits::eColor);
+  auto irradiance = graph.import_image("irradiance", irradiance_pass.image_view);
 
-  drv::DescriptorBinder binder {ds.descriptors.get(irradiance_pass.descriptor)};
+  drv::DescriptorBinder binder {ds.descriptors, irradiance_pass.descriptor};
   binder
     .bind_combined_img(0, radiance_array->api_view(), sampler)
     .bind_storage_image(2, irradiance_pass.image_view->api_view())
     .bind_ubo(1, irradiance_pass.samples_buffer->api_buffer())
     .write(ds.ctx);
-  
-  auto cmd = ds.submit_pool.start_cmd(ds.ctx);
-  vk::CommandBufferBeginInfo begin_info {};
-  cmd.begin(begin_info);
-  
-  drv::ImageBarrier to_general{irradiance_img, vk::ImageAspectFlagBits::eColor};
-
-  to_general.set_range(0, 1, 0, layers);
-  to_general.change_layout(vk::ImageLayout::eUndefined, vk::ImageLayout::eGeneral);
-  to_general.access_msk(vk::AccessFlagBits::eMemoryRead, vk::AccessFlagBits::eMemoryWrite);
-  to_general.write(cmd, vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eComputeShader);
 
-  cmd.bindPipeline(vk::PipelineBindPoint::eCompute, ds.pipelines.get(irradiance_pass.pipeline));
-  cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, ds.pipelines.get_layout(irradiance_pass.pipeline), 0, {ds.descriptors.get(irradiance_pass.descriptor)}, {});
-  cmd.dispatch(8, 16, layers);
+  graph.add_pass("irradiance", [this, &ds, layers](vk::CommandBuffer &cmd) {
+      cmd.bindPipeline(vk::PipelineBindPoint::eCompute, ds.pipelines.get(irradiance_pass.pipeline, ds.quality.constants));
+      cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, ds.pipelines.get_layout(irradiance_pass.pipeline), 0, {ds.descriptors.get(irradiance_pass.descriptor)}, {});
+      cmd.dispatch(8, 16, layers);
+    })
+    .read(radiance, drv::ImageUsage::Sampled, vk::PipelineStageFlagBits::eComputeShader)
+    .overwrite(irradiance, drv::ImageUsage::Storage, vk::PipelineStageFlagBits::eComputeShader);
 
-  drv::ImageBarrier to_sampled{irradiance_img, vk::ImageAspectFlagBits::eColor};
-  to_sampled.set_range(0, 1, 0, layers);
-  to_sampled.change_layout(vk::ImageLayout::eGeneral, vk::ImageLayout::eShaderReadOnlyOptimal);
-  to_sampled.access_msk(vk::AccessFlagBits::eMemoryWrite, vk::AccessFlagBits::eMemoryRead);
-  to_sampled.write(cmd, vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eBottomOfPipe);
-
-
-  cmd.end();
-  auto fence = ds.submit_pool.submit_cmd(ds.ctx, cmd);
-  ds.ctx.get_device().waitForFences({fence}, VK_TRUE, ~(0ul));
-  ds.ctx.get_device().destroyFence(fence);
+  return irradiance;
 }
 
-void LightField::create_hidist_images(DriverState &ds) {
-  std::cout << "HiDist started\n";
+//each mip is built from the previous one, the graph places barriers between mips
+void LightField::create_hidist_images(DriverState &ds, drv::RenderGraph &graph, drv::RGImage distance) {
   auto layers = dim.x * dim.y * dim.z;
-
-  std::vector<VkSampler> samplers;
-  
-  auto cmd = ds.submit_pool.start_cmd(ds.ctx);
-  vk::CommandBufferBeginInfo begin_info {};
-  cmd.begin(begin_info);
-
-  auto src_view = ds.storage.create_2Darray_mip_view(ds.ctx, dist_array->get_base_img(), vk::ImageAspectFlagBits::eColor, 0);
-
-  cmd.bindPipeline(vk::PipelineBindPoint::eCompute, ds.pipelines.get(hidist_pass.pipeline));
-
-  std::vector<drv::DescriptorSetID> desc;
-
   u32 resolution = OCT_RES/2;
 
   for (u32 mip_level = 0; mip_level < DIST_MIPS - 1; mip_level++) {
-    vk::PipelineStageFlags src_flags = (mip_level == 0)? vk::PipelineStageFlagBits::eTopOfPipe : vk::PipelineStageFlagBits::eComputeShader;
-    vk::PipelineStageFlags dst_flags = (mip_level == (DIST_MIPS - 2))? vk::PipelineStageFlagBits::eBottomOfPipe : vk::PipelineStageFlagBits::eComputeShader;
-    //uto img_layout = (mip_level == )
-    auto dst_view = ds.storage.create_2Darray_mip_view(ds.ctx, dist_array->get_base_img(), vk::ImageAspectFlagBits::eColor, mip_level + 1);
-    
-    drv::ImageBarrier to_general{dist_array->get_base_img(), vk::ImageAspectFlagBits::eColor};
-    to_general
-      .set_range(mip_level + 1, 1, 0, layers)
-      .change_layout(vk::ImageLayout::eUndefined, vk::ImageLayout::eGeneral)
-      .access_msk(vk::AccessFlagBits::eMemoryRead, vk::AccessFlagBits::eMemoryWrite)
-      .write(cmd, src_flags, vk::PipelineStageFlagBits::eComputeShader);
-
-    auto descriptor = ds.descriptors.allocate_set(ds.ctx, hidist_pass.descriptor_layout);
-    drv::DescriptorBinder binder{ds.descriptors.get(descriptor)};
-    binder
+    auto &src_view = hidist_pass.mip_views[mip_level];
+    auto &dst_view = hidist_pass.mip_views[mip_level + 1];
+
+    drv::DescriptorBinder binder {ds.descriptors, hidist_pass.descriptor_layout};
+    auto descriptor = binder
       .bind_combined_img(0, src_view->api_view(), hidist_pass.nearest_sampler)
       .bind_storage_image(1, dst_view->api_view())
-      .write(ds.ctx);
+      .write_cached(ds.ctx);
 
-    desc.push_back(descriptor);
+    graph.add_pass("hidist mip " + std::to_string(mip_level + 1), [this, &ds, descriptor, resolution, layers](vk::CommandBuffer &cmd) {
+        cmd.bindPipeline(vk::PipelineBindPoint::eCompute, ds.pipelines.get(hidist_pass.pipeline));
+        cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, ds.pipelines.get_layout(hidist_pass.pipeline), 0, {descriptor}, {});
+        cmd.dispatch(resolution/8, resolution/4, layers);
+      })
+      .read(distance, drv::ImageUsage::Sampled, vk::PipelineStageFlagBits::eComputeShader, {mip_level, 1})
+      .overwrite(distance, drv::ImageUsage::Storage, vk::PipelineStageFlagBits::eComputeShader, {mip_level + 1, 1});
 
-    cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, ds.pipelines.get_layout(hidist_pass.pipeline), 0, {ds.descriptors.get(descriptor)}, {});
-    cmd.dispatch(resolution/8, resolution/4, layers);
     resolution /= 2;
-
-    drv::ImageBarrier to_sampled{dist_array->get_base_img(), vk::ImageAspectFlagBits::eColor};
-    to_general
-      .set_range(mip_level + 1, 1, 0, layers)
-      .change_layout(vk::ImageLayout::eGeneral, vk::ImageLayout::eShaderReadOnlyOptimal)
-      .access_msk(vk::AccessFlagBits::eMemoryRead, vk::AccessFlagBits::eMemoryWrite)
-      .write(cmd, src_flags, vk::PipelineStageFlagBits::eComputeShader);
-
-    src_view = dst_view;
   }
-
-  cmd.end();
-  auto fence = ds.submit_pool.submit_cmd(ds.ctx, cmd);
-  ds.ctx.get_device().waitForFences({fence}, VK_TRUE, ~(0ul));
-  ds.ctx.get_device().destroyFence(fence);
-
-  std::cout << "HiDist created\n";
-}
\ No newline at end of file
+}
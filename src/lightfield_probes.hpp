@@ -6,6 +6,8 @@
 #include "postprocessing.hpp"
 #include "config.hpp"
 
+#include <array>
+
 struct LightFieldProbe {
   glm::vec3 pos;
 };
@@ -13,7 +15,8 @@ struct LightFieldProbe {
 struct LightField {
   void init(DriverState &ds);
   void release(DriverState &ds);
-  void render(DriverState &ds, Scene &scene, glm::vec3 bmin, glm::vec3 bmax, glm::uvec3 d);
+  //probes are filtered on the compute queue, arrays are ready to sample after the returned task
+  drv::GpuTask render(DriverState &ds, Scene &scene, glm::vec3 bmin, glm::vec3 bmax, glm::uvec3 d);
   
   glm::uvec3 get_dimensions() const { return dim; }
   glm::vec3 get_bbox_min() const { return bmin; }
@@ -36,18 +39,20 @@ private:
   void create_pipeline(DriverState &ds);
   void calc_matrix(u32 side, vk::Extent2D ext, glm::vec3 pos, glm::mat4 &out);
 
-  void transform_cubemap_layout(vk::CommandBuffer &buf, vk::ImageLayout src, vk::ImageLayout dst);
-  void blit_cubemaps(vk::CommandBuffer &buf, u32 side);
+  void blit_cubemaps(vk::CommandBuffer &buf, u32 side, const std::array<drv::RGImage, 4> &targets);
+  void update_framebuffer(DriverState &ds, const std::array<drv::RGImage, 4> &targets);
 
   void render_cubemaps(DriverState &ds, Scene &scene, glm::vec3 center);
+  void render_side(DriverState &ds, Scene &scene, vk::CommandBuffer &cmd);
   void bind_resources(DriverState &ds, Scene &scene);
   
   void init_compute_resources(DriverState &ds);
   void init_hidist_resources(DriverState &ds);
 
-  void downsample_distances(DriverState &ds);
-  void compute_irradiance(DriverState &ds);
-  void create_hidist_images(DriverState &ds);
+  //add filtering passes to graph, images are recorded by the caller
+  drv::RGImage downsample_distances(DriverState &ds, drv::RenderGraph &graph, drv::RGImage distance);
+  drv::RGImage compute_irradiance(DriverState &ds, drv::RenderGraph &graph, drv::RGImage radiance);
+  void create_hidist_images(DriverState &ds, drv::RenderGraph &graph, drv::RGImage distance);
 
   struct UBOData {
     glm::mat4 camera_proj;
@@ -55,8 +60,10 @@ private:
   };
 
   //render to cubemap resources
+  drv::RenderGraph bake_graph;
+  drv::RGImage cubemaps[3]; //distance, radiance, normal
   vk::Framebuffer fb;
-  drv::ImageViewID dist, color, norm, depth;
+  std::array<vk::ImageView, 4> fb_views {};
   drv::ImageViewID cm_dist, cm_color, cm_norm;
   vk::Sampler sampler;
 
@@ -98,6 +105,7 @@ private:
     drv::ComputePipelineID pipeline;
     drv::DescriptorSetLayoutID descriptor_layout;
     vk::Sampler nearest_sampler;
+    std::vector<drv::ImageViewID> mip_views;
   } hidist_pass;
 
   static constexpr u32 SAMPLES_COUNT = 1024;
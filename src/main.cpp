@@ -12,16 +12,105 @@
 
 #include "renderer.hpp"
 
-int main() {
-  SDL_Init(SDL_INIT_EVERYTHING);
+static vk::PresentModeKHR parse_present_mode(const std::string &name) {
+  if (name == "fifo") return vk::PresentModeKHR::eFifo;
+  if (name == "mailbox") return vk::PresentModeKHR::eMailbox;
+  if (name == "immediate") return vk::PresentModeKHR::eImmediate;
+  throw std::runtime_error {"Unknown present mode " + name};
+}
 
-  auto window = SDL_CreateWindow("", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 1920, 1080, SDL_WINDOW_VULKAN);
+static vk::Extent2D parse_size(const std::string &size) {
+  auto x = size.find('x');
+  if (x == std::string::npos) {
+    throw std::runtime_error {"Size must be WxH, got " + size};
+  }
+  return {u32(std::stoul(size.substr(0, x))), u32(std::stoul(size.substr(x + 1)))};
+}
+
+//--frames N --present fifo|mailbox|immediate --fps-limit N --low-latency
+//--headless --size WxH --run-frames N --sim-step S
+//--dynres-target MS --dynres-min S --no-dynres
+//--bench camera_path.txt --bench-dt S --bench-frames N --bench-warmup N --bench-out report.json
+static RendererConfig parse_args(int argc, char **argv) {
+  RendererConfig config {};
+  bool dynres_set = false;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+
+    if (arg == "--frames" && has_value) {
+      config.pacing.frames_in_flight = std::stoul(argv[++i]);
+    } else if (arg == "--present" && has_value) {
+      config.present_mode = parse_present_mode(argv[++i]);
+    } else if (arg == "--fps-limit" && has_value) {
+      config.pacing.fps_limit = std::stof(argv[++i]);
+    } else if (arg == "--low-latency") {
+      config.pacing.low_latency = true;
+    } else if (arg == "--headless") {
+      config.headless = true;
+    } else if (arg == "--size" && has_value) {
+      config.headless_extent = parse_size(argv[++i]);
+    } else if (arg == "--run-frames" && has_value) {
+      config.max_frames = std::stoul(argv[++i]);
+    } else if (arg == "--sim-step" && has_value) {
+      config.sim_step = std::stof(argv[++i]);
+    } else if (arg == "--dynres-target" && has_value) {
+      config.resolution.target_ms = std::stof(argv[++i]);
+      dynres_set = true;
+    } else if (arg == "--dynres-min" && has_value) {
+      config.resolution.min_scale = std::stof(argv[++i]);
+      dynres_set = true;
+    } else if (arg == "--no-dynres") {
+      config.resolution.enabled = false;
+      dynres_set = true;
+    } else if (arg == "--bench" && has_value) {
+      config.benchmark.path_file = argv[++i];
+    } else if (arg == "--bench-dt" && has_value) {
+      config.benchmark.dt = std::stof(argv[++i]);
+    } else if (arg == "--bench-frames" && has_value) {
+      config.benchmark.frames = std::stoul(argv[++i]);
+    } else if (arg == "--bench-warmup" && has_value) {
+      config.benchmark.warmup = std::stoul(argv[++i]);
+    } else if (arg == "--bench-out" && has_value) {
+      config.benchmark.output = argv[++i];
+    } else {
+      throw std::runtime_error {"Unknown argument " + arg};
+    }
+  }
+
+  if (config.sim_step <= 0.f) {
+    throw std::runtime_error {"Simulation step must be positive"};
+  }
+
+  //benchmark runs render the same work every time unless dynamic resolution is asked for
+  if (!config.benchmark.path_file.empty() && !dynres_set) {
+    config.resolution.enabled = false;
+  }
+
+  //nothing can stop a headless run except the frame count
+  if (config.headless && !config.max_frames) {
+    config.max_frames = 1000;
+  }
+  return config;
+}
+
+int main(int argc, char **argv) {
+  auto config = parse_args(argc, argv);
+  //headless runs use only SDL timers, no display is needed
+  SDL_Init(config.headless? SDL_INIT_TIMER : SDL_INIT_EVERYTHING);
+
+  SDL_Window *window = nullptr;
+  if (!config.headless) {
+    window = SDL_CreateWindow("", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 1920, 1080, SDL_WINDOW_VULKAN);
+  }
   
   Renderer renderer{};
-  renderer.init(window);
+  renderer.init(window, config);
   renderer.main_loop();
 
-  SDL_DestroyWindow(window);
+  if (window) {
+    SDL_DestroyWindow(window);
+  }
   SDL_Quit();
   return 0;
 }
\ No newline at end of file
@@ -34,7 +34,7 @@ struct PostProcessingPass {
 
     image_bindings.resize(input_textures_count);
     create_renderpass(ds);
-    create_pipeline_layout(ds);
+    create_pipeline_layout(ds, fs_name);
     create_pipeline(ds, "pass_vs", fs_name);
 
     mark_framebuffers_dirty();
@@ -44,8 +44,8 @@ struct PostProcessingPass {
   void release(DriverState &ds) {
     image_bindings.clear();
 
-    ds.descriptors.free_layout(ds.ctx, res_layout);
     for (u32 i = 0; i < CONTEXTS_COUNT; i++) {
+      ds.descriptors.free_set(ds.ctx, sets[i]);
       if (framebuffers[i]) {
         ds.ctx.get_device().destroyFramebuffer(framebuffers[i]);
         framebuffers[i] = nullptr;
@@ -54,7 +54,7 @@ struct PostProcessingPass {
       ubo[i].release();
     }
     ds.pipelines.free_pipeline(ds.ctx, pipeline);
-    ds.ctx.get_device().destroyRenderPass(renderpass);
+    ds.pipelines.free_renderpass(ds.ctx, renderpass);
   }
 
   void set_frame_data(const FrameData &data) {
@@ -66,10 +66,13 @@ struct PostProcessingPass {
   void set_push_const(const PushData &data) {
     if constexpr(!supportsPC()) return;
     next_push_data = data;
-    mark_sets_dirty();
   }
 
   void set_image_sampler(u32 binding, drv::ImageViewID id, vk::Sampler sampler) { 
+    //probe bake sets the same inputs for every probe, descriptors are rewritten only on change
+    if (image_bindings[binding].smp == sampler && image_bindings[binding].img == id) {
+      return;
+    }
     image_bindings[binding].smp = sampler;
     image_bindings[binding].img = id;
     mark_sets_dirty();
@@ -90,17 +93,21 @@ struct PostProcessingPass {
     bind_and_draw(ds, dctx.frame_id, dctx.dcb);
   }
 
-  void render_and_wait(DriverState &ds) {
+  //zone is the name of the pass in gpu profiler
+  void render_and_wait(DriverState &ds, const std::string &zone = "postprocessing") {
     flush(ds, SEQ_CTX);
     auto cmd = ds.submit_pool.start_cmd(ds.ctx);
 
     vk::CommandBufferBeginInfo begin_info {};
     cmd.begin(begin_info);
-    bind_and_draw(ds, SEQ_CTX, cmd);
+    ds.gpu_profiler.begin_frame(ds.ctx, cmd, drv::ONESHOT_SLOT);
+    {
+      drv::GpuZone gpu_zone {ds.gpu_profiler, cmd, drv::ONESHOT_SLOT, zone};
+      bind_and_draw(ds, SEQ_CTX, cmd);
+    }
     cmd.end();
-    auto fence = ds.submit_pool.submit_cmd(ds.ctx, cmd);
-    ds.ctx.get_device().waitForFences({fence}, VK_TRUE, ~(0ul));
-    ds.ctx.get_device().destroyFence(fence);
+    ds.submit_pool.submit_and_wait(ds.ctx, cmd);
+    ds.gpu_profiler.resolve(ds.ctx, drv::ONESHOT_SLOT);
   }
 
   
@@ -156,8 +163,7 @@ private:
 
     if (set_dirty[ctx_id]) {
       const u32 img_slots = image_bindings.size();
-      auto set = ds.descriptors.get(sets[ctx_id]);
-      drv::DescriptorBinder binder {set};
+      drv::DescriptorBinder binder {ds.descriptors, sets[ctx_id]};
       
       for (u32 i = 0; i < img_slots; i++) {
         if (image_bindings[i].img.is_nullptr()) {
@@ -214,52 +220,56 @@ private:
     info.setAttachments(attach_desc);
     info.setSubpasses(subpasses);
 
-    renderpass = ds.ctx.get_device().createRenderPass(info);
+    //passes with the same attachments share render pass and pipelines
+    renderpass = ds.pipelines.create_renderpass(ds.ctx, info);
   }
 
-  void create_pipeline_layout(DriverState &ds) {
+  void create_pipeline_layout(DriverState &ds, const std::string &frag_name) {
     if constexpr(supportsUBO()) {
       for (u32 i = 0; i < CONTEXTS_COUNT; i++) {
         ubo[i] = ds.storage.create_buffer(ds.ctx, drv::GPUMemoryT::Coherent, sizeof(FrameData), vk::BufferUsageFlagBits::eUniformBuffer);
       }
     }
 
+    //passes with the same shader interface share layouts
+    auto &reflected = ds.pipelines.reflect_layout(ds.ctx, ds.descriptors, {"pass_vs", frag_name});
+    validate_layout(reflected, frag_name);
+
+    res_layout = reflected.sets[0];
+    for (u32 i = 0; i < CONTEXTS_COUNT; i++) {
+      sets[i] = ds.descriptors.allocate_set(ds.ctx, res_layout);
+    }
 
-    drv::DescriptorSetLayoutBuilder builder {};
+    pipeline_layout = reflected.layout;
+  }
 
+  //set 0: textures at 0..n-1, ubo at n if the pass has FrameData
+  void validate_layout(const drv::ReflectedLayout &layout, const std::string &frag_name) {
     const u32 tex_count = image_bindings.size();
+    const u32 expected = tex_count + (supportsUBO()? 1 : 0);
+    auto error = [&](const std::string &msg) {
+      return std::runtime_error {"Shader " + frag_name + " doesn't match postprocessing pass: " + msg};
+    };
 
-    for (u32 i = 0; i < tex_count; i++) {
-      builder.add_combined_sampler(i, vk::ShaderStageFlagBits::eFragment);
+    if (layout.sets.size() != 1 || layout.bindings.size() != expected) {
+      throw error("expected " + std::to_string(expected) + " bindings in set 0");
     }
 
-    if constexpr(supportsUBO()) {
-      builder.add_ubo(tex_count, vk::ShaderStageFlagBits::eFragment);
-    }
-
-    res_layout = ds.descriptors.create_layout(ds.ctx, builder.build(), CONTEXTS_COUNT);
-    
-    for (u32 i = 0; i < CONTEXTS_COUNT; i++) {
-      sets[i] = ds.descriptors.allocate_set(ds.ctx, res_layout);
+    for (u32 i = 0; i < expected; i++) {
+      auto type = (i < tex_count)? vk::DescriptorType::eCombinedImageSampler : vk::DescriptorType::eUniformBuffer;
+      auto &b = layout.bindings[i];
+      if (b.binding != i || b.type != type || b.count != 1) {
+        throw error("wrong binding " + std::to_string(b.binding));
+      }
     }
 
-    auto desc_set_layouts = {ds.descriptors.get(res_layout)};
-
-    vk::PipelineLayoutCreateInfo info {};
-    vk::PushConstantRange range {};
+    u32 push_size = 0;
     if constexpr(supportsPC()) {
-      range.setOffset(0);
-      range.setSize(sizeof(PushData));
-      range.setStageFlags(vk::ShaderStageFlagBits::eFragment);
+      push_size = sizeof(PushData);
     }
-
-    auto ranges = {range};
-    if constexpr(supportsPC()) {
-      info.setPushConstantRanges(ranges);
+    if (layout.push_constants.size != push_size) {
+      throw error("push constants size is " + std::to_string(layout.push_constants.size) + ", expected " + std::to_string(push_size));
     }
-    
-    info.setSetLayouts(desc_set_layouts);
-    pipeline_layout = ds.ctx.get_device().createPipelineLayout(info);
   }
 
   void create_pipeline(DriverState &ds, const std::string &vert_name, const std::string &frag_name) {
@@ -0,0 +1,77 @@
+#ifndef QUALITY_HPP_INCLUDED
+#define QUALITY_HPP_INCLUDED
+
+#include "drv/pipeline.hpp"
+
+//probe images are created with these sizes, shaders get them through specialization
+const u32 PROBE_OCT_RES = 1024;
+const u32 PROBE_LOW_RES = 64;
+
+//same ids as in shaders/include/spec_constants.glsl
+enum SpecConstantID : u32 {
+  SPEC_LIGHTS_LIMIT = 0,
+  SPEC_IRRADIANCE_SAMPLES = 1,
+  SPEC_SH_SAMPLES = 2,
+  SPEC_PROBE_TEX_SIZE = 3,
+  SPEC_PROBE_LOW_RES_SIZE = 4,
+  SPEC_TRACE_STEPS = 5,
+  SPEC_HIZ_TRACE_STEPS = 6
+};
+
+enum class QualityTier {
+  Low,
+  Medium,
+  High
+};
+
+struct QualitySettings {
+  u32 lights_limit;
+  u32 irradiance_samples; //up to LightField::SAMPLES_COUNT
+  u32 sh_samples; //up to 256*256
+  u32 trace_steps;
+  u32 hiz_trace_steps;
+
+  static QualitySettings get(QualityTier tier) {
+    switch (tier) {
+      case QualityTier::Low: return {1, 256, 64*256, 8, 16};
+      case QualityTier::Medium: return {4, 512, 128*256, 16, 32};
+      default: return {4, 1024, 256*256, 32, 64};
+    }
+  }
+
+  drv::SpecConstants constants() const {
+    drv::SpecConstants consts;
+    consts
+      .set(SPEC_LIGHTS_LIMIT, lights_limit)
+      .set(SPEC_IRRADIANCE_SAMPLES, irradiance_samples)
+      .set(SPEC_SH_SAMPLES, sh_samples)
+      .set(SPEC_TRACE_STEPS, trace_steps)
+      .set(SPEC_HIZ_TRACE_STEPS, hiz_trace_steps);
+    return consts;
+  }
+};
+
+//Pipelines are created with constants of the current tier and use them as variant key,
+//other tiers are compiled on first use
+struct Quality {
+  QualityTier tier = QualityTier::High;
+  QualitySettings settings = QualitySettings::get(QualityTier::High);
+  drv::SpecConstants constants = settings.constants();
+
+  void set(QualityTier t) {
+    tier = t;
+    settings = QualitySettings::get(t);
+    constants = settings.constants();
+  }
+
+  //constants that don't depend on tier
+  static drv::SpecConstants probe_constants() {
+    drv::SpecConstants consts;
+    consts
+      .set(SPEC_PROBE_TEX_SIZE, f32(PROBE_OCT_RES))
+      .set(SPEC_PROBE_LOW_RES_SIZE, f32(PROBE_LOW_RES));
+    return consts;
+  }
+};
+
+#endif
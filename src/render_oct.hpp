@@ -8,7 +8,7 @@ struct OctahedralRenderer {
   OctahedralRenderer(){}
 
   void init(DriverState &ds) {
-    ds.pipelines.load_shader(ds.ctx, "cubemap_to_oct_fs", "src/shaders/cubemap_to_oct_frag.spv", vk::ShaderStageFlagBits::eFragment);
+    ds.pipelines.load_shader(ds.ctx, "cubemap_to_oct_fs", "src/shaders/cubemap_to_oct.frag", vk::ShaderStageFlagBits::eFragment);
     renderer.init_attachment(vk::Format::eR32Sfloat);
     renderer.init(ds, 1, "cubemap_to_oct_fs");
   }
@@ -24,7 +24,7 @@ struct OctahedralRenderer {
     renderer.set_attachment(0, out_oct);
     renderer.set_image_sampler(0, cubemap, smp);
     renderer.set_render_area(inf.extent.width, inf.extent.height);
-    renderer.render_and_wait(ds);
+    renderer.render_and_wait(ds, "oct conversion");
   }
 
 private:
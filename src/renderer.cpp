@@ -1,18 +1,44 @@
 #include "renderer.hpp"
 
-void Renderer::init(SDL_Window *w) {
+#include <iostream>
+
+void Renderer::init(SDL_Window *w, const RendererConfig &config) {
   window = w;
+  CPU_THREAD_NAME("render");
+  CPU_ZONE("renderer init");
   
-  ds.ctx.init(window);
+  if (config.headless) {
+    ds.ctx.init_headless(config.headless_extent, drv::MAX_FRAMES_IN_FLIGHT);
+  } else {
+    ds.ctx.init(window, config.present_mode);
+  }
+  max_frames = config.max_frames;
+  sim_step = config.sim_step;
+  benchmark.init(config.benchmark);
+  if (benchmark.active()) {
+    max_frames = benchmark.frame_count();
+  }
+  ds.workers.init();
+  ds.gpu_profiler.init(ds.ctx);
+  ds.work_stats.init(ds.ctx);
   ds.storage.init(ds.ctx);
+  ds.scheduler.init(ds.ctx);
+  ds.pipelines.init(ds.ctx);
 
   ds.main_renderpass = create_main_renderpass();
+  ds.submit_pool.configure(config.pacing);
   ds.submit_pool.init(ds.ctx, ds.main_renderpass);
+  ds.submit_pool.init_thread_pools(ds.ctx, ds.workers.size() + 1);
   imgui_ctx.init(ds.ctx, ds.main_renderpass, 0);
   imgui_ctx.create_fonts(ds.ctx, ds.submit_pool);
 
-  ds.pipelines.load_shader(ds.ctx, "pass_vs", "src/shaders/pass_vert.spv", vk::ShaderStageFlagBits::eVertex);
-  ds.pipelines.load_shader(ds.ctx, "shading_fs", "src/shaders/shading_frag.spv", vk::ShaderStageFlagBits::eFragment);
+  //changed sources are compiled in parallel, the rest comes from shader cache
+  ds.pipelines.prebuild_shaders(ds.workers, "src/shaders");
+  ds.pipelines.load_shader(ds.ctx, "pass_vs", "src/shaders/pass.vert", vk::ShaderStageFlagBits::eVertex);
+  ds.pipelines.load_shader(ds.ctx, "shading_fs", "src/shaders/shading.frag", vk::ShaderStageFlagBits::eFragment);
+
+  //pipelines are compiled on workers, the first get() of each one waits for it
+  ds.pipelines.begin_batch(ds.workers);
 
   frame_data = new FrameGlobal{};
   frame_data->init(ds);
@@ -21,14 +47,34 @@ void Renderer::init(SDL_Window *w) {
   gbuffer_subpass->init(ds);
 
   shading_subpass = new ShadingPass{ds, *frame_data};
+  upscale_pass = new UpscalePass{ds, shading_subpass->get_output()};
   shdebug_subpass = new SHDebugSubpass{ds, *frame_data};
+
+  ds.pipelines.end_batch();
+
+  //gbuffer contents are not needed between frames
+  auto &gbuf = frame_data->get_gbuffer();
+  const char *names[] = {"albedo", "normal", "world_pos", "depth"};
+  for (u32 i = 0; i < 4; i++) {
+    gbuffer_images[i] = frame_graph.import_image(names[i], gbuf.images[i]);
+  }
+  shading_image = frame_graph.import_image("shading", shading_subpass->get_output());
+
+  //scale is measured by frames in flight late
+  resolution.init(config.resolution, ds.ctx.get_swapchain_extent(), config.pacing.frames_in_flight);
+  //loading isn't counted as work of the first frame
+  ds.work_stats.reset(ds.storage);
 }
 
 void Renderer::release() {
   imgui_ctx.release(ds.ctx);
+  frame_graph.release();
 
   delete shdebug_subpass;
 
+  upscale_pass->release(ds);
+  delete upscale_pass;
+
   shading_subpass->release(ds);
   delete shading_subpass;
 
@@ -38,7 +84,11 @@ void Renderer::release() {
   ds.submit_pool.release(ds.ctx);
   frame_data->release(ds);
   delete frame_data;
+  ds.scheduler.release(ds.ctx);
   ds.pipelines.release(ds.ctx);
+  ds.gpu_profiler.release(ds.ctx);
+  ds.work_stats.release(ds.ctx);
+  ds.workers.release();
   ds.storage.release(ds.ctx);
   ds.ctx.get_device().destroyRenderPass(ds.main_renderpass);
 }
@@ -48,7 +98,7 @@ vk::RenderPass Renderer::create_main_renderpass() {
   vk::AttachmentDescription backbuf_desc{};
   backbuf_desc
   .setInitialLayout(vk::ImageLayout::eUndefined)
-  .setFinalLayout(vk::ImageLayout::ePresentSrcKHR)
+  .setFinalLayout(ds.ctx.get_backbuffer_layout())
   .setFormat(ds.ctx.get_swapchain_fmt())
   .setLoadOp(vk::AttachmentLoadOp::eDontCare)
   .setStoreOp(vk::AttachmentStoreOp::eStore)
@@ -72,12 +122,13 @@ vk::RenderPass Renderer::create_main_renderpass() {
 
   auto subpasses = {shading_pass};
 
+  //gbuffer reads are synchronized by the frame graph, only backbuffer acquire is left here
   vk::SubpassDependency dep {};
   dep
-    .setSrcAccessMask(vk::AccessFlagBits::eColorAttachmentWrite|vk::AccessFlagBits::eDepthStencilAttachmentWrite)
-    .setSrcStageMask(vk::PipelineStageFlagBits::eAllGraphics)
-    .setDstAccessMask(vk::AccessFlagBits::eShaderRead)
-    .setDstStageMask(vk::PipelineStageFlagBits::eFragmentShader)
+    .setSrcAccessMask({})
+    .setSrcStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput)
+    .setDstAccessMask(vk::AccessFlagBits::eColorAttachmentWrite)
+    .setDstStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput)
     .setSrcSubpass(VK_SUBPASS_EXTERNAL)
     .setDstSubpass(0);
 
@@ -113,24 +164,61 @@ void Renderer::create_framebuffers(std::vector<vk::Framebuffer> &fb) {
   }
 }
 
-void Renderer::update(float dt) {
-  frame_data->update(dt);
+void Renderer::update(float dt, std::chrono::steady_clock::time_point tick) {
+  frame_data->update(dt, tick);
   gbuffer_subpass->update(dt);
 }
 
+template <typename T, u32 SIZE>
+void Renderer::send(drv::SpscQueue<T, SIZE> &queue, const T &value) {
+  while (!queue.push(value) && running.load(std::memory_order_relaxed)) {
+    std::this_thread::yield();
+  }
+}
+
+//update thread, imgui input is processed by render thread before the next imgui frame
 void Renderer::handle_event(const SDL_Event &event) {
   if (event.type == SDL_QUIT) {
-    events_msk.store((u32)RenderEvents::Finish, std::memory_order_relaxed);
+    send(render_events, RenderEvents::Finish);
   }
 
   if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_r) {
-    events_msk.store((u32)RenderEvents::ReloadShaders, std::memory_order_relaxed);
+    send(render_events, RenderEvents::ReloadShaders);
   }
-  imgui_ctx.process_event(event);
+
+  if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_m) {
+    send(render_events, RenderEvents::Defragment);
+  }
+  send(ui_events, event);
   frame_data->handle_events(event);
 }
 
+void Renderer::defragment() {
+  drv::Relocations relocations;
+  auto stats = ds.storage.defragment(ds.ctx, relocations);
+  //collected handles may be reused by moved resources, stale sets go before patching
+  ds.descriptors.evict(ds.ctx, ds.storage.take_released());
+  ds.descriptors.relocate(ds.ctx, relocations, stats);
+
+  i64 reclaimed = i64(stats.unused_before) - i64(stats.unused_after);
+  std::cout << "Defragmentation: " << stats.buffers_moved << " buffers, " 
+    << stats.images_moved << " images, " << stats.views_recreated << " views moved, "
+    << stats.bytes_moved << " bytes copied, " << stats.sets_rewritten << " descriptor sets rewritten\n";
+  std::cout << "Unused " << stats.unused_before << " -> " << stats.unused_after << " bytes (" << reclaimed << " reclaimed), "
+    << "blocks " << stats.blocks_before << " -> " << stats.blocks_after << ", " << stats.bytes_freed << " bytes released\n";
+}
+
 void Renderer::render(drv::DrawContext &dctx) {
+  CPU_ZONE("render");
+  SDL_Event ui_event;
+  while (ui_events.pop(ui_event)) {
+    imgui_ctx.process_event(ui_event);
+  }
+  frame_data->collect_bake(ds);
+  auto extent = resolution.update(ds.submit_pool.get_last_timings().gpu);
+  ds.gpu_profiler.begin_frame(ds.ctx, dctx.dcb, dctx.frame_id);
+  ds.work_stats.begin_frame(ds.ctx, dctx.dcb, dctx.frame_id);
+  drv::GpuZone frame_zone {ds.gpu_profiler, dctx.dcb, dctx.frame_id, "frame"};
   imgui_ctx.new_frame();
 
   static bool show_sh = false;
@@ -141,75 +229,245 @@ void Renderer::render(drv::DrawContext &dctx) {
     if (ImGui::Button("SwitchView"))                        
       show_sh = !show_sh;
 
+    //pipelines for a new tier are compiled on first use
+    const char *tiers[] = {"Low", "Medium", "High"};
+    int tier = int(ds.quality.tier);
+    if (ImGui::Combo("Quality", &tier, tiers, 3)) {
+      ds.quality.set(QualityTier(tier));
+    }
+
     ImGui::End();
   }
 
+  {
+    ImGui::Begin("frame info");
+    ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
+    ImGui::End();
+  }
 
-  gbuffer_subpass->render(dctx, ds);
-  
-  vk::ClearValue color {};
-  color.color.setFloat32({0.f, 0.f, 0.f, 0.f});
+  {
+    ImGui::Begin("Frame graph");
+    ImGui::TextUnformatted(frame_graph.describe().c_str());
+    ImGui::End();
+  }
+
+  pacing_ui();
+  resolution_ui();
+  ds.gpu_profiler.draw_ui();
+  ds.work_stats.draw_ui();
+
+  frame_graph.add_pass("gbuffer", [&](vk::CommandBuffer &) {
+      gbuffer_subpass->render(dctx, ds, extent, ds.work_stats.pass("gbuffer"));
+    })
+    .overwrite(gbuffer_images[0], drv::ImageUsage::ColorAttachment)
+    .overwrite(gbuffer_images[1], drv::ImageUsage::ColorAttachment)
+    .overwrite(gbuffer_images[2], drv::ImageUsage::ColorAttachment)
+    .overwrite(gbuffer_images[3], drv::ImageUsage::DepthAttachment);
+
+  //gbuffer and shading run at dynamic resolution, main pass upscales to backbuffer
+  auto shading_pass = frame_graph.add_pass("shading", [&](vk::CommandBuffer &) {
+      shading_subpass->render(dctx, ds, extent, ds.work_stats.pass("shading"));
+    })
+    .overwrite(shading_image, drv::ImageUsage::ColorAttachment);
+  for (u32 i = 0; i < 4; i++) {
+    shading_pass.read(gbuffer_images[i], drv::ImageUsage::Sampled, vk::PipelineStageFlagBits::eFragmentShader);
+  }
+
+  //main pass is recorded on a worker while the gbuffer pass records its draw list
+  vk::CommandBufferInheritanceInfo main_inheritance {};
+  main_inheritance
+    .setRenderPass(ds.main_renderpass)
+    .setSubpass(0)
+    .setFramebuffer(dctx.backbuffer)
+    .setPipelineStatistics(ds.work_stats.get_inherited_statistics());
+
+  //imgui draws are only seen by pipeline statistics
+  auto &main_work = ds.work_stats.pass("main");
+  drv::ParallelRecorder main_recorder {ds.ctx, ds.submit_pool, ds.workers, dctx.frame_id, main_inheritance};
+  main_recorder.add([&](vk::CommandBuffer &cmd) {
+    auto sub_ctx = dctx;
+    sub_ctx.dcb = cmd;
+    if (show_sh) {
+      drv::GpuZone zone {ds.gpu_profiler, cmd, dctx.frame_id, "sh debug"};
+      shdebug_subpass->render(sub_ctx, ds, main_work);
+    } else {
+      drv::GpuZone zone {ds.gpu_profiler, cmd, dctx.frame_id, "upscale"};
+      upscale_pass->render(cmd, ds, resolution.get_uv_scale(), resolution.get_uv_max(), main_work);
+    }
+    drv::GpuZone zone {ds.gpu_profiler, cmd, dctx.frame_id, "imgui"};
+    imgui_ctx.render(cmd);
+  });
+
+  //writes to backbuffer, the graph doesn't track it
+  auto main_pass = frame_graph.add_pass("main", [&](vk::CommandBuffer &cmd) {
+    vk::ClearValue color {};
+    color.color.setFloat32({0.f, 0.f, 0.f, 0.f});
+          
+    auto clear_vals = {color};
+
+    vk::RenderPassBeginInfo info {};
+    info.setRenderPass(ds.main_renderpass);
+    info.setFramebuffer(dctx.backbuffer);
+    info.setClearValues(clear_vals);
+    info.setRenderArea(vk::Rect2D{{0, 0}, ds.ctx.get_swapchain_extent()});
         
-  auto clear_vals = {color};
-
-  vk::RenderPassBeginInfo info {};
-  info.setRenderPass(ds.main_renderpass);
-  info.setFramebuffer(dctx.backbuffer);
-  info.setClearValues(clear_vals);
-  info.setRenderArea(vk::Rect2D{{0, 0}, ds.ctx.get_swapchain_extent()});
-      
-  dctx.dcb.beginRenderPass(info, vk::SubpassContents::eInline);
-
-  if (show_sh) {
-    shdebug_subpass->render(dctx, ds);
-  } else {
-    shading_subpass->render(dctx, ds);
+    cmd.beginRenderPass(info, vk::SubpassContents::eSecondaryCommandBuffers);
+    main_recorder.execute(cmd);
+    cmd.endRenderPass();
+  });
+  main_pass.keep();
+
+  //gbuffer and shading passes are culled when nothing samples them
+  if (!show_sh) {
+    main_pass.read(shading_image, drv::ImageUsage::Sampled, vk::PipelineStageFlagBits::eFragmentShader);
   }
 
-  imgui_ctx.render(dctx.dcb);
-  dctx.dcb.endRenderPass();
-  dctx.dcb.end();
+  frame_graph.execute(ds.ctx, ds.storage, dctx.dcb, &ds.gpu_profiler, dctx.frame_id, &ds.work_stats);
+  ds.work_stats.end_frame(ds.storage);
 }
 
-void Renderer::main_loop() {
+void Renderer::pacing_ui() {
+  auto &timings = ds.submit_pool.get_timings();
+  auto &pacing = ds.submit_pool.get_pacing();
+
+  ImGui::Begin("Frame pacing");
+  ImGui::Text("Present mode: %s, frames in flight: %u", vk::to_string(ds.ctx.get_present_mode()).c_str(), pacing.frames_in_flight);
+  ImGui::Text("Frame %.2f ms (%.1f fps)", timings.frame, (timings.frame > 0.f)? 1000.f/timings.frame : 0.f);
+  ImGui::Text("CPU wait %.2f ms", timings.wait);
+  ImGui::Text("GPU %.2f ms, idle %.2f ms", timings.gpu, timings.gpu_idle);
+  ImGui::Text("Input to GPU done %.2f ms", timings.latency);
+
+  float fps_limit = pacing.fps_limit;
+  if (ImGui::SliderFloat("FPS limit", &fps_limit, 0.f, 240.f, "%.0f")) {
+    ds.submit_pool.set_fps_limit(fps_limit);
+  }
+
+  bool low_latency = pacing.low_latency;
+  if (ImGui::Checkbox("Low latency", &low_latency)) {
+    ds.submit_pool.set_low_latency(low_latency);
+  }
+  ImGui::End();
+}
 
-  std::thread update_thread([this](){
-    bool quit = false;
-    auto start = SDL_GetTicks();
-    while (!quit) {
+void Renderer::resolution_ui() {
+  auto config = resolution.get_config();
+  auto extent = resolution.get_extent();
+
+  ImGui::Begin("Dynamic resolution");
+  ImGui::Text("Scale %.2f, %ux%u", resolution.get_scale(), extent.width, extent.height);
+  bool changed = ImGui::Checkbox("Enabled", &config.enabled);
+  changed |= ImGui::SliderFloat("Target GPU ms", &config.target_ms, 4.f, 50.f, "%.1f");
+  changed |= ImGui::SliderFloat("Min scale", &config.min_scale, 0.25f, 1.f, "%.2f");
+  if (changed) {
+    resolution.configure(config);
+  }
+  ImGui::End();
+}
+
+//Simulation runs with fixed step, events are handled as they come while waiting for the next step,
+//so input latency is bounded by the step instead of a sleep between polls.
+void Renderer::update_loop() {
+  using Clock = std::chrono::steady_clock;
+  CPU_THREAD_NAME("update");
+
+  //steps are dropped after a long stall instead of catching up
+  const u32 MAX_CATCH_UP = 5;
+  auto step = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float>(sim_step));
+  auto next_tick = Clock::now() + step;
+
+  bool quit = false;
+  while (!quit && running.load(std::memory_order_relaxed)) {
+    auto now = Clock::now();
+    if (now < next_tick) {
+      //headless runs have no window and no events, render loop stops them
+      if (!window) {
+        std::this_thread::sleep_until(next_tick);
+        continue;
+      }
+
+      auto wait_ms = std::chrono::duration_cast<std::chrono::milliseconds>(next_tick - now).count();
       SDL_Event event;
-      while (SDL_PollEvent(&event)) {
-        this->handle_event(event);
-        quit = quit || (event.type == SDL_QUIT);
+      if (SDL_WaitEventTimeout(&event, int(wait_ms))) {
+        CPU_ZONE("events");
+        do {
+          handle_event(event);
+          quit = quit || (event.type == SDL_QUIT);
+        } while (SDL_PollEvent(&event));
       }
-      SDL_Delay(15);
-      
-      auto now = SDL_GetTicks();
-      float dt = (now - start)/1000.f;
-      start = now;
-      this->update(dt);
+      continue;
     }
-  });
+
+    u32 steps = 0;
+    while (next_tick <= now && steps < MAX_CATCH_UP) {
+      //benchmark camera is stepped by the render loop with fixed dt
+      if (!benchmark.active()) {
+        CPU_ZONE("update");
+        update(sim_step, next_tick);
+      }
+      next_tick += step;
+      steps++;
+    }
+
+    if (next_tick <= now) {
+      next_tick = now + step;
+    }
+  }
+}
+
+void Renderer::main_loop() {
+
+  running = true;
+  std::thread update_thread([this](){ update_loop(); });
 
   bool stop = false; 
+  u32 frames = 0;
   do {
-    auto draw_ctx = ds.submit_pool.get_next(ds.ctx);
+    CPU_ZONE("frame");
+    auto draw_ctx = ds.submit_pool.get_next(ds.ctx, ds.storage);
+    ds.descriptors.evict(ds.ctx, ds.storage.take_released());
+    ds.pipelines.next_frame(ds.ctx, draw_ctx.frame_index, draw_ctx.completed_frame);
+    if (benchmark.active()) {
+      auto pose = benchmark.next_pose();
+      frame_data->set_camera_pose(pose.pos, pose.yaw, pose.pitch);
+    }
+    frame_data->latch_camera(std::chrono::steady_clock::now());
     render(draw_ctx);
     ds.submit_pool.submit(ds.ctx, draw_ctx);
+    if (benchmark.active()) {
+      benchmark.record(ds.submit_pool.get_last_timings(), ds.gpu_profiler, ds.work_stats, resolution.get_scale());
+    }
 
-    auto flags = events_msk.exchange(0, std::memory_order_relaxed);
-    if (flags & (u32)RenderEvents::Finish) {
-      stop = true;      
+    frames++;
+    if (max_frames && frames >= max_frames) {
+      stop = true;
     }
 
-    if (flags & (u32)RenderEvents::ReloadShaders) {
-      ds.ctx.get_queue(drv::QueueT::Graphics).waitIdle();
-      ds.pipelines.reload_shaders(ds.ctx);
+    RenderEvents event;
+    while (render_events.pop(event)) {
+      if (event == RenderEvents::Finish) {
+        stop = true;
+      }
+
+      if (event == RenderEvents::ReloadShaders) {
+        //new pipelines are swapped in by next_frame when they are ready
+        ds.pipelines.start_reload(ds.ctx, ds.workers);
+      }
+
+      if (event == RenderEvents::Defragment) {
+        ds.ctx.get_device().waitIdle();
+        defragment();
+      }
     }
 
   } while(!stop);
   
   ds.ctx.get_device().waitIdle();
+  running = false;
   update_thread.join();
+  benchmark.write_report(ds);
   release();
+
+  if (drv::CpuProfiler::enabled()) {
+    drv::CpuProfiler::write_trace("cpu_trace.json");
+  }
 }
\ No newline at end of file
@@ -3,6 +3,7 @@
 
 #include <thread>
 #include <atomic>
+#include <chrono>
 
 #include "driverstate.hpp"
 #include "triangle.hpp"
@@ -10,37 +11,74 @@
 #include "cubemap_shadow.hpp"
 #include "render_oct.hpp"
 #include "shdebug_subpass.hpp"
+#include "upscale.hpp"
+#include "dynamic_resolution.hpp"
+#include "benchmark.hpp"
+#include "drv/spsc_queue.hpp"
 
 enum class RenderEvents {
   None = 0,
   Finish = 1,
   ReloadShaders = 2,
+  Defragment = 4,
+};
+
+struct RendererConfig {
+  vk::PresentModeKHR present_mode = vk::PresentModeKHR::eMailbox;
+  drv::FramePacing pacing;
+  //offscreen rendering without window, surface and present
+  bool headless = false;
+  vk::Extent2D headless_extent {1920, 1080};
+  //main loop stops after this many frames, 0 - until quit event
+  u32 max_frames = 0;
+  //simulation step of update thread, seconds
+  float sim_step = 1.f/120.f;
+  DynamicResolutionConfig resolution;
+  BenchmarkConfig benchmark;
 };
 
 struct Renderer {
-  void init(SDL_Window *w);
+  void init(SDL_Window *w, const RendererConfig &config = {});
   void release();
 
   vk::RenderPass create_main_renderpass();
-  void update(float dt);
+  void update(float dt, std::chrono::steady_clock::time_point tick);
   void handle_event(const SDL_Event &event);
 
   void render(drv::DrawContext &ctx);
   void main_loop();
+  void defragment();
 
 private:
   void create_framebuffers(std::vector<vk::Framebuffer> &fb);
+  void pacing_ui();
+  void resolution_ui();
+  void update_loop();
 
   DriverState ds;
   drv::ImguiContext imgui_ctx;
+  drv::RenderGraph frame_graph;
+  drv::RGImage gbuffer_images[4]; //albedo, normal, world_pos, depth
+  drv::RGImage shading_image;
+  DynamicResolution resolution;
 
 
   SDL_Window *window = nullptr;
 
-  std::atomic<u32> events_msk;
+  //update thread -> render thread, update thread waits only when a queue is full
+  template <typename T, u32 SIZE>
+  void send(drv::SpscQueue<T, SIZE> &queue, const T &value);
+
+  drv::SpscQueue<RenderEvents, 64> render_events;
+  drv::SpscQueue<SDL_Event, 256> ui_events;
+  std::atomic<bool> running {false};
+  u32 max_frames = 0;
+  float sim_step = 1.f/120.f;
+  Benchmark benchmark;
   FrameGlobal *frame_data = nullptr;
   GBufferSubpass *gbuffer_subpass = nullptr;
   ShadingPass *shading_subpass = nullptr;
+  UpscalePass *upscale_pass = nullptr;
   CubemapShadowRenderer *renderer = nullptr;
   SHDebugSubpass *shdebug_subpass = nullptr;
 };
@@ -191,8 +191,8 @@ void Scene::gen_shadows(DriverState &ds) {
   oct_shadows_array = ds.storage.create_2Darray_view(ds.ctx, oct_shadows_img, vk::ImageAspectFlagBits::eColor);
 
 
-  ds.pipelines.load_shader(ds.ctx, "pass_vs", "src/shaders/pass_vert.spv", vk::ShaderStageFlagBits::eVertex);
-  ds.pipelines.load_shader(ds.ctx, "cube_shadow_to_oct_fs", "src/shaders/cube_shadow_to_oct_frag.spv", vk::ShaderStageFlagBits::eFragment);
+  ds.pipelines.load_shader(ds.ctx, "pass_vs", "src/shaders/pass.vert", vk::ShaderStageFlagBits::eVertex);
+  ds.pipelines.load_shader(ds.ctx, "cube_shadow_to_oct_fs", "src/shaders/cube_shadow_to_oct.frag", vk::ShaderStageFlagBits::eFragment);
 
   PostProcessingPass<Nil, Nil> cubemap_to_oct{};
   cubemap_to_oct.init_attachment(vk::Format::eR32Sfloat);
@@ -207,7 +207,7 @@ void Scene::gen_shadows(DriverState &ds) {
     cubemap_to_oct.set_attachment(0, layer_view);
     cubemap_to_oct.set_image_sampler(0, view, sampler);
     cubemap_to_oct.set_render_area(1024, 1024);
-    cubemap_to_oct.render_and_wait(ds);
+    cubemap_to_oct.render_and_wait(ds, "shadow oct conversion");
   }
 
   cubemap_to_oct.release(ds);
@@ -247,7 +247,6 @@ void Scene::gen_textures(DriverState &ds) {
       scene_textures.mr_images.push_back(view);
     }
 
-    ds.storage.collect_buffers();
     scene_textures.materials.push_back(mat);
   }
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 #extension GL_ARB_separate_shader_objects : enable
 
 #include "include/shadows.glsl"
+#include "include/spec_constants.glsl"
 
 layout(location = 0) in vec3 world_view;
 layout(location = 1) in vec3 world_normal;
@@ -16,6 +17,7 @@ layout(set = 0, binding = 2) uniform texture2D textures[25];
 layout(set = 0, binding = 3) uniform sampler tex_smp;
 
 #define MAX_LIGHTS 4
+layout (constant_id = SPEC_LIGHTS_LIMIT) const int LIGHTS_LIMIT = MAX_LIGHTS;
 
 layout(set = 0, binding = 4) uniform LightData {
   vec4 lights_count;
@@ -38,7 +40,7 @@ void main() {
     discard;
   }
   
-  uint lights_count = uint(min(lights.lights_count.x, MAX_LIGHTS));
+  uint lights_count = uint(min(lights.lights_count.x, float(min(LIGHTS_LIMIT, MAX_LIGHTS))));
   vec3 irradiance = vec3(0);
   
   const float PI = 3.14159265359;
@@ -0,0 +1,13 @@
+#ifndef SPEC_CONSTANTS_GLSL_INCLUDED
+#define SPEC_CONSTANTS_GLSL_INCLUDED
+
+//same ids as SpecConstantID in quality.hpp
+#define SPEC_LIGHTS_LIMIT 0
+#define SPEC_IRRADIANCE_SAMPLES 1
+#define SPEC_SH_SAMPLES 2
+#define SPEC_PROBE_TEX_SIZE 3
+#define SPEC_PROBE_LOW_RES_SIZE 4
+#define SPEC_TRACE_STEPS 5
+#define SPEC_HIZ_TRACE_STEPS 6
+
+#endif
@@ -2,6 +2,7 @@
 #define TRACE_PROBE_GLSL
 
 #include "oct_coord.glsl"
+#include "spec_constants.glsl"
 
 #define MAX_PROBES 256
 
@@ -38,11 +39,17 @@ uniform sampler2DArray probe_irradiance;
 #define TRACE_RESULT_HIT     1
 #define TRACE_RESULT_UNKNOWN 2
 
-const vec2 TEX_SIZE       = vec2(1024.0);
-const vec2 TEX_SIZE_SMALL = vec2(64.0);
+layout (constant_id = SPEC_PROBE_TEX_SIZE) const float PROBE_TEX_SIZE = 1024.0;
+layout (constant_id = SPEC_PROBE_LOW_RES_SIZE) const float PROBE_LOW_RES_SIZE = 64.0;
+layout (constant_id = SPEC_TRACE_STEPS) const int TRACE_STEPS = 32;
+layout (constant_id = SPEC_HIZ_TRACE_STEPS) const int HIZ_TRACE_STEPS = 64;
 
-const vec2 INV_TEX_SIZE       = vec2(1.0) / TEX_SIZE;
-const vec2 INV_TEX_SIZE_SMALL = vec2(1.0) / TEX_SIZE_SMALL;
+//float ops on spec constants aren't allowed in global initializers
+#define TEX_SIZE       vec2(PROBE_TEX_SIZE)
+#define TEX_SIZE_SMALL vec2(PROBE_LOW_RES_SIZE)
+
+#define INV_TEX_SIZE       (vec2(1.0) / TEX_SIZE)
+#define INV_TEX_SIZE_SMALL (vec2(1.0) / TEX_SIZE_SMALL)
 
 const float MIN_THICKNESS = 0.03; // meters
 const float MAX_THICKNESS = 0.50; // meters
@@ -525,7 +532,7 @@ int trace_segment(
 
   vec2 _out; 
 
-  for (int i = 0; i < 32; i++) {
+  for (int i = 0; i < TRACE_STEPS; i++) {
     vec2 end_texc = segment_end;
 #if 1
     if (trace_lod_lowres(ray_origin, ray_dir, probe_id, 6, texc, segment_end, end_texc, _out, false)) {
@@ -588,7 +595,7 @@ int trace_segment_alt(
   vec2 seg_end[4];
   seg_end[lvl+1] = segment_end; 
 
-  for (int i = 0; i < 32; i++) {
+  for (int i = 0; i < TRACE_STEPS; i++) {
     bool highres = false;
     if (trace_lod_lowres(ray_origin, ray_dir, probe_id, lods[lvl], texc, seg_end[lvl+1], seg_end[lvl], _out, true)) {
       lvl--;
@@ -672,7 +679,7 @@ int trace_hi_segment(
   vec2 cross_step = vec2(delta.x >= 0.0 ? 1.0 : -1.0, delta.y >= 0.0 ? 1.0 : -1.0);
   vec2 cross_offset = cross_step * 0.00001;
 
-  while (iterations < 64) {
+  while (iterations < HIZ_TRACE_STEPS) {
     float curr_cell_count = TEX_SIZE.x * exp2(-level);
     ivec2 curr_cell = ivec2(floor(curr_cell_count * texc));
     
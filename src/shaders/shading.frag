@@ -7,6 +7,7 @@
 #include "include/trace_probe.glsl"
 #include "include/shadows.glsl"
 #include "include/real_sh.glsl"
+#include "include/spec_constants.glsl"
 
 layout(location = 0) in vec2 uv;
 layout(location = 0) out vec4 outColor;
@@ -19,6 +20,7 @@ layout (set = 0, binding = 3) uniform sampler2D depth_tex;
 layout(set = 0, binding = 4) uniform sampler2DArray oct_shadows;
 
 #define MAX_LIGHTS 4
+layout (constant_id = SPEC_LIGHTS_LIMIT) const int LIGHTS_LIMIT = MAX_LIGHTS;
 
 layout(set = 0, binding = 5) uniform LightSourceInfo {
   vec4 lights_count;
@@ -30,24 +32,27 @@ layout(set = 0, binding = 6) readonly buffer Sh {
   ShProbe sh_probes[];
 };
 
+//gbuffer is rendered into the top left corner, uv_scale is its size in uv
 layout (push_constant) uniform PushData {
   vec3 camera_origin;
+  vec2 uv_scale;
 } pc;
 
 
 bool trace_sh(in vec3 origin, in vec3 dir, uint probe_id, inout float tmin, inout float tmax);
 
 void main() {
-  vec3 world_dir = texture(worldpos_tex, uv).xyz;
+  vec2 tex_uv = uv * pc.uv_scale;
+  vec3 world_dir = texture(worldpos_tex, tex_uv).xyz;
   vec3 world_pos = world_dir + pc.camera_origin;
-  vec3 norm = texture(normal_tex, uv).xyz;
-  vec3 albedo = texture(albedo_tex, uv).rgb;
+  vec3 norm = texture(normal_tex, tex_uv).xyz;
+  vec3 albedo = texture(albedo_tex, tex_uv).rgb;
 
   //albedo = pow(albedo, vec3(2.2));
   //albedo = albedo/(1 - albedo);
 
-  float metalic = texture(normal_tex, uv).w;
-  float roughness = texture(worldpos_tex, uv).w;
+  float metalic = texture(normal_tex, tex_uv).w;
+  float roughness = texture(worldpos_tex, tex_uv).w;
 
   
   vec3 ray_hit;
@@ -62,7 +67,7 @@ void main() {
   vec4 signalColor = vec4(0, 0, 0, 0);
 
   float shadow = 0.f;
-  float lights_count = min(lights.lights_count.x, MAX_LIGHTS);
+  float lights_count = min(lights.lights_count.x, float(min(LIGHTS_LIMIT, MAX_LIGHTS)));
 
   vec3 irradiance = vec3(0);
 
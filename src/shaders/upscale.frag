@@ -0,0 +1,18 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(location = 0) in vec2 uv;
+layout(location = 0) out vec4 outColor;
+
+layout (set = 0, binding = 0) uniform sampler2D source;
+
+//rendered part of source is in the top left corner,
+//uv_max keeps bilinear taps from reading pixels outside of it
+layout (push_constant) uniform PushData {
+  vec2 uv_scale;
+  vec2 uv_max;
+} pc;
+
+void main() {
+  outColor = texture(source, min(uv * pc.uv_scale, pc.uv_max));
+}
@@ -16,8 +16,12 @@ const u32 MAX_LIGHTS = 4;
 
 struct ShadingPass {
 
+  //lit image, rendered at dynamic resolution into the top left corner and upscaled to backbuffer
+  static constexpr vk::Format OUTPUT_FMT = vk::Format::eR16G16B16A16Sfloat;
+
   ShadingPass(DriverState &ds, FrameGlobal &frame) : frame_data {frame} {
     create_sampler(ds);
+    create_output(ds);
     create_shader_desc(ds, frame);
     create_pipeline(ds);
   }
@@ -26,8 +30,11 @@ struct ShadingPass {
 
   void release(DriverState &ds) {
     ds.ctx.get_device().destroySampler(nearest_sampler);
-    ds.descriptors.free_layout(ds.ctx, tex_layout);
-    ds.descriptors.free_layout(ds.ctx, light_field_layout);
+    ds.ctx.get_device().destroyFramebuffer(framebuf);
+    ds.ctx.get_device().destroyRenderPass(renderpass);
+    for (auto &set : sets) {
+      ds.descriptors.free_set(ds.ctx, set);
+    }
     ds.pipelines.free_pipeline(ds.ctx, pipeline);
   }
 
@@ -43,21 +50,20 @@ struct ShadingPass {
 
     ds.storage.buffer_memcpy(ds.ctx, light_data, 0, &lights, sizeof(lights));
 
-    drv::DescriptorSetLayoutBuilder tex {};
-    tex
-      .add_combined_sampler(0, vk::ShaderStageFlagBits::eFragment)
-      .add_combined_sampler(1, vk::ShaderStageFlagBits::eFragment)
-      .add_combined_sampler(2, vk::ShaderStageFlagBits::eFragment)
-      .add_combined_sampler(3, vk::ShaderStageFlagBits::eFragment)
-      .add_combined_sampler(4, vk::ShaderStageFlagBits::eFragment)
-      .add_ubo(5, vk::ShaderStageFlagBits::eFragment);
-    
-    tex_layout = ds.descriptors.create_layout(ds.ctx, tex.build(), 1);
+    //set 0 - gbuffer and lights, set 1 - light field from trace_probe.glsl
+    auto &reflected = ds.pipelines.reflect_layout(ds.ctx, ds.descriptors, {"pass_vs", "shading_fs"});
+    if (reflected.sets.size() != 2 || reflected.push_constants.size < sizeof(PushData)) {
+      throw std::runtime_error {"shading_fs interface doesn't match ShadingPass"};
+    }
+    tex_layout = reflected.sets[0];
+    light_field_layout = reflected.sets[1];
+    pipeline_layout = reflected.layout;
+
     auto tex_set = ds.descriptors.allocate_set(ds.ctx, tex_layout);
     
     auto& gbuff = frame.get_gbuffer();
 
-    drv::DescriptorBinder binder {ds.descriptors.get(tex_set)};
+    drv::DescriptorBinder binder {ds.descriptors, tex_set};
     binder
       .bind_combined_img(0, gbuff.images[0]->api_view(), gbuff.sampler)
       .bind_combined_img(1, gbuff.images[1]->api_view(), gbuff.sampler)
@@ -69,16 +75,6 @@ struct ShadingPass {
     binder.write(ds.ctx);
     sets.push_back(tex_set);
 
-    drv::DescriptorSetLayoutBuilder lf {};
-    lf
-      .add_ubo(0, vk::ShaderStageFlagBits::eFragment)
-      .add_combined_sampler(1, vk::ShaderStageFlagBits::eFragment)
-      .add_combined_sampler(2, vk::ShaderStageFlagBits::eFragment)
-      .add_combined_sampler(3, vk::ShaderStageFlagBits::eFragment)
-      .add_combined_sampler(4, vk::ShaderStageFlagBits::eFragment) //radiance array
-      .add_combined_sampler(5, vk::ShaderStageFlagBits::eFragment); //irradiance array
-    
-    light_field_layout = ds.descriptors.create_layout(ds.ctx, lf.build(), 1);
     auto lf_set = ds.descriptors.allocate_set(ds.ctx, light_field_layout);
 
     ubo = ds.storage.create_buffer(ds.ctx, drv::GPUMemoryT::Coherent, sizeof(LightFieldData), vk::BufferUsageFlagBits::eUniformBuffer);
@@ -97,7 +93,7 @@ struct ShadingPass {
 
     ds.storage.buffer_memcpy(ds.ctx, ubo, 0, &data, sizeof(data));
 
-    drv::DescriptorBinder lf_binder { ds.descriptors.get(lf_set) };
+    drv::DescriptorBinder lf_binder {ds.descriptors, lf_set};
     lf_binder
       .bind_ubo(0, ubo->api_buffer())
       .bind_combined_img(1, frame_data.get_light_field().get_hidistance_array()->api_view(), nearest_sampler)
@@ -111,38 +107,29 @@ struct ShadingPass {
   }
 
   void create_pipeline(DriverState &ds) {
-    //ds.pipelines.load_shader(ds.ctx, "pass_vs", "src/shaders/pass_vert.spv", vk::ShaderStageFlagBits::eVertex);
-    //ds.pipelines.load_shader(ds.ctx, "shading_fs", "src/shaders/shading_frag.spv", vk::ShaderStageFlagBits::eFragment);
+    //ds.pipelines.load_shader(ds.ctx, "pass_vs", "src/shaders/pass.vert", vk::ShaderStageFlagBits::eVertex);
+    //ds.pipelines.load_shader(ds.ctx, "shading_fs", "src/shaders/shading.frag", vk::ShaderStageFlagBits::eFragment);
 
-    auto layouts = {ds.descriptors.get(tex_layout), ds.descriptors.get(light_field_layout)};
-    
-    vk::PushConstantRange push {};
-    push
-      .setOffset(0)
-      .setSize(sizeof(glm::vec3))
-      .setStageFlags(vk::ShaderStageFlagBits::eFragment);
-
-    auto push_ranges = {push};
-
-    vk::PipelineLayoutCreateInfo linfo {};
-    linfo
-      .setPushConstantRanges(push_ranges)
-      .setSetLayouts(layouts);
-    
-    pipeline_layout = ds.ctx.get_device().createPipelineLayout(linfo);
     auto ext = ds.ctx.get_swapchain_extent();
 
+    auto constants = Quality::probe_constants();
+    constants.merge(ds.quality.constants);
+
     drv::PipelineDescBuilder builder {};
     builder
       .add_shader("pass_vs")
       .add_shader("shading_fs")
+      .set_constants(constants)
     
       .set_vertex_assembly(vk::PrimitiveTopology::eTriangleList, false)
       .set_polygon_mode(vk::PolygonMode::eFill)
       .set_front_face(vk::FrontFace::eCounterClockwise)
 
+      //render extent changes every frame
       .add_viewport(0.f, 0.f, ext.width, ext.height, 0.f, 1.f)
       .add_scissors(0, 0, ext.width, ext.height)
+      .add_dynamic_state(vk::DynamicState::eViewport)
+      .add_dynamic_state(vk::DynamicState::eScissor)
 
       .set_blend_logic_op(false)
       .add_blend_attachment()
@@ -152,29 +139,45 @@ struct ShadingPass {
       .set_depth_func(vk::CompareOp::eNever)
       .set_depth_write(false)
 
-      .attach_to_renderpass(ds.main_renderpass, 0)
+      .attach_to_renderpass(renderpass, 0)
       .set_layout(pipeline_layout);
 
     pipeline = ds.pipelines.create_pipeline(ds.ctx, builder);
   }
 
-  void render(drv::DrawContext &draw_ctx, DriverState &ds) {
-     {
-      ImGui::Begin("frame info");
-      ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
-      ImGui::End();
-    }
-
-
-    auto pos = frame_data.get_camera_pos();
-
-    draw_ctx.dcb.bindPipeline(vk::PipelineBindPoint::eGraphics, ds.pipelines.get(pipeline));
+  //extent is the rendered part of gbuffer, the same part of output is written
+  void render(drv::DrawContext &draw_ctx, DriverState &ds, vk::Extent2D extent, drv::PassCounters &counters) {
+    auto ext = ds.ctx.get_swapchain_extent();
+    PushData push {};
+    push.camera_origin = frame_data.get_camera_pos();
+    push.uv_scale = glm::vec2{f32(extent.width)/ext.width, f32(extent.height)/ext.height};
+
+    vk::Rect2D area {{0, 0}, extent};
+    vk::Viewport viewport {0.f, 0.f, f32(extent.width), f32(extent.height), 0.f, 1.f};
+
+    vk::RenderPassBeginInfo info {};
+    info
+      .setRenderPass(renderpass)
+      .setFramebuffer(framebuf)
+      .setRenderArea(area);
+
+    draw_ctx.dcb.beginRenderPass(info, vk::SubpassContents::eInline);
+    draw_ctx.dcb.bindPipeline(vk::PipelineBindPoint::eGraphics, ds.pipelines.get(pipeline, ds.quality.constants));
+    draw_ctx.dcb.setViewport(0, {viewport});
+    draw_ctx.dcb.setScissor(0, {area});
     auto desc_sets = {ds.descriptors.get(sets[0]), ds.descriptors.get(sets[1])}; 
     draw_ctx.dcb.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipeline_layout, 0, desc_sets, {});
-    draw_ctx.dcb.pushConstants(pipeline_layout, vk::ShaderStageFlagBits::eFragment, 0, sizeof(glm::vec3), &pos);
+    draw_ctx.dcb.pushConstants(pipeline_layout, vk::ShaderStageFlagBits::eFragment, 0, sizeof(push), &push);
     draw_ctx.dcb.draw(3, 1, 0, 0);
+    draw_ctx.dcb.endRenderPass();
+
+    counters.bind_pipeline();
+    counters.bind_descriptors(desc_sets.size());
+    counters.draw(3);
   }
 
+  const drv::ImageViewID &get_output() const { return output; }
+
   void create_sampler(DriverState &ds) {
     vk::SamplerCreateInfo info {};
     info.setMinFilter(vk::Filter::eNearest);
@@ -185,6 +188,51 @@ struct ShadingPass {
     nearest_sampler = ds.ctx.get_device().createSampler(info);
   }
 
+  void create_output(DriverState &ds) {
+    auto ext = ds.ctx.get_swapchain_extent();
+    auto image = ds.storage.create_rt(ds.ctx, ext.width, ext.height, OUTPUT_FMT,
+      vk::ImageUsageFlagBits::eSampled|vk::ImageUsageFlagBits::eColorAttachment);
+    output = ds.storage.create_rt_view(ds.ctx, image, vk::ImageAspectFlagBits::eColor);
+
+    //layout transitions are made by the frame graph, pixels outside of render area are never read
+    vk::AttachmentDescription color {};
+    color
+      .setInitialLayout(vk::ImageLayout::eColorAttachmentOptimal)
+      .setFinalLayout(vk::ImageLayout::eColorAttachmentOptimal)
+      .setFormat(OUTPUT_FMT)
+      .setLoadOp(vk::AttachmentLoadOp::eDontCare)
+      .setStoreOp(vk::AttachmentStoreOp::eStore)
+      .setSamples(vk::SampleCountFlagBits::e1)
+      .setStencilLoadOp(vk::AttachmentLoadOp::eDontCare)
+      .setStencilStoreOp(vk::AttachmentStoreOp::eDontCare);
+
+    vk::AttachmentReference color_ref {0, vk::ImageLayout::eColorAttachmentOptimal};
+    auto attachments = {color};
+    auto color_refs = {color_ref};
+
+    vk::SubpassDescription subpass {};
+    subpass
+      .setPipelineBindPoint(vk::PipelineBindPoint::eGraphics)
+      .setColorAttachments(color_refs);
+    auto subpasses = {subpass};
+
+    vk::RenderPassCreateInfo rp_info {};
+    rp_info
+      .setAttachments(attachments)
+      .setSubpasses(subpasses);
+    renderpass = ds.ctx.get_device().createRenderPass(rp_info);
+
+    auto views = {output->api_view()};
+    vk::FramebufferCreateInfo fb_info {};
+    fb_info
+      .setRenderPass(renderpass)
+      .setAttachments(views)
+      .setWidth(ext.width)
+      .setHeight(ext.height)
+      .setLayers(1);
+    framebuf = ds.ctx.get_device().createFramebuffer(fb_info);
+  }
+
 private:
   drv::PipelineID pipeline;
   drv::DescriptorSetLayoutID tex_layout, light_field_layout;
@@ -193,6 +241,17 @@ private:
 
   vk::Sampler nearest_sampler;
 
+  drv::ImageViewID output;
+  vk::RenderPass renderpass;
+  vk::Framebuffer framebuf;
+
+  //same layout as in shading.frag
+  struct PushData {
+    glm::vec3 camera_origin;
+    f32 pad;
+    glm::vec2 uv_scale;
+  };
+
   struct LightFieldData {
     glm::vec4 probe_count;
     glm::vec4 probe_start;
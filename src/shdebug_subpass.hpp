@@ -14,7 +14,7 @@ struct SHDebugSubpass {
 
   }
 
-  void render(drv::DrawContext &draw_ctx, DriverState &ds) {
+  void render(drv::DrawContext &draw_ctx, DriverState &ds, drv::PassCounters &counters) {
     int layers = int(frame_data.get_light_field().get_lowres_array()->get_base_img()->get_info().arrayLayers);
 
     {
@@ -46,14 +46,18 @@ struct SHDebugSubpass {
     draw_ctx.dcb.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, ds.pipelines.get_layout(pipeline), 0, desc_sets, {});
     draw_ctx.dcb.pushConstants(ds.pipelines.get_layout(pipeline), vk::ShaderStageFlagBits::eFragment, 0, sizeof(settings), &settings);
     draw_ctx.dcb.draw(36, 1, 0, 0);
+
+    counters.bind_pipeline();
+    counters.bind_descriptors(desc_sets.size());
+    counters.draw(36);
   }
 
 
 private:
 
   void init_pipeline(DriverState &ds) {
-    ds.pipelines.load_shader(ds.ctx, "cubemap_verts_vs", "src/shaders/cubemap_verts_vert.spv", vk::ShaderStageFlagBits::eVertex);
-    ds.pipelines.load_shader(ds.ctx, "sh_draw_fs", "src/shaders/sh_draw_frag.spv", vk::ShaderStageFlagBits::eFragment);
+    ds.pipelines.load_shader(ds.ctx, "cubemap_verts_vs", "src/shaders/cubemap_verts.vert", vk::ShaderStageFlagBits::eVertex);
+    ds.pipelines.load_shader(ds.ctx, "sh_draw_fs", "src/shaders/sh_draw.frag", vk::ShaderStageFlagBits::eFragment);
 
     drv::DescriptorSetLayoutBuilder builder {};
     builder
@@ -107,7 +111,7 @@ private:
       ubo[i] = ds.storage.create_buffer(ds.ctx, drv::GPUMemoryT::Coherent, sizeof(UBOData), vk::BufferUsageFlagBits::eUniformBuffer);
       resources[i] = ds.descriptors.allocate_set(ds.ctx, resource_layout);
 
-      drv::DescriptorBinder binder{ds.descriptors.get(resources[i])};
+      drv::DescriptorBinder binder {ds.descriptors, resources[i]};
       binder
         .bind_ubo(0, ubo[i]->api_buffer())
         .bind_storage_buff(1, frame_data.get_sh_probes()->api_buffer())
@@ -8,7 +8,8 @@ struct SHPass {
   SHPass(DriverState &ds);
   ~SHPass();
 
-  drv::BufferID integrate(DriverState &ds, drv::ImageViewID &image, vk::Sampler sampler);
+  //runs on the compute queue after the task which writes image, pass must live until the result task is done
+  drv::GpuTask integrate(DriverState &ds, drv::ImageViewID &image, vk::Sampler sampler, drv::BufferID &result, const drv::GpuTask &after);
 
   static constexpr u32 NUM_SAMPLES = 256;
   static constexpr u32 NUM_SH_COEFFS = 36;
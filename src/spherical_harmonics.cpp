@@ -74,7 +74,7 @@ SHPass::~SHPass() {
 
 }
 
-drv::BufferID SHPass::integrate(DriverState &ds, drv::ImageViewID &image, vk::Sampler sampler) {
+drv::GpuTask SHPass::integrate(DriverState &ds, drv::ImageViewID &image, vk::Sampler sampler, drv::BufferID &result, const drv::GpuTask &after) {
   const auto &img_info = image->get_base_img()->get_info();
   u32 layers = img_info.arrayLayers;
 
@@ -82,32 +82,24 @@ drv::BufferID SHPass::integrate(DriverState &ds, drv::ImageViewID &image, vk::Sa
     ds.ctx, drv::GPUMemoryT::Local, sizeof(SHprobe) * layers, 
     vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eUniformBuffer);
 
-  drv::DescriptorBinder bind_resources{ds.descriptors.get(resources)};
+  drv::DescriptorBinder bind_resources {ds.descriptors, resources};
   bind_resources
     .bind_storage_buff(0, sh_samples->api_buffer())
     .bind_storage_buff(1, result_buffer->api_buffer())
     .bind_combined_img(2, image->api_view(), sampler)
     .write(ds.ctx);
 
-  auto cmd = ds.submit_pool.start_cmd(ds.ctx);
-  vk::CommandBufferBeginInfo begin_info {};
-  cmd.begin(begin_info);
-  
-  cmd.bindPipeline(vk::PipelineBindPoint::eCompute, ds.pipelines.get(pipeline));
-  cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, ds.pipelines.get_layout(pipeline), 0, {ds.descriptors.get(resources)}, {});
-  cmd.dispatch(layers, 1, 1);
-
-  cmd.end();
-  auto fence = ds.submit_pool.submit_cmd(ds.ctx, cmd);
-  auto res = ds.ctx.get_device().waitForFences({fence}, VK_TRUE, ~(0ul));
-  ds.ctx.get_device().destroyFence(fence);
-
-  if (res != vk::Result::eSuccess) {
-    throw std::runtime_error {"WaitFence error"};
+  //async slot is begun by the task it follows
+  auto cmd = ds.scheduler.begin(ds.ctx, drv::QueueT::Compute);
+  {
+    drv::GpuZone zone {ds.gpu_profiler, cmd, drv::GpuProfiler::ASYNC_SLOT, "sh integrate"};
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, ds.pipelines.get(pipeline, ds.quality.constants));
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, ds.pipelines.get_layout(pipeline), 0, {ds.descriptors.get(resources)}, {});
+    cmd.dispatch(layers, 1, 1);
   }
 
-
-  return result_buffer;
+  result = result_buffer;
+  return ds.scheduler.submit(ds.ctx, drv::QueueT::Compute, cmd, {{after, vk::PipelineStageFlagBits::eComputeShader}});
 }
 
 void SHPass::create_samples_buffer(DriverState &ds) {
@@ -148,7 +140,7 @@ void SHPass::create_samples_buffer(DriverState &ds) {
 }
 
 void SHPass::init_shader_resources(DriverState &ds) {
-  ds.pipelines.load_shader(ds.ctx, "integrate_sh_cs", "src/shaders/integrate_sh_comp.spv", vk::ShaderStageFlagBits::eCompute);
+  ds.pipelines.load_shader(ds.ctx, "integrate_sh_cs", "src/shaders/integrate_sh.comp", vk::ShaderStageFlagBits::eCompute);
 
   drv::DescriptorSetLayoutBuilder res_builder{};
   res_builder
@@ -164,7 +156,7 @@ void SHPass::init_shader_resources(DriverState &ds) {
   p_layout_info.setSetLayouts(used_layouts);
 
   auto pipeline_layout = ds.ctx.get_device().createPipelineLayout(p_layout_info);
-  pipeline = ds.pipelines.create_compute_pipeline(ds.ctx, "integrate_sh_cs", pipeline_layout);
+  pipeline = ds.pipelines.create_compute_pipeline(ds.ctx, "integrate_sh_cs", pipeline_layout, ds.quality.constants);
 
   resources = ds.descriptors.allocate_set(ds.ctx, resource_layout);
 }
\ No newline at end of file
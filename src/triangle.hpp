@@ -33,7 +33,8 @@ struct GBufferSubpass {
 
   }
 
-  void render(drv::DrawContext &draw_ctx, DriverState &ds);
+  //extent - part of gbuffer to render, up to swapchain extent
+  void render(drv::DrawContext &draw_ctx, DriverState &ds, vk::Extent2D extent, drv::PassCounters &counters);
 
 private:
   void create_texture_sets(DriverState &ds);
@@ -42,6 +43,9 @@ private:
   void create_pipeline(DriverState &ds);
   void create_pipeline_layout(DriverState &ds);
 
+  //smaller chunks cost more in secondary buffer setup than they save
+  static constexpr u32 MIN_DRAW_CHUNK = 64;
+
   struct VertexUB {
     glm::mat4 camera;
     glm::mat4 inv_camera;
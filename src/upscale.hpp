@@ -0,0 +1,94 @@
+#ifndef UPSCALE_HPP_INCLUDED
+#define UPSCALE_HPP_INCLUDED
+
+#include "driverstate.hpp"
+
+//Bilinear upscale of the rendered part of a full size image into the main render pass
+struct UpscalePass {
+  UpscalePass(DriverState &ds, const drv::ImageViewID &source) {
+    ds.pipelines.load_shader(ds.ctx, "upscale_fs", "src/shaders/upscale.frag", vk::ShaderStageFlagBits::eFragment);
+
+    vk::SamplerCreateInfo smp {};
+    smp
+      .setMinFilter(vk::Filter::eLinear)
+      .setMagFilter(vk::Filter::eLinear)
+      .setMipmapMode(vk::SamplerMipmapMode::eNearest)
+      .setAddressModeU(vk::SamplerAddressMode::eClampToEdge)
+      .setAddressModeV(vk::SamplerAddressMode::eClampToEdge)
+      .setMinLod(0.f)
+      .setMaxLod(0.f);
+    sampler = ds.ctx.get_device().createSampler(smp);
+
+    auto &reflected = ds.pipelines.reflect_layout(ds.ctx, ds.descriptors, {"pass_vs", "upscale_fs"});
+    if (reflected.sets.size() != 1 || reflected.push_constants.size < sizeof(PushData)) {
+      throw std::runtime_error {"upscale_fs interface doesn't match UpscalePass"};
+    }
+    pipeline_layout = reflected.layout;
+
+    set = ds.descriptors.allocate_set(ds.ctx, reflected.sets[0]);
+    drv::DescriptorBinder binder {ds.descriptors, set};
+    binder
+      .bind_combined_img(0, source->api_view(), sampler)
+      .write(ds.ctx);
+
+    auto ext = ds.ctx.get_swapchain_extent();
+
+    drv::PipelineDescBuilder builder {};
+    builder
+      .add_shader("pass_vs")
+      .add_shader("upscale_fs")
+
+      .set_vertex_assembly(vk::PrimitiveTopology::eTriangleList, false)
+      .set_polygon_mode(vk::PolygonMode::eFill)
+      .set_front_face(vk::FrontFace::eCounterClockwise)
+
+      .add_viewport(0.f, 0.f, ext.width, ext.height, 0.f, 1.f)
+      .add_scissors(0, 0, ext.width, ext.height)
+
+      .set_blend_logic_op(false)
+      .add_blend_attachment()
+      .set_blend_constants(1.f, 1.f, 1.f, 1.f)
+
+      .set_depth_test(false)
+      .set_depth_func(vk::CompareOp::eNever)
+      .set_depth_write(false)
+
+      .attach_to_renderpass(ds.main_renderpass, 0)
+      .set_layout(pipeline_layout);
+
+    pipeline = ds.pipelines.create_pipeline(ds.ctx, builder);
+  }
+
+  void release(DriverState &ds) {
+    ds.descriptors.free_set(ds.ctx, set);
+    ds.pipelines.free_pipeline(ds.ctx, pipeline);
+    ds.ctx.get_device().destroySampler(sampler);
+  }
+
+  //uv_scale - rendered part of source, uv_max - last texel center inside of it
+  void render(vk::CommandBuffer &cmd, DriverState &ds, glm::vec2 uv_scale, glm::vec2 uv_max, drv::PassCounters &counters) {
+    PushData push {uv_scale, uv_max};
+    cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, ds.pipelines.get(pipeline));
+    auto desc_sets = {ds.descriptors.get(set)};
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipeline_layout, 0, desc_sets, {});
+    cmd.pushConstants(pipeline_layout, vk::ShaderStageFlagBits::eFragment, 0, sizeof(push), &push);
+    cmd.draw(3, 1, 0, 0);
+
+    counters.bind_pipeline();
+    counters.bind_descriptors(desc_sets.size());
+    counters.draw(3);
+  }
+
+private:
+  struct PushData {
+    glm::vec2 uv_scale;
+    glm::vec2 uv_max;
+  };
+
+  drv::PipelineID pipeline;
+  vk::PipelineLayout pipeline_layout;
+  drv::DescriptorSetID set;
+  vk::Sampler sampler;
+};
+
+#endif